@@ -0,0 +1,56 @@
+#ifndef BENCH_H__
+#define BENCH_H__ 1
+
+#include "../src/include/quaerimus.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Benchmarks need a running server, connection parameters are taken from
+ * QURY_BENCH_HOST, QURY_BENCH_USER, QURY_BENCH_PASSWORD and QURY_BENCH_DB.
+ */
+static inline bool bench_connect(qury_conn_t *conn) {
+  const char *host = getenv("QURY_BENCH_HOST");
+  const char *user = getenv("QURY_BENCH_USER");
+  const char *password = getenv("QURY_BENCH_PASSWORD");
+  const char *db = getenv("QURY_BENCH_DB");
+
+  qury_conn_init(conn);
+  if (!mysql_real_connect(conn->mysql, host ? host : "localhost", user,
+                          password, db, 0, NULL, 0)) {
+    fprintf(stderr, "mysql_real_connect : %s\n", mysql_error(conn->mysql));
+    return false;
+  }
+  return true;
+}
+
+static inline uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int _bench_cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* sort samples and print mean, p50 and p99 in microseconds */
+static inline void bench_report(const char *name, uint64_t *samples,
+                                size_t count) {
+  uint64_t total = 0;
+  if (count == 0) {
+    return;
+  }
+  qsort(samples, count, sizeof(*samples), _bench_cmp_u64);
+  for (size_t i = 0; i < count; i++) {
+    total += samples[i];
+  }
+  printf("%-28s mean %9.2fus  p50 %9.2fus  p99 %9.2fus\n", name,
+         (double)total / count / 1000.0, samples[count / 2] / 1000.0,
+         samples[(count * 99) / 100] / 1000.0);
+}
+
+#endif /* BENCH_H__ */
@@ -0,0 +1,89 @@
+#include "bench.h"
+#include <string.h>
+
+#define ROWS 1000000
+
+/* decode only: parse the same monetary texts with strtod and with
+ * qury_decimal_parse */
+static void bench_decode(void) {
+  static char texts[ROWS][16];
+  static size_t lengths[ROWS];
+  double sum_d = 0.0;
+  qury_decimal_int_t sum_m = 0;
+
+  for (int i = 0; i < ROWS; i++) {
+    lengths[i] = snprintf(texts[i], sizeof(texts[i]), "%d.%02d",
+                          (int)((i * 7919LL) % 10000000), i % 100);
+  }
+
+  uint64_t start = bench_now_ns();
+  for (int i = 0; i < ROWS; i++) {
+    sum_d += strtod(texts[i], NULL);
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+  printf("%-28s %8.2f Mrows/s (%f)\n", "decode strtod",
+         ROWS / (elapsed / 1000.0), sum_d);
+
+  start = bench_now_ns();
+  for (int i = 0; i < ROWS; i++) {
+    qury_decimal_t d;
+    qury_decimal_parse(texts[i], lengths[i], &d);
+    sum_m += d.mantissa;
+  }
+  elapsed = bench_now_ns() - start;
+  printf("%-28s %8.2f Mrows/s (%lld)\n", "decode qury_decimal_parse",
+         ROWS / (elapsed / 1000.0), (long long)sum_m);
+}
+
+static void bench_scan(qury_conn_t *conn, const char *name, const char *query) {
+  qury_stmt_t *stmt = qury_new(conn, NULL);
+  uint64_t rows = 0;
+
+  qury_set_result_mode(stmt, QURY_ResultStreaming);
+  if (!qury_prepare(stmt, query, 0)) {
+    return;
+  }
+  uint64_t start = bench_now_ns();
+  if (!qury_execute(stmt)) {
+    return;
+  }
+  while (qury_fetch(stmt)) {
+    qury_bind_t *v = NULL;
+    if (qury_get_value(stmt, "amount", &v)) {
+      rows++;
+    }
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+  printf("%-28s %8.2f Mrows/s (%lu rows)\n", name,
+         rows / (elapsed / 1000.0), (unsigned long)rows);
+  qury_free(stmt);
+}
+
+int main(void) {
+  qury_conn_t conn;
+
+  bench_decode();
+
+  mysql_library_init(0, NULL, NULL);
+  if (!bench_connect(&conn)) {
+    return EXIT_FAILURE;
+  }
+  /* a million rows monetary table, seq_* needs the sequence engine */
+  if (mysql_query(conn.mysql,
+                  "CREATE TEMPORARY TABLE bench_money (id INT PRIMARY KEY, "
+                  "amount DECIMAL(15,2) NOT NULL)")
+      || mysql_query(conn.mysql,
+                     "INSERT INTO bench_money SELECT seq, (seq * 7919 % "
+                     "1000000000) / 100 FROM seq_1_to_1000000")) {
+    fprintf(stderr, "setup : %s\n", mysql_error(conn.mysql));
+    return EXIT_FAILURE;
+  }
+  bench_scan(&conn, "scan DECIMAL as double",
+             "SELECT CAST(amount AS DOUBLE) AS amount FROM bench_money");
+  bench_scan(&conn, "scan DECIMAL as decimal",
+             "SELECT amount FROM bench_money");
+
+  qury_close(&conn);
+  mysql_library_end();
+  return EXIT_SUCCESS;
+}
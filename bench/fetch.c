@@ -0,0 +1,78 @@
+#include "bench.h"
+
+/* fetch the whole result, reading one column per row */
+static void bench_fetch(qury_conn_t *conn, const char *name, const char *query,
+                        bool raw) {
+  qury_stmt_t *stmt = qury_new(conn, NULL);
+  uint64_t rows = 0;
+
+  qury_set_result_mode(stmt, QURY_ResultStreaming);
+  if (!qury_prepare(stmt, query, 0) || !qury_execute(stmt)) {
+    qury_free(stmt);
+    return;
+  }
+  uint64_t start = bench_now_ns();
+  if (raw) {
+    /* client library only, with the binds of the first qury_fetch */
+    rows += qury_fetch(stmt);
+    int status;
+    while ((status = mysql_stmt_fetch(stmt->stmt)) != 1
+           && status != MYSQL_NO_DATA) {
+      rows++;
+    }
+  } else {
+    while (qury_fetch(stmt)) {
+      qury_bind_t *v = NULL;
+      rows += qury_get_value(stmt, "a", &v);
+    }
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+  printf("%-28s %8.2f Mrows/s (%lu rows)\n", name,
+         rows / (elapsed / 1000.0), (unsigned long)rows);
+  qury_free(stmt);
+}
+
+static void bench_pair(qury_conn_t *conn, const char *name,
+                       const char *query) {
+  char label[64];
+  snprintf(label, sizeof(label), "%s mysql", name);
+  bench_fetch(conn, label, query, true);
+  snprintf(label, sizeof(label), "%s qury", name);
+  bench_fetch(conn, label, query, false);
+}
+
+int main(void) {
+  qury_conn_t conn;
+
+  mysql_library_init(0, NULL, NULL);
+  if (!bench_connect(&conn)) {
+    return EXIT_FAILURE;
+  }
+  /* the difference between the two lines of a pair is the row decoding of
+   * qury_fetch, seq_* needs the sequence engine */
+  bench_pair(&conn, "16 integers",
+             "SELECT seq AS a, seq+1, seq+2, seq+3, seq+4, seq+5, seq+6, "
+             "seq+7, seq+8, seq+9, seq+10, seq+11, seq+12, seq+13, seq+14, "
+             "seq+15 FROM seq_1_to_1000000");
+  bench_pair(&conn, "8 integers 8 strings",
+             "SELECT seq AS a, seq+1, seq+2, seq+3, seq+4, seq+5, seq+6, "
+             "seq+7, REPEAT('x', 64), REPEAT('y', 64), REPEAT('z', 64), "
+             "CONCAT('k', seq), CONCAT('l', seq), CONCAT('m', seq), "
+             "CONCAT('n', seq), CONCAT('o', seq) FROM seq_1_to_1000000");
+  bench_pair(&conn, "30 strings, 1 read",
+             "SELECT CONCAT('a', seq) AS a, "
+             "REPEAT('b', 200), REPEAT('c', 200), REPEAT('d', 200), "
+             "REPEAT('e', 200), REPEAT('f', 200), REPEAT('g', 200), "
+             "REPEAT('h', 200), REPEAT('i', 200), REPEAT('j', 200), "
+             "REPEAT('k', 200), REPEAT('l', 200), REPEAT('m', 200), "
+             "REPEAT('n', 200), REPEAT('o', 200), REPEAT('p', 200), "
+             "REPEAT('q', 200), REPEAT('r', 200), REPEAT('s', 200), "
+             "REPEAT('t', 200), REPEAT('u', 200), REPEAT('v', 200), "
+             "REPEAT('w', 200), REPEAT('x', 200), REPEAT('y', 200), "
+             "REPEAT('z', 200), REPEAT('0', 200), REPEAT('1', 200), "
+             "REPEAT('2', 200), REPEAT('3', 200) FROM seq_1_to_1000000");
+
+  qury_close(&conn);
+  mysql_library_end();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+#include "../src/include/quaerimus_pipeline.h"
+#include "bench.h"
+
+/* scan the whole result, reading every column of every row */
+static void bench_scan(qury_conn_t *conn, const char *name, const char *query,
+                       size_t slots) {
+  qury_stmt_t *stmt = qury_new(conn, NULL);
+  qury_pipeline_t p;
+  uint64_t rows = 0;
+  int64_t sum = 0;
+
+  qury_set_result_mode(stmt, QURY_ResultStreaming);
+  uint64_t start = bench_now_ns();
+  if (!qury_query_once(stmt, query, 0, NULL)) {
+    qury_free(stmt);
+    return;
+  }
+  if (slots > 0 && !qury_pipeline_start(&p, stmt, slots)) {
+    qury_free(stmt);
+    return;
+  }
+  while (qury_fetch(stmt)) {
+    for (int i = 0; i < stmt->field_cnt; i++) {
+      qury_bind_t *v = qury_get_column_value(stmt, (size_t)i);
+      sum += v->length;
+    }
+    rows++;
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+  printf("%-32s %8.2f Mrows/s (%lu rows", name, rows / (elapsed / 1000.0),
+         (unsigned long)rows);
+  if (slots > 0) {
+    printf(", reader waits %lu, consumer waits %lu",
+           (unsigned long)p.reader_waits, (unsigned long)p.consumer_waits);
+  }
+  printf(")\n");
+  if (sum == 0) {
+    fprintf(stderr, "nothing read\n");
+  }
+  qury_free(stmt);
+}
+
+static void bench_set(qury_conn_t *conn, const char *name, const char *query) {
+  static const size_t slots[] = {0, 16, 64, 256};
+  char label[64];
+  for (size_t i = 0; i < sizeof(slots) / sizeof(*slots); i++) {
+    if (slots[i] == 0) {
+      snprintf(label, sizeof(label), "%s serial", name);
+    } else {
+      snprintf(label, sizeof(label), "%s pipeline %zu", name, slots[i]);
+    }
+    bench_scan(conn, label, query, slots[i]);
+  }
+}
+
+int main(void) {
+  qury_conn_t conn;
+
+  mysql_library_init(0, NULL, NULL);
+  if (!bench_connect(&conn)) {
+    return EXIT_FAILURE;
+  }
+  /* the time of the query is included, the server produces rows while they
+   * are decoded, seq_* needs the sequence engine. Against a remote server
+   * the network wait is larger and so is the gain */
+  bench_set(&conn, "16 integers",
+            "SELECT seq, seq+1, seq+2, seq+3, seq+4, seq+5, seq+6, seq+7, "
+            "seq+8, seq+9, seq+10, seq+11, seq+12, seq+13, seq+14, seq+15 "
+            "FROM seq_1_to_1000000");
+  bench_set(&conn, "4 decimals 4 dates 4 strings",
+            "SELECT seq / 7, seq / 11, seq / 13, seq / 17, "
+            "NOW() - INTERVAL seq SECOND, NOW() - INTERVAL seq MINUTE, "
+            "NOW() - INTERVAL seq HOUR, NOW() - INTERVAL seq DAY, "
+            "CONCAT('k', seq), CONCAT('l', seq), REPEAT('x', 64), "
+            "REPEAT('y', 64) FROM seq_1_to_1000000");
+
+  qury_close(&conn);
+  mysql_library_end();
+  return EXIT_SUCCESS;
+}
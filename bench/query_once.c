@@ -0,0 +1,53 @@
+#include "bench.h"
+
+#define ITERATIONS 10000
+#define QUERY "SELECT :a + 1 AS v, :name AS name"
+
+static uint64_t samples[ITERATIONS];
+
+int main(void) {
+  qury_conn_t conn;
+  mysql_library_init(0, NULL, NULL);
+  if (!bench_connect(&conn)) {
+    return EXIT_FAILURE;
+  }
+
+  /* prepare + execute + close, as a one shot statement would be done */
+  for (int i = 0; i < ITERATIONS; i++) {
+    uint64_t start = bench_now_ns();
+    qury_stmt_t *stmt = qury_new(&conn, NULL);
+    if (!stmt || !qury_prepare(stmt, QUERY, 0)
+        || !qury_stmt_bind_int(stmt, "a", i)
+        || !qury_stmt_bind_str(stmt, "name", "bench")
+        || !qury_execute(stmt)) {
+      return EXIT_FAILURE;
+    }
+    while (qury_fetch(stmt))
+      ;
+    qury_free(stmt);
+    samples[i] = bench_now_ns() - start;
+  }
+  bench_report("prepare+execute+close", samples, ITERATIONS);
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    uint64_t start = bench_now_ns();
+    qury_stmt_t *stmt = qury_new(&conn, NULL);
+    if (!stmt || !qury_query_once(stmt, QUERY, 0,
+                                  (qury_param_t[]){
+                                      QURY_PARAM_INT("a", i),
+                                      QURY_PARAM_STR("name", "bench"),
+                                      QURY_PARAM_END,
+                                  })) {
+      return EXIT_FAILURE;
+    }
+    while (qury_fetch(stmt))
+      ;
+    qury_free(stmt);
+    samples[i] = bench_now_ns() - start;
+  }
+  bench_report("qury_query_once", samples, ITERATIONS);
+
+  qury_close(&conn);
+  mysql_library_end();
+  return EXIT_SUCCESS;
+}
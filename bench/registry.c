@@ -0,0 +1,101 @@
+#include "../src/include/quaerimus_registry.h"
+#include "bench.h"
+#include <pthread.h>
+
+/* connection storm: CONNECTIONS threads connect at once, attach the registry
+ * and serve REQUESTS random statements. Time-to-first-request runs from the
+ * end of mysql_real_connect to the end of the first request. */
+#define CONNECTIONS 32
+#define STATEMENTS 300
+#define REQUESTS 100
+
+static qury_registry_t Registry;
+static qury_registry_mode_t Mode;
+static uint64_t first[CONNECTIONS];
+static uint64_t requests[CONNECTIONS * REQUESTS];
+static pthread_barrier_t Barrier;
+
+static bool request(qury_registry_conn_t *rc, int id, int i) {
+  qury_stmt_t *stmt = qury_registry_stmt(rc, id);
+  if (!stmt || !qury_stmt_bind_int(stmt, "id", i) || !qury_execute(stmt)) {
+    return false;
+  }
+  while (qury_fetch(stmt))
+    ;
+  qury_registry_release(rc);
+  return true;
+}
+
+static void *client(void *arg) {
+  size_t n = (size_t)(uintptr_t)arg;
+  unsigned int seed = (unsigned int)n;
+  qury_conn_t conn;
+  qury_registry_conn_t rc;
+
+  mysql_thread_init();
+  pthread_barrier_wait(&Barrier);
+  if (!bench_connect(&conn)) {
+    exit(EXIT_FAILURE);
+  }
+  uint64_t start = bench_now_ns();
+  if (!qury_registry_attach(&Registry, &conn, &rc, Mode)
+      || !request(&rc, rand_r(&seed) % STATEMENTS, 0)) {
+    exit(EXIT_FAILURE);
+  }
+  first[n] = bench_now_ns() - start;
+
+  for (int i = 0; i < REQUESTS; i++) {
+    start = bench_now_ns();
+    if (!request(&rc, rand_r(&seed) % STATEMENTS, i)) {
+      exit(EXIT_FAILURE);
+    }
+    requests[n * REQUESTS + i] = bench_now_ns() - start;
+  }
+  qury_registry_detach(&rc);
+  qury_close(&conn);
+  mysql_thread_end();
+  return NULL;
+}
+
+static void storm(const char *name, qury_registry_mode_t mode) {
+  pthread_t threads[CONNECTIONS];
+  char label[64];
+
+  Mode = mode;
+  pthread_barrier_init(&Barrier, NULL, CONNECTIONS);
+  for (size_t i = 0; i < CONNECTIONS; i++) {
+    pthread_create(&threads[i], NULL, client, (void *)(uintptr_t)i);
+  }
+  for (size_t i = 0; i < CONNECTIONS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_barrier_destroy(&Barrier);
+
+  snprintf(label, sizeof(label), "%s first request", name);
+  bench_report(label, first, CONNECTIONS);
+  snprintf(label, sizeof(label), "%s requests", name);
+  bench_report(label, requests, CONNECTIONS * REQUESTS);
+}
+
+int main(void) {
+  mysql_library_init(0, NULL, NULL);
+  qury_registry_init(&Registry);
+  for (int i = 0; i < STATEMENTS; i++) {
+    char name[32];
+    char query[128];
+    snprintf(name, sizeof(name), "stmt_%d", i);
+    snprintf(query, sizeof(query), "SELECT :id + %d AS v, '%s' AS name", i,
+             name);
+    if (qury_registry_add(&Registry, name, query) < 0) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  storm("lazy", QURY_RegistryLazy);
+  storm("eager", QURY_RegistryEager);
+  storm("background", QURY_RegistryBackground);
+
+  qury_registry_free(&Registry);
+  mysql_library_end();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+#define _GNU_SOURCE
+#include "../src/include/quaerimus_writer.h"
+#include "bench.h"
+#include <string.h>
+
+#define QUERY                                                                  \
+  "SELECT seq AS id, CONCAT('customer \"', seq, '\"') AS name, "               \
+  "seq * 1.25 AS amount, NOW() AS created FROM seq_1_to_1000000"
+
+static bool count_write(void *userptr, const void *buffer, size_t length) {
+  (void)buffer;
+  *(uint64_t *)userptr += length;
+  return true;
+}
+
+/* what the endpoints do by hand: fetch, then format each row */
+static void bench_by_hand(qury_conn_t *conn) {
+  qury_stmt_t *stmt = qury_new(conn, NULL);
+  uint64_t bytes = 0;
+
+  qury_set_result_mode(stmt, QURY_ResultStreaming);
+  uint64_t start = bench_now_ns();
+  if (!qury_prepare(stmt, QUERY, 0) || !qury_execute(stmt)) {
+    return;
+  }
+  while (qury_fetch(stmt)) {
+    qury_bind_t *id = NULL, *name = NULL, *amount = NULL, *created = NULL;
+    qury_get_value(stmt, "id", &id);
+    qury_get_value(stmt, "name", &name);
+    qury_get_value(stmt, "amount", &amount);
+    qury_get_value(stmt, "created", &created);
+    MYSQL_TIME t = qury_get_datetime(created);
+    char *line = NULL;
+    int len = asprintf(&line,
+                       "{\"id\":%lu,\"name\":\"%s\",\"amount\":%.17g,"
+                       "\"created\":\"%04u-%02u-%02u %02u:%02u:%02u\"}\n",
+                       (unsigned long)qury_get_int(id), qury_get_cstr(name),
+                       qury_get_float(amount), t.year, t.month, t.day, t.hour,
+                       t.minute, t.second);
+    if (len > 0) {
+      bytes += len;
+    }
+    free(line);
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+  printf("%-28s %8.2f MB/s\n", "fetch then format",
+         (bytes / 1048576.0) / (elapsed / 1e9));
+  qury_free(stmt);
+}
+
+static void bench_writer(qury_conn_t *conn, const char *name,
+                         qury_format_t format) {
+  qury_stmt_t *stmt = qury_new(conn, NULL);
+  uint64_t bytes = 0;
+  qury_writer_t writer = {.write = count_write, .userptr = &bytes};
+
+  qury_set_result_mode(stmt, QURY_ResultStreaming);
+  uint64_t start = bench_now_ns();
+  if (!qury_prepare(stmt, QUERY, 0) || !qury_execute(stmt)
+      || qury_write_results(stmt, format, &writer) < 0) {
+    return;
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+  printf("%-28s %8.2f MB/s\n", name, (bytes / 1048576.0) / (elapsed / 1e9));
+  qury_free(stmt);
+}
+
+int main(void) {
+  qury_conn_t conn;
+  mysql_library_init(0, NULL, NULL);
+  if (!bench_connect(&conn)) {
+    return EXIT_FAILURE;
+  }
+  bench_by_hand(&conn);
+  bench_writer(&conn, "qury_write_results jsonl", QURY_FormatJSONLines);
+  bench_writer(&conn, "qury_write_results csv", QURY_FormatCSV);
+  qury_close(&conn);
+  mysql_library_end();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,163 @@
+#include "include/quaerimus_deadline.h"
+#include "include/quaerimus.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define _DEADLINE_ER_NO_SUCH_THREAD 1094
+#define _DEADLINE_KILL_SIZE 48
+
+static uint64_t _deadline_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* called with the lock, which is released during the KILL */
+static void _deadline_kill(qury_watchdog_t *w, qury_watch_t *watch) {
+    char sql[_DEADLINE_KILL_SIZE];
+    int len = snprintf(sql, sizeof(sql), "KILL QUERY %lu", watch->thread_id);
+
+    watch->fired = true;
+    watch->killing = true;
+    pthread_mutex_unlock(&w->lock);
+    MYSQL *mysql = w->side->mysql;
+    /* the query may have ended meanwhile */
+    if (mysql_real_query(mysql, sql, (unsigned long)len)
+        && mysql_errno(mysql) != _DEADLINE_ER_NO_SUCH_THREAD) {
+        fprintf(stderr, "qury_watchdog : %s\n", mysql_error(mysql));
+    }
+    pthread_mutex_lock(&w->lock);
+    watch->killing = false;
+    w->kills++;
+    pthread_cond_broadcast(&w->killed);
+}
+
+static void *_deadline_watcher(void *arg) {
+    qury_watchdog_t *w = arg;
+
+    mysql_thread_init();
+    pthread_mutex_lock(&w->lock);
+    while (!w->stop) {
+        uint64_t now = _deadline_now_ns();
+        uint64_t next = UINT64_MAX;
+        qury_watch_t *due = NULL;
+        for (size_t i = 0; i < w->used; i++) {
+            qury_watch_t *watch = &w->watches[i];
+            if (!watch->armed || watch->fired) {
+                continue;
+            }
+            if (watch->deadline_ns <= now) {
+                due = watch;
+                break;
+            }
+            if (watch->deadline_ns < next) {
+                next = watch->deadline_ns;
+            }
+        }
+        if (due) {
+            _deadline_kill(w, due);
+            continue;
+        }
+        if (next == UINT64_MAX) {
+            pthread_cond_wait(&w->cond, &w->lock);
+        } else {
+            struct timespec ts = {.tv_sec = (time_t)(next / 1000000000ULL),
+                                  .tv_nsec = (long)(next % 1000000000ULL)};
+            pthread_cond_timedwait(&w->cond, &w->lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    mysql_thread_end();
+    return NULL;
+}
+
+bool qury_watchdog_init(qury_watchdog_t *w, qury_conn_t *side) {
+    assert(w != NULL);
+    assert(side != NULL);
+
+    memset(w, 0, sizeof(*w));
+    w->side = side;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, &attr);
+    pthread_cond_init(&w->killed, NULL);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&w->thread, NULL, _deadline_watcher, w) != 0) {
+        fprintf(stderr, "qury_watchdog_init : cannot start the watcher\n");
+        pthread_cond_destroy(&w->killed);
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        return false;
+    }
+    return true;
+}
+
+void qury_watchdog_shutdown(qury_watchdog_t *w) {
+    if (!w) {
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    w->stop = true;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    pthread_cond_destroy(&w->killed);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+}
+
+size_t qury_watchdog_arm(qury_watchdog_t *w, unsigned long thread_id,
+                         uint32_t timeout_ms) {
+    assert(w != NULL);
+
+    uint64_t deadline = _deadline_now_ns() + (uint64_t)timeout_ms * 1000000ULL;
+    size_t i = 0;
+    pthread_mutex_lock(&w->lock);
+    while (i < w->used && w->watches[i].armed) {
+        i++;
+    }
+    if (i == QURY_WATCHDOG_SLOTS) {
+        w->unwatched++;
+        pthread_mutex_unlock(&w->lock);
+        return QURY_WATCH_NONE;
+    }
+    if (i == w->used) {
+        w->used++;
+    }
+    w->watches[i] = (qury_watch_t){
+        .deadline_ns = deadline, .thread_id = thread_id, .armed = true};
+    /* the watcher may sleep past this deadline */
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    return i;
+}
+
+bool qury_watchdog_disarm(qury_watchdog_t *w, size_t watch) {
+    assert(w != NULL);
+
+    if (watch >= QURY_WATCHDOG_SLOTS) {
+        return false;
+    }
+    pthread_mutex_lock(&w->lock);
+    qury_watch_t *wt = &w->watches[watch];
+    while (wt->killing) {
+        pthread_cond_wait(&w->killed, &w->lock);
+    }
+    bool fired = wt->fired;
+    wt->armed = false;
+    while (w->used > 0 && !w->watches[w->used - 1].armed) {
+        w->used--;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return fired;
+}
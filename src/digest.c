@@ -0,0 +1,349 @@
+#include "include/quaerimus_digest.h"
+#include "include/quaerimus.h"
+#include <assert.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _DIGEST_FNV_OFFSET 0xcbf29ce484222325ULL
+#define _DIGEST_FNV_PRIME 0x100000001b3ULL
+#define _DIGEST_STACK_SIZE 1024
+
+static qury_digest_t Digests[QURY_DIGEST_SHARDS][QURY_DIGEST_SLOTS];
+static atomic_bool Enabled = false;
+static _Atomic uint64_t Dropped = 0;
+
+void qury_digest_enable(bool on) { atomic_store(&Enabled, on); }
+
+bool qury_digest_enabled(void) {
+    return atomic_load_explicit(&Enabled, memory_order_relaxed);
+}
+
+static bool _digest_word(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '$' || c == '?'
+           || c == '`' || c == '@' || (unsigned char)c >= 0x80;
+}
+
+/* skip a quoted literal or identifier, returns the position after it */
+static size_t _digest_skip_quoted(const char *q, size_t i, size_t length) {
+    char quote = q[i++];
+    while (i < length) {
+        if (q[i] == '\\' && quote != '`') {
+            i += 2;
+            continue;
+        }
+        if (q[i] == quote) {
+            if (i + 1 < length && q[i + 1] == quote) {
+                /* doubled quote */
+                i += 2;
+                continue;
+            }
+            return i + 1;
+        }
+        i++;
+    }
+    return length;
+}
+
+/* out is at least 2 * length + 1 bytes, a space may come before a char */
+static size_t _digest_normalize(const char *q, size_t length, char *out) {
+    size_t n = 0;
+    bool space = false;
+
+    for (size_t i = 0; i < length;) {
+        char c = q[i];
+        if (isspace((unsigned char)c)) {
+            space = true;
+            i++;
+            continue;
+        }
+        if ((c == '-' && i + 2 < length && q[i + 1] == '-'
+             && isspace((unsigned char)q[i + 2]))
+            || c == '#') {
+            while (i < length && q[i] != '\n') {
+                i++;
+            }
+            space = true;
+            continue;
+        }
+        if (c == '/' && i + 1 < length && q[i + 1] == '*') {
+            const char *end = NULL;
+            for (size_t j = i + 2; j + 1 < length; j++) {
+                if (q[j] == '*' && q[j + 1] == '/') {
+                    end = q + j + 2;
+                    break;
+                }
+            }
+            i = end ? (size_t)(end - q) : length;
+            space = true;
+            continue;
+        }
+
+        char prev = n > 0 ? out[n - 1] : '(';
+        bool string = c == '\'' || c == '"';
+        bool number = (isdigit((unsigned char)c)
+                       || (c == '.' && i + 1 < length
+                           && isdigit((unsigned char)q[i + 1])))
+                      && (space || !_digest_word(prev));
+        bool param = c == ':' && i + 1 < length
+                     && (isalpha((unsigned char)q[i + 1]) || q[i + 1] == '_');
+        bool word = string || number || param || _digest_word(c);
+
+        /* one space between words and operators, none around ( ) . and
+         * before , */
+        bool joined = prev == '(' || prev == '.' || c == '(' || c == ')'
+                      || c == ',' || (c == '.' && !number);
+        if (!joined && (space || _digest_word(prev) != word)) {
+            out[n++] = ' ';
+        }
+        space = false;
+
+        if (string) {
+            i = _digest_skip_quoted(q, i, length);
+            out[n++] = '?';
+        } else if (c == '`') {
+            size_t end = _digest_skip_quoted(q, i, length);
+            memcpy(out + n, q + i, end - i);
+            n += end - i;
+            i = end;
+        } else if (number) {
+            /* number, hexadecimal and exponent included */
+            while (i < length
+                   && (isalnum((unsigned char)q[i]) || q[i] == '.'
+                       || ((q[i] == '+' || q[i] == '-')
+                           && (q[i - 1] == 'e' || q[i - 1] == 'E')))) {
+                i++;
+            }
+            out[n++] = '?';
+        } else if (param) {
+            /* named parameter */
+            i++;
+            while (i < length && (isalnum((unsigned char)q[i]) || q[i] == '_')) {
+                i++;
+            }
+            out[n++] = '?';
+        } else if (c == ',') {
+            out[n++] = ',';
+            space = true;
+            i++;
+        } else {
+            out[n++] = (char)tolower((unsigned char)c);
+            i++;
+        }
+    }
+    return n;
+}
+
+/* in(?, ?, ?) becomes in(?), in place */
+static size_t _digest_collapse_in(char *s, size_t n) {
+    size_t w = 0;
+    for (size_t r = 0; r < n;) {
+        if (r + 4 <= n && memcmp(s + r, "in(?", 4) == 0
+            && (r == 0 || !_digest_word(s[r - 1]))) {
+            size_t j = r + 4;
+            while (j + 3 <= n && memcmp(s + j, ", ?", 3) == 0) {
+                j += 3;
+            }
+            if (j < n && s[j] == ')') {
+                memmove(s + w, "in(?)", 5);
+                w += 5;
+                r = j + 1;
+                continue;
+            }
+        }
+        s[w++] = s[r++];
+    }
+    return w;
+}
+
+uint64_t qury_digest_fingerprint(const char *query, size_t length, char *text,
+                                 size_t size) {
+    assert(query != NULL);
+    if (length == 0) {
+        length = strlen(query);
+    }
+    char stack[_DIGEST_STACK_SIZE];
+    char *buffer = 2 * length < sizeof(stack) ? stack
+                                              : malloc(2 * length + 1);
+    if (!buffer) {
+        return 1;
+    }
+    size_t n = _digest_collapse_in(buffer,
+                                   _digest_normalize(query, length, buffer));
+
+    uint64_t h = _DIGEST_FNV_OFFSET;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (uint8_t)buffer[i];
+        h *= _DIGEST_FNV_PRIME;
+    }
+    if (text && size > 0) {
+        size_t len = n < size - 1 ? n : size - 1;
+        memcpy(text, buffer, len);
+        text[len] = '\0';
+    }
+    if (buffer != stack) {
+        free(buffer);
+    }
+    /* 0 marks a free slot */
+    return h != 0 ? h : 1;
+}
+
+qury_digest_t *qury_digest_lookup(const char *query, size_t length) {
+    char text[QURY_DIGEST_TEXT_SIZE];
+    uint64_t fp = qury_digest_fingerprint(query, length, text, sizeof(text));
+    /* top bits pick the shard, low bits the first slot */
+    qury_digest_t *shard = Digests[fp >> 60 & (QURY_DIGEST_SHARDS - 1)];
+
+    for (size_t i = 0; i < QURY_DIGEST_SLOTS; i++) {
+        qury_digest_t *d = &shard[(fp + i) & (QURY_DIGEST_SLOTS - 1)];
+        uint64_t current = atomic_load_explicit(&d->fingerprint,
+                                                memory_order_acquire);
+        if (current == 0) {
+            if (atomic_compare_exchange_strong(&d->fingerprint, &current,
+                                               fp)) {
+                memcpy(d->text, text, sizeof(d->text));
+                atomic_store_explicit(&d->ready, true, memory_order_release);
+                return d;
+            }
+            /* current is the fingerprint of the winner */
+        }
+        if (current == fp) {
+            return d;
+        }
+    }
+    atomic_fetch_add_explicit(&Dropped, 1, memory_order_relaxed);
+    return NULL;
+}
+
+void qury_digest_record(qury_digest_t *d, uint64_t ns, bool ok) {
+    if (!d) {
+        return;
+    }
+    atomic_fetch_add_explicit(&d->calls, 1, memory_order_relaxed);
+    if (!ok) {
+        atomic_fetch_add_explicit(&d->errors, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&d->total_ns, ns, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&d->max_ns, memory_order_relaxed);
+    while (ns > max
+           && !atomic_compare_exchange_weak_explicit(&d->max_ns, &max, ns,
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed))
+        ;
+}
+
+void qury_digest_add_rows(qury_digest_t *d, uint64_t rows, uint64_t bytes) {
+    if (!d) {
+        return;
+    }
+    atomic_fetch_add_explicit(&d->rows, rows, memory_order_relaxed);
+    atomic_fetch_add_explicit(&d->bytes, bytes, memory_order_relaxed);
+}
+
+#define _DIGEST_CMP(field)                                                     \
+    static int _digest_cmp_##field(const void *a, const void *b) {             \
+        uint64_t x = ((const qury_digest_stat_t *)a)->field;                   \
+        uint64_t y = ((const qury_digest_stat_t *)b)->field;                   \
+        return (x < y) - (x > y);                                              \
+    }
+
+/* descending */
+_DIGEST_CMP(total_ns)
+_DIGEST_CMP(calls)
+_DIGEST_CMP(rows)
+_DIGEST_CMP(max_ns)
+
+size_t qury_digest_top(qury_digest_stat_t *out, size_t n,
+                       qury_digest_order_t order) {
+    assert(out != NULL || n == 0);
+
+    qury_digest_stat_t *all =
+        malloc(sizeof(*all) * QURY_DIGEST_SHARDS * QURY_DIGEST_SLOTS);
+    if (!all) {
+        return 0;
+    }
+    size_t count = 0;
+    for (size_t s = 0; s < QURY_DIGEST_SHARDS; s++) {
+        for (size_t i = 0; i < QURY_DIGEST_SLOTS; i++) {
+            qury_digest_t *d = &Digests[s][i];
+            if (!atomic_load_explicit(&d->ready, memory_order_acquire)) {
+                continue;
+            }
+            all[count++] = (qury_digest_stat_t){
+                .fingerprint = atomic_load(&d->fingerprint),
+                .text = d->text,
+                .calls = atomic_load(&d->calls),
+                .errors = atomic_load(&d->errors),
+                .total_ns = atomic_load(&d->total_ns),
+                .max_ns = atomic_load(&d->max_ns),
+                .rows = atomic_load(&d->rows),
+                .bytes = atomic_load(&d->bytes)};
+        }
+    }
+    int (*cmp)(const void *, const void *) = _digest_cmp_total_ns;
+    switch (order) {
+        case QURY_DigestByCalls:
+            cmp = _digest_cmp_calls;
+            break;
+        case QURY_DigestByRows:
+            cmp = _digest_cmp_rows;
+            break;
+        case QURY_DigestByMaxTime:
+            cmp = _digest_cmp_max_ns;
+            break;
+        default:
+            break;
+    }
+    qsort(all, count, sizeof(*all), cmp);
+
+    if (count > n) {
+        count = n;
+    }
+    if (count > 0) {
+        memcpy(out, all, count * sizeof(*all));
+    }
+    free(all);
+    return count;
+}
+
+void qury_digest_report(FILE *f, size_t n, qury_digest_order_t order) {
+    assert(f != NULL);
+
+    qury_digest_stat_t *top = malloc(sizeof(*top) * (n > 0 ? n : 1));
+    if (!top) {
+        return;
+    }
+    size_t count = qury_digest_top(top, n, order);
+    fprintf(f, "%-16s %10s %8s %12s %12s %12s %12s  %s\n", "fingerprint",
+            "calls", "errors", "total ms", "avg us", "max us", "rows",
+            "query");
+    for (size_t i = 0; i < count; i++) {
+        qury_digest_stat_t *s = &top[i];
+        fprintf(f, "%016llx %10llu %8llu %12.3f %12.3f %12.3f %12llu  %s\n",
+                (unsigned long long)s->fingerprint,
+                (unsigned long long)s->calls, (unsigned long long)s->errors,
+                s->total_ns / 1e6,
+                s->calls > 0 ? s->total_ns / 1e3 / s->calls : 0.0,
+                s->max_ns / 1e3, (unsigned long long)s->rows, s->text);
+    }
+    free(top);
+}
+
+void qury_digest_reset(void) {
+    for (size_t s = 0; s < QURY_DIGEST_SHARDS; s++) {
+        for (size_t i = 0; i < QURY_DIGEST_SLOTS; i++) {
+            qury_digest_t *d = &Digests[s][i];
+            atomic_store(&d->calls, 0);
+            atomic_store(&d->errors, 0);
+            atomic_store(&d->total_ns, 0);
+            atomic_store(&d->max_ns, 0);
+            atomic_store(&d->rows, 0);
+            atomic_store(&d->bytes, 0);
+        }
+    }
+    atomic_store(&Dropped, 0);
+}
+
+uint64_t qury_digest_dropped(void) { return atomic_load(&Dropped); }
@@ -0,0 +1,356 @@
+#include "include/quaerimus_executor.h"
+#include "include/array.h"
+#include "include/quaerimus.h"
+#include "include/quaerimus_registry.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+void qury_mpsc_init(qury_mpsc_t *q) {
+    atomic_init(&q->stub.next, NULL);
+    atomic_init(&q->head, &q->stub);
+    q->tail = &q->stub;
+    atomic_flag_clear(&q->consuming);
+}
+
+void qury_mpsc_push(qury_mpsc_t *q, qury_request_t *req) {
+    atomic_store_explicit(&req->next, NULL, memory_order_relaxed);
+    qury_request_t *prev =
+        atomic_exchange_explicit(&q->head, req, memory_order_acq_rel);
+    /* the request is lost to the consumer until this store, it sees the
+     * queue as empty in between */
+    atomic_store_explicit(&prev->next, req, memory_order_release);
+}
+
+/* single consumer */
+static qury_request_t *_mpsc_pop(qury_mpsc_t *q) {
+    qury_request_t *tail = q->tail;
+    qury_request_t *next =
+        atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == &q->stub) {
+        if (!next) {
+            return NULL;
+        }
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire)) {
+        /* a producer is between its two steps */
+        return NULL;
+    }
+    qury_mpsc_push(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+/* pop unless another thread is consuming, which allows stealing */
+qury_request_t *qury_mpsc_take(qury_mpsc_t *q) {
+    if (atomic_flag_test_and_set_explicit(&q->consuming,
+                                          memory_order_acquire)) {
+        return NULL;
+    }
+    qury_request_t *req = _mpsc_pop(q);
+    atomic_flag_clear_explicit(&q->consuming, memory_order_release);
+    return req;
+}
+
+static void _executor_deadline(struct timespec *ts, unsigned int ms) {
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static void _executor_complete(qury_executor_t *ex, qury_request_t *req) {
+    if (req->on_done) {
+        req->on_done(req);
+        return;
+    }
+    qury_mpsc_push(&ex->completions, req);
+    if (atomic_load(&ex->waiters) > 0) {
+        pthread_mutex_lock(&ex->lock);
+        pthread_cond_broadcast(&ex->cond);
+        pthread_mutex_unlock(&ex->lock);
+    }
+}
+
+/* the statement is shared by the requests of the worker, a parameter left
+ * out by a request must not keep the value of the previous one */
+static bool _executor_unbind(qury_stmt_t *stmt) {
+    size_t index;
+    uintptr_t value;
+    array_foreach(&stmt->params, index, value) {
+        qury_bind_t *param = (qury_bind_t *)value;
+        if (param->type != QURY_Null
+            && !qury_stmt_bind(stmt, param->name, 0, 0, QURY_Null)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void _executor_run(qury_worker_t *w, qury_request_t *req) {
+    qury_stmt_t *stmt = qury_registry_stmt(&w->stmts, req->stmt_id);
+    bool ok = stmt != NULL && _executor_unbind(stmt);
+    for (const qury_param_t *p = req->params; ok && p && p->name; p++) {
+        ok = qury_stmt_bind(stmt, p->name, p->ptr, p->vlen, p->type);
+    }
+    ok = ok && qury_execute(stmt);
+    if (ok) {
+        if (req->on_rows) {
+            ok = req->on_rows(req, stmt);
+        }
+        /* rows left, the connection must be free for the next request */
+        while (qury_fetch(stmt))
+            ;
+        req->affected_rows = qury_affected_rows(stmt);
+    }
+    req->ok = ok;
+    req->worker = (int)w->index;
+    w->executed++;
+    _executor_complete(w->owner, req);
+}
+
+static qury_request_t *_executor_steal(qury_worker_t *w) {
+    qury_executor_t *ex = w->owner;
+    for (size_t i = 1; i < ex->nworkers; i++) {
+        qury_worker_t *victim = &ex->workers[(w->index + i) % ex->nworkers];
+        qury_request_t *req = qury_mpsc_take(&victim->queue);
+        if (req) {
+            w->stolen++;
+            return req;
+        }
+    }
+    return NULL;
+}
+
+static void _executor_wake(qury_worker_t *w) {
+    if (atomic_exchange(&w->sleeping, false)) {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+static void *_executor_worker(void *arg) {
+    qury_worker_t *w = arg;
+    qury_executor_t *ex = w->owner;
+
+    mysql_thread_init();
+    /* statements are allocated by the thread using them */
+    if (!qury_registry_attach(ex->registry, w->conn, &w->stmts,
+                              QURY_RegistryEager)) {
+        fprintf(stderr, "qury_executor : worker %zu cannot attach registry\n",
+                w->index);
+    }
+    while (!atomic_load(&ex->stop)) {
+        qury_request_t *req = qury_mpsc_take(&w->queue);
+        if (!req) {
+            req = _executor_steal(w);
+        }
+        if (req) {
+            _executor_run(w, req);
+            continue;
+        }
+
+        /* a submit after this point sees sleeping and signals */
+        atomic_store(&w->sleeping, true);
+        if ((req = qury_mpsc_take(&w->queue))) {
+            atomic_store(&w->sleeping, false);
+            _executor_run(w, req);
+            continue;
+        }
+        struct timespec ts;
+        _executor_deadline(&ts, QURY_EXECUTOR_IDLE_MS);
+        pthread_mutex_lock(&w->lock);
+        if (atomic_load(&w->sleeping) && !atomic_load(&ex->stop)) {
+            pthread_cond_timedwait(&w->cond, &w->lock, &ts);
+        }
+        pthread_mutex_unlock(&w->lock);
+        atomic_store(&w->sleeping, false);
+    }
+    qury_registry_detach(&w->stmts);
+    mysql_thread_end();
+    return NULL;
+}
+
+bool qury_executor_init(qury_executor_t *ex, qury_registry_t *registry,
+                        qury_conn_t **conns, size_t n) {
+    assert(ex != NULL);
+    assert(registry != NULL);
+    assert(conns != NULL);
+
+    memset(ex, 0, sizeof(*ex));
+    if (n == 0 || n > QURY_EXECUTOR_MAX) {
+        fprintf(stderr, "qury_executor_init : between 1 and %d connections\n",
+                QURY_EXECUTOR_MAX);
+        return false;
+    }
+    ex->registry = registry;
+    atomic_init(&ex->next, 0);
+    atomic_init(&ex->stop, false);
+    atomic_init(&ex->submitting, 0);
+    atomic_init(&ex->waiters, 0);
+    qury_mpsc_init(&ex->completions);
+    pthread_mutex_init(&ex->lock, NULL);
+    pthread_cond_init(&ex->cond, NULL);
+
+    for (size_t i = 0; i < n; i++) {
+        qury_worker_t *w = &ex->workers[i];
+        w->owner = ex;
+        w->index = i;
+        w->conn = conns[i];
+        qury_mpsc_init(&w->queue);
+        atomic_init(&w->sleeping, false);
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->cond, NULL);
+    }
+    /* workers steal from each other, all of them exist before any runs */
+    ex->nworkers = n;
+    for (size_t i = 0; i < n; i++) {
+        if (pthread_create(&ex->workers[i].thread, NULL, _executor_worker,
+                           &ex->workers[i])
+            != 0) {
+            fprintf(stderr, "qury_executor_init : cannot start worker\n");
+            ex->nworkers = i;
+            qury_executor_shutdown(ex);
+            return false;
+        }
+    }
+    return true;
+}
+
+void qury_executor_shutdown(qury_executor_t *ex) {
+    if (!ex) {
+        return;
+    }
+    atomic_store(&ex->stop, true);
+    /* a submit that saw stop false pushes before the queues are drained */
+    while (atomic_load(&ex->submitting) > 0) {
+        sched_yield();
+    }
+    for (size_t i = 0; i < ex->nworkers; i++) {
+        atomic_store(&ex->workers[i].sleeping, true);
+        _executor_wake(&ex->workers[i]);
+    }
+    for (size_t i = 0; i < ex->nworkers; i++) {
+        pthread_join(ex->workers[i].thread, NULL);
+    }
+    for (size_t i = 0; i < ex->nworkers; i++) {
+        qury_worker_t *w = &ex->workers[i];
+        qury_request_t *req = NULL;
+        while ((req = qury_mpsc_take(&w->queue))) {
+            req->ok = false;
+            req->worker = -1;
+            _executor_complete(ex, req);
+        }
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+    }
+    ex->nworkers = 0;
+}
+
+/* false once shutdown has begun, otherwise it waits for the matching
+ * _executor_leave */
+static bool _executor_enter(qury_executor_t *ex) {
+    atomic_fetch_add(&ex->submitting, 1);
+    if (atomic_load(&ex->stop)) {
+        atomic_fetch_sub(&ex->submitting, 1);
+        return false;
+    }
+    return true;
+}
+
+static bool _executor_leave(qury_executor_t *ex, bool ok) {
+    atomic_fetch_sub(&ex->submitting, 1);
+    return ok;
+}
+
+static bool _executor_push(qury_executor_t *ex, size_t worker,
+                           qury_request_t *req) {
+    if (worker >= ex->nworkers) {
+        return false;
+    }
+    req->ok = false;
+    req->affected_rows = 0;
+    req->worker = -1;
+    qury_worker_t *w = &ex->workers[worker];
+    qury_mpsc_push(&w->queue, req);
+    _executor_wake(w);
+    return true;
+}
+
+bool qury_executor_submit_to(qury_executor_t *ex, size_t worker,
+                             qury_request_t *req) {
+    assert(ex != NULL);
+    assert(req != NULL);
+
+    if (!_executor_enter(ex)) {
+        return false;
+    }
+    return _executor_leave(ex, _executor_push(ex, worker, req));
+}
+
+bool qury_executor_submit(qury_executor_t *ex, qury_request_t *req) {
+    assert(ex != NULL);
+    assert(req != NULL);
+
+    if (!_executor_enter(ex)) {
+        return false;
+    }
+    if (ex->nworkers == 0) {
+        return _executor_leave(ex, false);
+    }
+    size_t worker = atomic_fetch_add_explicit(&ex->next, 1,
+                                              memory_order_relaxed)
+                    % ex->nworkers;
+    return _executor_leave(ex, _executor_push(ex, worker, req));
+}
+
+qury_request_t *qury_executor_poll(qury_executor_t *ex) {
+    assert(ex != NULL);
+    return qury_mpsc_take(&ex->completions);
+}
+
+qury_request_t *qury_executor_wait(qury_executor_t *ex,
+                                   unsigned int timeout_ms) {
+    assert(ex != NULL);
+
+    qury_request_t *req = qury_executor_poll(ex);
+    if (req || timeout_ms == 0) {
+        return req;
+    }
+    struct timespec deadline;
+    _executor_deadline(&deadline, timeout_ms);
+    atomic_fetch_add(&ex->waiters, 1);
+    pthread_mutex_lock(&ex->lock);
+    /* workers broadcast under the lock, nothing is missed between the poll
+     * and the wait */
+    while (!(req = qury_executor_poll(ex))) {
+        if (pthread_cond_timedwait(&ex->cond, &ex->lock, &deadline)
+            == ETIMEDOUT) {
+            req = qury_executor_poll(ex);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ex->lock);
+    atomic_fetch_sub(&ex->waiters, 1);
+    return req;
+}
@@ -0,0 +1,284 @@
+#include "include/quaerimus_group.h"
+#include "include/quaerimus.h"
+#include "include/quaerimus_executor.h"
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define _GROUP_ER_LOCK_DEADLOCK 1213
+#define _GROUP_CR_MIN_ERROR 2000 /* client errors, CR_SERVER_LOST, ... */
+
+static uint64_t _group_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static bool _group_add(qury_group_t *g, qury_request_t *req) {
+    if (req->stmt_id < 0 || (size_t)req->stmt_id >= g->registry->count) {
+        fprintf(stderr, "qury_group : unknown statement %d\n", req->stmt_id);
+        return false;
+    }
+    return qury_batch_add(g->stmt, g->registry->entries[req->stmt_id].query, 0,
+                          req->params);
+}
+
+static void _group_fail(qury_request_t **items, size_t from, size_t to) {
+    for (size_t i = from; i < to; i++) {
+        items[i]->ok = false;
+        items[i]->affected_rows = 0;
+    }
+}
+
+/* one transaction for all the writes, sent with its COMMIT as one batch;
+ * a failed statement stops the batch, the rest is sent again */
+static void _group_flush(qury_group_t *g, qury_request_t **items, size_t n,
+                         size_t *map) {
+    MYSQL *mysql = g->conn->mysql;
+    size_t start = 0; /* first write of the transaction */
+    size_t next = 0;  /* first write not sent yet */
+    unsigned int replays = 0;
+
+    g->flushes++;
+    g->writes += n;
+    _group_fail(items, 0, n);
+    for (;;) {
+        size_t count = 0;
+        for (size_t i = next; i < n; i++) {
+            if (_group_add(g, items[i])) {
+                map[count++] = i;
+            }
+        }
+        next = n;
+        size_t done = 0;
+        g->round_trips++;
+        bool ok = qury_batch_add(g->stmt, "COMMIT", 0, NULL)
+                  && qury_batch_execute(g->stmt);
+        while (ok) {
+            if (done < count) {
+                items[map[done]]->ok = true;
+                items[map[done]]->affected_rows = qury_affected_rows(g->stmt);
+            }
+            done++;
+            ok = qury_next_result(g->stmt);
+        }
+        if (done == count + 1) {
+            /* committed */
+            return;
+        }
+
+        unsigned int err = mysql_errno(mysql);
+        if (err == _GROUP_ER_LOCK_DEADLOCK && replays < QURY_GROUP_RETRIES) {
+            /* the server rolled the whole transaction back */
+            replays++;
+            g->replays++;
+            mysql_rollback(mysql);
+            _group_fail(items, start, n);
+            next = start;
+            continue;
+        }
+        if (done >= count || err == _GROUP_ER_LOCK_DEADLOCK || err == 0
+            || err >= _GROUP_CR_MIN_ERROR) {
+            /* COMMIT failed, the connection is gone, or nothing can be
+             * trusted anymore */
+            mysql_rollback(mysql);
+            _group_fail(items, start, n);
+            return;
+        }
+        /* a statement error only undoes that statement, the transaction
+         * goes on with the writes after it */
+        items[map[done]]->ok = false;
+        next = map[done] + 1;
+        _group_fail(items, next, n);
+    }
+}
+
+static void _group_complete(qury_group_t *g, qury_request_t **items,
+                            size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (items[i]->on_done) {
+            items[i]->on_done(items[i]);
+        } else {
+            atomic_store_explicit(&items[i]->done, true, memory_order_release);
+        }
+    }
+    pthread_mutex_lock(&g->lock);
+    pthread_cond_broadcast(&g->done_cond);
+    pthread_mutex_unlock(&g->lock);
+}
+
+/* wait for a full batch, the oldest write to be due or the stop */
+static void _group_wait(qury_group_t *g) {
+    pthread_mutex_lock(&g->lock);
+    for (;;) {
+        size_t pending = atomic_load(&g->pending);
+        if (pending >= g->max_batch || atomic_load(&g->stop)) {
+            break;
+        }
+        if (pending == 0) {
+            pthread_cond_wait(&g->cond, &g->lock);
+            continue;
+        }
+        uint64_t due = atomic_load(&g->first_ns)
+                       + (uint64_t)g->max_delay_us * 1000ULL;
+        if (_group_now_ns() >= due) {
+            break;
+        }
+        struct timespec ts = {.tv_sec = (time_t)(due / 1000000000ULL),
+                              .tv_nsec = (long)(due % 1000000000ULL)};
+        pthread_cond_timedwait(&g->cond, &g->lock, &ts);
+    }
+    pthread_mutex_unlock(&g->lock);
+}
+
+static void *_group_flusher(void *arg) {
+    qury_group_t *g = arg;
+    size_t *map = malloc(g->max_batch * sizeof(*map));
+
+    mysql_thread_init();
+    for (;;) {
+        _group_wait(g);
+        size_t n = 0;
+        qury_request_t *req = NULL;
+        while (n < g->max_batch && (req = qury_mpsc_take(&g->queue))) {
+            g->items[n++] = req;
+        }
+        if (n > 0) {
+            atomic_fetch_sub(&g->pending, n);
+            if (map) {
+                _group_flush(g, g->items, n, map);
+            } else {
+                _group_fail(g->items, 0, n);
+            }
+            _group_complete(g, g->items, n);
+        } else if (atomic_load(&g->stop) && atomic_load(&g->submitting) == 0
+                   && atomic_load(&g->pending) == 0) {
+            /* in that order: a submit that missed the stop is counted in
+             * pending before it leaves submitting */
+            break;
+        } else {
+            /* a submitter is between counting and queuing */
+            sched_yield();
+        }
+    }
+    mysql_thread_end();
+    free(map);
+    return NULL;
+}
+
+bool qury_group_init(qury_group_t *g, qury_conn_t *conn,
+                     qury_registry_t *registry, size_t max_batch,
+                     unsigned int max_delay_us) {
+    assert(g != NULL);
+    assert(conn != NULL);
+    assert(registry != NULL);
+
+    memset(g, 0, sizeof(*g));
+    g->conn = conn;
+    g->registry = registry;
+    g->max_batch = max_batch > 0 ? max_batch : 1;
+    g->max_delay_us = max_delay_us;
+    qury_mpsc_init(&g->queue);
+    atomic_init(&g->pending, 0);
+    atomic_init(&g->first_ns, 0);
+    atomic_init(&g->stop, false);
+    atomic_init(&g->submitting, 0);
+
+    g->items = malloc(g->max_batch * sizeof(*g->items));
+    g->stmt = qury_new(conn, NULL);
+    if (!g->items || !g->stmt || mysql_autocommit(conn->mysql, 0)) {
+        fprintf(stderr, "qury_group_init : %s\n", mysql_error(conn->mysql));
+        free(g->items);
+        if (g->stmt) {
+            qury_free(g->stmt);
+        }
+        return false;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&g->lock, NULL);
+    pthread_cond_init(&g->cond, &attr);
+    pthread_cond_init(&g->done_cond, NULL);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&g->thread, NULL, _group_flusher, g) != 0) {
+        fprintf(stderr, "qury_group_init : cannot start the flusher\n");
+        pthread_cond_destroy(&g->done_cond);
+        pthread_cond_destroy(&g->cond);
+        pthread_mutex_destroy(&g->lock);
+        qury_free(g->stmt);
+        free(g->items);
+        mysql_autocommit(conn->mysql, 1);
+        return false;
+    }
+    return true;
+}
+
+void qury_group_shutdown(qury_group_t *g) {
+    if (!g) {
+        return;
+    }
+    pthread_mutex_lock(&g->lock);
+    atomic_store(&g->stop, true);
+    pthread_cond_signal(&g->cond);
+    pthread_mutex_unlock(&g->lock);
+    pthread_join(g->thread, NULL);
+
+    qury_free(g->stmt);
+    g->stmt = NULL;
+    free(g->items);
+    g->items = NULL;
+    mysql_autocommit(g->conn->mysql, 1);
+    pthread_cond_destroy(&g->done_cond);
+    pthread_cond_destroy(&g->cond);
+    pthread_mutex_destroy(&g->lock);
+}
+
+bool qury_group_submit(qury_group_t *g, qury_request_t *req) {
+    assert(g != NULL);
+    assert(req != NULL);
+
+    /* the flusher doesn't exit while a submit that missed the stop runs */
+    atomic_fetch_add(&g->submitting, 1);
+    if (atomic_load(&g->stop)) {
+        atomic_fetch_sub(&g->submitting, 1);
+        return false;
+    }
+    req->ok = false;
+    req->affected_rows = 0;
+    req->worker = -1;
+    atomic_store(&req->done, false);
+
+    /* counted first, the flusher never takes more than it has counted */
+    size_t pending = atomic_fetch_add(&g->pending, 1);
+    if (pending == 0) {
+        atomic_store(&g->first_ns, _group_now_ns());
+    }
+    qury_mpsc_push(&g->queue, req);
+    if (pending == 0 || pending + 1 >= g->max_batch) {
+        pthread_mutex_lock(&g->lock);
+        pthread_cond_signal(&g->cond);
+        pthread_mutex_unlock(&g->lock);
+    }
+    atomic_fetch_sub(&g->submitting, 1);
+    return true;
+}
+
+bool qury_group_wait(qury_group_t *g, qury_request_t *req) {
+    assert(g != NULL);
+    assert(req != NULL);
+
+    pthread_mutex_lock(&g->lock);
+    while (!atomic_load_explicit(&req->done, memory_order_acquire)) {
+        pthread_cond_wait(&g->done_cond, &g->lock);
+    }
+    pthread_mutex_unlock(&g->lock);
+    return req->ok;
+}
@@ -25,15 +25,69 @@
 #define QURY_Bool 0x0010
 #define QURY_Null 0x0020
 #define QURY_DateTime 0x0040
+#define QURY_Decimal 0x0080
 #define QURY_DataCallback 0x1000
+#define QURY_Borrowed 0x2000 /* string or bytes not copied, see qury_stmt_bind */
+#define QURY_Unsigned 0x4000 /* integer taken as uint64_t */
+#define QURY_Flags (QURY_DataCallback | QURY_Borrowed | QURY_Unsigned)
 typedef uint16_t qury_bind_value_type_t;
+
+#define QURY_ResultAdaptive 0x00 /* pick per execution, see qury_set_result_mode */
+#define QURY_ResultStreaming 0x01
+#define QURY_ResultBuffered 0x02
+typedef uint8_t qury_result_mode_t;
+
+#define QURY_ErrNone 0x00
+#define QURY_ErrMemoryBudget 0x01 /* hard memory budget exceeded */
+#define QURY_ErrTimeout 0x02 /* deadline passed, see qury_set_deadline */
+typedef uint8_t qury_error_t;
 typedef uint16_t qury_bind_result_type_t;
 
 typedef size_t (*qury_data_callback)(uint8_t *buffer, size_t length);
 
+/* DECIMAL text is at most 65 digits, sign, point and nul */
+#define QURY_DECIMAL_SIZE 68
+#ifdef __SIZEOF_INT128__
+__extension__ typedef __int128 qury_decimal_int_t;
+#define QURY_DECIMAL_DIGITS 38
+#else
+typedef int64_t qury_decimal_int_t;
+#define QURY_DECIMAL_DIGITS 18
+#endif
+
+/**
+ * \brief Exact fixed-point value
+ *
+ * The value is \a mantissa / 10^\a scale. If the value has more significant
+ * digits than \ref QURY_DECIMAL_DIGITS, \a overflow is set and \a mantissa
+ * holds only the leading digits.
+ */
+typedef struct {
+  qury_decimal_int_t mantissa;
+  uint8_t scale;
+  bool overflow;
+} qury_decimal_t;
+
+/**
+ * \brief Memory accounting
+ *
+ * Bytes allocated by quaerimus for a statement (bound values, fetched values,
+ * result layout), or for all statements of a connection. Memory held by the
+ * client library, like a buffered result, is not counted. A limit of 0 means
+ * no limit, see \ref qury_set_memory_budget.
+ */
+typedef struct {
+  size_t current;
+  size_t peak;
+  uint64_t allocations;
+  size_t soft_limit;
+  size_t hard_limit;
+} qury_mem_t;
+
 typedef struct {
   MYSQL *mysql;
   char *current_db;
+  qury_mem_t mem; /* all statements of the connection */
 } qury_conn_t;
 
 typedef union {
@@ -46,6 +100,7 @@ typedef union {
   } ostr;
   bool b;
   MYSQL_TIME dt;
+  qury_decimal_t dec;
   qury_data_callback cb;
 } qury_bind_value_t;
 
@@ -67,9 +122,69 @@ typedef struct {
   bool is_unsigned;
   char error;
   size_t length;
+  size_t offset; /* position of the placeholder in the parsed query */
+  void *buffer;    /* owned storage, reused while big enough */
+  size_t capacity; /* size of buffer */
+  bool chunked;    /* over the memory budget, see qury_read_column */
+  bool lazy;       /* left in the row until first read, see qury_fetch */
 } qury_bind_t;
 
+/**
+ * \brief Named parameter description
+ *
+ * Used to pass a full set of parameters at once, see \ref qury_query_once.
+ * The list is terminated by an entry with a NULL name (\ref QURY_PARAM_END).
+ * Fields are the same as the arguments of \ref qury_stmt_bind.
+ */
+typedef struct {
+  const char *name;
+  quryptr_t ptr;
+  size_t vlen;
+  qury_bind_value_type_t type;
+} qury_param_t;
+
+#define QURY_PARAM_INT(n, v)                                                   \
+  ((qury_param_t){.name = (n), .ptr = (quryptr_t)(v), .type = QURY_Integer})
+#define QURY_PARAM_UINT(n, v)                                                  \
+  ((qury_param_t){                                                             \
+      .name = (n), .ptr = (quryptr_t)(v), .type = QURY_Integer | QURY_Unsigned})
+#define QURY_PARAM_FLOAT(n, v)                                                 \
+  ((qury_param_t){.name = (n), .ptr = QURY_DOUBLE((v)), .type = QURY_Float})
+#define QURY_PARAM_BOOL(n, v)                                                  \
+  ((qury_param_t){.name = (n), .ptr = (quryptr_t)(v), .type = QURY_Bool})
+#define QURY_PARAM_STR(n, v)                                                   \
+  ((qury_param_t){                                                             \
+      .name = (n), .ptr = (quryptr_t)(uintptr_t)(v), .type = QURY_CString})
+#define QURY_PARAM_BYTES(n, v, len)                                            \
+  ((qury_param_t){.name = (n),                                                 \
+                  .ptr = (quryptr_t)(uintptr_t)(v),                            \
+                  .vlen = (len),                                               \
+                  .type = QURY_OString})
+#define QURY_PARAM_DECIMAL(n, v)                                               \
+  ((qury_param_t){                                                             \
+      .name = (n), .ptr = (quryptr_t)(uintptr_t)(v), .type = QURY_Decimal})
+#define QURY_PARAM_NULL(n) ((qury_param_t){.name = (n), .type = QURY_Null})
+#define QURY_PARAM_END ((qury_param_t){0})
+
+/**
+ * \brief Row decode step
+ *
+ * What is left to do on a column after the client library fetched a row,
+ * see \ref qury_fetch. Fixed width columns are fetched in place and have no
+ * step.
+ */
+typedef struct {
+  uint8_t op;
+  uint32_t column;
+  qury_bind_t *bind;
+} qury_decode_op_t;
+
+struct qury_digest_s;
+struct qury_pipeline_s;
+struct qury_watchdog_s;
+
 typedef struct {
+  qury_conn_t *conn;
   MYSQL_STMT *stmt;
   char *query;
   size_t query_length;
@@ -80,15 +195,60 @@ typedef struct {
   array_t params;
 
   MYSQL_BIND *results;
+  qury_decode_op_t *plan; /* built with results, one step per column to decode */
+  size_t plan_ops;
+  size_t plan_fixed_bytes; /* row bytes of the columns without step */
   array_t fields;
   array_t values;
 
   bool result_bounded;
   bool params_bounded;
+  bool values_bounded; /* results buffers given to the client library */
   bool query_executed;
 
+  /* text protocol, see qury_query_once */
+  bool text_protocol;
+  MYSQL_RES *res;
+  struct qury_pipeline_s *pipeline; /* see quaerimus_pipeline.h */
+
+  /* multiple results, see qury_next_result and qury_batch_add */
+  bool out_params;
+  bool batch_pending;
+  char *batch;
+  size_t batch_length;
+  size_t batch_capacity;
+  unsigned int batch_count;
+
+  /* read/write splitting, see quaerimus_router.h */
+  uint8_t route;
+
+  /* result mode, see qury_set_result_mode */
+  qury_result_mode_t result_mode;
+  bool buffered; /* mode of the current execution */
+  bool result_pending;
+  uint64_t result_rows;
+  uint64_t result_bytes;
+  uint64_t executions;
+  uint64_t avg_result_bytes;
+  struct qury_digest_s *digest; /* query shape, see quaerimus_digest.h */
+
+  /* deadline, see qury_set_deadline */
+  uint32_t timeout_ms;
+  struct qury_watchdog_s *watchdog;
+  size_t watch;
+  bool deadline_armed;
+
+  /* memory accounting, see qury_set_memory_budget */
+  qury_mem_t mem;
+  size_t arena_bytes;
+  size_t meta_bytes;
+  bool chunked_columns;
+  bool over_soft_budget;
+  qury_error_t error;
+
   /* internal use */
-  void *allocator; /* arena for the stmt duration */
+  void *allocator;      /* arena for the stmt duration */
+  void *meta_allocator; /* arena for the prepared query and result layout */
 } qury_stmt_t;
 
 #define qury_error(conn) mysql_error((conn)->mysql)
@@ -142,7 +302,10 @@ bool qury_select_db(qury_conn_t *conn, const char *dbname);
 /**
  * \brief Reset statment
  *
- * Reset a statement so it can rebound and re-run.
+ * Reset a statement so it can rebound and re-run. Bound values and fetched
+ * data are released, the prepared query and the result layout (fields and
+ * result binding) are kept and reused by the next \ref qury_execute as long
+ * as the columns don't change.
  *
  * \param [in] stmt A prepared statement
  */
@@ -158,6 +321,33 @@ void qury_reset(qury_stmt_t *stmt);
  */
 void qury_free(qury_stmt_t *stmt);
 
+/**
+ * \brief Called by \ref qury_parse_params for each named parameter
+ *
+ * \a name is not nul terminated and only valid during the call, \a offset is
+ * the position of the '?' placeholder in the rewritten query. Return false to
+ * stop parsing.
+ */
+typedef bool (*qury_param_cb_t)(void *userptr, const char *name,
+                                size_t name_len, size_t offset);
+
+/**
+ * \brief Rewrite named parameters
+ *
+ * Replace each ":name" of \a query, in place, by a '?' placeholder and call
+ * \a cb for it. Quoted strings and escaped characters are left alone. This is
+ * the parser used by \ref qury_prepare, exposed for tools that generate code
+ * from queries.
+ *
+ * \param [in,out] query The query, modified in place
+ * \param [in,out] length Length of the query, updated
+ * \param [in] cb Callback, may be NULL
+ * \param [in] userptr Passed to \a cb
+ * \return True for success, false otherwise
+ */
+bool qury_parse_params(char *query, size_t *length, qury_param_cb_t cb,
+                       void *userptr);
+
 /**
  * \brief Prepare a statement
  *
@@ -166,6 +356,19 @@ void qury_free(qury_stmt_t *stmt);
  */
 
 bool qury_prepare(qury_stmt_t *stmt, const char *query, size_t length);
+
+/**
+ * \brief Move a statement to another connection
+ *
+ * The statement is closed on its connection and prepared again on \a conn,
+ * the parsed query, bound parameters and result layout are kept. Any pending
+ * result is discarded. The memory of the statement is accounted to \a conn.
+ *
+ * \param [in] stmt A statement
+ * \param [in] conn The new connection
+ * \return True for success, false otherwise
+ */
+bool qury_stmt_move(qury_stmt_t *stmt, qury_conn_t *conn);
 /**
  * \brief Bind a parameter to a statement
  *
@@ -173,6 +376,18 @@ bool qury_prepare(qury_stmt_t *stmt, const char *query, size_t length);
  * request is <em>SELECT * FROM t WHERE id = :id</em>, the \a name parameter
  * is <em>"id"</em>.
  *
+ * Strings and bytes are copied into a buffer owned by the parameter, reused
+ * by the next bind of the same parameter while it is big enough. With
+ * \ref QURY_Borrowed (\a qury_stmt_bind_str_ref, \a qury_stmt_bind_bytes_ref)
+ * nothing is copied, the caller keeps the value valid and unchanged until the
+ * statement is executed.
+ *
+ * A decimal is given by address (\a qury_stmt_bind_decimal) and sent as text
+ * formatted with \ref qury_decimal_format, binding one that overflowed
+ * fails.
+ *
+ * Rebinding a parameter updates its slot in place, the binds are only given
+ * again to the client library when a buffer or a type changed.
  */
 bool qury_stmt_bind(qury_stmt_t *stmt, const char *name, quryptr_t ptr,
                     size_t vlen, qury_bind_value_type_t type);
@@ -193,14 +408,290 @@ bool qury_execute(qury_stmt_t *stmt);
  * \brief Fetch the next row
  *
  * Fetch the next row and keep it ready to get value with \ref qury_get_value.
+ * Only the length of string and bytes values is read : a value is copied on
+ * its first access, into a per column buffer that only grows, and it is valid
+ * until the next fetch. Columns never read cost no copy.
  *
  * \param [in] stmt An execute prepared statement.
  * \return True while there is data, false otherwise
  */
 bool qury_fetch(qury_stmt_t *stmt);
 
+/**
+ * \brief Run a statement once through the text protocol
+ *
+ * Parse the named parameters of \a query the same way as \ref qury_prepare,
+ * bind \a params and send the query with a single \a mysql_real_query. Values
+ * are inlined client-side (strings escaped with \a mysql_real_escape_string,
+ * bytes as hexadecimal literal), so there is no prepare round trip and no
+ * server-side statement left behind. This is for statements that run only
+ * once, statements that are re-run should use \ref qury_prepare.
+ *
+ * The result is streamed, rows are read with \ref qury_fetch and the usual
+ * \a qury_get_* accessors. Values are valid until the next \ref qury_fetch.
+ *
+ * \param [in] stmt A statement created with \ref qury_new
+ * \param [in] query The query with named parameters
+ * \param [in] length Length of the query, 0 to use strlen
+ * \param [in] params Parameters terminated by \ref QURY_PARAM_END, can be
+ *                    NULL if the query has no parameter
+ * \return True for success, false otherwise
+ */
+bool qury_query_once(qury_stmt_t *stmt, const char *query, size_t length,
+                     const qury_param_t *params);
+
+/**
+ * \brief Prepare and execute in one round trip
+ *
+ * Parse the named parameters of \a query, bind \a params and send the
+ * prepare and the execute together with \a mariadb_stmt_execute_direct. The
+ * statement stays prepared, it can be rebound and run again with
+ * \ref qury_execute.
+ *
+ * Servers not supporting direct execution (MySQL, MariaDB before 10.2) and
+ * parameters bound with a data callback fall back to \ref qury_prepare then
+ * \ref qury_execute.
+ *
+ * \param [in] stmt A statement created with \ref qury_new
+ * \param [in] query The query with named parameters
+ * \param [in] length Length of the query, 0 to use strlen
+ * \param [in] params Parameters terminated by \ref QURY_PARAM_END, can be
+ *                    NULL if the query has no parameter
+ * \return True for success, false otherwise
+ */
+bool qury_prepare_execute(qury_stmt_t *stmt, const char *query, size_t length,
+                          const qury_param_t *params);
+
+/**
+ * \brief Set how results are read
+ *
+ * With \ref QURY_ResultStreaming rows are read from the server as
+ * \ref qury_fetch goes, the connection is busy until the last row is read.
+ * With \ref QURY_ResultBuffered the whole result is read on
+ * \ref qury_execute, the connection is free for other statements while
+ * iterating and \ref qury_num_rows and \ref qury_seek are available.
+ *
+ * \ref QURY_ResultAdaptive, the default, streams the first execution then
+ * buffers when the previous results of the statement were small (average
+ * below 64KiB) and streams otherwise.
+ *
+ * \param [in] stmt A statement
+ * \param [in] mode One of the QURY_Result* mode
+ */
+void qury_set_result_mode(qury_stmt_t *stmt, qury_result_mode_t mode);
+
+/**
+ * \brief Number of rows of the result
+ *
+ * For a buffered result, the number of rows in the result. For a streamed
+ * result, the number of rows fetched so far.
+ *
+ * \param [in] stmt An executed statement
+ * \return The number of rows
+ */
+uint64_t qury_num_rows(qury_stmt_t *stmt);
+
+/**
+ * \brief Move to the next result set
+ *
+ * A stored procedure can return several result sets, a batch returns one per
+ * statement. Columns and values are set up again for the new result, then
+ * rows are read with \ref qury_fetch as usual. Unread rows of the current
+ * result are discarded.
+ *
+ * After a \a CALL with OUT or INOUT parameters, one result holds their
+ * values, one row with a column per parameter : \ref qury_out_params is then
+ * true.
+ *
+ * \param [in] stmt An executed statement
+ * \return True if there is another result, false at the end or on error
+ */
+bool qury_next_result(qury_stmt_t *stmt);
+
+/**
+ * \brief Current result holds OUT parameters
+ *
+ * \param [in] stmt An executed statement
+ * \return True if the current result is the OUT parameters of a procedure
+ */
+static inline bool qury_out_params(qury_stmt_t *stmt) {
+  return stmt->out_params;
+}
+
+/**
+ * \brief Number of rows changed by the current statement
+ *
+ * \param [in] stmt An executed statement
+ * \return Affected rows, for the current result of a batch
+ */
+uint64_t qury_affected_rows(qury_stmt_t *stmt);
+
+/**
+ * \brief Add a statement to a batch
+ *
+ * Parameters are interpolated as with \ref qury_query_once and the statement
+ * is queued, nothing is sent until \ref qury_batch_execute. Once executed,
+ * results come in the order statements were added : the first one is
+ * current, the following ones are reached with \ref qury_next_result. A
+ * statement without result set (INSERT, UPDATE ...) still has its result,
+ * with no column, see \ref qury_affected_rows.
+ *
+ * \param [in] stmt A statement, used for the whole batch
+ * \param [in] query The query with named parameters
+ * \param [in] length The query length, 0 if nul terminated
+ * \param [in] params Parameters, terminated by \ref QURY_PARAM_END
+ * \return True for success, false otherwise
+ */
+bool qury_batch_add(qury_stmt_t *stmt, const char *query, size_t length,
+                    const qury_param_t *params);
+
+/**
+ * \brief Send a batch
+ *
+ * All queued statements are sent in a single multi-statement packet. The
+ * connection has multi-statements enabled until the last result is read.
+ *
+ * \param [in] stmt A statement with queued statements
+ * \return True if the first statement succeeded, false otherwise
+ */
+bool qury_batch_execute(qury_stmt_t *stmt);
+
+/**
+ * \brief Set the memory budget of a statement
+ *
+ * Over the \a soft budget, the adaptive result mode stops buffering results
+ * in the client. An allocation that would go over the \a hard budget fails,
+ * \ref qury_fetch then returns false and \ref qury_stmt_errno is
+ * \ref QURY_ErrMemoryBudget. With \a chunked, a string or bytes value that
+ * doesn't fit is not fetched instead : it has \a chunked set, its length but
+ * no data, and it is read in pieces with \ref qury_read_column.
+ *
+ * \param [in] stmt A statement
+ * \param [in] soft Soft budget in bytes, 0 for none
+ * \param [in] hard Hard budget in bytes, 0 for none
+ * \param [in] chunked Don't fail on values over the hard budget
+ */
+void qury_set_memory_budget(qury_stmt_t *stmt, size_t soft, size_t hard,
+                            bool chunked);
+
+/**
+ * \brief Set the memory budget of a connection
+ *
+ * Same as \ref qury_set_memory_budget, for the sum of all statements created
+ * on \a conn.
+ */
+void qury_conn_set_memory_budget(qury_conn_t *conn, size_t soft, size_t hard);
+
+/**
+ * \brief Bound the time of each execution
+ *
+ * On MariaDB, queries are sent as <em>SET STATEMENT max_statement_time=...
+ * FOR query</em> and the server stops them past the deadline. With a
+ * \a watchdog, an execution still running at its deadline is also killed
+ * from a side connection, which covers the time the server doesn't count,
+ * like waiting for a lock, and servers without max_statement_time. A
+ * streaming result is watched until it is read. The execution or the fetch
+ * then fails and \ref qury_stmt_errno is \ref QURY_ErrTimeout.
+ *
+ * A prepared statement is prepared again when the deadline changes. Batches
+ * have no deadline. A server or network that doesn't answer at all is
+ * bounded by the timeouts of the connection, see
+ * \ref qury_conn_set_timeouts.
+ *
+ * \param [in] stmt A statement
+ * \param [in] timeout_ms Time of an execution, 0 for none
+ * \param [in] watchdog Watchdog killing late executions, NULL for none, see
+ *                      quaerimus_deadline.h
+ * \return True for success, false if the statement can't be prepared again
+ */
+bool qury_set_deadline(qury_stmt_t *stmt, uint32_t timeout_ms,
+                       struct qury_watchdog_s *watchdog);
+
+/**
+ * \brief Set the network timeouts of a connection
+ *
+ * Before connecting. A read or write on the socket that takes longer fails
+ * and the connection is lost.
+ *
+ * \param [in] conn A connection, not connected yet
+ * \param [in] read_s Read timeout in seconds, 0 for none
+ * \param [in] write_s Write timeout in seconds, 0 for none
+ * \return True for success, false otherwise
+ */
+bool qury_conn_set_timeouts(qury_conn_t *conn, unsigned int read_s,
+                            unsigned int write_s);
+
+/**
+ * \brief Error of the last operation
+ *
+ * \param [in] stmt A statement
+ * \return One of the QURY_Err*, \ref QURY_ErrNone when the last failure came
+ *         from the server or client library (see \a mysql_stmt_errno)
+ */
+static inline qury_error_t qury_stmt_errno(qury_stmt_t *stmt) {
+  return stmt->error;
+}
+
+/**
+ * \brief Whether the result ended on an error
+ *
+ * \ref qury_fetch returns false at the end of the result as well as on a
+ * network or server error or a \ref qury_stmt_errno stop, this tells them
+ * apart once it did.
+ *
+ * \param [in] stmt A statement
+ * \return True if the last fetch failed
+ */
+static inline bool qury_fetch_failed(qury_stmt_t *stmt) {
+  if (stmt->error != QURY_ErrNone) {
+    return true;
+  }
+  return stmt->text_protocol ? mysql_errno(stmt->conn->mysql) != 0
+                             : mysql_stmt_errno(stmt->stmt) != 0;
+}
+
+/**
+ * \brief Index of a column
+ *
+ * \param [in] stmt An executed statement
+ * \param [in] name Column name or original name
+ * \return The index or -1 if not found
+ */
+int qury_field_index(qury_stmt_t *stmt, const char *name);
+
+/**
+ * \brief Read part of a value of the current row
+ *
+ * Copy up to \a length bytes of column \a column, from \a offset. This is
+ * how a \a chunked value is read, it works for any string or bytes value.
+ *
+ * \param [in] stmt A statement with a fetched row
+ * \param [in] column Column index, see \ref qury_field_index
+ * \param [in] offset Where to start in the value
+ * \param [out] buffer Destination
+ * \param [in] length Size of \a buffer
+ * \return Number of bytes copied, 0 at the end of the value or on error
+ */
+size_t qury_read_column(qury_stmt_t *stmt, size_t column, size_t offset,
+                        void *buffer, size_t length);
+
+/**
+ * \brief Move to a row of a buffered result
+ *
+ * The next \ref qury_fetch returns the row \a row (starting at 0).
+ *
+ * \param [in] stmt An executed statement with a buffered result
+ * \param [in] row The row number
+ * \return True for success, false if the result is not buffered or \a row
+ *         is out of range
+ */
+bool qury_seek(qury_stmt_t *stmt, uint64_t row);
+
 #define qury_stmt_bind_int(stmt, name, value)                                  \
   qury_stmt_bind((stmt), (name), (quryptr_t)(value), 0, QURY_Integer)
+#define qury_stmt_bind_uint(stmt, name, value)                                 \
+  qury_stmt_bind((stmt), (name), (quryptr_t)(value), 0,                        \
+                 QURY_Integer | QURY_Unsigned)
 #define qury_stmt_bind_float(stmt, name, value)                                \
   qury_stmt_bind((stmt), (name), QURY_DOUBLE((value)), 0, QURY_Float)
 #define qury_stmt_bind_bool(stmt, name, value)                                 \
@@ -209,6 +700,15 @@ bool qury_fetch(qury_stmt_t *stmt);
   qury_stmt_bind((stmt), (name), (quryptr_t)(value), 0, QURY_CString)
 #define qury_stmt_bind_bytes(stmt, name, value, len)                           \
   qury_stmt_bind((stmt), (name), (quryptr_t)(value), (len), QURY_OString)
+#define qury_stmt_bind_decimal(stmt, name, value)                              \
+  qury_stmt_bind((stmt), (name), (quryptr_t)(uintptr_t)(value), 0,            \
+                 QURY_Decimal)
+#define qury_stmt_bind_str_ref(stmt, name, value)                              \
+  qury_stmt_bind((stmt), (name), (quryptr_t)(value), 0,                        \
+                 QURY_CString | QURY_Borrowed)
+#define qury_stmt_bind_bytes_ref(stmt, name, value, len)                       \
+  qury_stmt_bind((stmt), (name), (quryptr_t)(value), (len),                    \
+                 QURY_OString | QURY_Borrowed)
 #define qury_stmt_bind_lstr(stmt, name, callback)                              \
   qury_stmt_bind((stmt), (name), (quryptr_t)(callback), 0,                     \
                  QURY_CString | QURY_DataCallback)
@@ -234,6 +734,46 @@ void qury_stmt_dump(FILE *fp, qury_stmt_t *stmt);
  */
 void qury_stmt_reset(qury_stmt_t *stmt);
 
+/**
+ * \brief Parse a decimal number
+ *
+ * Parse the decimal text \a s (as sent by the server, "-123.4500") into a
+ * mantissa and a scale. There is no allocation nor floating point involved.
+ *
+ * \param [in] s The text, doesn't need to be nul terminated
+ * \param [in] len Length of \a s
+ * \param [out] d The decimal
+ * \return True for success, false if \a s is not a decimal number
+ */
+bool qury_decimal_parse(const char *s, size_t len, qury_decimal_t *d);
+
+/**
+ * \brief Format a decimal number
+ *
+ * Write \a d as decimal text ("-123.4500"), as the server takes it for a
+ * DECIMAL parameter.
+ *
+ * \param [in] d The decimal
+ * \param [out] buf Destination, nul terminated
+ * \param [in] size Size of \a buf, \ref QURY_DECIMAL_SIZE fits any DECIMAL
+ * \return The length of the text, 0 if it doesn't fit or \a d overflowed
+ */
+size_t qury_decimal_format(qury_decimal_t d, char *buf, size_t size);
+
+/**
+ * \brief Convert a decimal to double
+ *
+ * \param [in] d The decimal
+ * \return The closest double, precision can be lost
+ */
+static inline double qury_decimal_to_double(qury_decimal_t d) {
+    double div = 1.0;
+    for (uint8_t i = 0; i < d.scale; i++) {
+        div *= 10.0;
+    }
+    return (double)d.mantissa / div;
+}
+
 /**
  * \brief Get a field value
  *
@@ -250,6 +790,18 @@ void qury_stmt_reset(qury_stmt_t *stmt);
  */
 qury_bind_t *qury_get_field_value(qury_stmt_t *stmt, const char *name);
 
+/**
+ * \brief Get a field value by index
+ *
+ * Same as \ref qury_get_field_value, for column \a column.
+ *
+ * \param [in] stmt The SQL statement, after \ref qury_fetch
+ * \param [in] column Column index, see \ref qury_field_index
+ * \return A pointer to the column of the current row, NULL if the column
+ *         doesn't exist or its value can't be read
+ */
+qury_bind_t *qury_get_column_value(qury_stmt_t *stmt, size_t column);
+
 /**
  * \brief Get a field value
  *
@@ -326,6 +878,7 @@ static inline uint64_t qury_get_int(qury_bind_t *v) {
  */
 static inline double qury_get_float(qury_bind_t *v) {
     if (!v || v->is_null) { return 0.0; }
+    if (v->type == QURY_Decimal) { return qury_decimal_to_double(v->value.dec); }
     return v->value.f;
 }
 
@@ -334,6 +887,21 @@ static inline bool qury_get_bool(qury_bind_t *v) {
     return v->value.b;
 }
 
+/**
+ * \brief Return column value as decimal
+ *
+ * Get the exact value of a DECIMAL column obtained by calling
+ * \ref qury_get_value.
+ *
+ * \param [in] v A pointer set by \ref qury_get_value. Can be NULL.
+ * \return A decimal, zero if NULL
+ * \see qury_get_value
+ */
+static inline qury_decimal_t qury_get_decimal(qury_bind_t *v) {
+    if (!v || v->is_null) { return (qury_decimal_t){0}; }
+    return v->value.dec;
+}
+
 /**
  * \warning This is not the definitive form for this function, may change
  * \todo Finish the datetime support
@@ -343,6 +911,91 @@ static inline MYSQL_TIME qury_get_datetime(qury_bind_t *v) {
     return v->value.dt;
 }
 
+/* days before the month, non leap year, index is the month (1-12) */
+static const int16_t _qury_days_before_month[13] = {
+    0, 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+
+/**
+ * \brief Convert a MYSQL_TIME to Unix epoch microseconds
+ *
+ * No libc time call, days are computed from a table. The time is taken as
+ * UTC. A TIME value (\a time_type is MYSQL_TIMESTAMP_TIME) gives the
+ * duration in microseconds.
+ *
+ * \param [in] t The time
+ * \return Microseconds since 1970-01-01 00:00:00 UTC
+ */
+static inline int64_t qury_time_to_epoch_us(const MYSQL_TIME *t) {
+    int64_t us = ((int64_t)t->hour * 3600 + (int64_t)t->minute * 60
+                  + (int64_t)t->second)
+                     * 1000000
+                 + (int64_t)t->second_part;
+    if (t->time_type == MYSQL_TIMESTAMP_TIME) {
+        return t->neg ? -us : us;
+    }
+    int64_t y = t->year;
+    /* shifted by a 400 years cycle (146097 days) so year 0 stays positive */
+    int64_t yy = y + 399;
+    int64_t leap = ((y & 3) == 0) & (((y % 100) != 0) | ((y % 400) == 0));
+    int64_t days = yy * 365 + yy / 4 - yy / 100 + yy / 400 - 146097
+                   + _qury_days_before_month[t->month > 12 ? 0 : t->month]
+                   + (leap & (t->month > 2)) + (int64_t)t->day - 1 - 719162;
+    return days * 86400000000LL + us;
+}
+
+/**
+ * \brief Convert MYSQL_TIME to Unix epoch microseconds, in batch
+ *
+ * Same as \ref qury_time_to_epoch_us for \a n values at once, the
+ * arithmetic is done on several values per instruction when the compiler
+ * supports vector extensions.
+ *
+ * \param [in] t The times
+ * \param [in] n Number of times
+ * \param [out] out Microseconds since epoch, \a n values
+ */
+void qury_time_to_epoch_us_batch(const MYSQL_TIME *t, size_t n, int64_t *out);
+
+/**
+ * \brief Fetch a datetime column as Unix epoch microseconds
+ *
+ * Fetch up to \a n rows and convert the column \a name of each row with
+ * \ref qury_time_to_epoch_us_batch. The current row after the call is the
+ * last one fetched.
+ *
+ * \param [in] stmt An executed statement
+ * \param [in] name Column name
+ * \param [out] out Microseconds since epoch, 0 for NULL
+ * \param [out] is_null Set to true for NULL values, can be NULL
+ * \param [in] n Size of \a out (and \a is_null)
+ * \return The number of rows fetched, less than \a n at the end of the
+ *         result
+ */
+size_t qury_fetch_epoch_us(qury_stmt_t *stmt, const char *name, int64_t *out,
+                           bool *is_null, size_t n);
+
+/**
+ * \brief Return column value as Unix epoch microseconds
+ *
+ * \param [in] v A pointer set by \ref qury_get_value. Can be NULL.
+ * \return Microseconds since 1970-01-01 00:00:00 UTC, 0 if NULL
+ * \see qury_time_to_epoch_us
+ */
+static inline int64_t qury_get_epoch_us(qury_bind_t *v) {
+    if (!v || v->is_null) { return 0; }
+    return qury_time_to_epoch_us(&v->value.dt);
+}
+
+static inline int64_t qury_get_epoch_ms(qury_bind_t *v) {
+    int64_t us = qury_get_epoch_us(v);
+    return us >= 0 ? us / 1000 : -((999 - us) / 1000);
+}
+
+static inline int64_t qury_get_epoch(qury_bind_t *v) {
+    int64_t us = qury_get_epoch_us(v);
+    return us >= 0 ? us / 1000000 : -((999999 - us) / 1000000);
+}
+
 static inline bool qury_is_null(qury_bind_t *v) {
     if (!v || v->is_null) { return true; }
     return false;
@@ -0,0 +1,80 @@
+#ifndef QUAERIMUS_DEADLINE_H__
+#define QUAERIMUS_DEADLINE_H__ 1
+
+#include "quaerimus.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#define QURY_WATCHDOG_SLOTS 256 /* executions watched at once */
+#define QURY_WATCH_NONE SIZE_MAX
+
+typedef struct {
+  uint64_t deadline_ns; /* CLOCK_MONOTONIC */
+  unsigned long thread_id;
+  bool armed;
+  bool fired;   /* KILL QUERY sent */
+  bool killing; /* KILL QUERY being sent */
+} qury_watch_t;
+
+/**
+ * \brief Cancellation of the executions over their deadline
+ *
+ * A thread sends <em>KILL QUERY</em> on a side connection for each execution
+ * still running at its deadline, see \ref qury_set_deadline. The server then
+ * stops the query and the blocked client gets an error. One watchdog serves
+ * any number of statements and connections, of the same server and user.
+ */
+typedef struct qury_watchdog_s {
+  qury_conn_t *side; /* only used by the thread */
+  pthread_t thread;
+  bool stop;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;   /* armed or stopped */
+  pthread_cond_t killed; /* a KILL QUERY is done */
+  qury_watch_t watches[QURY_WATCHDOG_SLOTS];
+  size_t used; /* watches after it are free */
+
+  /* statistics */
+  uint64_t kills;
+  uint64_t unwatched; /* no free slot */
+} qury_watchdog_t;
+
+/**
+ * \brief Start a watchdog
+ *
+ * \param [in] w The watchdog
+ * \param [in] side A connected connection, not used by anything else
+ * \return True for success, false otherwise
+ */
+bool qury_watchdog_init(qury_watchdog_t *w, qury_conn_t *side);
+
+/**
+ * \brief Stop the watchdog
+ *
+ * No statement must be executing with it.
+ */
+void qury_watchdog_shutdown(qury_watchdog_t *w);
+
+/**
+ * \brief Watch an execution
+ *
+ * \param [in] w The watchdog
+ * \param [in] thread_id Server thread of the connection, mysql_thread_id
+ * \param [in] timeout_ms Time left
+ * \return The watch, \ref QURY_WATCH_NONE if all slots are taken
+ */
+size_t qury_watchdog_arm(qury_watchdog_t *w, unsigned long thread_id,
+                         uint32_t timeout_ms);
+
+/**
+ * \brief Stop watching an execution
+ *
+ * Waits for a KILL QUERY being sent, so it can't reach a later query of the
+ * connection.
+ *
+ * \return True if the execution was killed
+ */
+bool qury_watchdog_disarm(qury_watchdog_t *w, size_t watch);
+
+#endif /* QUAERIMUS_DEADLINE_H__ */
@@ -0,0 +1,124 @@
+#ifndef QUAERIMUS_DIGEST_H__
+#define QUAERIMUS_DIGEST_H__ 1
+
+#include "quaerimus.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define QURY_DIGEST_SHARDS 16
+#define QURY_DIGEST_SLOTS 256 /* per shard, a power of 2 */
+#define QURY_DIGEST_TEXT_SIZE 256
+
+typedef uint8_t qury_digest_order_t;
+
+#define QURY_DigestByTime 0x00
+#define QURY_DigestByCalls 0x01
+#define QURY_DigestByRows 0x02
+#define QURY_DigestByMaxTime 0x03
+
+/**
+ * \brief Statistics of a query shape
+ *
+ * Queries are normalized when they are parsed : literals and named
+ * parameters become ?, whitespace and comments are collapsed, IN lists are
+ * reduced to one element, words are lower case. Queries with the same
+ * normalized text share a digest, found by the 64 bits fingerprint of the
+ * text. Digests live for the whole process.
+ */
+typedef struct qury_digest_s {
+  _Atomic uint64_t fingerprint; /* 0 for a free slot */
+  atomic_bool ready;            /* text is set */
+  char text[QURY_DIGEST_TEXT_SIZE]; /* normalized query, may be truncated */
+
+  _Atomic uint64_t calls;
+  _Atomic uint64_t errors;
+  _Atomic uint64_t total_ns; /* time in qury_execute */
+  _Atomic uint64_t max_ns;
+  _Atomic uint64_t rows; /* fetched */
+  _Atomic uint64_t bytes;
+} qury_digest_t;
+
+/**
+ * \brief Copy of the statistics of a digest, see \ref qury_digest_top
+ */
+typedef struct {
+  uint64_t fingerprint;
+  const char *text;
+  uint64_t calls;
+  uint64_t errors;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t rows;
+  uint64_t bytes;
+} qury_digest_stat_t;
+
+/**
+ * \brief Turn digests on or off
+ *
+ * Off by default. Statements prepared while it is on are accounted.
+ */
+void qury_digest_enable(bool on);
+
+bool qury_digest_enabled(void);
+
+/**
+ * \brief Normalize a query
+ *
+ * \param [in] query The query
+ * \param [in] length The query length, 0 if nul terminated
+ * \param [out] text Normalized text, truncated to \a size, can be NULL
+ * \param [in] size Size of \a text
+ * \return The fingerprint, never 0
+ */
+uint64_t qury_digest_fingerprint(const char *query, size_t length, char *text,
+                                 size_t size);
+
+/**
+ * \brief Digest of a query, created if needed
+ *
+ * Lock-free, from any thread.
+ *
+ * \return The digest, NULL if the table is full
+ */
+qury_digest_t *qury_digest_lookup(const char *query, size_t length);
+
+/**
+ * \brief Account an execution
+ */
+void qury_digest_record(qury_digest_t *d, uint64_t ns, bool ok);
+
+/**
+ * \brief Account the rows of a result
+ */
+void qury_digest_add_rows(qury_digest_t *d, uint64_t rows, uint64_t bytes);
+
+/**
+ * \brief Digests with the highest value of \a order
+ *
+ * \param [out] out Statistics, ordered
+ * \param [in] n Size of \a out
+ * \param [in] order One of the QURY_DigestBy*
+ * \return Number of digests set in \a out
+ */
+size_t qury_digest_top(qury_digest_stat_t *out, size_t n,
+                       qury_digest_order_t order);
+
+/**
+ * \brief Print the top \a n digests
+ */
+void qury_digest_report(FILE *f, size_t n, qury_digest_order_t order);
+
+/**
+ * \brief Reset the statistics
+ *
+ * Digests are kept. Counts of executions running meanwhile may be lost.
+ */
+void qury_digest_reset(void);
+
+/**
+ * \brief Number of queries not accounted because the table was full
+ */
+uint64_t qury_digest_dropped(void);
+
+#endif /* QUAERIMUS_DIGEST_H__ */
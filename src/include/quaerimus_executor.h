@@ -0,0 +1,172 @@
+#ifndef QUAERIMUS_EXECUTOR_H__
+#define QUAERIMUS_EXECUTOR_H__ 1
+
+#include "quaerimus.h"
+#include "quaerimus_registry.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define QURY_EXECUTOR_MAX 64
+#define QURY_EXECUTOR_IDLE_MS 5 /* idle workers look for work to steal */
+
+struct qury_request_s;
+
+/* called on the worker thread with the executed statement to read the rows */
+typedef bool (*qury_request_rows_cb)(struct qury_request_s *req,
+                                     qury_stmt_t *stmt);
+/* called on the worker thread once the request is done */
+typedef void (*qury_request_done_cb)(struct qury_request_s *req);
+
+/**
+ * \brief Executor request
+ *
+ * Owned by the caller, it must stay valid, with \a params, until it is
+ * completed. Without \a on_done the completed request is put in the
+ * completion queue of the executor, see \ref qury_executor_poll.
+ */
+typedef struct qury_request_s {
+  _Atomic(struct qury_request_s *) next; /* internal, queue link */
+  int stmt_id;                  /* from the registry of the executor */
+  const qury_param_t *params;   /* ended by QURY_PARAM_END, may be NULL,
+                                 * parameters left out are NULL */
+  qury_request_rows_cb on_rows; /* NULL to discard the rows */
+  qury_request_done_cb on_done;
+  void *userptr;
+
+  /* result */
+  bool ok;
+  uint64_t affected_rows;
+  int worker;       /* which ran the request */
+  atomic_bool done; /* see qury_group_wait */
+} qury_request_t;
+
+/**
+ * \brief Intrusive multi-producer single-consumer queue
+ *
+ * Producers never lock (Vyukov queue). \a consuming lets a worker steal from
+ * another queue: a consumer that can't take the flag moves on.
+ */
+typedef struct {
+  _Atomic(qury_request_t *) head;
+  qury_request_t *tail;
+  qury_request_t stub;
+  atomic_flag consuming;
+} qury_mpsc_t;
+
+void qury_mpsc_init(qury_mpsc_t *q);
+
+/**
+ * \brief Queue a request, from any thread
+ */
+void qury_mpsc_push(qury_mpsc_t *q, qury_request_t *req);
+
+/**
+ * \brief Dequeue a request
+ *
+ * \return The oldest request, or NULL if the queue is empty or another
+ *         thread is dequeuing
+ */
+qury_request_t *qury_mpsc_take(qury_mpsc_t *q);
+
+struct qury_executor_s;
+
+typedef struct {
+  struct qury_executor_s *owner;
+  size_t index;
+  qury_conn_t *conn;
+  qury_registry_conn_t stmts;
+  qury_mpsc_t queue;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  atomic_bool sleeping;
+
+  /* statistics, written by the worker */
+  uint64_t executed;
+  uint64_t stolen;
+} qury_worker_t;
+
+/**
+ * \brief Query executor
+ *
+ * Each worker thread owns a connection and its statements, prepared from a
+ * \ref qury_registry_t. Any thread can submit requests, they go to the queue
+ * of a worker and idle workers steal from the others.
+ */
+typedef struct qury_executor_s {
+  qury_registry_t *registry;
+  qury_worker_t workers[QURY_EXECUTOR_MAX];
+  size_t nworkers;
+  atomic_size_t next; /* round robin */
+  atomic_bool stop;
+  atomic_size_t submitting; /* submits past the stop check */
+
+  /* completed requests without on_done */
+  qury_mpsc_t completions;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  atomic_int waiters;
+} qury_executor_t;
+
+/**
+ * \brief Start an executor
+ *
+ * One worker per connection. Workers prepare the registry on their
+ * connection when they start, the registry must not change afterwards.
+ *
+ * \param [in] ex The executor
+ * \param [in] registry Statements available to requests
+ * \param [in] conns Connected connections, owned by the workers until
+ *                   \ref qury_executor_shutdown
+ * \param [in] n Number of connections, at most \ref QURY_EXECUTOR_MAX
+ * \return True for success, false otherwise
+ */
+bool qury_executor_init(qury_executor_t *ex, qury_registry_t *registry,
+                        qury_conn_t **conns, size_t n);
+
+/**
+ * \brief Stop the workers
+ *
+ * Requests not executed yet are completed with \a ok set to false, submits
+ * from other threads fail once it has begun. Connections are not closed.
+ */
+void qury_executor_shutdown(qury_executor_t *ex);
+
+/**
+ * \brief Submit a request
+ *
+ * \param [in] ex The executor
+ * \param [in] req The request
+ * \return True for success, false if the executor is stopped
+ */
+bool qury_executor_submit(qury_executor_t *ex, qury_request_t *req);
+
+/**
+ * \brief Submit a request to a given worker
+ *
+ * Same as \ref qury_executor_submit, for affinity. The request can still be
+ * stolen by an idle worker.
+ */
+bool qury_executor_submit_to(qury_executor_t *ex, size_t worker,
+                             qury_request_t *req);
+
+/**
+ * \brief Take a completed request
+ *
+ * \return A request, or NULL if none is completed
+ */
+qury_request_t *qury_executor_poll(qury_executor_t *ex);
+
+/**
+ * \brief Wait for a completed request
+ *
+ * \param [in] ex The executor
+ * \param [in] timeout_ms How long to wait at most
+ * \return A request, or NULL on timeout
+ */
+qury_request_t *qury_executor_wait(qury_executor_t *ex,
+                                   unsigned int timeout_ms);
+
+#endif /* QUAERIMUS_EXECUTOR_H__ */
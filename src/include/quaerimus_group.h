@@ -0,0 +1,95 @@
+#ifndef QUAERIMUS_GROUP_H__
+#define QUAERIMUS_GROUP_H__ 1
+
+#include "quaerimus.h"
+#include "quaerimus_executor.h"
+#include "quaerimus_registry.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define QURY_GROUP_RETRIES 3 /* transaction replays after a deadlock */
+
+/**
+ * \brief Group commit
+ *
+ * Writes submitted by many threads are flushed by one thread, in a single
+ * transaction and a single round trip when possible: the pending statements
+ * and a COMMIT are sent as one multi-statement batch. A flush starts when
+ * \a max_batch writes are pending or the oldest has waited \a max_delay_us.
+ *
+ * Each write gets its own result. A write failing with a statement error
+ * fails alone, the others of the transaction still commit. On a deadlock the
+ * transaction is replayed. A client error (lost connection) fails every
+ * write of the transaction.
+ */
+typedef struct {
+  qury_conn_t *conn;
+  qury_registry_t *registry;
+  qury_stmt_t *stmt;
+  qury_mpsc_t queue;
+  size_t max_batch;
+  unsigned int max_delay_us;
+
+  atomic_size_t pending;
+  _Atomic uint64_t first_ns; /* submission time of the oldest pending write */
+  atomic_bool stop;
+  atomic_size_t submitting; /* submits past the stop check */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;      /* wakes the flusher */
+  pthread_cond_t done_cond; /* wakes qury_group_wait */
+  qury_request_t **items;
+
+  /* statistics, written by the flusher */
+  uint64_t flushes;
+  uint64_t writes;
+  uint64_t round_trips;
+  uint64_t replays;
+} qury_group_t;
+
+/**
+ * \brief Start a group commit flusher
+ *
+ * The flusher owns \a conn until \ref qury_group_shutdown, autocommit is
+ * turned off on it.
+ *
+ * \param [in] g The group
+ * \param [in] conn A connected connection
+ * \param [in] registry Statements available to writes, by id
+ * \param [in] max_batch Flush when that many writes are pending
+ * \param [in] max_delay_us Flush when the oldest write waited that long
+ * \return True for success, false otherwise
+ */
+bool qury_group_init(qury_group_t *g, qury_conn_t *conn,
+                     qury_registry_t *registry, size_t max_batch,
+                     unsigned int max_delay_us);
+
+/**
+ * \brief Flush what is pending and stop the flusher
+ *
+ * Submits from other threads fail once it has begun.
+ */
+void qury_group_shutdown(qury_group_t *g);
+
+/**
+ * \brief Submit a write
+ *
+ * \a stmt_id and \a params of \a req give the statement, \a on_rows is not
+ * used. When done, \a on_done is called from the flusher thread, or without
+ * it \a done is set, see \ref qury_group_wait.
+ *
+ * \param [in] g The group
+ * \param [in] req The write, valid until done
+ * \return True for success, false if the group is stopped
+ */
+bool qury_group_submit(qury_group_t *g, qury_request_t *req);
+
+/**
+ * \brief Wait for a write without \a on_done
+ *
+ * \return The result of the write, \a affected_rows is set on success
+ */
+bool qury_group_wait(qury_group_t *g, qury_request_t *req);
+
+#endif /* QUAERIMUS_GROUP_H__ */
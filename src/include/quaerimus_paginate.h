@@ -0,0 +1,125 @@
+#ifndef QUAERIMUS_PAGINATE_H__
+#define QUAERIMUS_PAGINATE_H__ 1
+
+#include "quaerimus.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#define QURY_PAGINATE_NAME_SIZE 64
+
+typedef struct {
+  qury_stmt_t *stmt;
+  pthread_t thread;
+  bool running; /* prefetch started and not joined */
+  bool ok;      /* execution result */
+} qury_page_t;
+
+/**
+ * \brief Keyset pagination
+ *
+ * Pages of a query are read as one stream of rows. The query has an
+ * \a :after_key and a \a :limit parameter and is sorted on the key column,
+ * like <em>SELECT ... WHERE id > :after_key ORDER BY id LIMIT :limit</em>.
+ * Each page starts after the last key of the previous one, the cost of a
+ * page doesn't grow with the pages before it as it does with OFFSET.
+ *
+ * Pages are buffered. With a second connection, page N+1 is executed by a
+ * thread while page N is read.
+ */
+typedef struct {
+  qury_page_t pages[2]; /* the page being read and the next one */
+  size_t current;
+  bool prefetch; /* one connection per page */
+
+  char key[QURY_PAGINATE_NAME_SIZE];
+  size_t limit;
+
+  /* last key of the current page, bound as :after_key of the next one */
+  qury_bind_value_type_t key_type;
+  quryptr_t key_value;
+  char *key_buffer;
+  size_t key_length;
+  size_t key_capacity;
+
+  bool active;    /* started and rows left */
+  bool last_page; /* the current page is short, nothing after it */
+  bool failed;
+
+  /* statistics */
+  uint64_t rows;
+  uint64_t page_count;
+  uint64_t prefetched;
+} qury_paginate_t;
+
+/**
+ * \brief Prepare a keyset pagination
+ *
+ * \param [in] p The pagination
+ * \param [in] conn A connection
+ * \param [in] prefetch_conn Another connection to prefetch the next page,
+ *                           NULL to execute pages one after the other on
+ *                           \a conn
+ * \param [in] query The query, with \a :after_key and \a :limit parameters
+ * \param [in] length Length of \a query, 0 to use strlen
+ * \param [in] key Name of the key column in the result
+ * \param [in] limit Rows per page
+ * \return True for success, false otherwise
+ */
+bool qury_paginate_init(qury_paginate_t *p, qury_conn_t *conn,
+                        qury_conn_t *prefetch_conn, const char *query,
+                        size_t length, const char *key, size_t limit);
+
+/**
+ * \brief Wait for a prefetch and free the statements
+ */
+void qury_paginate_free(qury_paginate_t *p);
+
+/**
+ * \brief Bind another parameter of the query
+ *
+ * Same as \ref qury_stmt_bind, for all the pages. Values are copied, they
+ * must not use \ref QURY_Borrowed. Takes effect on the next
+ * \ref qury_paginate_start.
+ */
+bool qury_paginate_bind(qury_paginate_t *p, const char *name, quryptr_t ptr,
+                        size_t vlen, qury_bind_value_type_t type);
+
+/**
+ * \brief Execute the first page
+ *
+ * \param [in] p The pagination
+ * \param [in] ptr The first \a :after_key, see \ref qury_stmt_bind
+ * \param [in] vlen Length of \a ptr for bytes
+ * \param [in] type Type of the key, integer, float, string or bytes
+ * \return True for success, false otherwise
+ */
+bool qury_paginate_start(qury_paginate_t *p, quryptr_t ptr, size_t vlen,
+                         qury_bind_value_type_t type);
+
+/**
+ * \brief Fetch the next row
+ *
+ * Moves to the next page at the end of a page.
+ *
+ * \param [in] p A started pagination
+ * \return True while there are rows, false at the end or if a page failed
+ *         (\a failed is set)
+ */
+bool qury_paginate_fetch(qury_paginate_t *p);
+
+/**
+ * \brief Statement of the current row
+ *
+ * Values are read from it with \ref qury_get_value, until the next
+ * \ref qury_paginate_fetch.
+ */
+static inline qury_stmt_t *qury_paginate_stmt(qury_paginate_t *p) {
+  return p->pages[p->current].stmt;
+}
+
+static inline bool qury_paginate_get_value(qury_paginate_t *p,
+                                           const char *name, qury_bind_t **v) {
+  return qury_get_value(qury_paginate_stmt(p), name, v);
+}
+
+#endif /* QUAERIMUS_PAGINATE_H__ */
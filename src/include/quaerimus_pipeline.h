@@ -0,0 +1,102 @@
+#ifndef QUAERIMUS_PIPELINE_H__
+#define QUAERIMUS_PIPELINE_H__ 1
+
+#include "quaerimus.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define QURY_PIPELINE_SLOTS 64 /* default ring depth */
+
+/**
+ * \brief Raw row copied by the reader
+ *
+ * Values are nul terminated, as in a MYSQL_ROW.
+ */
+typedef struct {
+  char **row;
+  unsigned long *lengths;
+  char *data; /* values of the row, one after the other */
+  size_t capacity;
+} qury_row_slot_t;
+
+/**
+ * \brief Pipelined fetch
+ *
+ * A reader thread takes the rows of a streaming text protocol result from
+ * the connection and copies them to a ring of slots. \ref qury_fetch takes
+ * them from the ring and decodes them, so the network wait of the next rows
+ * overlaps the decoding and the processing of the current one.
+ *
+ * While it runs, the connection belongs to the reader : nothing else must
+ * use it until the result is read or the pipeline is stopped. Slots are
+ * allocated with malloc and not accounted in the memory budget.
+ */
+typedef struct qury_pipeline_s {
+  qury_stmt_t *stmt;
+  pthread_t thread;
+  bool running; /* started and not joined */
+
+  qury_row_slot_t *slots;
+  size_t count;
+  int columns;
+
+  /* single producer, single consumer */
+  _Atomic size_t head; /* next slot written by the reader */
+  _Atomic size_t tail; /* next slot read by the consumer */
+  bool holding;        /* the consumer still uses the slot at tail */
+  atomic_bool stop;
+  atomic_bool done; /* the reader won't write more rows */
+  bool failed;      /* the reader stopped on an error */
+
+  pthread_mutex_t lock;
+  pthread_cond_t not_full;
+  pthread_cond_t not_empty;
+  atomic_bool reader_waiting;
+  atomic_bool consumer_waiting;
+
+  /* statistics */
+  uint64_t rows;
+  uint64_t reader_waits;   /* ring full, decoding is the bottleneck */
+  uint64_t consumer_waits; /* ring empty, the network is the bottleneck */
+} qury_pipeline_t;
+
+/**
+ * \brief Read the current result through a reader thread
+ *
+ * The statement must have been executed with the text protocol
+ * (\ref qury_query_once) in \ref QURY_ResultStreaming mode, before its first
+ * \ref qury_fetch. Rows are then fetched as usual, values stay valid until
+ * the next \ref qury_fetch. The pipeline stops at the end of the result.
+ *
+ * \param [in] p The pipeline, kept by the caller until it stops
+ * \param [in] stmt The statement
+ * \param [in] slots Rows read ahead, 0 for \ref QURY_PIPELINE_SLOTS
+ * \return True for success, false otherwise, the statement is then fetched
+ *         without a pipeline
+ */
+bool qury_pipeline_start(qury_pipeline_t *p, qury_stmt_t *stmt, size_t slots);
+
+/**
+ * \brief Stop the reader and free the slots
+ *
+ * Waits for the row being read. Rows left on the connection are skipped
+ * when the result is freed. Statistics are kept. Called by the statement at
+ * the end of the result, when it is executed again or freed.
+ */
+void qury_pipeline_stop(qury_pipeline_t *p);
+
+/**
+ * \brief Next row of the ring
+ *
+ * For \ref qury_fetch. Gives the slot of the previous row back to the
+ * reader and waits for the next one.
+ *
+ * \param [in] p A started pipeline
+ * \param [out] lengths Lengths of the values
+ * \return The row, NULL at the end of the result or on error (\a failed is
+ *         set)
+ */
+char **qury_pipeline_next(qury_pipeline_t *p, unsigned long **lengths);
+
+#endif /* QUAERIMUS_PIPELINE_H__ */
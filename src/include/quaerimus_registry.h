@@ -0,0 +1,147 @@
+#ifndef QUAERIMUS_REGISTRY_H__
+#define QUAERIMUS_REGISTRY_H__ 1
+
+#include "quaerimus.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#define QURY_RegistryEager 0x00      /* prepare everything on attach */
+#define QURY_RegistryBackground 0x01 /* prepare in a thread until first use */
+#define QURY_RegistryLazy 0x02       /* prepare on first use */
+typedef uint8_t qury_registry_mode_t;
+
+typedef struct {
+  char *name;
+  char *query;
+} qury_registry_entry_t;
+
+/**
+ * \brief Statement registry
+ *
+ * Named statements registered once at startup, then prepared on each
+ * connection by \ref qury_registry_attach. The registry must not change
+ * once connections are attached.
+ */
+typedef struct {
+  qury_registry_entry_t *entries;
+  size_t count;
+  size_t capacity;
+} qury_registry_t;
+
+/**
+ * \brief Statements of the registry on a connection
+ */
+typedef struct {
+  qury_registry_t *registry;
+  qury_conn_t *conn;
+  qury_stmt_t **stmts; /* by id, NULL until prepared */
+  size_t count;
+  qury_registry_mode_t mode;
+
+  /* background preparation */
+  pthread_t thread;
+  bool running; /* started and not joined */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool stop;      /* under lock */
+  bool busy;      /* a request uses the connection, under lock */
+  bool preparing; /* the thread uses the connection, under lock */
+  bool done;      /* the thread tried every statement, under lock */
+
+  /* statistics */
+  uint64_t prepare_ns; /* time spent in qury_prepare */
+  size_t prepared;
+  size_t failed;
+} qury_registry_conn_t;
+
+/**
+ * \brief Initialize an empty registry
+ */
+void qury_registry_init(qury_registry_t *reg);
+
+/**
+ * \brief Free a registry
+ *
+ * Attached connections must be detached first.
+ */
+void qury_registry_free(qury_registry_t *reg);
+
+/**
+ * \brief Register a statement
+ *
+ * \param [in] reg The registry
+ * \param [in] name A unique name
+ * \param [in] query The query, with named parameters
+ * \return The statement id or -1 in case of failure
+ */
+int qury_registry_add(qury_registry_t *reg, const char *name,
+                      const char *query);
+
+/**
+ * \brief Find a statement id by name
+ *
+ * \return The statement id or -1 if unknown
+ */
+int qury_registry_find(qury_registry_t *reg, const char *name);
+
+/**
+ * \brief Prepare the registry on a connection
+ *
+ * With \ref QURY_RegistryEager every statement is prepared before returning.
+ * With \ref QURY_RegistryBackground a thread prepares them while the
+ * connection is idle: a connection can't be used by two threads, so
+ * \ref qury_registry_stmt pauses it, after the statement being prepared, and
+ * \ref qury_registry_release lets it go on. A statement not prepared yet is
+ * prepared by the request itself, like with \ref QURY_RegistryLazy.
+ *
+ * \param [in] reg The registry
+ * \param [in] conn A connected connection
+ * \param [out] rc The statements of the connection
+ * \param [in] mode How to prepare
+ * \return True for success, false otherwise. A statement failing to prepare
+ *         is not an error here, it is counted in \a failed and tried again
+ *         on first use.
+ */
+bool qury_registry_attach(qury_registry_t *reg, qury_conn_t *conn,
+                          qury_registry_conn_t *rc, qury_registry_mode_t mode);
+
+/**
+ * \brief Get a prepared statement
+ *
+ * The connection belongs to the caller until \ref qury_registry_release.
+ *
+ * \param [in] rc The statements of a connection
+ * \param [in] id A statement id
+ * \return The statement, or NULL if it can't be prepared
+ */
+qury_stmt_t *qury_registry_stmt(qury_registry_conn_t *rc, int id);
+
+/**
+ * \brief Give the connection back to the background preparation
+ *
+ * Once the result of the statement is read. Without it the background
+ * thread stays paused after the first request, and the statements left are
+ * prepared on first use. Does nothing in the other modes.
+ *
+ * \param [in] rc The statements of a connection
+ */
+void qury_registry_release(qury_registry_conn_t *rc);
+
+/**
+ * \brief Prepare again after a reconnection
+ *
+ * Statements don't survive a new session, they are freed and the registry is
+ * prepared again with the mode given to \ref qury_registry_attach.
+ *
+ * \return True for success, false otherwise
+ */
+bool qury_registry_reconnect(qury_registry_conn_t *rc);
+
+/**
+ * \brief Free the statements of a connection
+ *
+ * The connection is not closed.
+ */
+void qury_registry_detach(qury_registry_conn_t *rc);
+
+#endif /* QUAERIMUS_REGISTRY_H__ */
@@ -0,0 +1,157 @@
+#ifndef QUAERIMUS_ROUTER_H__
+#define QUAERIMUS_ROUTER_H__ 1
+
+#include "quaerimus.h"
+#include <stdint.h>
+
+#define QURY_RouteAuto 0x00    /* from the statement, see qury_query_is_read_only */
+#define QURY_RouteReplica 0x01 /* read-only, may run on a replica */
+#define QURY_RoutePrimary 0x02 /* always on the primary */
+typedef uint8_t qury_route_t;
+
+#define QURY_ROUTER_MAX_REPLICAS 16
+/* "domain-server-seq", 3 integers up to 20 digits */
+#define QURY_GTID_SIZE 64
+
+/**
+ * \brief Replica state
+ *
+ * \a seq is the last sequence number of \a domain known to be applied on the
+ * replica, it saves a round trip when the replica is already known to be
+ * recent enough.
+ */
+typedef struct {
+  qury_conn_t *conn;
+  uint32_t domain;
+  uint64_t seq;
+  bool known;
+} qury_replica_t;
+
+/**
+ * \brief Read/write splitting
+ *
+ * Writes go to the primary, read-only statements to the replicas. After a
+ * write, the GTID of the session is remembered and reads only go to a replica
+ * which has applied it (read-your-writes), otherwise to the primary.
+ *
+ * A router is a session: like a connection it must not be used by several
+ * threads at once.
+ */
+typedef struct {
+  qury_conn_t *primary;
+  qury_replica_t replicas[QURY_ROUTER_MAX_REPLICAS];
+  size_t nreplicas;
+  size_t next; /* round robin */
+
+  /* last GTID written by the session */
+  char gtid[QURY_GTID_SIZE];
+  uint32_t domain;
+  uint64_t seq;
+  bool has_gtid;
+
+  bool tracking;        /* last_gtid is sent with the OK packets */
+  unsigned int wait_ms; /* wait for a replica to catch up, 0 to skip it */
+
+  /* statistics */
+  uint64_t primary_reads; /* reads sent to the primary, no replica was recent */
+  uint64_t replica_reads;
+  uint64_t waits;
+} qury_router_t;
+
+/**
+ * \brief Initialize a router
+ *
+ * Ask the primary to track \a last_gtid in the session state, when the server
+ * doesn't support it the GTID is read with a query after each write.
+ *
+ * \param [in] r The router
+ * \param [in] primary A connected primary
+ * \return True for success, false otherwise
+ */
+bool qury_router_init(qury_router_t *r, qury_conn_t *primary);
+
+/**
+ * \brief Add a replica
+ *
+ * \param [in] r The router
+ * \param [in] conn A connected replica
+ * \return True for success, false if there are already
+ *         \ref QURY_ROUTER_MAX_REPLICAS replicas
+ */
+bool qury_router_add_replica(qury_router_t *r, qury_conn_t *conn);
+
+/**
+ * \brief Set how long to wait for a lagging replica
+ *
+ * With \a wait_ms set, a read waits up to \a wait_ms milliseconds for a
+ * replica to apply the session GTID (MASTER_GTID_WAIT). With 0, the default,
+ * a lagging replica is skipped. When no replica is recent enough the read
+ * goes to the primary.
+ */
+static inline void qury_router_set_wait(qury_router_t *r,
+                                        unsigned int wait_ms) {
+  r->wait_ms = wait_ms;
+}
+
+/**
+ * \brief Check if a query is read-only
+ *
+ * SELECT, SHOW, DESCRIBE, EXPLAIN, WITH, VALUES and TABLE statements are
+ * read-only unless they lock (FOR UPDATE, LOCK IN SHARE MODE), write
+ * (INTO) or call a function changing the session or a sequence (GET_LOCK,
+ * LAST_INSERT_ID, NEXTVAL, NEXT VALUE FOR...). Anything else is a write.
+ * Comments are skipped, except executable ones.
+ *
+ * \param [in] query The query, with named parameters or placeholders
+ * \param [in] length Length of \a query, 0 to use strlen
+ * \return True if the query can run on a replica
+ */
+bool qury_query_is_read_only(const char *query, size_t length);
+
+/**
+ * \brief Prepare a routed statement
+ *
+ * Same as \ref qury_new and \ref qury_prepare on the connection picked for
+ * \a route. With \ref QURY_RouteAuto the route is given by
+ * \ref qury_query_is_read_only. The statement may move to another
+ * connection on execution, see \ref qury_stmt_move.
+ *
+ * \param [in] r The router
+ * \param [in] query The query
+ * \param [in] length Length of \a query, 0 to use strlen
+ * \param [in] route \ref QURY_RouteAuto, \ref QURY_RouteReplica or
+ *                   \ref QURY_RoutePrimary
+ * \param [in] allocator_userptr The context of the allocator, see qury_new
+ * \return A new statement or NULL in case of failure
+ */
+qury_stmt_t *qury_router_prepare(qury_router_t *r, const char *query,
+                                 size_t length, qury_route_t route,
+                                 void *allocator_userptr);
+
+/**
+ * \brief Execute a routed statement
+ *
+ * A read runs on a replica which has applied the last GTID of the session, a
+ * write runs on the primary and its GTID is recorded.
+ *
+ * Other statements on the same connections must not have a pending result,
+ * checking a replica needs a query.
+ *
+ * \param [in] r The router
+ * \param [in] stmt A statement from \ref qury_router_prepare
+ * \return True for success, false otherwise
+ */
+bool qury_router_execute(qury_router_t *r, qury_stmt_t *stmt);
+
+/**
+ * \brief Record the GTID of the last write on the primary
+ *
+ * Called by \ref qury_router_execute, call it after a write made directly on
+ * the primary connection (COMMIT of a transaction for instance).
+ *
+ * \param [in] r The router
+ * \return True for success, false otherwise
+ */
+bool qury_router_track(qury_router_t *r);
+
+#endif /* QUAERIMUS_ROUTER_H__ */
@@ -0,0 +1,150 @@
+#ifndef QUAERIMUS_SCATTER_H__
+#define QUAERIMUS_SCATTER_H__ 1
+
+#include "quaerimus.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#define QURY_SCATTER_MAX 64
+#define QURY_SCATTER_NAME_SIZE 64
+
+struct qury_scatter_s;
+
+typedef struct {
+  struct qury_scatter_s *owner;
+  qury_stmt_t *stmt;
+  int64_t lo; /* partition [lo, hi) */
+  int64_t hi;
+  pthread_t thread;
+  bool running; /* thread started and not joined */
+  bool ok;      /* execution result, valid once done */
+  bool done;
+} qury_scatter_part_t;
+
+/**
+ * \brief Scatter-gather query
+ *
+ * The same query runs on several connections, each on a part of a range
+ * given by the \a :lo and \a :hi parameters (\a lo included, \a hi
+ * excluded). Parts are executed by worker threads and buffered, rows are then
+ * read with \ref qury_scatter_fetch in the calling thread.
+ *
+ * Without an order column, rows come part after part in the order the parts
+ * finish. With one, parts are merged on it (k-way merge), each part must be
+ * sorted by the same column with ORDER BY. Strings are merged in byte order,
+ * so a string order column must have a binary or _bin collation, the fetch
+ * fails otherwise.
+ */
+typedef struct qury_scatter_s {
+  qury_scatter_part_t parts[QURY_SCATTER_MAX];
+  size_t nparts;
+
+  /* parts in the order they finish */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t finished[QURY_SCATTER_MAX];
+  size_t nfinished;
+  size_t consumed; /* finished parts read, unordered mode */
+
+  /* merge, see qury_scatter_execute */
+  char order_by[QURY_SCATTER_NAME_SIZE];
+  int order_column; /* index of order_by, -1 for an unordered stream */
+  bool descending;
+  bool order_pad; /* PAD SPACE collation of a string order column */
+  size_t heap[QURY_SCATTER_MAX];
+  size_t heap_size;
+
+  bool started; /* first row fetched */
+  bool failed;  /* a part failed, the result is incomplete */
+  size_t current; /* part of the current row */
+} qury_scatter_t;
+
+/**
+ * \brief Prepare a scatter-gather query
+ *
+ * One statement per connection, the query must have \a :lo and \a :hi
+ * parameters on the split key, like
+ * <em>WHERE id >= :lo AND id < :hi</em>.
+ *
+ * \param [in] s The scatter-gather query
+ * \param [in] conns Connections, one part each
+ * \param [in] n Number of connections, at most \ref QURY_SCATTER_MAX
+ * \param [in] query The query
+ * \param [in] length Length of \a query, 0 to use strlen
+ * \return True for success, false otherwise
+ */
+bool qury_scatter_init(qury_scatter_t *s, qury_conn_t **conns, size_t n,
+                       const char *query, size_t length);
+
+/**
+ * \brief Wait for the parts and free the statements
+ */
+void qury_scatter_free(qury_scatter_t *s);
+
+/**
+ * \brief Bind a parameter on every part
+ *
+ * Same as \ref qury_stmt_bind, for the parameters other than \a lo and
+ * \a hi.
+ */
+bool qury_scatter_bind(qury_scatter_t *s, const char *name, quryptr_t ptr,
+                       size_t vlen, qury_bind_value_type_t type);
+
+/**
+ * \brief Split the range and execute the parts
+ *
+ * The range [\a lo, \a hi) is split into equal parts, one per connection,
+ * executed concurrently. Results are buffered on the client.
+ *
+ * \param [in] s The scatter-gather query
+ * \param [in] lo First key
+ * \param [in] hi Last key + 1
+ * \param [in] order_by Column to merge on, NULL for an unordered stream
+ * \param [in] descending The parts are sorted in descending order
+ * \return True if the parts are started, false otherwise
+ */
+bool qury_scatter_execute(qury_scatter_t *s, int64_t lo, int64_t hi,
+                          const char *order_by, bool descending);
+
+/**
+ * \brief Move to the next row
+ *
+ * Same as \ref qury_fetch. Returns false at the end or when a part failed,
+ * check \a failed to know.
+ *
+ * \param [in] s The scatter-gather query
+ * \return True while there is data, false otherwise
+ */
+bool qury_scatter_fetch(qury_scatter_t *s);
+
+/**
+ * \brief Statement of the current row
+ *
+ * The current row can be read with the usual accessors on it, like
+ * \ref qury_get_value.
+ */
+static inline qury_stmt_t *qury_scatter_stmt(qury_scatter_t *s) {
+  return s->parts[s->current].stmt;
+}
+
+/**
+ * \brief Get a field value of the current row
+ *
+ * Same as \ref qury_get_field_value.
+ */
+static inline qury_bind_t *qury_scatter_get_field_value(qury_scatter_t *s,
+                                                        const char *name) {
+  return qury_get_field_value(qury_scatter_stmt(s), name);
+}
+
+/**
+ * \brief Get a field value of the current row
+ *
+ * Same as \ref qury_get_value.
+ */
+static inline bool qury_scatter_get_value(qury_scatter_t *s, const char *name,
+                                          qury_bind_t **v) {
+  return qury_get_value(qury_scatter_stmt(s), name, v);
+}
+
+#endif /* QUAERIMUS_SCATTER_H__ */
@@ -0,0 +1,163 @@
+#ifndef QUAERIMUS_SHARD_H__
+#define QUAERIMUS_SHARD_H__ 1
+
+#include "quaerimus.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define QURY_SHARD_MAX 64
+#define QURY_SHARD_NAME_SIZE 32
+#define QURY_SHARD_VNODES 128    /* virtual nodes for a weight of 1 */
+#define QURY_SHARD_CACHE_SIZE 64 /* prepared statements per shard, power of 2 */
+
+typedef struct {
+  uint64_t hash;
+  uint32_t shard;
+} qury_vnode_t;
+
+/**
+ * \brief Consistent hash ring
+ *
+ * Virtual nodes sorted by hash, a key belongs to the first node with a hash
+ * greater or equal. A ring is never modified once published.
+ */
+typedef struct qury_ring_s {
+  size_t nvnodes;
+  qury_vnode_t vnodes[];
+} qury_ring_t;
+
+typedef struct {
+  uint64_t hash;
+  char *query; /* copy of the caller string */
+  qury_stmt_t *stmt;
+  uint32_t users; /* not released yet, see qury_shard_release */
+} qury_shard_cached_t;
+
+typedef struct {
+  char name[QURY_SHARD_NAME_SIZE];
+  qury_conn_t *conn;
+  uint32_t weight; /* 0 takes the shard out of the ring */
+  qury_shard_cached_t cache[QURY_SHARD_CACHE_SIZE];
+} qury_shard_t;
+
+/**
+ * \brief Shard map
+ *
+ * Statements are sent to the shard owning the value of the named parameter
+ * \a key. Adding a shard or changing a weight builds a new ring and publishes
+ * it atomically: lookups never lock and only the keys of the changed shard
+ * move. The writer then waits for the lookups still using the previous ring
+ * and frees it.
+ *
+ * Lookups (\ref qury_shard_lookup) can run from any thread while the map is
+ * changed. Statements follow the rules of their connection, see
+ * \ref qury_shard_stmt.
+ */
+typedef struct {
+  char key[QURY_SHARD_NAME_SIZE];
+  qury_shard_t shards[QURY_SHARD_MAX];
+  _Atomic size_t nshards;
+  _Atomic(qury_ring_t *) ring;
+  atomic_uint epoch;        /* parity of the readers counting lookups */
+  atomic_size_t readers[2]; /* lookups running */
+  pthread_mutex_t lock;     /* between writers only */
+} qury_shard_map_t;
+
+/**
+ * \brief Initialize a shard map
+ *
+ * \param [in] m The map
+ * \param [in] key Name of the shard key parameter, without colon
+ * \return True for success, false otherwise
+ */
+bool qury_shard_map_init(qury_shard_map_t *m, const char *key);
+
+/**
+ * \brief Free the cached statements and the rings
+ *
+ * Statements not released are freed too. Connections are not closed.
+ */
+void qury_shard_map_free(qury_shard_map_t *m);
+
+/**
+ * \brief Add a shard
+ *
+ * The name places the shard on the ring, the same names give the same key
+ * placement in every process whatever the order of the calls.
+ *
+ * \param [in] m The map
+ * \param [in] name A unique name
+ * \param [in] conn A connection to the shard
+ * \param [in] weight Relative weight, 0 to add it out of the ring
+ * \return The shard index or -1 in case of failure
+ */
+int qury_shard_add(qury_shard_map_t *m, const char *name, qury_conn_t *conn,
+                   uint32_t weight);
+
+/**
+ * \brief Change the weight of a shard
+ *
+ * With 0 the shard leaves the ring and its keys move to the other shards,
+ * the cached statements stay until \ref qury_shard_map_free.
+ *
+ * \return True for success, false otherwise
+ */
+bool qury_shard_set_weight(qury_shard_map_t *m, int shard, uint32_t weight);
+
+/**
+ * \brief Hash a shard key
+ *
+ * Integers are mixed with splitmix64, strings and bytes hashed with FNV-1a
+ * then mixed.
+ *
+ * \param [in] p The key, same as a \ref qury_param_t
+ * \return The key position on the ring
+ */
+uint64_t qury_shard_hash(const qury_param_t *p);
+
+/**
+ * \brief Find the shard of a hash
+ *
+ * \param [in] m The map
+ * \param [in] hash From \ref qury_shard_hash
+ * \return The shard index or -1 if the ring is empty
+ */
+int qury_shard_lookup(qury_shard_map_t *m, uint64_t hash);
+
+/**
+ * \brief Get a statement on the right shard
+ *
+ * Find the shard of the \a key parameter in \a params, get the statement for
+ * \a query from the cache of the shard (prepared the first time) and bind
+ * \a params. The statement is ready for \ref qury_execute and stays owned
+ * by the map.
+ *
+ * The statement stays valid until it is given back with
+ * \ref qury_shard_release, the cache only replaces statements not in use.
+ * When all of them are, the statement is prepared without being cached and
+ * freed by \ref qury_shard_release.
+ *
+ * The cache uses the text of \a query as a key. Statements of a shard use
+ * its connection, so calls for the same map are made by one thread at a
+ * time.
+ *
+ * \param [in] m The map
+ * \param [in] query The query
+ * \param [in] params Parameters, must include the shard key
+ * \return The statement or NULL in case of failure
+ */
+qury_stmt_t *qury_shard_stmt(qury_shard_map_t *m, const char *query,
+                             const qury_param_t *params);
+
+/**
+ * \brief Give back a statement of \ref qury_shard_stmt
+ *
+ * Once its result is read. The statement must not be used afterwards.
+ *
+ * \param [in] m The map
+ * \param [in] stmt The statement, NULL is ignored
+ */
+void qury_shard_release(qury_shard_map_t *m, qury_stmt_t *stmt);
+
+#endif /* QUAERIMUS_SHARD_H__ */
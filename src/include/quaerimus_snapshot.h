@@ -0,0 +1,141 @@
+#ifndef QUAERIMUS_SNAPSHOT_H__
+#define QUAERIMUS_SNAPSHOT_H__ 1
+
+#include "quaerimus.h"
+#include <stdint.h>
+
+#define QURY_SNAPSHOT_MAGIC "QURYSNP"
+#define QURY_SNAPSHOT_VERSION 2
+
+/**
+ * \brief Snapshot file header
+ *
+ * All offsets are from the start of the file and aligned on 16 bytes. The
+ * file is written in the host byte order.
+ */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t ncols;
+  uint64_t nrows;
+  uint64_t size; /* whole file */
+  uint64_t names_offset;
+  uint64_t names_size; /* nul terminated column names */
+  uint64_t reserved[2];
+} qury_snapshot_header_t;
+
+/**
+ * \brief Snapshot column descriptor
+ *
+ * Fixed width columns have \a width bytes per row at \a data_offset.
+ * Strings and bytes have \a nrows + 1 uint64_t offsets into the heap at
+ * \a data_offset, each value is followed by a nul byte in the heap. The null
+ * bitmap has a bit set for each NULL row.
+ */
+typedef struct {
+  qury_bind_value_type_t type;
+  uint8_t is_unsigned;
+  uint8_t reserved;
+  uint32_t name_offset; /* from names_offset */
+  uint32_t width;
+  uint32_t reserved2;
+  uint64_t nulls_offset;
+  uint64_t data_offset;
+  uint64_t heap_offset;
+  uint64_t heap_size;
+} qury_snapshot_column_t;
+
+typedef struct {
+  const uint8_t *map;
+  size_t size;
+  const qury_snapshot_header_t *header;
+  const qury_snapshot_column_t *columns;
+  const char **names;
+  qury_bind_t *values;
+  uint64_t row; /* next row to fetch */
+} qury_snapshot_t;
+
+/**
+ * \brief Write a result to a snapshot file
+ *
+ * Fetch every remaining row of an executed statement and write them column
+ * by column to \a path. The file is written aside then renamed, so readers
+ * never see a partial file. Values over the memory budget are read with
+ * \ref qury_read_column.
+ *
+ * \param [in] stmt An executed statement
+ * \param [in] path Destination file
+ * \return True for success, false otherwise
+ */
+bool qury_snapshot_write(qury_stmt_t *stmt, const char *path);
+
+/**
+ * \brief Open a snapshot file
+ *
+ * The file is mapped read-only, values point into the mapping so processes
+ * opening the same file share the page cache copy.
+ *
+ * \param [in] path The snapshot file
+ * \return A snapshot or NULL in case of failure or invalid file
+ */
+qury_snapshot_t *qury_snapshot_open(const char *path);
+
+/**
+ * \brief Unmap and free a snapshot
+ *
+ * \param [in] snap A snapshot
+ */
+void qury_snapshot_close(qury_snapshot_t *snap);
+
+static inline uint64_t qury_snapshot_num_rows(qury_snapshot_t *snap) {
+  return snap->header->nrows;
+}
+
+/**
+ * \brief Move to the next row
+ *
+ * Same as \ref qury_fetch, values are then available with
+ * \ref qury_snapshot_get_value and the usual \a qury_get_* accessors.
+ *
+ * \param [in] snap A snapshot
+ * \return True while there is data, false otherwise
+ */
+bool qury_snapshot_fetch(qury_snapshot_t *snap);
+
+/**
+ * \brief Move to a row
+ *
+ * The next \ref qury_snapshot_fetch returns the row \a row (starting at 0).
+ *
+ * \param [in] snap A snapshot
+ * \param [in] row The row number
+ * \return True for success, false if out of range
+ */
+bool qury_snapshot_seek(qury_snapshot_t *snap, uint64_t row);
+
+/**
+ * \brief Get a field value of the current row
+ *
+ * Same as \ref qury_get_field_value on a snapshot.
+ */
+qury_bind_t *qury_snapshot_get_field_value(qury_snapshot_t *snap,
+                                           const char *name);
+
+/**
+ * \brief Get a field value of the current row
+ *
+ * Same as \ref qury_get_value on a snapshot.
+ */
+static inline bool qury_snapshot_get_value(qury_snapshot_t *snap,
+                                           const char *name, qury_bind_t **v) {
+  assert(v != NULL);
+  *v = NULL;
+  qury_bind_t *_v = qury_snapshot_get_field_value(snap, name);
+  if (!_v || _v->type == QURY_Null || _v->is_null) {
+    return false;
+  }
+  *v = _v;
+  return true;
+}
+
+#endif /* QUAERIMUS_SNAPSHOT_H__ */
@@ -0,0 +1,46 @@
+#ifndef QUAERIMUS_TRACE_H__
+#define QUAERIMUS_TRACE_H__ 1
+
+/**
+ * \brief Static tracing probes
+ *
+ * Built with QURY_USDT (make USDT=1), the QURY_TRACE* macros are USDT probes
+ * of the \a quaerimus provider, see sys/sdt.h. A probe is a nop until a
+ * tracer (perf, bpftrace) attaches to it. Without QURY_USDT they compile to
+ * nothing and their arguments are not evaluated.
+ *
+ * Probes, arguments in order :
+ * - prepare__start : stmt, query, length
+ * - prepare__done : stmt, ok
+ * - execute__start : stmt, query, length, also for the direct execution of
+ *   qury_prepare_execute (no prepare__* probes then)
+ * - execute__done : stmt, ok, rows buffered by the client (0 when streaming)
+ * - fetch__start : stmt
+ * - fetch__done : stmt, ok, rows fetched so far, bytes fetched so far
+ * - long__data : stmt, parameter index, bytes sent
+ */
+
+#if defined(QURY_USDT) && QURY_USDT
+#include <sys/sdt.h>
+
+#define QURY_TRACE1(name, a) DTRACE_PROBE1(quaerimus, name, a)
+#define QURY_TRACE2(name, a, b) DTRACE_PROBE2(quaerimus, name, a, b)
+#define QURY_TRACE3(name, a, b, c) DTRACE_PROBE3(quaerimus, name, a, b, c)
+#define QURY_TRACE4(name, a, b, c, d)                                          \
+  DTRACE_PROBE4(quaerimus, name, a, b, c, d)
+#else
+#define QURY_TRACE1(name, a)                                                   \
+  do {                                                                         \
+  } while (0)
+#define QURY_TRACE2(name, a, b)                                                \
+  do {                                                                         \
+  } while (0)
+#define QURY_TRACE3(name, a, b, c)                                             \
+  do {                                                                         \
+  } while (0)
+#define QURY_TRACE4(name, a, b, c, d)                                          \
+  do {                                                                         \
+  } while (0)
+#endif
+
+#endif /* QUAERIMUS_TRACE_H__ */
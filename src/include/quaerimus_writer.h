@@ -0,0 +1,49 @@
+#ifndef QUAERIMUS_WRITER_H__
+#define QUAERIMUS_WRITER_H__ 1
+
+#include "quaerimus.h"
+#include <stdint.h>
+
+#define QURY_WRITER_BUFFER_SIZE (64 * 1024)
+
+#define QURY_FormatJSONLines 0x01 /* one JSON object per line */
+#define QURY_FormatJSONArray 0x02 /* a single JSON array of objects */
+#define QURY_FormatCSV 0x03       /* RFC 4180, header line then rows */
+typedef uint8_t qury_format_t;
+
+/**
+ * \brief Output of \ref qury_write_results
+ *
+ * When \a write is NULL, data is written to the file descriptor \a fd.
+ * Otherwise \a write is called with \a userptr and must return false on
+ * error.
+ */
+typedef struct {
+  int fd;
+  bool (*write)(void *userptr, const void *buffer, size_t length);
+  void *userptr;
+} qury_writer_t;
+
+#define QURY_WRITER_FD(f) ((qury_writer_t){.fd = (f)})
+
+/**
+ * \brief Serialize a result
+ *
+ * Fetch every remaining row of an executed statement and write them in
+ * \a format to \a writer. Output is buffered (\ref QURY_WRITER_BUFFER_SIZE),
+ * there is no allocation per row.
+ *
+ * Integers and decimals are written exactly, doubles with 17 significant
+ * digits (non finite values are null), datetimes as "YYYY-MM-DD hh:mm:ss"
+ * with microseconds when not zero. In JSON, binary columns are base64
+ * strings and NULL is null, in CSV NULL is an empty field.
+ *
+ * \param [in] stmt An executed statement
+ * \param [in] format One of the QURY_Format*
+ * \param [in] writer Where to write
+ * \return The number of rows written or -1 on error
+ */
+int64_t qury_write_results(qury_stmt_t *stmt, qury_format_t format,
+                           qury_writer_t *writer);
+
+#endif /* QUAERIMUS_WRITER_H__ */
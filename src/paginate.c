@@ -0,0 +1,228 @@
+#include "include/quaerimus_paginate.h"
+#include "include/quaerimus.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void *_paginate_worker(void *arg) {
+    qury_page_t *page = arg;
+    mysql_thread_init();
+    page->ok = qury_execute(page->stmt);
+    mysql_thread_end();
+    return NULL;
+}
+
+static void _paginate_join(qury_page_t *page) {
+    if (page->running) {
+        pthread_join(page->thread, NULL);
+        page->running = false;
+    }
+}
+
+bool qury_paginate_init(qury_paginate_t *p, qury_conn_t *conn,
+                        qury_conn_t *prefetch_conn, const char *query,
+                        size_t length, const char *key, size_t limit) {
+    assert(p != NULL);
+    assert(conn != NULL);
+    assert(query != NULL);
+    assert(key != NULL);
+
+    memset(p, 0, sizeof(*p));
+    if (strlen(key) >= sizeof(p->key)) {
+        fprintf(stderr, "qury_paginate_init : key name too long\n");
+        return false;
+    }
+    if (limit == 0) {
+        fprintf(stderr, "qury_paginate_init : empty pages\n");
+        return false;
+    }
+    strcpy(p->key, key);
+    p->limit = limit;
+    p->prefetch = prefetch_conn != NULL && prefetch_conn != conn;
+
+    for (size_t i = 0; i < 2; i++) {
+        qury_page_t *page = &p->pages[i];
+        page->stmt = qury_new(i == 1 && p->prefetch ? prefetch_conn : conn,
+                              NULL);
+        if (!page->stmt) {
+            qury_paginate_free(p);
+            return false;
+        }
+        /* the key of the last row is read before the rows */
+        qury_set_result_mode(page->stmt, QURY_ResultBuffered);
+        if (!qury_prepare(page->stmt, query, length)
+            || !qury_stmt_bind(page->stmt, "limit", (quryptr_t)limit, 0,
+                               QURY_Integer)) {
+            qury_paginate_free(p);
+            return false;
+        }
+    }
+    return true;
+}
+
+void qury_paginate_free(qury_paginate_t *p) {
+    if (!p) {
+        return;
+    }
+    for (size_t i = 0; i < 2; i++) {
+        _paginate_join(&p->pages[i]);
+        if (p->pages[i].stmt) {
+            qury_free(p->pages[i].stmt);
+            p->pages[i].stmt = NULL;
+        }
+    }
+    free(p->key_buffer);
+    p->key_buffer = NULL;
+    p->key_capacity = 0;
+    p->active = false;
+}
+
+bool qury_paginate_bind(qury_paginate_t *p, const char *name, quryptr_t ptr,
+                        size_t vlen, qury_bind_value_type_t type) {
+    assert(p != NULL);
+    for (size_t i = 0; i < 2; i++) {
+        /* a prefetch may still use it */
+        _paginate_join(&p->pages[i]);
+        if (!qury_stmt_bind(p->pages[i].stmt, name, ptr, vlen, type)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* copy the key of the last row, the current row goes back to the first */
+static bool _paginate_last_key(qury_paginate_t *p, qury_stmt_t *stmt,
+                               uint64_t rows) {
+    int column = qury_field_index(stmt, p->key);
+    if (column < 0) {
+        fprintf(stderr, "qury_paginate : no key column %s\n", p->key);
+        return false;
+    }
+    if (!qury_seek(stmt, rows - 1) || !qury_fetch(stmt)) {
+        return false;
+    }
+    qury_bind_t *v = qury_get_column_value(stmt, (size_t)column);
+    if (!v || qury_is_null(v)) {
+        fprintf(stderr, "qury_paginate : NULL key %s\n", p->key);
+        return false;
+    }
+    p->key_type = v->type & ~QURY_Flags;
+    switch (p->key_type) {
+        case QURY_Integer:
+            p->key_value = (quryptr_t)v->value.i;
+            break;
+        case QURY_Float:
+            p->key_value = QURY_DOUBLE(v->value.f);
+            break;
+        case QURY_CString:
+        case QURY_OString: {
+            if (v->length + 1 > p->key_capacity) {
+                char *tmp = realloc(p->key_buffer, v->length + 1);
+                if (!tmp) {
+                    return false;
+                }
+                p->key_buffer = tmp;
+                p->key_capacity = v->length + 1;
+            }
+            const void *data = p->key_type == QURY_CString
+                                   ? (const void *)v->value.cstr
+                                   : (const void *)v->value.ostr.ptr;
+            memcpy(p->key_buffer, data, v->length);
+            p->key_buffer[v->length] = '\0';
+            p->key_length = v->length;
+            p->key_value = (quryptr_t)(uintptr_t)p->key_buffer;
+        } break;
+        default:
+            fprintf(stderr, "qury_paginate : unsupported type for key %s\n",
+                    p->key);
+            return false;
+    }
+    return qury_seek(stmt, 0);
+}
+
+/* bind the last key to the other page and, with a second connection,
+ * execute it while this one is read */
+static bool _paginate_next(qury_paginate_t *p) {
+    qury_page_t *next = &p->pages[p->current ^ 1];
+    if (!qury_stmt_bind(next->stmt, "after_key", p->key_value, p->key_length,
+                        p->key_type)) {
+        return false;
+    }
+    if (p->prefetch
+        && pthread_create(&next->thread, NULL, _paginate_worker, next) == 0) {
+        next->running = true;
+        p->prefetched++;
+    }
+    return true;
+}
+
+/* the current page is executed, look at its size and prepare the next */
+static bool _paginate_enter(qury_paginate_t *p) {
+    qury_page_t *page = &p->pages[p->current];
+    _paginate_join(page);
+    if (!page->ok) {
+        return false;
+    }
+    p->page_count++;
+    uint64_t rows = qury_num_rows(page->stmt);
+    p->last_page = rows < p->limit;
+    if (p->last_page) {
+        return true;
+    }
+    return _paginate_last_key(p, page->stmt, rows) && _paginate_next(p);
+}
+
+bool qury_paginate_start(qury_paginate_t *p, quryptr_t ptr, size_t vlen,
+                         qury_bind_value_type_t type) {
+    assert(p != NULL);
+
+    for (size_t i = 0; i < 2; i++) {
+        _paginate_join(&p->pages[i]);
+    }
+    p->current = 0;
+    p->active = false;
+    p->failed = false;
+    p->last_page = false;
+    p->key_length = 0;
+
+    qury_page_t *page = &p->pages[0];
+    if (!qury_stmt_bind(page->stmt, "after_key", ptr, vlen, type)) {
+        return false;
+    }
+    page->ok = qury_execute(page->stmt);
+    if (!_paginate_enter(p)) {
+        p->failed = true;
+        return false;
+    }
+    p->active = true;
+    return true;
+}
+
+bool qury_paginate_fetch(qury_paginate_t *p) {
+    assert(p != NULL);
+
+    while (p->active) {
+        if (qury_fetch(p->pages[p->current].stmt)) {
+            p->rows++;
+            return true;
+        }
+        if (p->last_page) {
+            break;
+        }
+        p->current ^= 1;
+        qury_page_t *page = &p->pages[p->current];
+        if (!page->running) {
+            /* no prefetch, executed now */
+            page->ok = qury_execute(page->stmt);
+        }
+        if (!_paginate_enter(p)) {
+            p->failed = true;
+            break;
+        }
+    }
+    p->active = false;
+    return false;
+}
@@ -0,0 +1,225 @@
+#include "include/quaerimus_pipeline.h"
+#include "include/quaerimus.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _PIPELINE_SLOT_SIZE 256
+
+/* copy the values of a row after each other, nul terminated */
+static bool _pipeline_copy(qury_row_slot_t *slot, MYSQL_ROW row,
+                           unsigned long *lengths, int columns) {
+    size_t need = 0;
+    for (int i = 0; i < columns; i++) {
+        need += row[i] ? lengths[i] + 1 : 0;
+    }
+    if (need > slot->capacity) {
+        size_t capacity =
+            slot->capacity > 0 ? slot->capacity : _PIPELINE_SLOT_SIZE;
+        while (capacity < need) {
+            capacity *= 2;
+        }
+        char *tmp = realloc(slot->data, capacity);
+        if (!tmp) {
+            return false;
+        }
+        slot->data = tmp;
+        slot->capacity = capacity;
+    }
+
+    char *w = slot->data;
+    for (int i = 0; i < columns; i++) {
+        slot->lengths[i] = lengths[i];
+        if (!row[i]) {
+            slot->row[i] = NULL;
+            continue;
+        }
+        memcpy(w, row[i], lengths[i]);
+        w[lengths[i]] = '\0';
+        slot->row[i] = w;
+        w += lengths[i] + 1;
+    }
+    return true;
+}
+
+/* wait for a free slot, false when stopped */
+static bool _pipeline_wait_slot(qury_pipeline_t *p, size_t head) {
+    if (head - atomic_load(&p->tail) < p->count) {
+        return true;
+    }
+    p->reader_waits++;
+    pthread_mutex_lock(&p->lock);
+    /* seen by the consumer when it frees a slot, or the consumer's tail is
+     * seen here */
+    atomic_store(&p->reader_waiting, true);
+    while (head - atomic_load(&p->tail) >= p->count
+           && !atomic_load(&p->stop)) {
+        pthread_cond_wait(&p->not_full, &p->lock);
+    }
+    atomic_store(&p->reader_waiting, false);
+    pthread_mutex_unlock(&p->lock);
+    return !atomic_load(&p->stop);
+}
+
+static void _pipeline_wake(qury_pipeline_t *p, atomic_bool *waiting,
+                           pthread_cond_t *cond) {
+    if (atomic_load(waiting)) {
+        pthread_mutex_lock(&p->lock);
+        pthread_cond_signal(cond);
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
+static void *_pipeline_reader(void *arg) {
+    qury_pipeline_t *p = arg;
+    MYSQL_RES *res = p->stmt->res;
+    size_t head = atomic_load_explicit(&p->head, memory_order_relaxed);
+
+    mysql_thread_init();
+    while (!atomic_load_explicit(&p->stop, memory_order_relaxed)) {
+        MYSQL_ROW row = mysql_fetch_row(res);
+        if (!row) {
+            /* reported by qury_fetch once the reader is joined */
+            p->failed = mysql_errno(p->stmt->conn->mysql) != 0;
+            break;
+        }
+        if (!_pipeline_wait_slot(p, head)) {
+            break;
+        }
+        if (!_pipeline_copy(&p->slots[head % p->count], row,
+                            mysql_fetch_lengths(res), p->columns)) {
+            fprintf(stderr, "qury_pipeline : cannot allocate a row\n");
+            p->failed = true;
+            break;
+        }
+        atomic_store(&p->head, ++head);
+        _pipeline_wake(p, &p->consumer_waiting, &p->not_empty);
+    }
+    atomic_store(&p->done, true);
+    pthread_mutex_lock(&p->lock);
+    pthread_cond_signal(&p->not_empty);
+    pthread_mutex_unlock(&p->lock);
+    mysql_thread_end();
+    return NULL;
+}
+
+static void _pipeline_free_slots(qury_pipeline_t *p) {
+    if (!p->slots) {
+        return;
+    }
+    for (size_t i = 0; i < p->count; i++) {
+        free(p->slots[i].row);
+        free(p->slots[i].lengths);
+        free(p->slots[i].data);
+    }
+    free(p->slots);
+    p->slots = NULL;
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->not_full);
+    pthread_cond_destroy(&p->not_empty);
+}
+
+bool qury_pipeline_start(qury_pipeline_t *p, qury_stmt_t *stmt, size_t slots) {
+    assert(p != NULL);
+    assert(stmt != NULL);
+
+    memset(p, 0, sizeof(*p));
+    if (!stmt->text_protocol || !stmt->res || stmt->buffered) {
+        fprintf(stderr,
+                "qury_pipeline_start : needs a streaming text protocol "
+                "result\n");
+        return false;
+    }
+    if (stmt->pipeline || stmt->result_rows > 0) {
+        fprintf(stderr, "qury_pipeline_start : result already fetched\n");
+        return false;
+    }
+    p->stmt = stmt;
+    p->count = slots > 0 ? slots : QURY_PIPELINE_SLOTS;
+    p->columns = stmt->field_cnt;
+
+    p->slots = calloc(p->count, sizeof(*p->slots));
+    if (!p->slots) {
+        return false;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->not_full, NULL);
+    pthread_cond_init(&p->not_empty, NULL);
+    for (size_t i = 0; i < p->count; i++) {
+        qury_row_slot_t *slot = &p->slots[i];
+        slot->row = calloc((size_t)p->columns, sizeof(*slot->row));
+        slot->lengths = calloc((size_t)p->columns, sizeof(*slot->lengths));
+        if (!slot->row || !slot->lengths) {
+            _pipeline_free_slots(p);
+            return false;
+        }
+    }
+
+    if (pthread_create(&p->thread, NULL, _pipeline_reader, p) != 0) {
+        fprintf(stderr, "qury_pipeline_start : cannot start the reader\n");
+        _pipeline_free_slots(p);
+        return false;
+    }
+    p->running = true;
+    stmt->pipeline = p;
+    return true;
+}
+
+void qury_pipeline_stop(qury_pipeline_t *p) {
+    if (!p) {
+        return;
+    }
+    if (p->running) {
+        atomic_store(&p->stop, true);
+        pthread_mutex_lock(&p->lock);
+        pthread_cond_signal(&p->not_full);
+        pthread_mutex_unlock(&p->lock);
+        pthread_join(p->thread, NULL);
+        p->running = false;
+    }
+    if (p->stmt && p->stmt->pipeline == p) {
+        p->stmt->pipeline = NULL;
+    }
+    p->holding = false;
+    _pipeline_free_slots(p);
+}
+
+char **qury_pipeline_next(qury_pipeline_t *p, unsigned long **lengths) {
+    assert(p != NULL);
+    assert(lengths != NULL);
+
+    if (!p->slots) {
+        return NULL;
+    }
+    size_t tail = atomic_load_explicit(&p->tail, memory_order_relaxed);
+    if (p->holding) {
+        /* the values of the previous row are not used anymore */
+        atomic_store(&p->tail, ++tail);
+        p->holding = false;
+        _pipeline_wake(p, &p->reader_waiting, &p->not_full);
+    }
+
+    if (atomic_load(&p->head) == tail) {
+        p->consumer_waits++;
+        pthread_mutex_lock(&p->lock);
+        atomic_store(&p->consumer_waiting, true);
+        while (atomic_load(&p->head) == tail && !atomic_load(&p->done)) {
+            pthread_cond_wait(&p->not_empty, &p->lock);
+        }
+        atomic_store(&p->consumer_waiting, false);
+        pthread_mutex_unlock(&p->lock);
+        /* the last rows are written before done is set */
+        if (atomic_load(&p->head) == tail) {
+            return NULL;
+        }
+    }
+
+    qury_row_slot_t *slot = &p->slots[tail % p->count];
+    p->holding = true;
+    p->rows++;
+    *lengths = slot->lengths;
+    return slot->row;
+}
@@ -1,13 +1,20 @@
 
 #include "include/quaerimus.h"
 #include "include/array.h"
+#include "include/quaerimus_deadline.h"
+#include "include/quaerimus_digest.h"
+#include "include/quaerimus_pipeline.h"
+#include "include/quaerimus_trace.h"
 #include <assert.h>
+#include <inttypes.h>
 #include <mariadb/mariadb_com.h>
 #include <mariadb/mysql.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #define _ST_NONE 0
@@ -25,8 +32,8 @@
 /* allows variable name to be :varname: */
 #define _is_quote_char(c) ((c) == '\'' || (c) == '`' || (c) == '"')
 #define _is_separator_char(c)                                                 \
-    ((c) == ' ' || (c) == '\t' || (c) == _prefix_char || (c) == ','           \
-     || (c) == ';')
+    ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r'                  \
+     || (c) == _prefix_char || (c) == ',' || (c) == ';')
 #define _is_block_close_char(c) ((c) == ')')
 #define _is_variable_prefix(c) ((c) == _prefix_char)
 #define _is_variable_char(c)                                                  \
@@ -49,6 +56,8 @@ static const char *_type_to_str(qury_bind_value_type_t type) {
             return "boolean";
         case QURY_Float:
             return "float";
+        case QURY_Decimal:
+            return "decimal";
         case QURY_Null:
             return "null";
     }
@@ -71,16 +80,17 @@ struct alloc_head {
 
 static void *_alloc(void *head, size_t len) {
     struct alloc_chunk *ptr = malloc(len + sizeof(struct alloc_chunk));
-    if (ptr) {
-        ptr->ptr = ((uint8_t *)ptr) + sizeof(struct alloc_chunk);
-        ptr->next = NULL;
-        if (((struct alloc_head *)head)->chunks == NULL) {
-            ((struct alloc_head *)head)->chunks = ptr;
-            ((struct alloc_head *)head)->tails = ptr;
-        } else {
-            ((struct alloc_head *)head)->tails->next = ptr;
-            ((struct alloc_head *)head)->tails = ptr;
-        }
+    if (!ptr) {
+        return NULL;
+    }
+    ptr->ptr = ((uint8_t *)ptr) + sizeof(struct alloc_chunk);
+    ptr->next = NULL;
+    if (((struct alloc_head *)head)->chunks == NULL) {
+        ((struct alloc_head *)head)->chunks = ptr;
+        ((struct alloc_head *)head)->tails = ptr;
+    } else {
+        ((struct alloc_head *)head)->tails->next = ptr;
+        ((struct alloc_head *)head)->tails = ptr;
     }
     return ptr->ptr;
 }
@@ -92,47 +102,47 @@ static void *_realloc(void *head, void *ptr, size_t len) {
     if (ptr == NULL) {
         return _alloc(head, len);
     }
-    struct alloc_chunk *c = ((struct alloc_head *)head)->chunks;
+    struct alloc_head *h = head;
+    struct alloc_chunk *c = h->chunks;
     struct alloc_chunk *p = NULL;
-    while (c) {
+    while (c && c->ptr != ptr) {
         p = c;
-        if (c->ptr == ptr) {
-            break;
-        }
         c = c->next;
     }
 
     if (c) {
-        struct alloc_chunk *n = c->next;
         struct alloc_chunk *c2 = realloc(c, len + (sizeof(struct alloc_chunk)));
         if (c2) {
             c2->ptr = ((uint8_t *)c2) + sizeof(struct alloc_chunk);
-            c2->next = n;
-            if (((struct alloc_head *)head)->chunks != p) {
+            if (p) {
                 p->next = c2;
             } else {
-                ((struct alloc_head *)head)->chunks = c2;
+                h->chunks = c2;
+            }
+            if (h->tails == c) {
+                h->tails = c2;
             }
-
             return c2->ptr;
         }
     }
     return NULL;
 }
 static void _free(void *head, void *ptr) {
-    struct alloc_chunk *c = ((struct alloc_head *)head)->chunks;
+    struct alloc_head *h = head;
+    struct alloc_chunk *c = h->chunks;
     struct alloc_chunk *p = NULL;
-    while (c) {
+    while (c && c->ptr != ptr) {
         p = c;
-        if (c->ptr == ptr) {
-            break;
-        }
+        c = c->next;
     }
     if (c) {
-        if (((struct alloc_head *)head)->chunks != p) {
+        if (p) {
             p->next = c->next;
         } else {
-            ((struct alloc_head *)head)->chunks = c->next;
+            h->chunks = c->next;
+        }
+        if (h->tails == c) {
+            h->tails = p;
         }
         free(c);
     }
@@ -223,6 +233,132 @@ static qury_allocator_t *MemoryAllocator =
     .memdup = _memdup,
     .reset = _reset};
 
+/* memory accounting, every allocation for a statement goes through these */
+static size_t *_qury_arena_bytes(qury_stmt_t *stmt, void *arena) {
+    if (arena == stmt->meta_allocator && arena != stmt->allocator) {
+        return &stmt->meta_bytes;
+    }
+    return &stmt->arena_bytes;
+}
+
+/* true when len more bytes stay under the hard budgets */
+static bool _qury_mem_fits(qury_stmt_t *stmt, size_t len) {
+    qury_mem_t *cmem = stmt->conn ? &stmt->conn->mem : NULL;
+    return !((stmt->mem.hard_limit > 0
+              && stmt->mem.current + len > stmt->mem.hard_limit)
+             || (cmem && cmem->hard_limit > 0
+                 && cmem->current + len > cmem->hard_limit));
+}
+
+static bool _qury_mem_charge(qury_stmt_t *stmt, void *arena, size_t len) {
+    qury_mem_t *cmem = stmt->conn ? &stmt->conn->mem : NULL;
+    if (!_qury_mem_fits(stmt, len)) {
+        stmt->error = QURY_ErrMemoryBudget;
+        return false;
+    }
+    *_qury_arena_bytes(stmt, arena) += len;
+    stmt->mem.current += len;
+    stmt->mem.allocations++;
+    if (stmt->mem.current > stmt->mem.peak) {
+        stmt->mem.peak = stmt->mem.current;
+    }
+    if (stmt->mem.soft_limit > 0 && stmt->mem.current > stmt->mem.soft_limit) {
+        stmt->over_soft_budget = true;
+    }
+    if (cmem) {
+        cmem->current += len;
+        cmem->allocations++;
+        if (cmem->current > cmem->peak) {
+            cmem->peak = cmem->current;
+        }
+        if (cmem->soft_limit > 0 && cmem->current > cmem->soft_limit) {
+            stmt->over_soft_budget = true;
+        }
+    }
+    return true;
+}
+
+static void _qury_mem_release(qury_stmt_t *stmt, void *arena, size_t len) {
+    size_t *bytes = _qury_arena_bytes(stmt, arena);
+    len = len > *bytes ? *bytes : len;
+    *bytes -= len;
+    stmt->mem.current -= len;
+    if (stmt->conn) {
+        stmt->conn->mem.current -= len;
+    }
+}
+
+static void *_qury_alloc(qury_stmt_t *stmt, void *arena, size_t len) {
+    if (!_qury_mem_charge(stmt, arena, len)) {
+        return NULL;
+    }
+    void *ptr = MemoryAllocator->alloc(arena, len);
+    if (!ptr) {
+        _qury_mem_release(stmt, arena, len);
+    }
+    return ptr;
+}
+
+static void *_qury_realloc(qury_stmt_t *stmt, void *arena, void *ptr,
+                           size_t old_len, size_t len) {
+    if (len > old_len && !_qury_mem_charge(stmt, arena, len - old_len)) {
+        return NULL;
+    }
+    void *tmp = MemoryAllocator->realloc(arena, ptr, len);
+    if (!tmp && len > old_len) {
+        _qury_mem_release(stmt, arena, len - old_len);
+    } else if (tmp && len < old_len) {
+        _qury_mem_release(stmt, arena, old_len - len);
+    }
+    return tmp;
+}
+
+static char *_qury_strndup(qury_stmt_t *stmt, void *arena, const char *ptr,
+                           size_t len) {
+    if (!_qury_mem_charge(stmt, arena, len + 1)) {
+        return NULL;
+    }
+    char *str = MemoryAllocator->strndup(arena, ptr, len);
+    if (!str) {
+        _qury_mem_release(stmt, arena, len + 1);
+    }
+    return str;
+}
+
+static void _qury_arena_reset(qury_stmt_t *stmt, void *arena) {
+    if (MemoryAllocator->reset) {
+        MemoryAllocator->reset(arena);
+        _qury_mem_release(stmt, arena, *_qury_arena_bytes(stmt, arena));
+    }
+}
+
+void qury_set_memory_budget(qury_stmt_t *stmt, size_t soft, size_t hard,
+                            bool chunked) {
+    assert(stmt != NULL);
+    stmt->mem.soft_limit = soft;
+    stmt->mem.hard_limit = hard;
+    stmt->chunked_columns = chunked;
+    stmt->over_soft_budget = soft > 0 && stmt->mem.current > soft;
+}
+
+void qury_conn_set_memory_budget(qury_conn_t *conn, size_t soft, size_t hard) {
+    assert(conn != NULL);
+    conn->mem.soft_limit = soft;
+    conn->mem.hard_limit = hard;
+}
+
+bool qury_conn_set_timeouts(qury_conn_t *conn, unsigned int read_s,
+                            unsigned int write_s) {
+    assert(conn != NULL);
+    if (mysql_options(conn->mysql, MYSQL_OPT_READ_TIMEOUT, &read_s)
+        || mysql_options(conn->mysql, MYSQL_OPT_WRITE_TIMEOUT, &write_s)) {
+        fprintf(stderr, "qury_conn_set_timeouts : %s\n",
+                mysql_error(conn->mysql));
+        return false;
+    }
+    return true;
+}
+
 void qury_stmt_dump(FILE *fp, qury_stmt_t *stmt) {
     assert(stmt != NULL);
     int count_qm = 0;
@@ -236,9 +372,9 @@ void qury_stmt_dump(FILE *fp, qury_stmt_t *stmt) {
             (int)array_size(&stmt->params));
     for (size_t i = 0; i < array_size(&stmt->params); i++) {
         qury_bind_t *p = (qury_bind_t *)array_get(&stmt->params, i);
-        fprintf(fp, "\t• %3ld %7s(%2d)\t%-20s ", i + 1, _type_to_str(p->type),
+        fprintf(fp, "\t• %3ld %7s(%2d)\t%-20s ", i + 1, _type_to_str(p->type & ~QURY_Borrowed),
                 p->type, p->name);
-        switch (p->type) {
+        switch (p->type & ~QURY_Borrowed) {
             case QURY_CString: {
                 fprintf(fp, "\"%s\"", p->value.cstr);
             } break;
@@ -292,9 +428,9 @@ static uint16_t _mtype_to_qurytype(enum enum_field_types type,
         case MYSQL_TYPE_LONGLONG:
             return QURY_Integer;
         case MYSQL_TYPE_DECIMAL:
-            return QURY_Float;
+            return QURY_Decimal;
         case MYSQL_TYPE_NEWDECIMAL:
-            return QURY_Float;
+            return QURY_Decimal;
         case MYSQL_TYPE_YEAR:
             return QURY_Integer;
         case MYSQL_TYPE_DOUBLE:
@@ -361,8 +497,130 @@ static uint16_t _mtype_to_qurytype(enum enum_field_types type,
     return QURY_Null;
 }
 
-static inline size_t _qury_process_param(qury_stmt_t *stmt, char *query,
-                                         size_t *length) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define _QURY_SWAR_DIGITS 1
+/* true if the 8 bytes at s are all ascii digits */
+static inline bool _qury_is_8digits(const char *s) {
+    uint64_t v;
+    memcpy(&v, s, sizeof(v));
+    return ((v & 0xF0F0F0F0F0F0F0F0ULL)
+            | (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+           == 0x3333333333333333ULL;
+}
+
+/* value of 8 ascii digits, three multiplications instead of eight */
+static inline uint32_t _qury_parse_8digits(const char *s) {
+    uint64_t v;
+    memcpy(&v, s, sizeof(v));
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)))
+         + (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32))))
+        >> 32;
+    return (uint32_t)v;
+}
+#endif
+
+bool qury_decimal_parse(const char *s, size_t len, qury_decimal_t *d) {
+    qury_decimal_int_t m = 0;
+    size_t i = 0;
+    size_t digits = 0;
+    bool neg = false;
+    bool dot = false;
+    int scale = 0;
+
+    assert(d != NULL);
+    memset(d, 0, sizeof(*d));
+    if (len > 0 && (s[0] == '-' || s[0] == '+')) {
+        neg = s[0] == '-';
+        i++;
+    }
+    while (i < len) {
+#ifdef _QURY_SWAR_DIGITS
+        if (i + 8 <= len && digits + 8 <= QURY_DECIMAL_DIGITS
+            && _qury_is_8digits(&s[i])) {
+            uint32_t block = _qury_parse_8digits(&s[i]);
+            if (m != 0) {
+                digits += 8;
+            } else {
+                /* leading zeros don't count */
+                for (uint32_t v = block; v != 0; v /= 10) {
+                    digits++;
+                }
+            }
+            m = m * 100000000 + block;
+            i += 8;
+            scale += dot ? 8 : 0;
+            continue;
+        }
+#endif
+        unsigned int c = (unsigned char)s[i++] - '0';
+        if (c > 9) {
+            if (c == (unsigned int)('.' - '0') && !dot) {
+                dot = true;
+                continue;
+            }
+            return false;
+        }
+        /* leading zeros don't count */
+        digits += (m != 0 || c != 0);
+        if (digits > QURY_DECIMAL_DIGITS) {
+            d->overflow = true;
+            continue;
+        }
+        m = m * 10 + c;
+        scale += dot;
+    }
+    d->mantissa = neg ? -m : m;
+    d->scale = (uint8_t)scale;
+    return true;
+}
+
+size_t qury_decimal_format(qury_decimal_t d, char *buf, size_t size) {
+    /* scale can go up to 255 with leading zeros */
+    char tmp[QURY_DECIMAL_DIGITS + 258];
+    char *end = tmp + sizeof(tmp);
+    char *p = end;
+    bool neg = d.mantissa < 0;
+    qury_decimal_int_t m = neg ? -d.mantissa : d.mantissa;
+    int digits = 0;
+
+    assert(buf != NULL);
+    if (d.overflow) {
+        return 0;
+    }
+    do {
+        *--p = (char)('0' + (int)(m % 10));
+        m /= 10;
+        digits++;
+    } while (m != 0);
+    while (digits <= d.scale) {
+        *--p = '0';
+        digits++;
+    }
+    if (d.scale > 0) {
+        /* shift the integer part left to insert the point */
+        memmove(p - 1, p, (size_t)(digits - d.scale));
+        p--;
+        end[-d.scale - 1] = '.';
+    }
+    if (neg) {
+        *--p = '-';
+    }
+    size_t len = (size_t)(end - p);
+    if (len >= size) {
+        return 0;
+    }
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    return len;
+}
+
+bool qury_parse_params(char *query, size_t *length, qury_param_cb_t cb,
+                       void *userptr) {
+    assert(query != NULL);
+    assert(length != NULL);
+
     int state = _ST_NONE;
     size_t name_start = 0;
     size_t removed_size = 0;
@@ -398,14 +656,10 @@ static inline size_t _qury_process_param(qury_stmt_t *stmt, char *query,
             && _st_isset(state, _ST_VARNAME)) {
             removed_size = i - name_start;
             query[name_start - 1] = '?';
-            qury_bind_t *bind =
-                MemoryAllocator->alloc(stmt->allocator, sizeof(*bind));
-            if (!bind) {
-                /* TODO : error handling */
-            }
-            bind->name = MemoryAllocator->strndup(stmt->allocator, &query[name_start],
-                                                  i - name_start);
-            array_push(&stmt->params, (uintptr_t)bind);
+            if (cb && !cb(userptr, &query[name_start], i - name_start,
+                          name_start - 1)) {
+                return false;
+            }
             memmove(&query[name_start], &query[i],
                     *length - (name_start + removed_size));
             *length -= removed_size;
@@ -430,37 +684,57 @@ static inline size_t _qury_process_param(qury_stmt_t *stmt, char *query,
     if (state != _ST_FAILED && _st_isset(state, _ST_VARNAME)) {
         removed_size = i - name_start;
         query[name_start - 1] = '?';
-        qury_bind_t *bind = MemoryAllocator->alloc(stmt->allocator, sizeof(*bind));
-        if (!bind) {
-            /* TODO : error handling */
+        if (cb && !cb(userptr, &query[name_start], i - name_start,
+                      name_start - 1)) {
+            return false;
         }
-        bind->name = MemoryAllocator->strndup(stmt->allocator, &query[name_start],
-                                              i - name_start);
-        array_push(&stmt->params, (uintptr_t)bind);
-
         memmove(&query[name_start], &query[i],
                 *length - (name_start + removed_size));
         *length -= removed_size;
         _st_clear(state, _ST_VARNAME);
     }
 
-    if (state == _ST_FAILED) {
-        /* TODO : something as we have an error */
+    return state != _ST_FAILED;
+}
+
+static bool _qury_add_param(void *userptr, const char *name, size_t name_len,
+                            size_t offset) {
+    qury_stmt_t *stmt = (qury_stmt_t *)userptr;
+    qury_bind_t *bind =
+        _qury_alloc(stmt, stmt->meta_allocator, sizeof(*bind));
+    if (!bind) {
+        return false;
+    }
+    memset(bind, 0, sizeof(*bind));
+    bind->offset = offset;
+    bind->name = _qury_strndup(stmt, stmt->meta_allocator, name, name_len);
+    if (!bind->name) {
+        return false;
+    }
+    return array_push(&stmt->params, (uintptr_t)bind);
+}
+
+static inline bool _qury_process_param(qury_stmt_t *stmt, char *query,
+                                       size_t *length) {
+    if (!qury_parse_params(query, length, _qury_add_param, stmt)) {
+        return false;
     }
 
-    stmt->binds = MemoryAllocator->alloc(
-                                         stmt->allocator, sizeof(MYSQL_BIND) * (array_size(&stmt->params) + 1));
+    stmt->binds = _qury_alloc(stmt, stmt->meta_allocator,
+                              sizeof(MYSQL_BIND) * (array_size(&stmt->params) + 1));
     if (!stmt->binds) {
-        /* TODO : error to handle again */
+        return false;
     }
+    memset(stmt->binds, 0,
+           sizeof(MYSQL_BIND) * (array_size(&stmt->params) + 1));
 
     stmt->query[stmt->query_length] = '\0';
-    return 0;
+    return true;
 }
 
 void qury_conn_init(qury_conn_t *c) {
     memset(c, 0, sizeof(*c));
-    mysql_init(c->mysql);
+    c->mysql = mysql_init(NULL);
 }
 
 void qury_init(qury_allocator_t *allocator) {
@@ -489,6 +763,16 @@ qury_stmt_t *qury_new(qury_conn_t *conn, void *allocator_userptr) {
 
     memset(stmt, 0, sizeof(qury_stmt_t));
     stmt->allocator = allocator_userptr;
+    stmt->conn = conn;
+    /* prepared statement data outlives qury_reset, so it gets its own arena
+     * when the allocator can create one */
+    stmt->meta_allocator = allocator_userptr;
+    if (MemoryAllocator->init) {
+        stmt->meta_allocator = MemoryAllocator->init(0, NULL);
+        if (!stmt->meta_allocator) {
+            return NULL;
+        }
+    }
     stmt->stmt = mysql_stmt_init(conn->mysql);
     if (!stmt->stmt) {
         return false;
@@ -531,46 +815,273 @@ bool qury_select_db(qury_conn_t *conn, const char *dbname) {
     return false;
 }
 
+static uint64_t _qury_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+#define QURY_ADAPTIVE_BUFFERED_MAX (64 * 1024)
+
+#define _QURY_ER_QUERY_INTERRUPTED 1317
+#define _QURY_ER_STATEMENT_TIMEOUT 1969
+
+/* the execution starting now is under the deadline */
+static void _qury_deadline_begin(qury_stmt_t *stmt) {
+    if (stmt->timeout_ms == 0) {
+        return;
+    }
+    stmt->deadline_armed = true;
+    stmt->watch = stmt->watchdog
+                      ? qury_watchdog_arm(stmt->watchdog,
+                                          mysql_thread_id(stmt->conn->mysql),
+                                          stmt->timeout_ms)
+                      : QURY_WATCH_NONE;
+}
+
+/* nothing left to read for the execution, if it failed past the deadline
+ * it is a timeout */
+static void _qury_deadline_end(qury_stmt_t *stmt) {
+    if (!stmt->deadline_armed) {
+        return;
+    }
+    stmt->deadline_armed = false;
+    bool killed = stmt->watch != QURY_WATCH_NONE
+                  && qury_watchdog_disarm(stmt->watchdog, stmt->watch);
+    unsigned int err = stmt->text_protocol ? mysql_errno(stmt->conn->mysql)
+                                           : mysql_stmt_errno(stmt->stmt);
+    if (err == _QURY_ER_STATEMENT_TIMEOUT
+        || (killed && err == _QURY_ER_QUERY_INTERRUPTED)) {
+        stmt->error = QURY_ErrTimeout;
+    }
+}
+
+/* an execution that failed or left no rows on the connection is done */
+static bool _qury_deadline_executed(qury_stmt_t *stmt, bool ok) {
+    if (!ok || stmt->buffered || stmt->field_cnt == 0) {
+        _qury_deadline_end(stmt);
+    }
+    return ok;
+}
+
+/* account the result that just ended for the adaptive mode */
+static void _qury_result_done(qury_stmt_t *stmt) {
+    /* the reader must be done with the connection */
+    qury_pipeline_stop(stmt->pipeline);
+    _qury_deadline_end(stmt);
+    if (!stmt->result_pending) {
+        return;
+    }
+    stmt->result_pending = false;
+    qury_digest_add_rows(stmt->digest, stmt->result_rows, stmt->result_bytes);
+    if (stmt->executions == 0) {
+        stmt->avg_result_bytes = stmt->result_bytes;
+    } else {
+        stmt->avg_result_bytes =
+            (stmt->avg_result_bytes * 3 + stmt->result_bytes) / 4;
+    }
+    stmt->executions++;
+}
+
+static void _qury_result_begin(qury_stmt_t *stmt) {
+    _qury_result_done(stmt);
+    switch (stmt->result_mode) {
+        case QURY_ResultBuffered:
+            stmt->buffered = true;
+            break;
+        case QURY_ResultStreaming:
+            stmt->buffered = false;
+            break;
+        default:
+        case QURY_ResultAdaptive:
+            /* nothing known yet, don't risk buffering a large scan */
+            stmt->buffered = stmt->executions > 0 && !stmt->over_soft_budget
+                             && stmt->avg_result_bytes
+                                    <= QURY_ADAPTIVE_BUFFERED_MAX;
+            break;
+    }
+    stmt->result_rows = 0;
+    stmt->result_bytes = 0;
+    stmt->result_pending = true;
+}
+
+static bool _qury_store_result(qury_stmt_t *stmt) {
+    if (!stmt->buffered || stmt->field_cnt == 0) {
+        return true;
+    }
+    if (mysql_stmt_store_result(stmt->stmt)) {
+        fprintf(stderr, "mysql_stmt_store_result : %s\n",
+                mysql_stmt_error(stmt->stmt));
+        return false;
+    }
+    return true;
+}
+
+void qury_set_result_mode(qury_stmt_t *stmt, qury_result_mode_t mode) {
+    assert(stmt != NULL);
+    stmt->result_mode = mode;
+}
+
+uint64_t qury_num_rows(qury_stmt_t *stmt) {
+    assert(stmt != NULL);
+    if (!stmt->buffered) {
+        return stmt->result_rows;
+    }
+    if (stmt->text_protocol) {
+        return stmt->res ? mysql_num_rows(stmt->res) : 0;
+    }
+    return mysql_stmt_num_rows(stmt->stmt);
+}
+
+bool qury_seek(qury_stmt_t *stmt, uint64_t row) {
+    assert(stmt != NULL);
+    if (!stmt->buffered || !stmt->query_executed) {
+        return false;
+    }
+    if (row >= qury_num_rows(stmt)) {
+        return false;
+    }
+    if (stmt->text_protocol) {
+        mysql_data_seek(stmt->res, row);
+    } else {
+        mysql_stmt_data_seek(stmt->stmt, row);
+    }
+    stmt->result_rows = row;
+    return true;
+}
+
+static void _qury_forget_layout(qury_stmt_t *stmt) {
+    stmt->field_cnt = 0;
+    stmt->results = NULL;
+    stmt->plan = NULL;
+    stmt->plan_ops = 0;
+    memset(&stmt->fields, 0, sizeof(stmt->fields));
+    memset(&stmt->values, 0, sizeof(stmt->values));
+}
+
+static void _qury_batch_end(qury_stmt_t *stmt) {
+    if (stmt->batch_pending) {
+        stmt->batch_pending = false;
+        mysql_set_server_option(stmt->conn->mysql,
+                                MYSQL_OPTION_MULTI_STATEMENTS_OFF);
+    }
+}
+
 void qury_reset(qury_stmt_t *stmt) {
+    _qury_result_done(stmt);
+    if (stmt->res) {
+        mysql_free_result(stmt->res);
+        stmt->res = NULL;
+    }
+    if (stmt->batch_pending) {
+        /* results left from a batch */
+        MYSQL *mysql = stmt->conn->mysql;
+        while (mysql_more_results(mysql) && mysql_next_result(mysql) == 0) {
+            MYSQL_RES *res = mysql_use_result(mysql);
+            if (res) {
+                mysql_free_result(res);
+            }
+        }
+        _qury_batch_end(stmt);
+    }
+    stmt->batch = NULL;
+    stmt->batch_length = 0;
+    stmt->batch_capacity = 0;
+    stmt->batch_count = 0;
+    stmt->out_params = false;
     mysql_stmt_free_result(stmt->stmt);
     mysql_stmt_reset(stmt->stmt);
-    if (MemoryAllocator->reset) {
-        MemoryAllocator->reset(stmt->allocator);
-    }
-    stmt->query_length = 0;
+    _qury_arena_reset(stmt, stmt->allocator);
     stmt->result_bounded = false;
     stmt->params_bounded = false;
-    stmt->field_cnt = 0;
-    stmt->results = NULL;
-    stmt->binds = NULL;
+
+    if (stmt->meta_allocator == stmt->allocator) {
+        /* no separate arena, the prepared data is gone as well */
+        stmt->text_protocol = false;
+        stmt->query_length = 0;
+        stmt->binds = NULL;
+        memset(&stmt->params, 0, sizeof(stmt->params));
+        _qury_forget_layout(stmt);
+        return;
+    }
+
+    /* bound values and fetched data were in the statement arena */
+    size_t index = 0;
+    uintptr_t value = 0;
+    array_foreach(&stmt->params, index, value) {
+        qury_bind_t *param = (qury_bind_t *)value;
+        memset(&param->value, 0, sizeof(param->value));
+        memset(&stmt->binds[index], 0, sizeof(*stmt->binds));
+        stmt->binds[index].buffer_type = MYSQL_TYPE_NULL;
+        param->type = QURY_None;
+        param->length = 0;
+        param->buffer = NULL;
+        param->capacity = 0;
+    }
+    array_foreach(&stmt->values, index, value) {
+        qury_bind_t *v = (qury_bind_t *)value;
+        memset(&v->value, 0, sizeof(qury_bind_value_t));
+        if (v->buffer && stmt->results) {
+            stmt->results[index].buffer = NULL;
+            stmt->results[index].buffer_length = 0;
+        }
+        v->buffer = NULL;
+        v->capacity = 0;
+    }
+    stmt->values_bounded = false;
 }
 
-bool qury_prepare(qury_stmt_t *stmt, const char *query, size_t length) {
-    assert(stmt != NULL);
-    assert(query != NULL);
+static bool _qury_parse(qury_stmt_t *stmt, const char *query, size_t length) {
     if (length == 0) {
         length = strlen(query);
     }
+    stmt->error = QURY_ErrNone;
 
+    /* new query, previous prepared data and layout don't apply */
+    if (stmt->meta_allocator != stmt->allocator && MemoryAllocator->reset) {
+        _qury_arena_reset(stmt, stmt->meta_allocator);
+        memset(&stmt->params, 0, sizeof(stmt->params));
+        _qury_forget_layout(stmt);
+    }
     if (stmt->params.capacity > 0) {
         array_clear(&stmt->params);
     } else {
         if (!array_init(&stmt->params, QURY_PARAMS_INIT_SIZE, MemoryAllocator,
-                        stmt->allocator)) {
+                        stmt->meta_allocator)) {
             return false;
         }
     }
-    stmt->query = MemoryAllocator->strndup(stmt->allocator, query, length);
+    stmt->query = _qury_strndup(stmt, stmt->meta_allocator, query, length);
     if (!stmt->query) {
         return false;
     }
     stmt->query_length = length;
+    /* normalized from the text with the parameter names */
+    stmt->digest =
+        qury_digest_enabled() ? qury_digest_lookup(query, length) : NULL;
+
+    if (!_qury_process_param(stmt, stmt->query, &stmt->query_length)) {
+        fprintf(stderr, "qury_prepare : cannot parse parameters\n");
+        return false;
+    }
+
+    stmt->result_bounded = false;
+    stmt->params_bounded = false;
+    stmt->results = NULL;
+    return true;
+}
 
-    _qury_process_param(stmt, stmt->query, &stmt->query_length);
+static const char *_qury_server_query(qury_stmt_t *stmt, size_t *length);
 
+static bool _qury_prepare_server(qury_stmt_t *stmt) {
     int errcode = 0;
-    if ((errcode =
-         mysql_stmt_prepare(stmt->stmt, stmt->query, stmt->query_length))) {
+    size_t length = 0;
+    stmt->text_protocol = false;
+    const char *query = _qury_server_query(stmt, &length);
+    if (!query) {
+        return false;
+    }
+    if ((errcode = mysql_stmt_prepare(stmt->stmt, query, length))) {
         fprintf(stderr, "mysql_stmt_prepare : %d %s\n", errcode,
                 mysql_stmt_error(stmt->stmt));
         return false;
@@ -578,24 +1089,603 @@ bool qury_prepare(qury_stmt_t *stmt, const char *query, size_t length) {
     return true;
 }
 
+bool qury_prepare(qury_stmt_t *stmt, const char *query, size_t length) {
+    assert(stmt != NULL);
+    assert(query != NULL);
+
+    QURY_TRACE3(prepare__start, stmt, query, length);
+    bool ok = _qury_parse(stmt, query, length) && _qury_prepare_server(stmt);
+    QURY_TRACE2(prepare__done, stmt, ok);
+    return ok;
+}
+
+bool qury_set_deadline(qury_stmt_t *stmt, uint32_t timeout_ms,
+                       struct qury_watchdog_s *watchdog) {
+    assert(stmt != NULL);
+
+    /* the current execution stops being watched */
+    _qury_deadline_end(stmt);
+    bool changed = stmt->timeout_ms != timeout_ms;
+    stmt->timeout_ms = timeout_ms;
+    stmt->watchdog = watchdog;
+    if (!changed || stmt->query_length == 0 || stmt->text_protocol) {
+        return true;
+    }
+
+    /* the server side deadline is in the prepared text */
+    _qury_result_done(stmt);
+    mysql_stmt_free_result(stmt->stmt);
+    stmt->params_bounded = false;
+    stmt->values_bounded = false;
+    stmt->result_bounded = false;
+    stmt->query_executed = false;
+    return _qury_prepare_server(stmt);
+}
+
+bool qury_stmt_move(qury_stmt_t *stmt, qury_conn_t *conn) {
+    assert(stmt != NULL);
+    assert(conn != NULL);
+
+    if (stmt->conn == conn) {
+        return true;
+    }
+    MYSQL_STMT *handle = mysql_stmt_init(conn->mysql);
+    if (!handle) {
+        fprintf(stderr, "qury_stmt_move : %s\n", mysql_error(conn->mysql));
+        return false;
+    }
+    _qury_result_done(stmt);
+    if (stmt->res) {
+        mysql_free_result(stmt->res);
+        stmt->res = NULL;
+    }
+    mysql_stmt_free_result(stmt->stmt);
+    mysql_stmt_close(stmt->stmt);
+    stmt->stmt = handle;
+
+    /* the bytes of the statement now count for the new connection */
+    if (stmt->conn) {
+        stmt->conn->mem.current -= stmt->mem.current > stmt->conn->mem.current
+                                       ? stmt->conn->mem.current
+                                       : stmt->mem.current;
+    }
+    stmt->conn = conn;
+    conn->mem.current += stmt->mem.current;
+    if (conn->mem.current > conn->mem.peak) {
+        conn->mem.peak = conn->mem.current;
+    }
+
+    /* parsed query, parameters and layout are kept, only the server side
+     * is redone */
+    stmt->params_bounded = false;
+    stmt->values_bounded = false;
+    stmt->result_bounded = false;
+    stmt->query_executed = false;
+    if (stmt->query_length > 0 && !stmt->text_protocol) {
+        return _qury_prepare_server(stmt);
+    }
+    return true;
+}
+
 void qury_free(qury_stmt_t *stmt) {
     if (stmt != NULL) {
+        qury_pipeline_stop(stmt->pipeline);
+        _qury_deadline_end(stmt);
+        if (stmt->res) {
+            mysql_free_result(stmt->res);
+        }
         mysql_stmt_free_result(stmt->stmt);
         mysql_stmt_close(stmt->stmt);
-        array_destroy(&stmt->params);
-        array_destroy(&stmt->fields);
-        array_destroy(&stmt->values);
+        if (stmt->conn) {
+            stmt->conn->mem.current -= stmt->mem.current > stmt->conn->mem.current
+                                           ? stmt->conn->mem.current
+                                           : stmt->mem.current;
+        }
+        /* arrays live in the arenas, the statement itself is in the first
+         * one, so it goes last */
         if (MemoryAllocator->destroy) {
+            if (stmt->meta_allocator != stmt->allocator) {
+                MemoryAllocator->destroy(stmt->meta_allocator);
+            }
             MemoryAllocator->destroy(stmt->allocator);
         }
     }
 }
 
-#define DATA_CALLBACK_BUFFER_SIZE 4096
-bool qury_execute(qury_stmt_t *stmt) {
-    assert(stmt != NULL);
-
-    if (!stmt->params_bounded) {
+/* true when the cached layout still describes the result */
+static bool _qury_layout_match(qury_stmt_t *stmt, MYSQL_RES *meta) {
+    if (stmt->field_cnt == 0 || (int)mysql_num_fields(meta) != stmt->field_cnt
+        || array_size(&stmt->values) != (size_t)stmt->field_cnt) {
+        return false;
+    }
+    MYSQL_FIELD *fields = mysql_fetch_fields(meta);
+    for (int i = 0; i < stmt->field_cnt; i++) {
+        qury_field_name_t *f = (qury_field_name_t *)array_get(&stmt->fields, i);
+        if (f->type != fields[i].type || f->charsetnr != fields[i].charsetnr
+            || f->flags != fields[i].flags || f->decimals != fields[i].decimals
+            || !f->name || strlen(f->name) != fields[i].name_length
+            || memcmp(f->name, fields[i].name, fields[i].name_length) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void _qury_load_fields(qury_stmt_t *stmt, MYSQL_RES *meta) {
+    MYSQL_FIELD *field = NULL;
+    if (_qury_layout_match(stmt, meta)) {
+        return;
+    }
+    /* rebuilt on next fetch */
+    stmt->results = NULL;
+    array_clear(&stmt->values);
+    stmt->field_cnt = mysql_num_fields(meta);
+    if (stmt->field_cnt > 0) {
+        if (stmt->fields.capacity > 0) {
+            array_clear(&stmt->fields);
+        } else {
+            array_init(&stmt->fields, stmt->field_cnt, MemoryAllocator,
+                       stmt->meta_allocator);
+        }
+        while ((field = mysql_fetch_field(meta)) != NULL) {
+            qury_field_name_t *f = _qury_alloc(stmt, stmt->meta_allocator,
+                                               sizeof(qury_field_name_t));
+            if (!f) {
+                break;
+            }
+            f->type = field->type;
+            f->charsetnr = field->charsetnr;
+            f->flags = field->flags;
+            f->decimals = field->decimals;
+            f->name = _qury_strndup(stmt, stmt->meta_allocator, field->name,
+                                    field->name_length);
+            f->org_name = _qury_strndup(stmt, stmt->meta_allocator,
+                                        field->org_name, field->org_name_length);
+            f->table = _qury_strndup(stmt, stmt->meta_allocator, field->table,
+                                     field->table_length);
+            array_push(&stmt->fields, (uintptr_t)f);
+        }
+    }
+}
+
+/* growable buffer within the statement arena */
+struct _qury_sbuf {
+    char *ptr;
+    size_t len;
+    size_t cap;
+};
+
+static bool _qury_sbuf_reserve(qury_stmt_t *stmt, struct _qury_sbuf *b,
+                               size_t need) {
+    if (b->len + need <= b->cap) {
+        return true;
+    }
+    size_t cap = b->cap > 0 ? b->cap : 256;
+    while (cap < b->len + need) {
+        cap *= 2;
+    }
+    void *tmp = _qury_realloc(stmt, stmt->allocator, b->ptr, b->cap, cap);
+    if (!tmp) {
+        return false;
+    }
+    b->ptr = tmp;
+    b->cap = cap;
+    return true;
+}
+
+static bool _qury_sbuf_append(qury_stmt_t *stmt, struct _qury_sbuf *b,
+                              const void *data, size_t len) {
+    if (!_qury_sbuf_reserve(stmt, b, len)) {
+        return false;
+    }
+    memcpy(&b->ptr[b->len], data, len);
+    b->len += len;
+    return true;
+}
+
+#define DATA_CALLBACK_BUFFER_SIZE 4096
+#define _QURY_LITERAL_SIZE 32
+
+static bool _qury_append_literal(qury_stmt_t *stmt, struct _qury_sbuf *out,
+                                 qury_bind_t *param) {
+    static const char hex[] = "0123456789ABCDEF";
+    char literal[_QURY_LITERAL_SIZE];
+    int len = 0;
+    const uint8_t *data = NULL;
+    size_t dlen = 0;
+
+    if (param->is_null) {
+        /* a NULL string or bytes keeps its type */
+        return _qury_sbuf_append(stmt, out, "NULL", 4);
+    }
+    if (param->type & QURY_DataCallback) {
+        /* read everything first, escaping must not split a character */
+        struct _qury_sbuf cbdata = {0};
+        uint8_t buffer[DATA_CALLBACK_BUFFER_SIZE];
+        size_t rlen = 0;
+        while ((rlen = param->value.cb(buffer, DATA_CALLBACK_BUFFER_SIZE)) > 0) {
+            if (!_qury_sbuf_append(stmt, &cbdata, buffer, rlen)) {
+                return false;
+            }
+        }
+        data = (const uint8_t *)cbdata.ptr;
+        dlen = cbdata.len;
+    }
+
+    switch (param->type & ~QURY_Flags) {
+        case QURY_Integer: {
+            if (param->is_unsigned) {
+                len = snprintf(literal, sizeof(literal), "%" PRIu64,
+                               param->value.i);
+            } else {
+                len = snprintf(literal, sizeof(literal), "%" PRId64,
+                               (int64_t)param->value.i);
+            }
+            return _qury_sbuf_append(stmt, out, literal, len);
+        }
+        case QURY_Bool:
+            return _qury_sbuf_append(stmt, out, param->value.b ? "1" : "0", 1);
+        case QURY_Float: {
+            if (!isfinite(param->value.f)) {
+                fprintf(stderr, "qury_query_once : %s is not a finite number\n",
+                        param->name);
+                return false;
+            }
+            len = snprintf(literal, sizeof(literal), "%.17g", param->value.f);
+            return _qury_sbuf_append(stmt, out, literal, len);
+        }
+        case QURY_CString: {
+            if (!(param->type & QURY_DataCallback)) {
+                data = (const uint8_t *)param->value.cstr;
+                dlen = param->length;
+            }
+            if (!_qury_sbuf_reserve(stmt, out, dlen * 2 + 3)) {
+                return false;
+            }
+            out->ptr[out->len++] = '\'';
+            if (dlen > 0) {
+                unsigned long elen = mysql_real_escape_string(
+                    stmt->conn->mysql, &out->ptr[out->len], (const char *)data,
+                    dlen);
+                if (elen == (unsigned long)-1) {
+                    fprintf(stderr, "mysql_real_escape_string : %s\n",
+                            mysql_error(stmt->conn->mysql));
+                    return false;
+                }
+                out->len += elen;
+            }
+            out->ptr[out->len++] = '\'';
+            return true;
+        }
+        case QURY_OString: {
+            if (!(param->type & QURY_DataCallback)) {
+                data = param->value.ostr.ptr;
+                dlen = param->value.ostr.len;
+            }
+            if (!_qury_sbuf_reserve(stmt, out, dlen * 2 + 3)) {
+                return false;
+            }
+            out->ptr[out->len++] = 'X';
+            out->ptr[out->len++] = '\'';
+            for (size_t i = 0; i < dlen; i++) {
+                out->ptr[out->len++] = hex[data[i] >> 4];
+                out->ptr[out->len++] = hex[data[i] & 0x0F];
+            }
+            out->ptr[out->len++] = '\'';
+            return true;
+        }
+        case QURY_Decimal:
+            /* formatted by qury_stmt_bind, a valid number */
+            return _qury_sbuf_append(stmt, out, param->value.cstr,
+                                     param->length);
+        default:
+        case QURY_Null:
+            return _qury_sbuf_append(stmt, out, "NULL", 4);
+    }
+}
+
+static bool _qury_interpolate(qury_stmt_t *stmt, struct _qury_sbuf *out) {
+    size_t last = 0;
+    size_t index = 0;
+    uintptr_t value = 0;
+    array_foreach(&stmt->params, index, value) {
+        qury_bind_t *param = (qury_bind_t *)value;
+        if (!_qury_sbuf_append(stmt, out, &stmt->query[last],
+                               param->offset - last)
+            || !_qury_append_literal(stmt, out, param)) {
+            return false;
+        }
+        last = param->offset + 1;
+    }
+    return _qury_sbuf_append(stmt, out, &stmt->query[last],
+                             stmt->query_length - last);
+}
+
+#define _QURY_DEADLINE_PREFIX_SIZE 64
+
+/* server side deadline, MariaDB 10.1 and later */
+static int _qury_deadline_prefix(qury_stmt_t *stmt, char *out, size_t size) {
+    MYSQL *mysql = stmt->conn->mysql;
+    if (stmt->timeout_ms == 0 || !mariadb_connection(mysql)
+        || mysql_get_server_version(mysql) < 100100) {
+        return 0;
+    }
+    return snprintf(out, size, "SET STATEMENT max_statement_time=%u.%03u FOR ",
+                    stmt->timeout_ms / 1000, stmt->timeout_ms % 1000);
+}
+
+/* parsed query, with the deadline prefix in the statement arena */
+static const char *_qury_server_query(qury_stmt_t *stmt, size_t *length) {
+    char prefix[_QURY_DEADLINE_PREFIX_SIZE];
+    int n = _qury_deadline_prefix(stmt, prefix, sizeof(prefix));
+    *length = stmt->query_length;
+    if (n <= 0) {
+        return stmt->query;
+    }
+    struct _qury_sbuf sql = {0};
+    if (!_qury_sbuf_append(stmt, &sql, prefix, (size_t)n)
+        || !_qury_sbuf_append(stmt, &sql, stmt->query, stmt->query_length)) {
+        return NULL;
+    }
+    *length = sql.len;
+    return sql.ptr;
+}
+
+static bool _qury_text_values(qury_stmt_t *stmt) {
+    if (stmt->values.capacity > 0) {
+        array_clear(&stmt->values);
+    } else {
+        if (!array_init(&stmt->values, stmt->field_cnt, MemoryAllocator,
+                        stmt->meta_allocator)) {
+            return false;
+        }
+    }
+    for (int i = 0; i < stmt->field_cnt; i++) {
+        qury_bind_t *mybind =
+            _qury_alloc(stmt, stmt->meta_allocator, sizeof(qury_bind_t));
+        if (!mybind) {
+            return false;
+        }
+        memset(mybind, 0, sizeof(qury_bind_t));
+        qury_field_name_t *field =
+            (qury_field_name_t *)array_get(&stmt->fields, i);
+        mybind->name = field->name;
+        mybind->type = _mtype_to_qurytype(field->type, field->charsetnr);
+        mybind->is_unsigned = !!(field->flags & UNSIGNED_FLAG);
+        array_push(&stmt->values, (uintptr_t)mybind);
+    }
+    return true;
+}
+
+static bool _qury_text_result(qury_stmt_t *stmt);
+
+static bool _qury_execute_text(qury_stmt_t *stmt) {
+    MYSQL *mysql = stmt->conn->mysql;
+    struct _qury_sbuf sql = {0};
+
+    if (stmt->res) {
+        mysql_free_result(stmt->res);
+        stmt->res = NULL;
+    }
+    char prefix[_QURY_DEADLINE_PREFIX_SIZE];
+    int n = _qury_deadline_prefix(stmt, prefix, sizeof(prefix));
+    if ((n > 0 && !_qury_sbuf_append(stmt, &sql, prefix, (size_t)n))
+        || !_qury_interpolate(stmt, &sql)) {
+        return false;
+    }
+    if (mysql_real_query(mysql, sql.ptr, sql.len)) {
+        fprintf(stderr, "mysql_real_query : %s\n", mysql_error(mysql));
+        return false;
+    }
+    stmt->query_executed = true;
+    return _qury_text_result(stmt);
+}
+
+static bool _qury_text_result(qury_stmt_t *stmt) {
+    MYSQL *mysql = stmt->conn->mysql;
+
+    stmt->out_params = false;
+    stmt->res = stmt->buffered ? mysql_store_result(mysql)
+                               : mysql_use_result(mysql);
+    if (!stmt->res) {
+        if (mysql_field_count(mysql) == 0) {
+            /* not a SELECT */
+            stmt->field_cnt = 0;
+            return true;
+        }
+        fprintf(stderr, "mysql_%s_result : %s\n",
+                stmt->buffered ? "store" : "use", mysql_error(mysql));
+        return false;
+    }
+    _qury_load_fields(stmt, stmt->res);
+    stmt->result_bounded = true;
+    if (array_size(&stmt->values) == (size_t)stmt->field_cnt) {
+        return true;
+    }
+    return _qury_text_values(stmt);
+}
+
+bool qury_query_once(qury_stmt_t *stmt, const char *query, size_t length,
+                     const qury_param_t *params) {
+    assert(stmt != NULL);
+    assert(query != NULL);
+
+    if (!_qury_parse(stmt, query, length)) {
+        return false;
+    }
+    stmt->text_protocol = true;
+    for (; params && params->name; params++) {
+        if (!qury_stmt_bind(stmt, params->name, params->ptr, params->vlen,
+                            params->type)) {
+            return false;
+        }
+    }
+    return qury_execute(stmt);
+}
+
+bool qury_batch_add(qury_stmt_t *stmt, const char *query, size_t length,
+                    const qury_param_t *params) {
+    assert(stmt != NULL);
+    assert(query != NULL);
+
+    struct _qury_sbuf batch = {stmt->batch, stmt->batch_length,
+                               stmt->batch_capacity};
+    if (!_qury_parse(stmt, query, length)) {
+        return false;
+    }
+    /* batches are not accounted, their statements would share a digest */
+    stmt->digest = NULL;
+    stmt->text_protocol = true;
+    for (; params && params->name; params++) {
+        if (!qury_stmt_bind(stmt, params->name, params->ptr, params->vlen,
+                            params->type)) {
+            return false;
+        }
+    }
+    bool ok = (batch.len == 0 || _qury_sbuf_append(stmt, &batch, ";", 1))
+              && _qury_interpolate(stmt, &batch);
+    /* the buffer may have moved even on failure */
+    stmt->batch = batch.ptr;
+    stmt->batch_capacity = batch.cap;
+    if (ok) {
+        stmt->batch_length = batch.len;
+        stmt->batch_count++;
+    }
+    return ok;
+}
+
+bool qury_batch_execute(qury_stmt_t *stmt) {
+    assert(stmt != NULL);
+    MYSQL *mysql = stmt->conn->mysql;
+
+    if (stmt->batch_count == 0) {
+        return false;
+    }
+    stmt->error = QURY_ErrNone;
+    _qury_result_begin(stmt);
+    if (stmt->res) {
+        mysql_free_result(stmt->res);
+        stmt->res = NULL;
+    }
+    stmt->text_protocol = true;
+    if (mysql_set_server_option(mysql, MYSQL_OPTION_MULTI_STATEMENTS_ON)) {
+        fprintf(stderr, "mysql_set_server_option : %s\n", mysql_error(mysql));
+        return false;
+    }
+    stmt->batch_pending = true;
+
+    bool ok = mysql_real_query(mysql, stmt->batch, stmt->batch_length) == 0;
+    stmt->batch_length = 0;
+    stmt->batch_count = 0;
+    if (!ok) {
+        fprintf(stderr, "mysql_real_query : %s\n", mysql_error(mysql));
+        _qury_batch_end(stmt);
+        return false;
+    }
+    stmt->query_executed = true;
+    return _qury_text_result(stmt);
+}
+
+static void _qury_check_out_params(qury_stmt_t *stmt);
+
+static void _qury_load_result(qury_stmt_t *stmt) {
+    if (!stmt->result_bounded) {
+        MYSQL_RES *meta = mysql_stmt_result_metadata(stmt->stmt);
+        if (meta != NULL) {
+            _qury_load_fields(stmt, meta);
+            mysql_free_result(meta);
+        }
+        stmt->result_bounded = true;
+    }
+}
+
+/* mariadb_stmt_execute_direct needs a MariaDB server 10.2 or later */
+static bool _qury_execute_direct_supported(qury_stmt_t *stmt) {
+    MYSQL *mysql = stmt->conn->mysql;
+    return mariadb_connection(mysql)
+           && mysql_get_server_version(mysql) >= 100200;
+}
+
+static bool _qury_execute_direct(qury_stmt_t *stmt, const char *query,
+                                 size_t length) {
+    stmt->error = QURY_ErrNone;
+    _qury_result_begin(stmt);
+    _qury_deadline_begin(stmt);
+    if (mariadb_stmt_execute_direct(stmt->stmt, query, length)) {
+        fprintf(stderr, "mariadb_stmt_execute_direct : %s\n",
+                mysql_stmt_error(stmt->stmt));
+        return false;
+    }
+    stmt->query_executed = true;
+    _qury_load_result(stmt);
+    _qury_check_out_params(stmt);
+    return _qury_store_result(stmt);
+}
+
+bool qury_prepare_execute(qury_stmt_t *stmt, const char *query, size_t length,
+                          const qury_param_t *params) {
+    assert(stmt != NULL);
+    assert(query != NULL);
+
+    if (!_qury_parse(stmt, query, length)) {
+        return false;
+    }
+    stmt->text_protocol = false;
+
+    bool long_data = false;
+    for (; params && params->name; params++) {
+        if (!qury_stmt_bind(stmt, params->name, params->ptr, params->vlen,
+                            params->type)) {
+            return false;
+        }
+        if (params->type & QURY_DataCallback) {
+            long_data = true;
+        }
+    }
+
+    /* long data is sent for an already prepared statement, so it goes the
+     * usual way as well as servers without direct execution */
+    if (long_data || !_qury_execute_direct_supported(stmt)) {
+        return _qury_prepare_server(stmt) && qury_execute(stmt);
+    }
+
+    unsigned int count = (unsigned int)array_size(&stmt->params);
+    if (mysql_stmt_attr_set(stmt->stmt, STMT_ATTR_PREBIND_PARAMS, &count)
+        || (count > 0 && mysql_stmt_bind_param(stmt->stmt, stmt->binds))) {
+        fprintf(stderr, "mysql_stmt_bind_param : %s\n",
+                mysql_stmt_error(stmt->stmt));
+        return false;
+    }
+    stmt->params_bounded = true;
+
+    size_t server_length = 0;
+    const char *server_query = _qury_server_query(stmt, &server_length);
+    if (!server_query) {
+        return false;
+    }
+    /* traced and timed as qury_execute, the rows are added when the result
+     * is read */
+    QURY_TRACE3(execute__start, stmt, stmt->query, stmt->query_length);
+    uint64_t start = stmt->digest ? _qury_now_ns() : 0;
+    bool ok = _qury_deadline_executed(
+        stmt, _qury_execute_direct(stmt, server_query, server_length));
+    if (stmt->digest) {
+        qury_digest_record(stmt->digest, _qury_now_ns() - start, ok);
+    }
+    QURY_TRACE3(execute__done, stmt, ok,
+                ok && stmt->buffered ? qury_num_rows(stmt) : 0);
+    return ok;
+}
+
+static bool _qury_execute(qury_stmt_t *stmt) {
+    stmt->error = QURY_ErrNone;
+    _qury_result_begin(stmt);
+    _qury_deadline_begin(stmt);
+    if (stmt->text_protocol) {
+        return _qury_execute_text(stmt);
+    }
+
+    if (!stmt->params_bounded) {
         if (mysql_stmt_bind_param(stmt->stmt, stmt->binds)) {
             fprintf(stderr, "mysq_stmt_bind_param : %s\n",
                     mysql_stmt_error(stmt->stmt));
@@ -608,15 +1698,18 @@ bool qury_execute(qury_stmt_t *stmt) {
     uintptr_t value = 0;
     array_foreach(&stmt->params, index, value) {
         qury_bind_t *param = (qury_bind_t *)value;
-        uint8_t buffer[DATA_CALLBACK_BUFFER_SIZE] = {0};
         if (param->type & QURY_DataCallback) {
+            uint8_t buffer[DATA_CALLBACK_BUFFER_SIZE];
             size_t rlen = 0;
             while ((rlen = param->value.cb(buffer, DATA_CALLBACK_BUFFER_SIZE)) > 0) {
-                if (!mysql_stmt_send_long_data(stmt->stmt, index, (const char *)buffer,
-                                               rlen)) {
-                    break;
+                QURY_TRACE3(long__data, stmt, index, rlen);
+                /* zero is success */
+                if (mysql_stmt_send_long_data(stmt->stmt, index,
+                                              (const char *)buffer, rlen)) {
+                    fprintf(stderr, "mysql_stmt_send_long_data : %s\n",
+                            mysql_stmt_error(stmt->stmt));
+                    return false;
                 }
-                rlen = 0;
             }
         }
     }
@@ -627,45 +1720,269 @@ bool qury_execute(qury_stmt_t *stmt) {
     }
 
     stmt->query_executed = true;
+    _qury_load_result(stmt);
+    return _qury_store_result(stmt);
+}
 
-    if (!stmt->result_bounded) {
-        MYSQL_RES *meta = mysql_stmt_result_metadata(stmt->stmt);
-        MYSQL_FIELD *field = NULL;
-        if (meta != NULL) {
-            stmt->field_cnt = mysql_num_fields(meta);
-            if (stmt->field_cnt > 0) {
-                if (stmt->fields.capacity > 0) {
-                    array_clear(&stmt->fields);
-                } else {
-                    array_init(&stmt->fields, stmt->field_cnt, MemoryAllocator,
-                               stmt->allocator);
-                }
-                while ((field = mysql_fetch_field(meta)) != NULL) {
-                    qury_field_name_t *f = MemoryAllocator->alloc(
-                                                                  stmt->allocator, sizeof(qury_field_name_t));
-                    f->type = field->type;
-                    f->charsetnr = field->charsetnr;
-                    f->flags = field->flags;
-                    f->decimals = field->decimals;
-                    f->name = MemoryAllocator->strndup(stmt->allocator, field->name,
-                                                       field->name_length);
-                    f->org_name = MemoryAllocator->strndup(
-                                                           stmt->allocator, field->org_name, field->org_name_length);
-                    f->table = MemoryAllocator->strndup(stmt->allocator, field->table,
-                                                        field->table_length);
-                    array_push(&stmt->fields, (uintptr_t)f);
-                }
+bool qury_execute(qury_stmt_t *stmt) {
+    assert(stmt != NULL);
+
+    QURY_TRACE3(execute__start, stmt, stmt->query, stmt->query_length);
+    uint64_t start = stmt->digest ? _qury_now_ns() : 0;
+    bool ok = _qury_deadline_executed(stmt, _qury_execute(stmt));
+    if (stmt->digest) {
+        qury_digest_record(stmt->digest, _qury_now_ns() - start, ok);
+    }
+    QURY_TRACE3(execute__done, stmt, ok,
+                ok && stmt->buffered ? qury_num_rows(stmt) : 0);
+    return ok;
+}
+
+/* OUT parameters of a CALL come as a result flagged by the server */
+static void _qury_check_out_params(qury_stmt_t *stmt) {
+    unsigned int status = 0;
+    stmt->out_params = false;
+    if (!mariadb_get_infov(stmt->conn->mysql, MARIADB_CONNECTION_SERVER_STATUS,
+                           &status)) {
+        stmt->out_params = (status & SERVER_PS_OUT_PARAMS) != 0;
+    }
+}
+
+bool qury_next_result(qury_stmt_t *stmt) {
+    assert(stmt != NULL);
+
+    if (stmt->text_protocol) {
+        MYSQL *mysql = stmt->conn->mysql;
+        qury_pipeline_stop(stmt->pipeline);
+        if (stmt->res) {
+            /* reads what is left of an unbuffered result */
+            mysql_free_result(stmt->res);
+            stmt->res = NULL;
+        }
+        int rc = mysql_next_result(mysql);
+        if (rc != 0) {
+            if (rc > 0) {
+                fprintf(stderr, "mysql_next_result : %s\n", mysql_error(mysql));
             }
-            mysql_free_result(meta);
+            _qury_batch_end(stmt);
+            return false;
+        }
+        return _qury_text_result(stmt);
+    }
+
+    mysql_stmt_free_result(stmt->stmt);
+    int rc = mysql_stmt_next_result(stmt->stmt);
+    if (rc != 0) {
+        if (rc > 0) {
+            fprintf(stderr, "mysql_stmt_next_result : %s\n",
+                    mysql_stmt_error(stmt->stmt));
+        }
+        return false;
+    }
+    /* each result has its own layout, the library forgets the bound result */
+    stmt->result_bounded = false;
+    stmt->values_bounded = false;
+    if (mysql_stmt_field_count(stmt->stmt) == 0) {
+        stmt->field_cnt = 0;
+        stmt->out_params = false;
+        return true;
+    }
+    _qury_load_result(stmt);
+    _qury_check_out_params(stmt);
+    return _qury_store_result(stmt);
+}
+
+uint64_t qury_affected_rows(qury_stmt_t *stmt) {
+    assert(stmt != NULL);
+    if (stmt->text_protocol) {
+        return mysql_affected_rows(stmt->conn->mysql);
+    }
+    return mysql_stmt_affected_rows(stmt->stmt);
+}
+
+static uint64_t _qury_text_to_int(qury_field_name_t *field, const char *s,
+                                  size_t len) {
+    if (field->type == MYSQL_TYPE_BIT) {
+        /* BIT is sent as big endian bytes */
+        uint64_t v = 0;
+        for (size_t i = 0; i < len; i++) {
+            v = (v << 8) | (uint8_t)s[i];
+        }
+        return v;
+    }
+    if (field->flags & UNSIGNED_FLAG) {
+        return strtoull(s, NULL, 10);
+    }
+    return (uint64_t)strtoll(s, NULL, 10);
+}
+
+static unsigned int _qury_text_digits(const char *s, size_t len, size_t *i,
+                                      size_t max) {
+    unsigned int v = 0;
+    for (size_t n = 0; *i < len && n < max && s[*i] >= '0' && s[*i] <= '9';
+         n++, (*i)++) {
+        v = v * 10 + (s[*i] - '0');
+    }
+    return v;
+}
+
+/* parse "YYYY-MM-DD", "YYYY-MM-DD hh:mm:ss[.ffffff]" or "[-]h:mm:ss[.ffffff]"
+ */
+static void _qury_text_to_time(const char *s, size_t len, MYSQL_TIME *t) {
+    size_t i = 0;
+    memset(t, 0, sizeof(*t));
+    if (len >= 10 && s[4] == '-') {
+        t->year = _qury_text_digits(s, len, &i, 4);
+        i++;
+        t->month = _qury_text_digits(s, len, &i, 2);
+        i++;
+        t->day = _qury_text_digits(s, len, &i, 2);
+        t->time_type = MYSQL_TIMESTAMP_DATE;
+        if (i >= len || (s[i] != ' ' && s[i] != 'T')) {
+            return;
+        }
+        i++;
+        t->time_type = MYSQL_TIMESTAMP_DATETIME;
+    } else {
+        t->time_type = MYSQL_TIMESTAMP_TIME;
+        if (i < len && s[i] == '-') {
+            t->neg = 1;
+            i++;
+        }
+    }
+    /* TIME hours can have more than two digits */
+    t->hour = _qury_text_digits(s, len, &i, 4);
+    if (i < len && s[i] == ':') {
+        i++;
+        t->minute = _qury_text_digits(s, len, &i, 2);
+    }
+    if (i < len && s[i] == ':') {
+        i++;
+        t->second = _qury_text_digits(s, len, &i, 2);
+    }
+    if (i < len && s[i] == '.') {
+        size_t start = ++i;
+        t->second_part = _qury_text_digits(s, len, &i, 6);
+        for (size_t n = i - start; n < 6; n++) {
+            t->second_part *= 10;
+        }
+    }
+}
+
+static bool _qury_fetch_text(qury_stmt_t *stmt) {
+    if (!stmt->res) {
+        return false;
+    }
+    MYSQL_ROW row = NULL;
+    unsigned long *lengths = NULL;
+    if (stmt->pipeline) {
+        /* read ahead by the reader thread */
+        row = qury_pipeline_next(stmt->pipeline, &lengths);
+        if (!row) {
+            qury_pipeline_stop(stmt->pipeline);
+        }
+    } else {
+        row = mysql_fetch_row(stmt->res);
+        lengths = row ? mysql_fetch_lengths(stmt->res) : NULL;
+    }
+    if (!row) {
+        if (mysql_errno(stmt->conn->mysql)) {
+            fprintf(stderr, "mysql_fetch_row : %s\n",
+                    mysql_error(stmt->conn->mysql));
+        }
+        _qury_result_done(stmt);
+        return false;
+    }
+    stmt->result_rows++;
+
+    for (int i = 0; i < stmt->field_cnt; i++) {
+        qury_bind_t *mybind = ((qury_bind_t *)array_get(&stmt->values, i));
+        memset(&mybind->value, 0, sizeof(qury_bind_value_t));
+        mybind->is_null = row[i] == NULL;
+        mybind->length = lengths[i];
+        stmt->result_bytes += lengths[i];
+        if (mybind->is_null) {
+            continue;
+        }
+        switch (mybind->type) {
+            case QURY_Integer: {
+                mybind->value.i = _qury_text_to_int(
+                    (qury_field_name_t *)array_get(&stmt->fields, i), row[i],
+                    lengths[i]);
+            } break;
+            case QURY_Float: {
+                mybind->value.f = strtod(row[i], NULL);
+            } break;
+            case QURY_CString: {
+                /* rows are nul terminated by libmariadb */
+                mybind->value.cstr = row[i];
+            } break;
+            case QURY_OString: {
+                mybind->value.ostr.ptr = (uint8_t *)row[i];
+                mybind->value.ostr.len = lengths[i];
+            } break;
+            case QURY_DateTime: {
+                _qury_text_to_time(row[i], lengths[i], &mybind->value.dt);
+            } break;
+            case QURY_Decimal: {
+                qury_decimal_parse(row[i], lengths[i], &mybind->value.dec);
+            } break;
+            default: {
+            } break;
         }
-        stmt->result_bounded = true;
     }
     return true;
 }
 
-bool qury_fetch(qury_stmt_t *stmt) {
+/* steps of the row decode plan, see qury_decode_op_t */
+#define _QURY_DecodeString 1
+#define _QURY_DecodeDecimal 2
+
+/* capacity of an owned buffer holding need bytes */
+static size_t _qury_bind_capacity(qury_bind_t *bind, size_t need) {
+    size_t capacity = bind->capacity > 0 ? bind->capacity : 32;
+    while (capacity < need) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+/* grow the owned buffer of a parameter or value, never shrinks */
+static bool _qury_bind_reserve(qury_stmt_t *stmt, qury_bind_t *bind,
+                               size_t need) {
+    if (need <= bind->capacity) {
+        return true;
+    }
+    size_t capacity = _qury_bind_capacity(bind, need);
+    void *tmp = _qury_realloc(stmt, stmt->allocator, bind->buffer,
+                              bind->capacity, capacity);
+    if (!tmp) {
+        return false;
+    }
+    bind->buffer = tmp;
+    bind->capacity = capacity;
+    return true;
+}
+
+static bool _qury_fetch(qury_stmt_t *stmt) {
+    if (stmt->text_protocol) {
+        return _qury_fetch_text(stmt);
+    }
+    if (stmt->field_cnt == 0) {
+        return false;
+    }
+
     if (!stmt->results) {
-        stmt->results = MemoryAllocator->alloc(stmt->allocator,
+        /* the decode plan follows the layout, it is compiled with the
+         * result binds */
+        stmt->plan = _qury_alloc(stmt, stmt->meta_allocator,
+                                 sizeof(qury_decode_op_t) * stmt->field_cnt);
+        if (!stmt->plan) {
+            return false;
+        }
+        stmt->plan_ops = 0;
+        stmt->plan_fixed_bytes = 0;
+        stmt->results = _qury_alloc(stmt, stmt->meta_allocator,
                                                sizeof(MYSQL_BIND)
                                                * stmt->field_cnt);
         if (!stmt->results) {
@@ -675,14 +1992,14 @@ bool qury_fetch(qury_stmt_t *stmt) {
             array_clear(&stmt->values);
         } else {
             if (!array_init(&stmt->values, stmt->field_cnt, MemoryAllocator,
-                            stmt->allocator)) {
+                            stmt->meta_allocator)) {
                 return false;
             }
         }
 
         for (int i = 0; i < stmt->field_cnt; i++) {
             qury_bind_t *mybind =
-                MemoryAllocator->alloc(stmt->allocator, sizeof(qury_bind_t));
+                _qury_alloc(stmt, stmt->meta_allocator, sizeof(qury_bind_t));
             if (!mybind) {
                 return false;
             }
@@ -693,7 +2010,7 @@ bool qury_fetch(qury_stmt_t *stmt) {
             memset(&stmt->results[i], 0, sizeof(MYSQL_BIND));
             mybind->name = field->name;
             mybind->is_null = false;
-            mybind->is_unsigned = false;
+            mybind->is_unsigned = !!(field->flags & UNSIGNED_FLAG);
             mybind->length = 0;
             mybind->type = _mtype_to_qurytype(field->type, field->charsetnr);
 
@@ -703,8 +2020,12 @@ bool qury_fetch(qury_stmt_t *stmt) {
             }
             stmt->results[i].buffer_length = 0;
             stmt->results[i].buffer = NULL;
+            stmt->results[i].is_unsigned = mybind->is_unsigned;
+            /* the library keeps a copy of the binds, indicators must point
+             * to our values */
+            stmt->results[i].is_null = (my_bool *)&mybind->is_null;
             stmt->results[i].error = &mybind->error;
-            stmt->results[i].length = &mybind->length;
+            stmt->results[i].length = (unsigned long *)&mybind->length;
             switch (mybind->type) {
                 case QURY_Null: {
                     mybind->length = sizeof(uint64_t);
@@ -732,88 +2053,103 @@ bool qury_fetch(qury_stmt_t *stmt) {
                     stmt->results[i].buffer = &mybind->value.dt;
                     stmt->results[i].buffer_length = mybind->length;
                 } break;
+                case QURY_Decimal: {
+                    /* fetch the decimal text as is, no conversion to double */
+                    stmt->results[i].buffer_type = MYSQL_TYPE_STRING;
+                    stmt->results[i].buffer = _qury_alloc(
+                        stmt, stmt->meta_allocator, QURY_DECIMAL_SIZE);
+                    if (!stmt->results[i].buffer) {
+                        return false;
+                    }
+                    stmt->results[i].buffer_length = QURY_DECIMAL_SIZE;
+                } break;
                 default: {
                 } break;
             }
-            array_push(&stmt->values, (uintptr_t)mybind);
-        }
-        mysql_stmt_bind_result(stmt->stmt, stmt->results);
-    } else {
-        /* nullify strings buffer so we get the size we need to allocated */
-        for (int i = 0; i < stmt->field_cnt; i++) {
-            qury_bind_t *mybind = ((qury_bind_t *)array_get(&stmt->values, i));
-            memset(&mybind->value, 0, sizeof(qury_bind_value_t));
             switch (mybind->type) {
                 case QURY_CString:
-                case QURY_OString: {
-                    stmt->results[i].buffer = NULL;
-                    stmt->results[i].length_value = 0;
-                    stmt->results[i].buffer_length = 0;
-                } break;
+                case QURY_OString:
+                    stmt->plan[stmt->plan_ops++] = (qury_decode_op_t){
+                        _QURY_DecodeString, (uint32_t)i, mybind};
+                    break;
+                case QURY_Decimal:
+                    stmt->plan[stmt->plan_ops++] = (qury_decode_op_t){
+                        _QURY_DecodeDecimal, (uint32_t)i, mybind};
+                    break;
+                default:
+                    stmt->plan_fixed_bytes += mybind->length;
+                    break;
             }
+            array_push(&stmt->values, (uintptr_t)mybind);
         }
+        stmt->values_bounded = false;
+    }
+    if (!stmt->values_bounded) {
+        if (mysql_stmt_bind_result(stmt->stmt, stmt->results)) {
+            fprintf(stderr, "mysql_stmt_bind_result : %s\n",
+                    mysql_stmt_error(stmt->stmt));
+            return false;
+        }
+        stmt->values_bounded = true;
     }
 
     int status = mysql_stmt_fetch(stmt->stmt);
-    if (status == 1 || status == MYSQL_NO_DATA)
+    if (status == 1 || status == MYSQL_NO_DATA) {
+        _qury_result_done(stmt);
         return false;
+    }
+    stmt->result_rows++;
 
-    for (int i = 0; i < stmt->field_cnt; i++) {
-        qury_bind_t *mybind = ((qury_bind_t *)array_get(&stmt->values, i));
-        switch (mybind->type) {
-            case QURY_CString: {
-                mybind->is_null = false;
-                if (mybind->length == 0) {
-                    mybind->is_null = true;
-                    break;
-                }
-                void *tmp =
-                    MemoryAllocator->realloc(stmt->allocator, mybind->value.cstr,
-                                             sizeof(uint8_t) * (mybind->length + 1));
-                if (!tmp) {
-                    break;
-                }
-                mybind->value.cstr = tmp;
-                mybind->value.cstr[mybind->length] = '\0';
-                stmt->results[i].buffer = mybind->value.cstr;
-                stmt->results[i].buffer_length = mybind->length;
-                if (mysql_stmt_fetch_column(stmt->stmt, &stmt->results[i], i, 0) != 0) {
-                    break;
-                }
-            } break;
-            case QURY_OString: {
-                mybind->is_null = false;
-                if (mybind->length == 0) {
-                    mybind->is_null = true;
-                    break;
-                }
-                void *tmp =
-                    MemoryAllocator->realloc(stmt->allocator, mybind->value.ostr.ptr,
-                                             sizeof(uint8_t) * (mybind->length));
-                if (!tmp) {
-                    break;
-                }
-                mybind->value.ostr.ptr = tmp;
-                mybind->value.ostr.len = mybind->length;
-                stmt->results[i].buffer = mybind->value.ostr.ptr;
-                stmt->results[i].buffer_length = mybind->length;
-
-                if (mysql_stmt_fetch_column(stmt->stmt, &stmt->results[i], i, 0) != 0) {
-                    break;
-                }
-            } break;
-            default: {
-                mybind->is_unsigned = !!stmt->results[i].is_unsigned;
-                mybind->is_null =
-                    !!(stmt->results[i].is_null == 0 ? stmt->results[i].is_null_value
-                       : true);
-            } break;
+    /* fixed width columns are already in place, only the steps of the plan
+     * are left, none when all columns are fixed width */
+    stmt->result_bytes += stmt->plan_fixed_bytes;
+    const qury_decode_op_t *end = stmt->plan + stmt->plan_ops;
+    for (const qury_decode_op_t *op = stmt->plan; op < end; op++) {
+        qury_bind_t *mybind = op->bind;
+        stmt->result_bytes += mybind->length;
+        if (op->op == _QURY_DecodeDecimal) {
+            if (!mybind->is_null) {
+                qury_decimal_parse(stmt->results[op->column].buffer,
+                                   mybind->length, &mybind->value.dec);
+            }
+            continue;
         }
+        mybind->chunked = false;
+        mybind->lazy = false;
+        memset(&mybind->value, 0, sizeof(mybind->value));
+        if (mybind->is_null) {
+            continue;
+        }
+        /* only the length was fetched, the value stays in the row until
+         * qury_get_column_value, if it fits the budget */
+        if (mybind->length + 1 > mybind->capacity
+            && !_qury_mem_fits(stmt,
+                               _qury_bind_capacity(mybind, mybind->length + 1)
+                                   - mybind->capacity)) {
+            if (stmt->chunked_columns) {
+                /* see qury_read_column */
+                mybind->chunked = true;
+                continue;
+            }
+            stmt->error = QURY_ErrMemoryBudget;
+            fprintf(stderr, "qury_fetch : cannot allocate %zu bytes for %s\n",
+                    mybind->length + 1, mybind->name);
+            _qury_result_done(stmt);
+            return false;
+        }
+        mybind->lazy = true;
     }
 
     return true;
 }
 
+bool qury_fetch(qury_stmt_t *stmt) {
+    QURY_TRACE1(fetch__start, stmt);
+    bool ok = _qury_fetch(stmt);
+    QURY_TRACE4(fetch__done, stmt, ok, stmt->result_rows, stmt->result_bytes);
+    return ok;
+}
+
 bool qury_stmt_bind(qury_stmt_t *stmt, const char *name, quryptr_t ptr,
                     size_t vlen, qury_bind_value_type_t type) {
     assert(stmt != NULL);
@@ -827,17 +2163,27 @@ bool qury_stmt_bind(qury_stmt_t *stmt, const char *name, quryptr_t ptr,
     array_foreach(&stmt->params, index, value) {
         qury_bind_t *param = (qury_bind_t *)value;
         if (strcasecmp(param->name, name) == 0) {
-            memset(stmt->binds + index, 0, sizeof(*stmt->binds));
+            /* rebind in place, only what the library copied matters */
             MYSQL_BIND *mybind = stmt->binds + index;
-            mybind->length = &param->length;
+            void *previous_buffer = mybind->buffer;
+            enum enum_field_types previous_type = mybind->buffer_type;
+            my_bool *previous_null = mybind->is_null;
+            my_bool previous_unsigned = mybind->is_unsigned;
+            mybind->length = (unsigned long *)&param->length;
             mybind->error = &param->error;
-            stmt->binds[index].is_null = 0;
-            switch (type) {
+            mybind->is_null = NULL;
+            mybind->buffer_length = 0;
+            mybind->is_unsigned = 0;
+            param->is_null = false;
+            param->is_unsigned = false;
+            switch (type & ~QURY_Flags) {
                 case QURY_Integer: {
                     memcpy(&param->value.i, &ptr, sizeof(quryptr_t));
                     param->length = sizeof(quryptr_t);
                     mybind->buffer = &param->value.i;
                     mybind->buffer_type = MYSQL_TYPE_LONGLONG;
+                    param->is_unsigned = !!(type & QURY_Unsigned);
+                    mybind->is_unsigned = param->is_unsigned;
                 } break;
                 case QURY_Bool: {
                     /* char is big enough */
@@ -854,14 +2200,23 @@ bool qury_stmt_bind(qury_stmt_t *stmt, const char *name, quryptr_t ptr,
                 } break;
                 case QURY_CString: {
                     if ((uintptr_t)ptr != 0) {
+                        const char *str = (const char *)(uintptr_t)ptr;
                         if (type & QURY_DataCallback) {
                             param->value.cb = (qury_data_callback)ptr;
+                            mybind->buffer = NULL;
+                        } else if (type & QURY_Borrowed) {
+                            param->length = strlen(str);
+                            param->value.cstr = (char *)str;
+                            mybind->buffer = param->value.cstr;
                         } else {
-                            param->length = strlen((const char *)(uintptr_t)ptr);
-                            param->value.cstr = MemoryAllocator->strndup(
-                                                                         stmt->allocator, (const char *)(uintptr_t)ptr, param->length);
+                            param->length = strlen(str);
+                            if (!_qury_bind_reserve(stmt, param,
+                                                    param->length + 1)) {
+                                return false;
+                            }
+                            memcpy(param->buffer, str, param->length + 1);
+                            param->value.cstr = param->buffer;
                             mybind->buffer = param->value.cstr;
-                            mybind->length = &param->length;
                         }
                         mybind->buffer_type = MYSQL_TYPE_STRING;
                         break;
@@ -870,20 +2225,51 @@ bool qury_stmt_bind(qury_stmt_t *stmt, const char *name, quryptr_t ptr,
                 } break;
                 case QURY_OString: {
                     if ((uintptr_t)ptr != 0 && vlen > 0) {
+                        const void *bytes = (const void *)(uintptr_t)ptr;
                         if (type & QURY_DataCallback) {
                             param->value.cb = (qury_data_callback)ptr;
+                            mybind->buffer = NULL;
+                        } else if (type & QURY_Borrowed) {
+                            param->value.ostr.ptr = (uint8_t *)bytes;
+                            param->value.ostr.len = vlen;
+                            param->length = vlen;
+                            mybind->buffer = param->value.ostr.ptr;
                         } else {
-                            param->value.ostr.ptr = MemoryAllocator->memdup(
-                                                                            stmt->allocator, (const void *)(uintptr_t)ptr, vlen);
+                            if (!_qury_bind_reserve(stmt, param, vlen)) {
+                                return false;
+                            }
+                            memcpy(param->buffer, bytes, vlen);
+                            param->value.ostr.ptr = param->buffer;
                             param->value.ostr.len = vlen;
+                            param->length = vlen;
                             mybind->buffer = param->value.ostr.ptr;
-                            mybind->length = &param->value.ostr.len;
                         }
                         mybind->buffer_type = MYSQL_TYPE_BLOB;
                         break;
                     }
                     goto set_param_null;
                 } break;
+                case QURY_Decimal: {
+                    if ((uintptr_t)ptr == 0) {
+                        goto set_param_null;
+                    }
+                    /* sent as text, the server converts it */
+                    const qury_decimal_t *dec =
+                        (const qury_decimal_t *)(uintptr_t)ptr;
+                    if (!_qury_bind_reserve(stmt, param, QURY_DECIMAL_SIZE)) {
+                        return false;
+                    }
+                    param->length = qury_decimal_format(*dec, param->buffer,
+                                                        QURY_DECIMAL_SIZE);
+                    if (param->length == 0) {
+                        fprintf(stderr, "qury_stmt_bind : %s overflows\n",
+                                name);
+                        return false;
+                    }
+                    param->value.cstr = param->buffer;
+                    mybind->buffer = param->value.cstr;
+                    mybind->buffer_type = MYSQL_TYPE_NEWDECIMAL;
+                } break;
 
                 default:
                     type = QURY_Null;
@@ -891,33 +2277,223 @@ bool qury_stmt_bind(qury_stmt_t *stmt, const char *name, quryptr_t ptr,
                 case QURY_Null: {
 set_param_null:
                     /* no value for null */
-                    stmt->binds[index].is_null = (char *)&param->is_null;
+                    param->is_null = true;
+                    stmt->binds[index].is_null = (my_bool *)&param->is_null;
                     param->length = 0;
                     mybind->buffer_type = MYSQL_TYPE_NULL;
                     mybind->buffer = NULL;
                 } break;
             }
             param->type = type;
+            if (mybind->buffer != previous_buffer
+                || mybind->buffer_type != previous_type
+                || mybind->is_null != previous_null
+                || mybind->is_unsigned != previous_unsigned) {
+                stmt->params_bounded = false;
+            }
         }
     }
     return true;
 }
 
-qury_bind_t *qury_get_field_value(qury_stmt_t *stmt, const char *name) {
-    size_t i = 0;
-    for (i = 0; i < array_size(&stmt->fields); i++) {
+int qury_field_index(qury_stmt_t *stmt, const char *name) {
+    assert(stmt != NULL);
+    assert(name != NULL);
+    for (size_t i = 0; i < array_size(&stmt->fields); i++) {
         qury_field_name_t *field = (qury_field_name_t *)array_get(&stmt->fields, i);
         if (field->name && strcmp(name, field->name) == 0) {
-            break;
+            return (int)i;
         }
         if (field->org_name && strcmp(name, field->org_name) == 0) {
-            break;
+            return (int)i;
         }
     }
-    if (i >= array_size(&stmt->fields)) {
+    return -1;
+}
+
+/* copy a value left in the row by qury_fetch */
+static bool _qury_value_load(qury_stmt_t *stmt, size_t column,
+                             qury_bind_t *v) {
+    if (!_qury_bind_reserve(stmt, v, v->length + 1)) {
+        fprintf(stderr, "qury_get_column_value : cannot allocate %zu bytes "
+                        "for %s\n",
+                v->length + 1, v->name);
+        return false;
+    }
+    if (v->length > 0) {
+        /* a copy, the bound results still fetch lengths only */
+        MYSQL_BIND bind = stmt->results[column];
+        unsigned long length = 0;
+        bind.buffer = v->buffer;
+        bind.buffer_length = v->capacity;
+        bind.length = &length;
+        if (mysql_stmt_fetch_column(stmt->stmt, &bind, (unsigned int)column,
+                                    0)) {
+            fprintf(stderr, "mysql_stmt_fetch_column : %s\n",
+                    mysql_stmt_error(stmt->stmt));
+            return false;
+        }
+    }
+    if (v->type == QURY_CString) {
+        v->value.cstr = v->buffer;
+        v->value.cstr[v->length] = '\0';
+    } else {
+        v->value.ostr.ptr = v->buffer;
+        v->value.ostr.len = v->length;
+    }
+    v->lazy = false;
+    return true;
+}
+
+qury_bind_t *qury_get_column_value(qury_stmt_t *stmt, size_t column) {
+    assert(stmt != NULL);
+    if (column >= (size_t)stmt->field_cnt
+        || column >= array_size(&stmt->values)) {
+        return NULL;
+    }
+    qury_bind_t *v = (qury_bind_t *)array_get(&stmt->values, column);
+    if (v->lazy && !stmt->text_protocol && !_qury_value_load(stmt, column, v)) {
         return NULL;
     }
-    return (qury_bind_t *)array_get(&stmt->values, i);
+    return v;
+}
+
+qury_bind_t *qury_get_field_value(qury_stmt_t *stmt, const char *name) {
+    int i = qury_field_index(stmt, name);
+    if (i < 0) {
+        return NULL;
+    }
+    return qury_get_column_value(stmt, (size_t)i);
+}
+
+size_t qury_read_column(qury_stmt_t *stmt, size_t column, size_t offset,
+                        void *buffer, size_t length) {
+    assert(stmt != NULL);
+    assert(buffer != NULL);
+    if (column >= (size_t)stmt->field_cnt
+        || column >= array_size(&stmt->values)) {
+        return 0;
+    }
+    qury_bind_t *v = (qury_bind_t *)array_get(&stmt->values, column);
+    if (v->is_null || (v->type != QURY_CString && v->type != QURY_OString)
+        || offset >= v->length || length == 0) {
+        return 0;
+    }
+    size_t n = v->length - offset < length ? v->length - offset : length;
+    if (stmt->text_protocol) {
+        /* the whole row is in the client library */
+        const uint8_t *data = v->type == QURY_CString
+                                  ? (const uint8_t *)v->value.cstr
+                                  : v->value.ostr.ptr;
+        memcpy(buffer, data + offset, n);
+        return n;
+    }
+    if (!v->chunked && !v->lazy) {
+        memcpy(buffer, (const uint8_t *)v->buffer + offset, n);
+        return n;
+    }
+    MYSQL_BIND bind;
+    unsigned long total = 0;
+    my_bool is_null = 0;
+    my_bool error = 0;
+    memset(&bind, 0, sizeof(bind));
+    /* bytes, a string buffer would get a nul byte */
+    bind.buffer_type = MYSQL_TYPE_BLOB;
+    bind.buffer = buffer;
+    bind.buffer_length = n;
+    bind.length = &total;
+    bind.is_null = &is_null;
+    bind.error = &error;
+    if (mysql_stmt_fetch_column(stmt->stmt, &bind, (unsigned int)column,
+                                (unsigned long)offset)) {
+        fprintf(stderr, "mysql_stmt_fetch_column : %s\n",
+                mysql_stmt_error(stmt->stmt));
+        return 0;
+    }
+    return n;
 }
 
 void qury_stmt_reset(qury_stmt_t *stmt) { mysql_stmt_reset(stmt->stmt); }
+
+#if defined(__GNUC__)
+#define _QURY_EPOCH_LANES 4
+typedef int64_t _qury_v64 __attribute__((vector_size(sizeof(int64_t)
+                                                     * _QURY_EPOCH_LANES)));
+
+/* x / 100 for 0 <= x < 43699 */
+#define _qury_div100(x) (((x) * 5243) >> 19)
+
+/* qury_time_to_epoch_us on _QURY_EPOCH_LANES values, vector comparisons
+ * give -1 for true so they are used as masks */
+static void _qury_epoch_lanes(const MYSQL_TIME *t, int64_t *out) {
+    _qury_v64 y, mon_days, after_feb, day, us, is_time, neg;
+    for (int l = 0; l < _QURY_EPOCH_LANES; l++) {
+        y[l] = t[l].year;
+        mon_days[l] = _qury_days_before_month[t[l].month > 12 ? 0 : t[l].month];
+        after_feb[l] = t[l].month > 2;
+        day[l] = t[l].day;
+        us[l] = ((int64_t)t[l].hour * 3600 + (int64_t)t[l].minute * 60
+                 + (int64_t)t[l].second)
+                    * 1000000
+                + (int64_t)t[l].second_part;
+        is_time[l] = -(int64_t)(t[l].time_type == MYSQL_TIMESTAMP_TIME);
+        neg[l] = -(int64_t)(t[l].neg != 0);
+    }
+    _qury_v64 yy = y + 399;
+    _qury_v64 c = _qury_div100(yy);
+    _qury_v64 yc = _qury_div100(y);
+    _qury_v64 leap = ((y & 3) == 0) & (((y - yc * 100) != 0) | ((yc & 3) == 0));
+    _qury_v64 days = yy * 365 + (yy >> 2) - c + (c >> 2) - 146097 + mon_days
+                     + (leap & after_feb) + day - 1 - 719162;
+    _qury_v64 epoch = days * 86400000000LL + us;
+    _qury_v64 duration = (us ^ neg) - neg;
+    _qury_v64 r = (duration & is_time) | (epoch & ~is_time);
+    memcpy(out, &r, sizeof(r));
+}
+#endif
+
+void qury_time_to_epoch_us_batch(const MYSQL_TIME *t, size_t n, int64_t *out) {
+    size_t i = 0;
+#ifdef _QURY_EPOCH_LANES
+    for (; i + _QURY_EPOCH_LANES <= n; i += _QURY_EPOCH_LANES) {
+        _qury_epoch_lanes(&t[i], &out[i]);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = qury_time_to_epoch_us(&t[i]);
+    }
+}
+
+#define _QURY_EPOCH_CHUNK 64
+size_t qury_fetch_epoch_us(qury_stmt_t *stmt, const char *name, int64_t *out,
+                           bool *is_null, size_t n) {
+    MYSQL_TIME chunk[_QURY_EPOCH_CHUNK];
+    size_t done = 0;
+    size_t count = 0;
+
+    assert(stmt != NULL);
+    assert(out != NULL);
+    while (count < n && qury_fetch(stmt)) {
+        qury_bind_t *v = qury_get_field_value(stmt, name);
+        size_t k = count - done;
+        if (!v || v->is_null || v->type != QURY_DateTime) {
+            memset(&chunk[k], 0, sizeof(chunk[k]));
+            chunk[k].time_type = MYSQL_TIMESTAMP_TIME;
+            if (is_null) {
+                is_null[count] = true;
+            }
+        } else {
+            chunk[k] = v->value.dt;
+            if (is_null) {
+                is_null[count] = false;
+            }
+        }
+        count++;
+        if (count - done == _QURY_EPOCH_CHUNK) {
+            qury_time_to_epoch_us_batch(chunk, _QURY_EPOCH_CHUNK, &out[done]);
+            done = count;
+        }
+    }
+    qury_time_to_epoch_us_batch(chunk, count - done, &out[done]);
+    return count;
+}
@@ -0,0 +1,892 @@
+/* qurygen : generate typed C functions from annotated SQL files
+ *
+ * A file holds one or more queries, each introduced by annotations :
+ *
+ *   -- name: invoice_by_project
+ *   -- param: prj_id int
+ *   -- column: id int
+ *   -- column: nr str 64
+ *   SELECT id, nr FROM invoice WHERE project_id > :prj_id;
+ *
+ * Types are int, uint, float, bool, str, bytes, datetime and decimal. str
+ * and bytes columns take a maximum size (default 255). A param type ending
+ * with '?' is nullable, the generated function then takes a pointer and NULL
+ * binds SQL NULL. decimal values go through their text form.
+ *
+ * Named parameters are rewritten with qury_parse_params, so the rules are the
+ * ones of qury_prepare. With -H, every query is prepared against the server :
+ * parameters and columns are checked, and columns that are not annotated are
+ * taken from the result metadata.
+ */
+#include "include/quaerimus.h"
+#include <ctype.h>
+#include <mariadb/mysql.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define _GEN_MAX_ITEMS 256
+#define _GEN_MAX_NAME 64
+#define _GEN_DEFAULT_SIZE 255
+#define _GEN_MAX_SIZE 65535
+
+#define _GEN_Int 1
+#define _GEN_UInt 2
+#define _GEN_Float 3
+#define _GEN_Bool 4
+#define _GEN_Str 5
+#define _GEN_Bytes 6
+#define _GEN_DateTime 7
+#define _GEN_Decimal 8
+
+typedef struct {
+    char name[_GEN_MAX_NAME];
+    int type;
+    size_t size;
+    bool nullable;
+} _gen_item_t;
+
+typedef struct {
+    char name[_GEN_MAX_NAME];
+    const char *file;
+    int line;
+    _gen_item_t params[_GEN_MAX_ITEMS];
+    size_t nparams;
+    _gen_item_t columns[_GEN_MAX_ITEMS];
+    size_t ncolumns;
+    size_t placeholders[_GEN_MAX_ITEMS]; /* index in params */
+    size_t nplaceholders;
+    char *sql;
+    size_t sql_len;
+    size_t sql_cap;
+} _gen_query_t;
+
+static const struct {
+    const char *name;
+    int type;
+} _gen_types[] = {
+    {"int", _GEN_Int},       {"uint", _GEN_UInt},  {"float", _GEN_Float},
+    {"bool", _GEN_Bool},     {"str", _GEN_Str},    {"bytes", _GEN_Bytes},
+    {"datetime", _GEN_DateTime}, {"decimal", _GEN_Decimal}, {NULL, 0}};
+
+static const char *_gen_ctype(int type) {
+    switch (type) {
+        case _GEN_Int:
+            return "int64_t";
+        case _GEN_UInt:
+            return "uint64_t";
+        case _GEN_Float:
+            return "double";
+        case _GEN_Bool:
+            return "bool";
+        case _GEN_DateTime:
+            return "MYSQL_TIME";
+        case _GEN_Decimal:
+            return "qury_decimal_t";
+        default:
+            return NULL;
+    }
+}
+
+static const char *_gen_mysql_type(int type) {
+    switch (type) {
+        case _GEN_Int:
+        case _GEN_UInt:
+            return "MYSQL_TYPE_LONGLONG";
+        case _GEN_Float:
+            return "MYSQL_TYPE_DOUBLE";
+        case _GEN_Bool:
+            return "MYSQL_TYPE_TINY";
+        case _GEN_Str:
+        case _GEN_Decimal:
+            return "MYSQL_TYPE_STRING";
+        case _GEN_Bytes:
+            return "MYSQL_TYPE_BLOB";
+        case _GEN_DateTime:
+            return "MYSQL_TYPE_DATETIME";
+        default:
+            return NULL;
+    }
+}
+
+static bool _gen_is_ident(const char *s, size_t len) {
+    if (len == 0 || len >= _GEN_MAX_NAME || isdigit((unsigned char)s[0])) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum((unsigned char)s[i]) && s[i] != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char *_gen_word(const char *s, const char *end, size_t *len) {
+    while (s < end && isspace((unsigned char)*s)) {
+        s++;
+    }
+    const char *w = s;
+    while (s < end && !isspace((unsigned char)*s)) {
+        s++;
+    }
+    *len = (size_t)(s - w);
+    return w;
+}
+
+static bool _gen_parse_item(const char *s, const char *end, _gen_item_t *item,
+                            bool column) {
+    size_t len = 0;
+    const char *w = _gen_word(s, end, &len);
+    if (!_gen_is_ident(w, len)) {
+        return false;
+    }
+    memcpy(item->name, w, len);
+    item->name[len] = '\0';
+
+    w = _gen_word(w + len, end, &len);
+    item->nullable = len > 0 && w[len - 1] == '?';
+    if (item->nullable) {
+        if (column) {
+            /* columns always have a null indicator */
+            return false;
+        }
+        len--;
+    }
+    item->type = 0;
+    for (int i = 0; _gen_types[i].name; i++) {
+        if (strlen(_gen_types[i].name) == len
+            && memcmp(_gen_types[i].name, w, len) == 0) {
+            item->type = _gen_types[i].type;
+            break;
+        }
+    }
+    if (item->type == 0) {
+        return false;
+    }
+
+    item->size = _GEN_DEFAULT_SIZE;
+    w = _gen_word(w + len + item->nullable, end, &len);
+    if (len > 0) {
+        char *e = NULL;
+        unsigned long size = strtoul(w, &e, 10);
+        if (e != w + len || size == 0 || size > _GEN_MAX_SIZE) {
+            return false;
+        }
+        item->size = size;
+    }
+    return true;
+}
+
+static bool _gen_sql_append(_gen_query_t *q, const char *s, size_t len) {
+    if (q->sql_len + len + 2 > q->sql_cap) {
+        size_t cap = q->sql_cap > 0 ? q->sql_cap * 2 : 1024;
+        while (cap < q->sql_len + len + 2) {
+            cap *= 2;
+        }
+        char *tmp = realloc(q->sql, cap);
+        if (!tmp) {
+            return false;
+        }
+        q->sql = tmp;
+        q->sql_cap = cap;
+    }
+    memcpy(&q->sql[q->sql_len], s, len);
+    q->sql_len += len;
+    q->sql[q->sql_len++] = '\n';
+    q->sql[q->sql_len] = '\0';
+    return true;
+}
+
+static bool _gen_placeholder(void *userptr, const char *name, size_t name_len,
+                             size_t offset) {
+    _gen_query_t *q = (_gen_query_t *)userptr;
+    (void)offset;
+    for (size_t i = 0; i < q->nparams; i++) {
+        if (strlen(q->params[i].name) == name_len
+            && memcmp(q->params[i].name, name, name_len) == 0) {
+            if (q->nplaceholders >= _GEN_MAX_ITEMS) {
+                return false;
+            }
+            q->placeholders[q->nplaceholders++] = i;
+            return true;
+        }
+    }
+    fprintf(stderr, "%s:%d : %s : parameter :%.*s is not declared\n", q->file,
+            q->line, q->name, (int)name_len, name);
+    return false;
+}
+
+static bool _gen_finish(_gen_query_t *q) {
+    if (!q->sql) {
+        fprintf(stderr, "%s:%d : %s : no query\n", q->file, q->line, q->name);
+        return false;
+    }
+    /* trailing blanks and statement terminator */
+    while (q->sql_len > 0
+           && (isspace((unsigned char)q->sql[q->sql_len - 1])
+               || q->sql[q->sql_len - 1] == ';')) {
+        q->sql_len--;
+    }
+    q->sql[q->sql_len] = '\0';
+    return qury_parse_params(q->sql, &q->sql_len, _gen_placeholder, q);
+}
+
+static _gen_query_t *_gen_load(const char *file, _gen_query_t *queries,
+                               size_t *count, size_t max) {
+    FILE *fp = fopen(file, "r");
+    if (!fp) {
+        fprintf(stderr, "qurygen : cannot open %s\n", file);
+        return NULL;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len = 0;
+    int lineno = 0;
+    _gen_query_t *q = NULL;
+    bool ok = true;
+
+    while (ok && (len = getline(&line, &cap, fp)) >= 0) {
+        lineno++;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        const char *s = line;
+        const char *end = line + len;
+        while (s < end && isspace((unsigned char)*s)) {
+            s++;
+        }
+        if (s == end) {
+            continue;
+        }
+        if (end - s < 2 || s[0] != '-' || s[1] != '-') {
+            if (!q) {
+                fprintf(stderr, "%s:%d : query without -- name:\n", file, lineno);
+                ok = false;
+            } else {
+                ok = _gen_sql_append(q, line, (size_t)len);
+            }
+            continue;
+        }
+        s += 2;
+        while (s < end && isspace((unsigned char)*s)) {
+            s++;
+        }
+        if (strncmp(s, "name:", 5) == 0) {
+            if (q && !_gen_finish(q)) {
+                ok = false;
+                break;
+            }
+            if (*count >= max) {
+                fprintf(stderr, "%s:%d : too many queries\n", file, lineno);
+                ok = false;
+                break;
+            }
+            q = &queries[(*count)++];
+            memset(q, 0, sizeof(*q));
+            q->file = file;
+            q->line = lineno;
+            size_t wlen = 0;
+            const char *w = _gen_word(s + 5, end, &wlen);
+            if (!_gen_is_ident(w, wlen)) {
+                fprintf(stderr, "%s:%d : invalid query name\n", file, lineno);
+                ok = false;
+                break;
+            }
+            memcpy(q->name, w, wlen);
+            q->name[wlen] = '\0';
+        } else if (strncmp(s, "param:", 6) == 0 || strncmp(s, "column:", 7) == 0) {
+            bool column = s[0] == 'c';
+            if (!q) {
+                fprintf(stderr, "%s:%d : annotation without -- name:\n", file,
+                        lineno);
+                ok = false;
+                break;
+            }
+            size_t *n = column ? &q->ncolumns : &q->nparams;
+            _gen_item_t *items = column ? q->columns : q->params;
+            if (*n >= _GEN_MAX_ITEMS
+                || !_gen_parse_item(s + (column ? 7 : 6), end, &items[*n], column)) {
+                fprintf(stderr, "%s:%d : invalid annotation\n", file, lineno);
+                ok = false;
+                break;
+            }
+            (*n)++;
+        }
+        /* other comments are dropped */
+    }
+    if (ok && q) {
+        ok = _gen_finish(q);
+    }
+    free(line);
+    fclose(fp);
+    return ok ? queries : NULL;
+}
+
+static int _gen_from_field(MYSQL_FIELD *f, _gen_item_t *item) {
+    bool is_unsigned = (f->flags & UNSIGNED_FLAG) != 0;
+    size_t size = f->length > 0 && f->length < _GEN_MAX_SIZE ? f->length
+                                                             : _GEN_DEFAULT_SIZE;
+    switch (f->type) {
+        case MYSQL_TYPE_TINY:
+        case MYSQL_TYPE_SHORT:
+        case MYSQL_TYPE_INT24:
+        case MYSQL_TYPE_LONG:
+        case MYSQL_TYPE_LONGLONG:
+        case MYSQL_TYPE_YEAR:
+        case MYSQL_TYPE_BIT:
+            item->type = is_unsigned ? _GEN_UInt : _GEN_Int;
+            break;
+        case MYSQL_TYPE_FLOAT:
+        case MYSQL_TYPE_DOUBLE:
+            item->type = _GEN_Float;
+            break;
+        case MYSQL_TYPE_DECIMAL:
+        case MYSQL_TYPE_NEWDECIMAL:
+            item->type = _GEN_Decimal;
+            break;
+        case MYSQL_TYPE_DATE:
+        case MYSQL_TYPE_TIME:
+        case MYSQL_TYPE_DATETIME:
+        case MYSQL_TYPE_TIMESTAMP:
+            item->type = _GEN_DateTime;
+            break;
+        default:
+            item->type = f->charsetnr == 63 ? _GEN_Bytes : _GEN_Str;
+            break;
+    }
+    item->size = size;
+    item->nullable = false;
+    return item->type;
+}
+
+static bool _gen_compatible(int declared, int actual) {
+    if (declared == actual) {
+        return true;
+    }
+    /* integers can be read in any width, text as anything */
+    return ((declared == _GEN_Int || declared == _GEN_UInt || declared == _GEN_Bool)
+            && (actual == _GEN_Int || actual == _GEN_UInt))
+           || declared == _GEN_Str || declared == _GEN_Bytes
+           || (declared == _GEN_Float && actual == _GEN_Decimal);
+}
+
+static bool _gen_validate(MYSQL *mysql, _gen_query_t *q) {
+    MYSQL_STMT *stmt = mysql_stmt_init(mysql);
+    bool ok = false;
+    if (!stmt) {
+        return false;
+    }
+    if (mysql_stmt_prepare(stmt, q->sql, q->sql_len)) {
+        fprintf(stderr, "%s:%d : %s : %s\n", q->file, q->line, q->name,
+                mysql_stmt_error(stmt));
+        goto done;
+    }
+    if (mysql_stmt_param_count(stmt) != q->nplaceholders) {
+        fprintf(stderr, "%s:%d : %s : server expects %lu parameters, found %zu\n",
+                q->file, q->line, q->name, mysql_stmt_param_count(stmt),
+                q->nplaceholders);
+        goto done;
+    }
+    MYSQL_RES *meta = mysql_stmt_result_metadata(stmt);
+    size_t nfields = meta ? mysql_num_fields(meta) : 0;
+    MYSQL_FIELD *fields = meta ? mysql_fetch_fields(meta) : NULL;
+    if (q->ncolumns == 0 && nfields > 0) {
+        if (nfields > _GEN_MAX_ITEMS) {
+            mysql_free_result(meta);
+            goto done;
+        }
+        for (size_t i = 0; i < nfields; i++) {
+            if (!_gen_is_ident(fields[i].name, strlen(fields[i].name))) {
+                fprintf(stderr, "%s:%d : %s : column \"%s\" needs an alias\n",
+                        q->file, q->line, q->name, fields[i].name);
+                mysql_free_result(meta);
+                goto done;
+            }
+            strcpy(q->columns[i].name, fields[i].name);
+            _gen_from_field(&fields[i], &q->columns[i]);
+        }
+        q->ncolumns = nfields;
+    } else if (q->ncolumns != nfields) {
+        fprintf(stderr, "%s:%d : %s : server returns %zu columns, %zu declared\n",
+                q->file, q->line, q->name, nfields, q->ncolumns);
+        if (meta) {
+            mysql_free_result(meta);
+        }
+        goto done;
+    } else {
+        for (size_t i = 0; i < nfields; i++) {
+            _gen_item_t actual;
+            _gen_from_field(&fields[i], &actual);
+            if (strcmp(fields[i].name, q->columns[i].name) != 0) {
+                fprintf(stderr, "%s:%d : %s : column %zu is \"%s\", declared %s\n",
+                        q->file, q->line, q->name, i, fields[i].name,
+                        q->columns[i].name);
+                mysql_free_result(meta);
+                goto done;
+            }
+            if (!_gen_compatible(q->columns[i].type, actual.type)) {
+                fprintf(stderr, "%s:%d : %s : column %s has an incompatible type\n",
+                        q->file, q->line, q->name, q->columns[i].name);
+                mysql_free_result(meta);
+                goto done;
+            }
+        }
+    }
+    if (meta) {
+        mysql_free_result(meta);
+    }
+    ok = true;
+done:
+    mysql_stmt_close(stmt);
+    return ok;
+}
+
+static void _gen_header(FILE *fp, _gen_query_t *q) {
+    fprintf(fp, "/* %s:%d */\n", q->file, q->line);
+    if (q->ncolumns > 0) {
+        fprintf(fp, "typedef struct {\n");
+        for (size_t i = 0; i < q->ncolumns; i++) {
+            _gen_item_t *c = &q->columns[i];
+            switch (c->type) {
+                case _GEN_Str:
+                    fprintf(fp, "    char %s[%zu];\n", c->name, c->size + 1);
+                    fprintf(fp, "    unsigned long %s_length;\n", c->name);
+                    break;
+                case _GEN_Bytes:
+                    fprintf(fp, "    uint8_t %s[%zu];\n", c->name, c->size);
+                    fprintf(fp, "    unsigned long %s_length;\n", c->name);
+                    break;
+                default:
+                    fprintf(fp, "    %s %s;\n", _gen_ctype(c->type), c->name);
+                    break;
+            }
+            fprintf(fp, "    my_bool %s_is_null;\n", c->name);
+        }
+        fprintf(fp, "    bool truncated; /* a str or bytes column did not fit */\n");
+        fprintf(fp, "} %s_row_t;\n\n", q->name);
+    }
+
+    fprintf(fp, "typedef struct {\n");
+    fprintf(fp, "    MYSQL_STMT *stmt;\n");
+    fprintf(fp, "    MYSQL_BIND params[%zu];\n",
+            q->nplaceholders > 0 ? q->nplaceholders : 1);
+    fprintf(fp, "    unsigned long lengths[%zu];\n",
+            q->nplaceholders > 0 ? q->nplaceholders : 1);
+    fprintf(fp, "    my_bool nulls[%zu];\n",
+            q->nplaceholders > 0 ? q->nplaceholders : 1);
+    for (size_t i = 0; i < q->nparams; i++) {
+        const char *ctype = _gen_ctype(q->params[i].type);
+        if (q->params[i].type == _GEN_Decimal) {
+            /* sent as text, the server converts it */
+            fprintf(fp, "    char pd_%s[QURY_DECIMAL_SIZE];\n",
+                    q->params[i].name);
+            fprintf(fp, "    unsigned long pd_%s_length;\n", q->params[i].name);
+        } else if (ctype) {
+            fprintf(fp, "    %s p_%s;\n", ctype, q->params[i].name);
+        }
+    }
+    if (q->ncolumns > 0) {
+        fprintf(fp, "    MYSQL_BIND results[%zu];\n", q->ncolumns);
+        for (size_t i = 0; i < q->ncolumns; i++) {
+            if (q->columns[i].type == _GEN_Decimal) {
+                fprintf(fp, "    char d_%s[QURY_DECIMAL_SIZE];\n",
+                        q->columns[i].name);
+                fprintf(fp, "    unsigned long d_%s_length;\n",
+                        q->columns[i].name);
+            }
+        }
+        fprintf(fp, "    %s_row_t row;\n", q->name);
+    }
+    fprintf(fp, "} %s_t;\n\n", q->name);
+
+    fprintf(fp, "bool %s_prepare(%s_t *q, MYSQL *mysql);\n", q->name, q->name);
+    fprintf(fp, "bool %s_execute(%s_t *q", q->name, q->name);
+    for (size_t i = 0; i < q->nparams; i++) {
+        _gen_item_t *p = &q->params[i];
+        switch (p->type) {
+            case _GEN_Str:
+                fprintf(fp, ", const char *%s, size_t %s_length", p->name,
+                        p->name);
+                break;
+            case _GEN_Bytes:
+                fprintf(fp, ", const void *%s, size_t %s_length", p->name,
+                        p->name);
+                break;
+            default:
+                fprintf(fp, p->nullable ? ", const %s *%s" : ", %s %s",
+                        _gen_ctype(p->type), p->name);
+                break;
+        }
+    }
+    fprintf(fp, ");\n");
+    if (q->ncolumns > 0) {
+        fprintf(fp, "bool %s_fetch(%s_t *q);\n", q->name, q->name);
+    }
+    fprintf(fp, "void %s_close(%s_t *q);\n\n", q->name, q->name);
+}
+
+static void _gen_literal(FILE *fp, const char *s, size_t len) {
+    fprintf(fp, "    \"");
+    for (size_t i = 0; i < len; i++) {
+        switch (s[i]) {
+            case '"':
+                fputs("\\\"", fp);
+                break;
+            case '\\':
+                fputs("\\\\", fp);
+                break;
+            case '\t':
+                fputs("\\t", fp);
+                break;
+            case '\n':
+                fputs(i + 1 < len ? "\\n\"\n    \"" : "\\n", fp);
+                break;
+            default:
+                fputc(s[i], fp);
+                break;
+        }
+    }
+    fprintf(fp, "\"");
+}
+
+static void _gen_source(FILE *fp, _gen_query_t *q) {
+    bool rebind = false;
+
+    fprintf(fp, "/* %s:%d */\n", q->file, q->line);
+    fprintf(fp, "static const char %s_sql[] =\n", q->name);
+    _gen_literal(fp, q->sql, q->sql_len);
+    fprintf(fp, ";\n\n");
+
+    /* prepare */
+    fprintf(fp, "bool %s_prepare(%s_t *q, MYSQL *mysql) {\n", q->name, q->name);
+    fprintf(fp, "    memset(q, 0, sizeof(*q));\n");
+    fprintf(fp, "    q->stmt = mysql_stmt_init(mysql);\n");
+    fprintf(fp, "    if (!q->stmt) {\n        return false;\n    }\n");
+    fprintf(fp, "    if (mysql_stmt_prepare(q->stmt, %s_sql, sizeof(%s_sql) - 1)\n",
+            q->name, q->name);
+    fprintf(fp, "        || mysql_stmt_param_count(q->stmt) != %zu\n",
+            q->nplaceholders);
+    fprintf(fp, "        || mysql_stmt_field_count(q->stmt) != %zu) {\n",
+            q->ncolumns);
+    fprintf(fp, "        fprintf(stderr, \"%s_prepare : %%s\\n\", "
+                "mysql_stmt_error(q->stmt));\n", q->name);
+    fprintf(fp, "        mysql_stmt_close(q->stmt);\n");
+    fprintf(fp, "        q->stmt = NULL;\n        return false;\n    }\n");
+    for (size_t i = 0; i < q->nplaceholders; i++) {
+        _gen_item_t *p = &q->params[q->placeholders[i]];
+        fprintf(fp, "    q->params[%zu].buffer_type = %s;\n", i,
+                _gen_mysql_type(p->type));
+        if (p->type == _GEN_Decimal) {
+            fprintf(fp, "    q->params[%zu].buffer = q->pd_%s;\n", i, p->name);
+            fprintf(fp, "    q->params[%zu].buffer_length = QURY_DECIMAL_SIZE;\n",
+                    i);
+        } else if (p->type != _GEN_Str && p->type != _GEN_Bytes) {
+            fprintf(fp, "    q->params[%zu].buffer = &q->p_%s;\n", i, p->name);
+        } else {
+            rebind = true;
+        }
+        if (p->type == _GEN_UInt) {
+            fprintf(fp, "    q->params[%zu].is_unsigned = 1;\n", i);
+        }
+        fprintf(fp, "    q->params[%zu].length = &q->lengths[%zu];\n", i, i);
+        fprintf(fp, "    q->params[%zu].is_null = &q->nulls[%zu];\n", i, i);
+    }
+    for (size_t i = 0; i < q->ncolumns; i++) {
+        _gen_item_t *c = &q->columns[i];
+        fprintf(fp, "    q->results[%zu].buffer_type = %s;\n", i,
+                _gen_mysql_type(c->type));
+        switch (c->type) {
+            case _GEN_Decimal:
+                fprintf(fp, "    q->results[%zu].buffer = q->d_%s;\n", i, c->name);
+                fprintf(fp, "    q->results[%zu].buffer_length = QURY_DECIMAL_SIZE;\n", i);
+                fprintf(fp, "    q->results[%zu].length = &q->d_%s_length;\n", i,
+                        c->name);
+                break;
+            case _GEN_Str:
+            case _GEN_Bytes:
+                fprintf(fp, "    q->results[%zu].buffer = q->row.%s;\n", i, c->name);
+                fprintf(fp, "    q->results[%zu].buffer_length = sizeof(q->row.%s);\n",
+                        i, c->name);
+                fprintf(fp, "    q->results[%zu].length = &q->row.%s_length;\n", i,
+                        c->name);
+                break;
+            default:
+                fprintf(fp, "    q->results[%zu].buffer = &q->row.%s;\n", i, c->name);
+                break;
+        }
+        if (c->type == _GEN_UInt) {
+            fprintf(fp, "    q->results[%zu].is_unsigned = 1;\n", i);
+        }
+        fprintf(fp, "    q->results[%zu].is_null = &q->row.%s_is_null;\n", i,
+                c->name);
+    }
+    if (q->nplaceholders > 0 && !rebind) {
+        fprintf(fp, "    if (mysql_stmt_bind_param(q->stmt, q->params)) {\n");
+        fprintf(fp, "        %s_close(q);\n        return false;\n    }\n",
+                q->name);
+    }
+    if (q->ncolumns > 0) {
+        fprintf(fp, "    if (mysql_stmt_bind_result(q->stmt, q->results)) {\n");
+        fprintf(fp, "        %s_close(q);\n        return false;\n    }\n",
+                q->name);
+    }
+    fprintf(fp, "    return true;\n}\n\n");
+
+    /* execute */
+    fprintf(fp, "bool %s_execute(%s_t *q", q->name, q->name);
+    for (size_t i = 0; i < q->nparams; i++) {
+        _gen_item_t *p = &q->params[i];
+        switch (p->type) {
+            case _GEN_Str:
+                fprintf(fp, ", const char *%s, size_t %s_length", p->name,
+                        p->name);
+                break;
+            case _GEN_Bytes:
+                fprintf(fp, ", const void *%s, size_t %s_length", p->name,
+                        p->name);
+                break;
+            default:
+                fprintf(fp, p->nullable ? ", const %s *%s" : ", %s %s",
+                        _gen_ctype(p->type), p->name);
+                break;
+        }
+    }
+    fprintf(fp, ") {\n");
+    for (size_t i = 0; i < q->nparams; i++) {
+        _gen_item_t *p = &q->params[i];
+        if (p->type == _GEN_Str || p->type == _GEN_Bytes) {
+            continue;
+        }
+        if (p->type == _GEN_Decimal) {
+            const char *indent = p->nullable ? "        " : "    ";
+            fprintf(fp, "    q->pd_%s_length = 0;\n", p->name);
+            if (p->nullable) {
+                fprintf(fp, "    if (%s) {\n", p->name);
+            }
+            fprintf(fp, "%sq->pd_%s_length = qury_decimal_format(%s%s, q->pd_%s, "
+                        "sizeof(q->pd_%s));\n",
+                    indent, p->name, p->nullable ? "*" : "", p->name, p->name,
+                    p->name);
+            fprintf(fp, "%sif (q->pd_%s_length == 0) {\n", indent, p->name);
+            fprintf(fp, "%s    fprintf(stderr, \"%s_execute : %s overflows\\n\");\n",
+                    indent, q->name, p->name);
+            fprintf(fp, "%s    return false;\n%s}\n", indent, indent);
+            if (p->nullable) {
+                fprintf(fp, "    }\n");
+            }
+            continue;
+        }
+        if (p->nullable) {
+            fprintf(fp, "    if (%s) {\n        q->p_%s = *%s;\n    }\n", p->name,
+                    p->name, p->name);
+        } else {
+            fprintf(fp, "    q->p_%s = %s;\n", p->name, p->name);
+        }
+    }
+    for (size_t i = 0; i < q->nplaceholders; i++) {
+        _gen_item_t *p = &q->params[q->placeholders[i]];
+        if (p->type == _GEN_Str || p->type == _GEN_Bytes) {
+            fprintf(fp, "    q->params[%zu].buffer = (void *)%s;\n", i, p->name);
+            fprintf(fp, "    q->params[%zu].buffer_length = %s_length;\n", i,
+                    p->name);
+            fprintf(fp, "    q->lengths[%zu] = %s_length;\n", i, p->name);
+        } else if (p->type == _GEN_Decimal) {
+            fprintf(fp, "    q->lengths[%zu] = q->pd_%s_length;\n", i, p->name);
+        }
+        if (p->nullable || p->type == _GEN_Str || p->type == _GEN_Bytes) {
+            fprintf(fp, "    q->nulls[%zu] = %s == NULL;\n", i, p->name);
+        }
+    }
+    if (rebind) {
+        /* the client library copies the binds, buffers changed */
+        fprintf(fp, "    if (mysql_stmt_bind_param(q->stmt, q->params)) {\n");
+        fprintf(fp, "        return false;\n    }\n");
+    }
+    if (q->ncolumns > 0) {
+        fprintf(fp, "    mysql_stmt_free_result(q->stmt);\n");
+    }
+    fprintf(fp, "    if (mysql_stmt_execute(q->stmt)) {\n");
+    fprintf(fp, "        fprintf(stderr, \"%s_execute : %%s\\n\", "
+                "mysql_stmt_error(q->stmt));\n", q->name);
+    fprintf(fp, "        return false;\n    }\n");
+    fprintf(fp, "    return true;\n}\n\n");
+
+    /* fetch */
+    if (q->ncolumns > 0) {
+        fprintf(fp, "bool %s_fetch(%s_t *q) {\n", q->name, q->name);
+        fprintf(fp, "    int rc = mysql_stmt_fetch(q->stmt);\n");
+        fprintf(fp, "    if (rc == 1 || rc == MYSQL_NO_DATA) {\n");
+        fprintf(fp, "        return false;\n    }\n");
+        fprintf(fp, "    q->row.truncated = rc == MYSQL_DATA_TRUNCATED;\n");
+        for (size_t i = 0; i < q->ncolumns; i++) {
+            _gen_item_t *c = &q->columns[i];
+            if (c->type == _GEN_Str) {
+                fprintf(fp, "    q->row.%s[q->row.%s_length < %zu ? q->row.%s_length : %zu] = '\\0';\n",
+                        c->name, c->name, c->size, c->name, c->size);
+            } else if (c->type == _GEN_Decimal) {
+                fprintf(fp, "    if (!q->row.%s_is_null) {\n", c->name);
+                fprintf(fp, "        qury_decimal_parse(q->d_%s, q->d_%s_length, "
+                            "&q->row.%s);\n", c->name, c->name, c->name);
+                fprintf(fp, "    }\n");
+            }
+        }
+        fprintf(fp, "    return true;\n}\n\n");
+    }
+
+    /* close */
+    fprintf(fp, "void %s_close(%s_t *q) {\n", q->name, q->name);
+    fprintf(fp, "    if (q->stmt) {\n        mysql_stmt_close(q->stmt);\n");
+    fprintf(fp, "        q->stmt = NULL;\n    }\n}\n\n");
+}
+
+static void _gen_guard(char *guard, size_t size, const char *base) {
+    const char *name = strrchr(base, '/');
+    name = name ? name + 1 : base;
+    size_t j = 0;
+    for (size_t i = 0; name[i] && j + 3 < size; i++) {
+        guard[j++] = isalnum((unsigned char)name[i])
+                         ? (char)toupper((unsigned char)name[i])
+                         : '_';
+    }
+    guard[j] = '\0';
+    strncat(guard, "_H__", size - j - 1);
+}
+
+static void _usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-H host -u user -p password -d database] -o basename "
+            "file.sql ...\n"
+            "  Write basename.h and basename.c. With -H, queries are checked\n"
+            "  against the server and unannotated columns are inferred.\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    const char *host = NULL;
+    const char *user = NULL;
+    const char *password = NULL;
+    const char *db = NULL;
+    const char *out = NULL;
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "H:u:p:d:o:h")) != -1) {
+        switch (opt) {
+            case 'H':
+                host = optarg;
+                break;
+            case 'u':
+                user = optarg;
+                break;
+            case 'p':
+                password = optarg;
+                break;
+            case 'd':
+                db = optarg;
+                break;
+            case 'o':
+                out = optarg;
+                break;
+            default:
+                _usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (!out || optind >= argc) {
+        _usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size_t max = 1024;
+    size_t count = 0;
+    _gen_query_t *queries = calloc(max, sizeof(*queries));
+    if (!queries) {
+        return EXIT_FAILURE;
+    }
+    for (int i = optind; i < argc; i++) {
+        if (!_gen_load(argv[i], queries, &count, max)) {
+            return EXIT_FAILURE;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < i; j++) {
+            if (strcmp(queries[i].name, queries[j].name) == 0) {
+                fprintf(stderr, "%s:%d : %s already defined at %s:%d\n",
+                        queries[i].file, queries[i].line, queries[i].name,
+                        queries[j].file, queries[j].line);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    if (host) {
+        mysql_library_init(0, NULL, NULL);
+        MYSQL *mysql = mysql_init(NULL);
+        if (!mysql
+            || !mysql_real_connect(mysql, host, user, password, db, 0, NULL, 0)) {
+            fprintf(stderr, "qurygen : %s\n",
+                    mysql ? mysql_error(mysql) : "out of memory");
+            return EXIT_FAILURE;
+        }
+        bool ok = true;
+        for (size_t i = 0; i < count; i++) {
+            ok = _gen_validate(mysql, &queries[i]) && ok;
+        }
+        mysql_close(mysql);
+        mysql_library_end();
+        if (!ok) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t olen = strlen(out);
+    char *path = malloc(olen + 3);
+    char guard[128] = {0};
+    if (!path) {
+        return EXIT_FAILURE;
+    }
+    _gen_guard(guard, sizeof(guard), out);
+
+    snprintf(path, olen + 3, "%s.h", out);
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "qurygen : cannot write %s\n", path);
+        return EXIT_FAILURE;
+    }
+    fprintf(fp, "/* Generated by qurygen, do not edit */\n");
+    fprintf(fp, "#ifndef %s\n#define %s 1\n\n", guard, guard);
+    fprintf(fp, "#include \"quaerimus.h\"\n#include <stdbool.h>\n");
+    fprintf(fp, "#include <stdint.h>\n\n");
+    for (size_t i = 0; i < count; i++) {
+        _gen_header(fp, &queries[i]);
+    }
+    fprintf(fp, "#endif /* %s */\n", guard);
+    if (fclose(fp) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    snprintf(path, olen + 3, "%s.c", out);
+    fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "qurygen : cannot write %s\n", path);
+        return EXIT_FAILURE;
+    }
+    const char *base = strrchr(out, '/');
+    fprintf(fp, "/* Generated by qurygen, do not edit */\n");
+    fprintf(fp, "#include \"%s.h\"\n#include <stdio.h>\n#include <string.h>\n\n",
+            base ? base + 1 : out);
+    for (size_t i = 0; i < count; i++) {
+        _gen_source(fp, &queries[i]);
+    }
+    if (fclose(fp) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        free(queries[i].sql);
+    }
+    free(queries);
+    free(path);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,257 @@
+#include "include/quaerimus_registry.h"
+#include "include/quaerimus.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define _REGISTRY_INIT_SIZE 64
+
+static uint64_t _registry_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void qury_registry_init(qury_registry_t *reg) {
+    assert(reg != NULL);
+    memset(reg, 0, sizeof(*reg));
+}
+
+void qury_registry_free(qury_registry_t *reg) {
+    if (!reg) {
+        return;
+    }
+    for (size_t i = 0; i < reg->count; i++) {
+        free(reg->entries[i].name);
+        free(reg->entries[i].query);
+    }
+    free(reg->entries);
+    memset(reg, 0, sizeof(*reg));
+}
+
+int qury_registry_add(qury_registry_t *reg, const char *name,
+                      const char *query) {
+    assert(reg != NULL);
+    assert(name != NULL);
+    assert(query != NULL);
+
+    if (qury_registry_find(reg, name) >= 0) {
+        fprintf(stderr, "qury_registry_add : duplicate statement %s\n", name);
+        return -1;
+    }
+    if (reg->count == reg->capacity) {
+        size_t capacity =
+            reg->capacity > 0 ? reg->capacity * 2 : _REGISTRY_INIT_SIZE;
+        qury_registry_entry_t *tmp =
+            realloc(reg->entries, capacity * sizeof(*tmp));
+        if (!tmp) {
+            return -1;
+        }
+        reg->entries = tmp;
+        reg->capacity = capacity;
+    }
+    qury_registry_entry_t *e = &reg->entries[reg->count];
+    e->name = strdup(name);
+    e->query = strdup(query);
+    if (!e->name || !e->query) {
+        free(e->name);
+        free(e->query);
+        return -1;
+    }
+    return (int)reg->count++;
+}
+
+int qury_registry_find(qury_registry_t *reg, const char *name) {
+    assert(reg != NULL);
+    assert(name != NULL);
+    for (size_t i = 0; i < reg->count; i++) {
+        if (strcmp(reg->entries[i].name, name) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static bool _registry_prepare(qury_registry_conn_t *rc, size_t id) {
+    uint64_t start = _registry_now_ns();
+    qury_stmt_t *stmt = qury_new(rc->conn, NULL);
+    if (!stmt) {
+        return false;
+    }
+    if (!qury_prepare(stmt, rc->registry->entries[id].query, 0)) {
+        fprintf(stderr, "qury_registry : cannot prepare %s\n",
+                rc->registry->entries[id].name);
+        qury_free(stmt);
+        rc->failed++;
+        return false;
+    }
+    rc->stmts[id] = stmt;
+    rc->prepared++;
+    rc->prepare_ns += _registry_now_ns() - start;
+    return true;
+}
+
+/* prepares between the requests, which pause it while they use the
+ * connection */
+static void *_registry_worker(void *arg) {
+    qury_registry_conn_t *rc = arg;
+    mysql_thread_init();
+    pthread_mutex_lock(&rc->lock);
+    for (size_t i = 0; i < rc->count; i++) {
+        while (rc->busy && !rc->stop) {
+            pthread_cond_wait(&rc->cond, &rc->lock);
+        }
+        if (rc->stop) {
+            break;
+        }
+        if (rc->stmts[i]) {
+            continue;
+        }
+        rc->preparing = true;
+        pthread_mutex_unlock(&rc->lock);
+        _registry_prepare(rc, i);
+        pthread_mutex_lock(&rc->lock);
+        rc->preparing = false;
+        pthread_cond_broadcast(&rc->cond);
+    }
+    rc->done = true;
+    pthread_mutex_unlock(&rc->lock);
+    mysql_thread_end();
+    return NULL;
+}
+
+/* the connection is ours again once this returns */
+static void _registry_stop(qury_registry_conn_t *rc) {
+    if (rc->running) {
+        pthread_mutex_lock(&rc->lock);
+        rc->stop = true;
+        pthread_cond_broadcast(&rc->cond);
+        pthread_mutex_unlock(&rc->lock);
+        pthread_join(rc->thread, NULL);
+        rc->running = false;
+    }
+}
+
+/* take the connection from the worker, false once it is done */
+static bool _registry_pause(qury_registry_conn_t *rc) {
+    pthread_mutex_lock(&rc->lock);
+    bool done = rc->done;
+    if (!done) {
+        rc->busy = true;
+        while (rc->preparing) {
+            pthread_cond_wait(&rc->cond, &rc->lock);
+        }
+    }
+    pthread_mutex_unlock(&rc->lock);
+    return !done;
+}
+
+static bool _registry_start(qury_registry_conn_t *rc) {
+    switch (rc->mode) {
+        case QURY_RegistryLazy:
+            return true;
+        case QURY_RegistryBackground:
+            rc->stop = false;
+            rc->busy = false;
+            rc->done = false;
+            if (pthread_create(&rc->thread, NULL, _registry_worker, rc) == 0) {
+                rc->running = true;
+                return true;
+            }
+            /* no thread, prepare now */
+            /* fall through */
+        default:
+        case QURY_RegistryEager:
+            for (size_t i = 0; i < rc->count; i++) {
+                _registry_prepare(rc, i);
+            }
+            return true;
+    }
+}
+
+bool qury_registry_attach(qury_registry_t *reg, qury_conn_t *conn,
+                          qury_registry_conn_t *rc, qury_registry_mode_t mode) {
+    assert(reg != NULL);
+    assert(conn != NULL);
+    assert(rc != NULL);
+
+    memset(rc, 0, sizeof(*rc));
+    rc->registry = reg;
+    rc->conn = conn;
+    rc->mode = mode;
+    rc->count = reg->count;
+    pthread_mutex_init(&rc->lock, NULL);
+    pthread_cond_init(&rc->cond, NULL);
+    if (rc->count > 0) {
+        rc->stmts = calloc(rc->count, sizeof(*rc->stmts));
+        if (!rc->stmts) {
+            rc->count = 0;
+            return false;
+        }
+    }
+    return _registry_start(rc);
+}
+
+qury_stmt_t *qury_registry_stmt(qury_registry_conn_t *rc, int id) {
+    assert(rc != NULL);
+
+    if (id < 0 || (size_t)id >= rc->count) {
+        return NULL;
+    }
+    if (rc->running && !_registry_pause(rc)) {
+        /* everything was tried */
+        _registry_stop(rc);
+    }
+    if (!rc->stmts[id] && !_registry_prepare(rc, (size_t)id)) {
+        qury_registry_release(rc);
+        return NULL;
+    }
+    return rc->stmts[id];
+}
+
+void qury_registry_release(qury_registry_conn_t *rc) {
+    assert(rc != NULL);
+
+    if (!rc->running) {
+        return;
+    }
+    pthread_mutex_lock(&rc->lock);
+    rc->busy = false;
+    pthread_cond_broadcast(&rc->cond);
+    pthread_mutex_unlock(&rc->lock);
+}
+
+static void _registry_free_stmts(qury_registry_conn_t *rc) {
+    _registry_stop(rc);
+    for (size_t i = 0; i < rc->count; i++) {
+        if (rc->stmts[i]) {
+            qury_free(rc->stmts[i]);
+            rc->stmts[i] = NULL;
+        }
+    }
+    rc->prepared = 0;
+    rc->failed = 0;
+    rc->prepare_ns = 0;
+}
+
+bool qury_registry_reconnect(qury_registry_conn_t *rc) {
+    assert(rc != NULL);
+    _registry_free_stmts(rc);
+    return _registry_start(rc);
+}
+
+void qury_registry_detach(qury_registry_conn_t *rc) {
+    if (!rc) {
+        return;
+    }
+    _registry_free_stmts(rc);
+    free(rc->stmts);
+    rc->stmts = NULL;
+    rc->count = 0;
+    pthread_cond_destroy(&rc->cond);
+    pthread_mutex_destroy(&rc->lock);
+}
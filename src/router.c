@@ -0,0 +1,412 @@
+#include "include/quaerimus_router.h"
+#include "include/quaerimus.h"
+#include <assert.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define _ROUTER_WORD_SIZE 16
+
+/* first statement words which don't write */
+static const char *_router_read_verbs[] = {
+    "SELECT", "SHOW", "DESCRIBE", "DESC", "EXPLAIN", "WITH", "VALUES", "TABLE",
+    NULL};
+
+/* words making a read statement a write */
+static const char *_router_write_words[] = {
+    "UPDATE", "INTO",   "LOCK",   "GET_LOCK", "RELEASE_LOCK", "LAST_INSERT_ID",
+    "NEXTVAL", "SETVAL", "INSERT", "DELETE",   "REPLACE",      "NEXT",
+    NULL};
+
+static bool _router_word_in(const char *word, const char **list) {
+    for (size_t i = 0; list[i]; i++) {
+        if (strcasecmp(word, list[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* skip blanks and comments, return the new position */
+static size_t _router_skip(const char *q, size_t len, size_t i) {
+    while (i < len) {
+        if (isspace((unsigned char)q[i]) || q[i] == '(') {
+            i++;
+        } else if (q[i] == '/' && i + 2 < len && q[i + 1] == '*'
+                   && (q[i + 2] == '!'
+                       || (q[i + 2] == 'M' && i + 3 < len && q[i + 3] == '!'))) {
+            /* executable comment, the server runs what is inside */
+            i += q[i + 2] == '!' ? 3 : 4;
+            while (i < len && isdigit((unsigned char)q[i])) {
+                i++;
+            }
+        } else if (q[i] == '#'
+                   || (q[i] == '-' && i + 2 < len && q[i + 1] == '-'
+                       && isspace((unsigned char)q[i + 2]))) {
+            while (i < len && q[i] != '\n') {
+                i++;
+            }
+        } else if (q[i] == '/' && i + 1 < len && q[i + 1] == '*') {
+            i += 2;
+            while (i + 1 < len && !(q[i] == '*' && q[i + 1] == '/')) {
+                i++;
+            }
+            i += 2;
+        } else {
+            break;
+        }
+    }
+    return i;
+}
+
+static bool _router_is_word(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '$';
+}
+
+bool qury_query_is_read_only(const char *query, size_t length) {
+    assert(query != NULL);
+    if (length == 0) {
+        length = strlen(query);
+    }
+
+    char word[_ROUTER_WORD_SIZE];
+    bool first = true;
+    bool any = false;
+    size_t i = _router_skip(query, length, 0);
+    while (i < length) {
+        char c = query[i];
+        if (c == '\'' || c == '"' || c == '`') {
+            /* quoted string or identifier, doubled or escaped quotes stay
+             * inside */
+            for (i++; i < length; i++) {
+                if (query[i] == '\\' && c != '`') {
+                    i++;
+                } else if (query[i] == c) {
+                    if (i + 1 < length && query[i + 1] == c) {
+                        i++;
+                    } else {
+                        break;
+                    }
+                }
+            }
+            i++;
+        } else if (c == ':' && i + 1 < length && _router_is_word(query[i + 1])) {
+            /* named parameter */
+            for (i++; i < length && _router_is_word(query[i]); i++) {
+            }
+        } else if (_router_is_word(c)) {
+            size_t n = 0;
+            for (; i < length && _router_is_word(query[i]); i++) {
+                if (n < sizeof(word) - 1) {
+                    word[n++] = query[i];
+                }
+            }
+            word[n] = '\0';
+            if (first) {
+                if (!_router_word_in(word, _router_read_verbs)) {
+                    return false;
+                }
+                first = false;
+                any = true;
+            } else if (_router_word_in(word, _router_write_words)) {
+                return false;
+            }
+        } else if (c == ';') {
+            /* next statement */
+            first = true;
+            i = _router_skip(query, length, i + 1);
+        } else {
+            i = _router_skip(query, length, i + 1);
+        }
+    }
+    return any;
+}
+
+/* find the sequence number of domain in a GTID list "d-s-n,d-s-n" */
+static bool _router_gtid_seq(const char *list, uint32_t domain,
+                             uint64_t *seq) {
+    const char *p = list;
+    while (*p) {
+        char *end = NULL;
+        unsigned long d = strtoul(p, &end, 10);
+        if (end == p || *end != '-') {
+            return false;
+        }
+        p = end + 1;
+        strtoul(p, &end, 10);
+        if (end == p || *end != '-') {
+            return false;
+        }
+        p = end + 1;
+        unsigned long long n = strtoull(p, &end, 10);
+        if (end == p) {
+            return false;
+        }
+        if (d == domain) {
+            *seq = n;
+            return true;
+        }
+        p = end;
+        while (*p == ',' || isspace((unsigned char)*p)) {
+            p++;
+        }
+    }
+    return false;
+}
+
+static bool _router_set_gtid(qury_router_t *r, const char *gtid, size_t len) {
+    if (len == 0 || len >= sizeof(r->gtid)) {
+        return false;
+    }
+    char tmp[QURY_GTID_SIZE];
+    memcpy(tmp, gtid, len);
+    tmp[len] = '\0';
+    for (size_t i = 0; i < len; i++) {
+        /* also keeps the GTID safe to put in a query */
+        if (!isdigit((unsigned char)tmp[i]) && tmp[i] != '-') {
+            return false;
+        }
+    }
+    uint32_t domain = (uint32_t)strtoul(tmp, NULL, 10);
+    uint64_t seq = 0;
+    if (!_router_gtid_seq(tmp, domain, &seq)) {
+        return false;
+    }
+    memcpy(r->gtid, tmp, len + 1);
+    r->domain = domain;
+    r->seq = seq;
+    r->has_gtid = true;
+    return true;
+}
+
+/* run a query returning a single value */
+static bool _router_query_value(MYSQL *mysql, const char *query, char *value,
+                                size_t size) {
+    if (mysql_real_query(mysql, query, strlen(query))) {
+        fprintf(stderr, "qury_router : %s\n", mysql_error(mysql));
+        return false;
+    }
+    MYSQL_RES *res = mysql_store_result(mysql);
+    if (!res) {
+        fprintf(stderr, "qury_router : %s\n", mysql_error(mysql));
+        return false;
+    }
+    bool ok = false;
+    MYSQL_ROW row = mysql_fetch_row(res);
+    if (row && row[0]) {
+        unsigned long *lengths = mysql_fetch_lengths(res);
+        size_t len = lengths[0] < size - 1 ? lengths[0] : size - 1;
+        memcpy(value, row[0], len);
+        value[len] = '\0';
+        ok = true;
+    }
+    mysql_free_result(res);
+    return ok;
+}
+
+bool qury_router_init(qury_router_t *r, qury_conn_t *primary) {
+    assert(r != NULL);
+    assert(primary != NULL);
+
+    memset(r, 0, sizeof(*r));
+    r->primary = primary;
+
+    static const char track[] =
+        "SET SESSION session_track_system_variables = "
+        "IF(@@session_track_system_variables = '', 'last_gtid', "
+        "CONCAT(@@session_track_system_variables, ',last_gtid'))";
+    /* not an error, the GTID is then queried after each write */
+    r->tracking = mysql_real_query(primary->mysql, track, sizeof(track) - 1) == 0;
+    return true;
+}
+
+bool qury_router_add_replica(qury_router_t *r, qury_conn_t *conn) {
+    assert(r != NULL);
+    assert(conn != NULL);
+
+    if (r->nreplicas >= QURY_ROUTER_MAX_REPLICAS) {
+        fprintf(stderr, "qury_router_add_replica : too many replicas\n");
+        return false;
+    }
+    r->replicas[r->nreplicas++] = (qury_replica_t){.conn = conn};
+    return true;
+}
+
+bool qury_router_track(qury_router_t *r) {
+    assert(r != NULL);
+
+    MYSQL *mysql = r->primary->mysql;
+    if (r->tracking) {
+        const char *data = NULL;
+        size_t len = 0;
+        bool is_name = true;
+        bool is_gtid = false;
+        if (mysql_session_track_get_first(mysql, SESSION_TRACK_SYSTEM_VARIABLES,
+                                          &data, &len)
+            != 0) {
+            /* unchanged, nothing was written */
+            return true;
+        }
+        do {
+            if (is_name) {
+                is_gtid = len == 9 && memcmp(data, "last_gtid", 9) == 0;
+            } else if (is_gtid) {
+                /* empty when nothing went to the binary log */
+                if (len > 0) {
+                    _router_set_gtid(r, data, len);
+                }
+                break;
+            }
+            is_name = !is_name;
+        } while (mysql_session_track_get_next(
+                     mysql, SESSION_TRACK_SYSTEM_VARIABLES, &data, &len)
+                 == 0);
+        return true;
+    }
+
+    char gtid[QURY_GTID_SIZE];
+    if (!_router_query_value(mysql, "SELECT @@last_gtid", gtid, sizeof(gtid))) {
+        return false;
+    }
+    if (gtid[0] != '\0') {
+        _router_set_gtid(r, gtid, strlen(gtid));
+    }
+    return true;
+}
+
+/* true when the replica has applied the session GTID */
+static bool _router_recent(qury_router_t *r, qury_replica_t *rep, bool wait) {
+    if (!r->has_gtid
+        || (rep->known && rep->domain == r->domain && rep->seq >= r->seq)) {
+        return true;
+    }
+
+    char query[QURY_GTID_SIZE + 64];
+    char value[256];
+    if (wait && r->wait_ms > 0) {
+        r->waits++;
+        snprintf(query, sizeof(query), "SELECT MASTER_GTID_WAIT('%s', %u.%03u)",
+                 r->gtid, r->wait_ms / 1000, r->wait_ms % 1000);
+        /* 0 when reached, -1 on timeout */
+        if (!_router_query_value(rep->conn->mysql, query, value, sizeof(value))
+            || strcmp(value, "0") != 0) {
+            return false;
+        }
+        rep->domain = r->domain;
+        rep->seq = r->seq;
+        rep->known = true;
+        return true;
+    }
+
+    uint64_t seq = 0;
+    if (!_router_query_value(rep->conn->mysql, "SELECT @@gtid_slave_pos", value,
+                             sizeof(value))
+        || !_router_gtid_seq(value, r->domain, &seq)) {
+        return false;
+    }
+    rep->domain = r->domain;
+    rep->seq = seq;
+    rep->known = true;
+    return seq >= r->seq;
+}
+
+static qury_replica_t *_router_replica(qury_router_t *r, qury_conn_t *conn) {
+    for (size_t i = 0; i < r->nreplicas; i++) {
+        if (r->replicas[i].conn == conn) {
+            return &r->replicas[i];
+        }
+    }
+    return NULL;
+}
+
+/* connection for a read, the current one is kept while recent enough so the
+ * statement isn't prepared again */
+static qury_conn_t *_router_pick(qury_router_t *r, qury_conn_t *current) {
+    if (r->nreplicas == 0) {
+        r->primary_reads++;
+        return r->primary;
+    }
+    qury_replica_t *rep = _router_replica(r, current);
+    bool waited = false;
+    if (rep) {
+        waited = r->wait_ms > 0 && r->has_gtid;
+        if (_router_recent(r, rep, true)) {
+            r->replica_reads++;
+            return rep->conn;
+        }
+    }
+    /* only one wait per read, the others are checked */
+    for (size_t i = 0; i < r->nreplicas; i++) {
+        qury_replica_t *cand = &r->replicas[(r->next + i) % r->nreplicas];
+        if (cand == rep) {
+            continue;
+        }
+        if (_router_recent(r, cand, !waited)) {
+            r->next = (r->next + i + 1) % r->nreplicas;
+            r->replica_reads++;
+            return cand->conn;
+        }
+        waited = waited || (r->wait_ms > 0 && r->has_gtid);
+    }
+    r->primary_reads++;
+    return r->primary;
+}
+
+qury_stmt_t *qury_router_prepare(qury_router_t *r, const char *query,
+                                 size_t length, qury_route_t route,
+                                 void *allocator_userptr) {
+    assert(r != NULL);
+    assert(query != NULL);
+
+    if (route == QURY_RouteAuto) {
+        route = qury_query_is_read_only(query, length) ? QURY_RouteReplica
+                                                       : QURY_RoutePrimary;
+    }
+    qury_conn_t *conn = r->primary;
+    if (route == QURY_RouteReplica && r->nreplicas > 0) {
+        /* freshness is checked on execution */
+        conn = r->replicas[r->next].conn;
+        r->next = (r->next + 1) % r->nreplicas;
+    }
+    qury_stmt_t *stmt = qury_new(conn, allocator_userptr);
+    if (!stmt) {
+        return NULL;
+    }
+    stmt->route = route;
+    if (!qury_prepare(stmt, query, length)) {
+        qury_free(stmt);
+        return NULL;
+    }
+    return stmt;
+}
+
+bool qury_router_execute(qury_router_t *r, qury_stmt_t *stmt) {
+    assert(r != NULL);
+    assert(stmt != NULL);
+
+    /* the connection may be queried before execution */
+    if (stmt->res) {
+        mysql_free_result(stmt->res);
+        stmt->res = NULL;
+    }
+    mysql_stmt_free_result(stmt->stmt);
+
+    if (stmt->route == QURY_RouteReplica) {
+        qury_conn_t *conn = _router_pick(r, stmt->conn);
+        return qury_stmt_move(stmt, conn) && qury_execute(stmt);
+    }
+
+    if (!qury_stmt_move(stmt, r->primary) || !qury_execute(stmt)) {
+        return false;
+    }
+    /* a locking read marked for the primary doesn't write, and the fallback
+     * query can't run while its result is pending */
+    if (qury_query_is_read_only(stmt->query, stmt->query_length)
+        || (!r->tracking && mysql_stmt_field_count(stmt->stmt) > 0)) {
+        return true;
+    }
+    return qury_router_track(r);
+}
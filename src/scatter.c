@@ -0,0 +1,411 @@
+#include "include/quaerimus_scatter.h"
+#include "include/array.h"
+#include "include/quaerimus.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define _scatter_sign(a, b) (((a) > (b)) - ((a) < (b)))
+#define _SCATTER_BINARY_CHARSET 63
+
+static void *_scatter_worker(void *arg) {
+    qury_scatter_part_t *part = arg;
+    qury_scatter_t *s = part->owner;
+
+    mysql_thread_init();
+    bool ok = qury_execute(part->stmt);
+    mysql_thread_end();
+
+    pthread_mutex_lock(&s->lock);
+    part->ok = ok;
+    part->done = true;
+    s->finished[s->nfinished++] = (size_t)(part - s->parts);
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static void _scatter_join(qury_scatter_t *s) {
+    for (size_t i = 0; i < s->nparts; i++) {
+        if (s->parts[i].running) {
+            pthread_join(s->parts[i].thread, NULL);
+            s->parts[i].running = false;
+        }
+    }
+}
+
+bool qury_scatter_init(qury_scatter_t *s, qury_conn_t **conns, size_t n,
+                       const char *query, size_t length) {
+    assert(s != NULL);
+    assert(conns != NULL);
+    assert(query != NULL);
+
+    memset(s, 0, sizeof(*s));
+    s->order_column = -1;
+    if (n == 0 || n > QURY_SCATTER_MAX) {
+        fprintf(stderr, "qury_scatter_init : between 1 and %d connections\n",
+                QURY_SCATTER_MAX);
+        return false;
+    }
+    if (pthread_mutex_init(&s->lock, NULL) != 0) {
+        return false;
+    }
+    if (pthread_cond_init(&s->cond, NULL) != 0) {
+        pthread_mutex_destroy(&s->lock);
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        qury_scatter_part_t *part = &s->parts[i];
+        part->owner = s;
+        part->stmt = qury_new(conns[i], NULL);
+        if (!part->stmt) {
+            qury_scatter_free(s);
+            return false;
+        }
+        s->nparts++;
+        /* the part is read after its thread is done */
+        qury_set_result_mode(part->stmt, QURY_ResultBuffered);
+        if (!qury_prepare(part->stmt, query, length)) {
+            qury_scatter_free(s);
+            return false;
+        }
+    }
+    return true;
+}
+
+void qury_scatter_free(qury_scatter_t *s) {
+    if (!s) {
+        return;
+    }
+    _scatter_join(s);
+    for (size_t i = 0; i < s->nparts; i++) {
+        if (s->parts[i].stmt) {
+            qury_free(s->parts[i].stmt);
+            s->parts[i].stmt = NULL;
+        }
+    }
+    s->nparts = 0;
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->lock);
+}
+
+bool qury_scatter_bind(qury_scatter_t *s, const char *name, quryptr_t ptr,
+                       size_t vlen, qury_bind_value_type_t type) {
+    assert(s != NULL);
+    /* the parts may still run */
+    _scatter_join(s);
+    for (size_t i = 0; i < s->nparts; i++) {
+        if (!qury_stmt_bind(s->parts[i].stmt, name, ptr, vlen, type)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool qury_scatter_execute(qury_scatter_t *s, int64_t lo, int64_t hi,
+                          const char *order_by, bool descending) {
+    assert(s != NULL);
+
+    _scatter_join(s);
+    s->nfinished = 0;
+    s->consumed = 0;
+    s->heap_size = 0;
+    s->started = false;
+    s->failed = false;
+    s->current = 0;
+    s->order_column = -1;
+    s->descending = descending;
+    s->order_by[0] = '\0';
+    if (order_by) {
+        if (strlen(order_by) >= sizeof(s->order_by)) {
+            fprintf(stderr, "qury_scatter_execute : column name too long\n");
+            return false;
+        }
+        strcpy(s->order_by, order_by);
+    }
+
+    /* equal parts, the first ones take the remainder */
+    uint64_t span = hi > lo ? (uint64_t)hi - (uint64_t)lo : 0;
+    uint64_t step = span / s->nparts;
+    uint64_t rem = span % s->nparts;
+    int64_t start = lo;
+    for (size_t i = 0; i < s->nparts; i++) {
+        qury_scatter_part_t *part = &s->parts[i];
+        uint64_t len = step + (i < rem ? 1 : 0);
+        part->lo = start;
+        part->hi = (int64_t)((uint64_t)start + len);
+        start = part->hi;
+        part->ok = false;
+        part->done = false;
+        if (!qury_stmt_bind(part->stmt, "lo", (quryptr_t)part->lo, 0,
+                            QURY_Integer)
+            || !qury_stmt_bind(part->stmt, "hi", (quryptr_t)part->hi, 0,
+                               QURY_Integer)) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < s->nparts; i++) {
+        qury_scatter_part_t *part = &s->parts[i];
+        if (pthread_create(&part->thread, NULL, _scatter_worker, part) == 0) {
+            part->running = true;
+        } else {
+            /* no thread, run it here */
+            _scatter_worker(part);
+        }
+    }
+    return true;
+}
+
+/* wait for a part, true if it succeeded */
+static bool _scatter_wait(qury_scatter_t *s, size_t i) {
+    pthread_mutex_lock(&s->lock);
+    while (!s->parts[i].done) {
+        pthread_cond_wait(&s->cond, &s->lock);
+    }
+    bool ok = s->parts[i].ok;
+    pthread_mutex_unlock(&s->lock);
+    return ok;
+}
+
+static int _scatter_time_cmp(const MYSQL_TIME *a, const MYSQL_TIME *b) {
+    int c = 0;
+    if ((c = _scatter_sign(a->year, b->year))
+        || (c = _scatter_sign(a->month, b->month))
+        || (c = _scatter_sign(a->day, b->day))
+        || (c = _scatter_sign(a->hour, b->hour))
+        || (c = _scatter_sign(a->minute, b->minute))
+        || (c = _scatter_sign(a->second, b->second))) {
+        return c;
+    }
+    return _scatter_sign(a->second_part, b->second_part);
+}
+
+/* tail of the longer string against the spaces padding the shorter one */
+static int _scatter_pad_cmp(const uint8_t *tail, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (tail[i] != ' ') {
+            return tail[i] < ' ' ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/* NULL first like the server, strings in binary order, as if padded with
+ * spaces with \a pad */
+static int _scatter_cmp(qury_bind_t *a, qury_bind_t *b, bool pad) {
+    /* a value that can't be read sorts as NULL */
+    bool anull = !a || a->is_null || a->type == QURY_Null;
+    bool bnull = !b || b->is_null || b->type == QURY_Null;
+    if (anull || bnull) {
+        return (int)bnull - (int)anull;
+    }
+    switch (a->type & ~QURY_Flags) {
+        case QURY_Integer:
+            if (a->is_unsigned) {
+                return _scatter_sign(a->value.i, b->value.i);
+            }
+            return _scatter_sign((int64_t)a->value.i, (int64_t)b->value.i);
+        case QURY_Float:
+            return _scatter_sign(a->value.f, b->value.f);
+        case QURY_Bool:
+            return _scatter_sign(a->value.b, b->value.b);
+        case QURY_CString:
+        case QURY_OString: {
+            const void *pa = a->type == QURY_CString ? (void *)a->value.cstr
+                                                     : (void *)a->value.ostr.ptr;
+            const void *pb = b->type == QURY_CString ? (void *)b->value.cstr
+                                                     : (void *)b->value.ostr.ptr;
+            size_t n = a->length < b->length ? a->length : b->length;
+            int c = n > 0 ? memcmp(pa, pb, n) : 0;
+            if (c != 0) {
+                return _scatter_sign(c, 0);
+            }
+            if (!pad) {
+                return _scatter_sign(a->length, b->length);
+            }
+            return a->length > n ? _scatter_pad_cmp((const uint8_t *)pa + n,
+                                                    a->length - n)
+                                 : -_scatter_pad_cmp((const uint8_t *)pb + n,
+                                                     b->length - n);
+        }
+        case QURY_DateTime:
+            return _scatter_time_cmp(&a->value.dt, &b->value.dt);
+        case QURY_Decimal:
+            if (a->value.dec.scale == b->value.dec.scale
+                && !a->value.dec.overflow && !b->value.dec.overflow) {
+                return _scatter_sign(a->value.dec.mantissa,
+                                     b->value.dec.mantissa);
+            }
+            return _scatter_sign(qury_decimal_to_double(a->value.dec),
+                                 qury_decimal_to_double(b->value.dec));
+        default:
+            return 0;
+    }
+}
+
+static bool _scatter_less(qury_scatter_t *s, size_t a, size_t b) {
+    size_t column = (size_t)s->order_column;
+    qury_bind_t *va = qury_get_column_value(s->parts[a].stmt, column);
+    qury_bind_t *vb = qury_get_column_value(s->parts[b].stmt, column);
+    int c = _scatter_cmp(va, vb, s->order_pad);
+    if (s->descending) {
+        c = -c;
+    }
+    /* ties in part order, which is the split key order */
+    return c < 0 || (c == 0 && a < b);
+}
+
+static void _scatter_sift_down(qury_scatter_t *s, size_t i) {
+    for (;;) {
+        size_t l = 2 * i + 1;
+        size_t r = l + 1;
+        size_t m = i;
+        if (l < s->heap_size && _scatter_less(s, s->heap[l], s->heap[m])) {
+            m = l;
+        }
+        if (r < s->heap_size && _scatter_less(s, s->heap[r], s->heap[m])) {
+            m = r;
+        }
+        if (m == i) {
+            return;
+        }
+        size_t tmp = s->heap[i];
+        s->heap[i] = s->heap[m];
+        s->heap[m] = tmp;
+        i = m;
+    }
+}
+
+/* strings are merged byte by byte, which is the order of the server for the
+ * binary and _bin collations only */
+static bool _scatter_check_collation(qury_scatter_t *s, qury_stmt_t *stmt) {
+    size_t column = (size_t)s->order_column;
+    qury_bind_t *v = qury_get_column_value(stmt, column);
+    qury_field_name_t *f = (qury_field_name_t *)array_get(&stmt->fields, column);
+    s->order_pad = false;
+    if (!v || !f || (v->type != QURY_CString && v->type != QURY_OString)
+        || f->charsetnr == _SCATTER_BINARY_CHARSET) {
+        return true;
+    }
+    MARIADB_CHARSET_INFO *cs = mariadb_get_charset_by_nr(f->charsetnr);
+    size_t len = cs && cs->name ? strlen(cs->name) : 0;
+    if (len < 4 || strcmp(cs->name + len - 4, "_bin") != 0) {
+        fprintf(stderr,
+                "qury_scatter_fetch : %s has the collation %s, the merge needs "
+                "a _bin one\n",
+                s->order_by, len > 0 ? cs->name : "unknown");
+        return false;
+    }
+    /* PAD SPACE unless NO PAD, trailing spaces don't count */
+    s->order_pad = strstr(cs->name, "_nopad_") == NULL;
+    return true;
+}
+
+/* a part without more rows, false if its result ended on an error */
+static bool _scatter_part_done(qury_scatter_t *s, size_t i) {
+    if (qury_fetch_failed(s->parts[i].stmt)) {
+        fprintf(stderr, "qury_scatter_fetch : part %zu ended on an error\n", i);
+        s->failed = true;
+        return false;
+    }
+    return true;
+}
+
+static bool _scatter_fetch_merge(qury_scatter_t *s) {
+    if (!s->started) {
+        /* first row of every part */
+        s->started = true;
+        for (size_t i = 0; i < s->nparts; i++) {
+            if (!_scatter_wait(s, i)) {
+                s->failed = true;
+                return false;
+            }
+            if (qury_fetch(s->parts[i].stmt)) {
+                s->heap[s->heap_size++] = i;
+            } else if (!_scatter_part_done(s, i)) {
+                return false;
+            }
+        }
+        if (s->heap_size == 0) {
+            return false;
+        }
+        s->order_column = qury_field_index(s->parts[s->heap[0]].stmt,
+                                           s->order_by);
+        if (s->order_column < 0) {
+            fprintf(stderr, "qury_scatter_fetch : no column %s\n", s->order_by);
+            s->failed = true;
+            return false;
+        }
+        if (!_scatter_check_collation(s, s->parts[s->heap[0]].stmt)) {
+            s->failed = true;
+            return false;
+        }
+        for (size_t i = s->heap_size / 2; i-- > 0;) {
+            _scatter_sift_down(s, i);
+        }
+    } else if (s->heap_size > 0) {
+        if (!qury_fetch(s->parts[s->heap[0]].stmt)) {
+            if (!_scatter_part_done(s, s->heap[0])) {
+                return false;
+            }
+            s->heap[0] = s->heap[--s->heap_size];
+        }
+        _scatter_sift_down(s, 0);
+    }
+    if (s->heap_size == 0) {
+        return false;
+    }
+    s->current = s->heap[0];
+    return true;
+}
+
+static bool _scatter_fetch_stream(qury_scatter_t *s) {
+    if (s->started) {
+        if (qury_fetch(s->parts[s->current].stmt)) {
+            return true;
+        }
+        s->started = false;
+        if (!_scatter_part_done(s, s->current)) {
+            return false;
+        }
+        s->consumed++;
+    }
+    /* next part to finish */
+    while (s->consumed < s->nparts) {
+        pthread_mutex_lock(&s->lock);
+        while (s->consumed == s->nfinished) {
+            pthread_cond_wait(&s->cond, &s->lock);
+        }
+        size_t i = s->finished[s->consumed];
+        pthread_mutex_unlock(&s->lock);
+
+        if (!s->parts[i].ok) {
+            s->failed = true;
+            return false;
+        }
+        if (qury_fetch(s->parts[i].stmt)) {
+            s->current = i;
+            s->started = true;
+            return true;
+        }
+        if (!_scatter_part_done(s, i)) {
+            return false;
+        }
+        s->consumed++;
+    }
+    return false;
+}
+
+bool qury_scatter_fetch(qury_scatter_t *s) {
+    assert(s != NULL);
+    if (s->failed) {
+        return false;
+    }
+    if (s->order_by[0] != '\0') {
+        return _scatter_fetch_merge(s);
+    }
+    return _scatter_fetch_stream(s);
+}
@@ -0,0 +1,341 @@
+#include "include/quaerimus_shard.h"
+#include "include/quaerimus.h"
+#include <assert.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _FNV_OFFSET 0xcbf29ce484222325ULL
+#define _FNV_PRIME 0x100000001b3ULL
+
+static uint64_t _shard_mix(uint64_t x) {
+    /* splitmix64 finalizer */
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t _shard_fnv(uint64_t h, const void *ptr, size_t len) {
+    const uint8_t *p = ptr;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * _FNV_PRIME;
+    }
+    return h;
+}
+
+uint64_t qury_shard_hash(const qury_param_t *p) {
+    assert(p != NULL);
+
+    switch (p->type & ~QURY_Flags) {
+        case QURY_CString: {
+            const char *s = (const char *)(uintptr_t)p->ptr;
+            return _shard_mix(_shard_fnv(_FNV_OFFSET, s, s ? strlen(s) : 0));
+        }
+        case QURY_OString:
+            return _shard_mix(
+                _shard_fnv(_FNV_OFFSET, (const void *)(uintptr_t)p->ptr, p->vlen));
+        case QURY_Null:
+            return _shard_mix(0);
+        default:
+            /* integers, and floats or booleans by their bits */
+            return _shard_mix(p->ptr);
+    }
+}
+
+static int _shard_vnode_cmp(const void *a, const void *b) {
+    const qury_vnode_t *x = a;
+    const qury_vnode_t *y = b;
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    /* same hash on two shards, keep the order stable */
+    return x->shard < y->shard ? -1 : x->shard > y->shard;
+}
+
+/* wait for the lookups started before the last ring was published; a
+ * lookup counts itself in the readers of the epoch it saw, both are drained
+ * since it may have seen the epoch before the previous flip */
+static void _shard_synchronize(qury_shard_map_t *m) {
+    for (int i = 0; i < 2; i++) {
+        unsigned int e = atomic_fetch_add(&m->epoch, 1) & 1;
+        while (atomic_load(&m->readers[e]) != 0) {
+            sched_yield();
+        }
+    }
+}
+
+/* build and publish a ring from the current weights, writer lock held */
+static bool _shard_rebuild(qury_shard_map_t *m) {
+    size_t nshards = atomic_load_explicit(&m->nshards, memory_order_relaxed);
+    size_t nvnodes = 0;
+    for (size_t i = 0; i < nshards; i++) {
+        nvnodes += (size_t)m->shards[i].weight * QURY_SHARD_VNODES;
+    }
+    qury_ring_t *ring =
+        malloc(sizeof(qury_ring_t) + nvnodes * sizeof(qury_vnode_t));
+    if (!ring) {
+        fprintf(stderr, "qury_shard : cannot allocate ring\n");
+        return false;
+    }
+    ring->nvnodes = 0;
+    for (size_t i = 0; i < nshards; i++) {
+        qury_shard_t *s = &m->shards[i];
+        /* placement only depends on the name */
+        uint64_t base = _shard_fnv(_FNV_OFFSET, s->name, strlen(s->name));
+        for (size_t v = 0; v < (size_t)s->weight * QURY_SHARD_VNODES; v++) {
+            ring->vnodes[ring->nvnodes++] = (qury_vnode_t){
+                .hash = _shard_mix(base ^ _shard_mix(v)), .shard = (uint32_t)i};
+        }
+    }
+    qsort(ring->vnodes, ring->nvnodes, sizeof(qury_vnode_t), _shard_vnode_cmp);
+
+    /* lookups may still use the previous ring */
+    qury_ring_t *previous = atomic_exchange(&m->ring, ring);
+    if (previous) {
+        _shard_synchronize(m);
+        free(previous);
+    }
+    return true;
+}
+
+bool qury_shard_map_init(qury_shard_map_t *m, const char *key) {
+    assert(m != NULL);
+    assert(key != NULL);
+
+    memset(m, 0, sizeof(*m));
+    if (strlen(key) >= sizeof(m->key)) {
+        fprintf(stderr, "qury_shard_map_init : key name too long\n");
+        return false;
+    }
+    strcpy(m->key, key);
+    atomic_init(&m->nshards, 0);
+    atomic_init(&m->ring, NULL);
+    atomic_init(&m->epoch, 0);
+    atomic_init(&m->readers[0], 0);
+    atomic_init(&m->readers[1], 0);
+    if (pthread_mutex_init(&m->lock, NULL) != 0) {
+        return false;
+    }
+    pthread_mutex_lock(&m->lock);
+    bool ok = _shard_rebuild(m);
+    pthread_mutex_unlock(&m->lock);
+    return ok;
+}
+
+void qury_shard_map_free(qury_shard_map_t *m) {
+    if (!m) {
+        return;
+    }
+    size_t nshards = atomic_load(&m->nshards);
+    for (size_t i = 0; i < nshards; i++) {
+        for (size_t j = 0; j < QURY_SHARD_CACHE_SIZE; j++) {
+            if (m->shards[i].cache[j].stmt) {
+                qury_free(m->shards[i].cache[j].stmt);
+                free(m->shards[i].cache[j].query);
+                m->shards[i].cache[j].stmt = NULL;
+            }
+        }
+    }
+    free(atomic_exchange(&m->ring, NULL));
+    pthread_mutex_destroy(&m->lock);
+}
+
+int qury_shard_add(qury_shard_map_t *m, const char *name, qury_conn_t *conn,
+                   uint32_t weight) {
+    assert(m != NULL);
+    assert(name != NULL);
+    assert(conn != NULL);
+
+    if (strlen(name) >= QURY_SHARD_NAME_SIZE) {
+        fprintf(stderr, "qury_shard_add : name too long\n");
+        return -1;
+    }
+    pthread_mutex_lock(&m->lock);
+    size_t n = atomic_load_explicit(&m->nshards, memory_order_relaxed);
+    if (n >= QURY_SHARD_MAX) {
+        pthread_mutex_unlock(&m->lock);
+        fprintf(stderr, "qury_shard_add : too many shards\n");
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (strcmp(m->shards[i].name, name) == 0) {
+            pthread_mutex_unlock(&m->lock);
+            fprintf(stderr, "qury_shard_add : duplicate shard %s\n", name);
+            return -1;
+        }
+    }
+    qury_shard_t *s = &m->shards[n];
+    memset(s, 0, sizeof(*s));
+    strcpy(s->name, name);
+    s->conn = conn;
+    s->weight = weight;
+    /* visible before a ring refers to it */
+    atomic_store_explicit(&m->nshards, n + 1, memory_order_release);
+    bool ok = _shard_rebuild(m);
+    pthread_mutex_unlock(&m->lock);
+    return ok ? (int)n : -1;
+}
+
+bool qury_shard_set_weight(qury_shard_map_t *m, int shard, uint32_t weight) {
+    assert(m != NULL);
+
+    pthread_mutex_lock(&m->lock);
+    if (shard < 0 || (size_t)shard >= atomic_load(&m->nshards)) {
+        pthread_mutex_unlock(&m->lock);
+        fprintf(stderr, "qury_shard_set_weight : unknown shard %d\n", shard);
+        return false;
+    }
+    m->shards[shard].weight = weight;
+    bool ok = _shard_rebuild(m);
+    pthread_mutex_unlock(&m->lock);
+    return ok;
+}
+
+int qury_shard_lookup(qury_shard_map_t *m, uint64_t hash) {
+    assert(m != NULL);
+
+    /* the ring can't be freed while it is counted */
+    unsigned int e = atomic_load(&m->epoch) & 1;
+    atomic_fetch_add(&m->readers[e], 1);
+    qury_ring_t *ring = atomic_load(&m->ring);
+    int shard = -1;
+    if (ring && ring->nvnodes > 0) {
+        /* first node at or after hash, wrapping around */
+        size_t lo = 0;
+        size_t hi = ring->nvnodes;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (ring->vnodes[mid].hash < hash) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == ring->nvnodes) {
+            lo = 0;
+        }
+        shard = (int)ring->vnodes[lo].shard;
+    }
+    atomic_fetch_sub_explicit(&m->readers[e], 1, memory_order_release);
+    return shard;
+}
+
+static qury_stmt_t *_shard_prepare(qury_shard_t *s, const char *query) {
+    qury_stmt_t *stmt = qury_new(s->conn, NULL);
+    if (stmt && !qury_prepare(stmt, query, 0)) {
+        qury_free(stmt);
+        return NULL;
+    }
+    return stmt;
+}
+
+/* cached statement for query, prepared on a miss, in use until released */
+static qury_stmt_t *_shard_cached(qury_shard_t *s, const char *query) {
+    uint64_t h = _shard_fnv(_FNV_OFFSET, query, strlen(query));
+    size_t mask = QURY_SHARD_CACHE_SIZE - 1;
+    size_t home = h & mask;
+    qury_shard_cached_t *c = NULL;
+    for (size_t i = 0; i < QURY_SHARD_CACHE_SIZE; i++) {
+        qury_shard_cached_t *e = &s->cache[(home + i) & mask];
+        if (!e->stmt) {
+            c = e;
+            break;
+        }
+        if (e->hash == h && strcmp(e->query, query) == 0) {
+            e->users++;
+            return e->stmt;
+        }
+    }
+
+    if (!c) {
+        /* full, replace the first statement not in use from the home slot */
+        for (size_t i = 0; i < QURY_SHARD_CACHE_SIZE; i++) {
+            qury_shard_cached_t *e = &s->cache[(home + i) & mask];
+            if (e->users == 0) {
+                qury_free(e->stmt);
+                free(e->query);
+                e->stmt = NULL;
+                c = e;
+                break;
+            }
+        }
+        if (!c) {
+            /* all in use, not cached, freed when released */
+            return _shard_prepare(s, query);
+        }
+    }
+    char *key = strdup(query);
+    if (!key) {
+        return NULL;
+    }
+    qury_stmt_t *stmt = _shard_prepare(s, query);
+    if (!stmt) {
+        free(key);
+        return NULL;
+    }
+    *c = (qury_shard_cached_t){
+        .hash = h, .query = key, .stmt = stmt, .users = 1};
+    return stmt;
+}
+
+void qury_shard_release(qury_shard_map_t *m, qury_stmt_t *stmt) {
+    assert(m != NULL);
+
+    if (!stmt) {
+        return;
+    }
+    size_t nshards = atomic_load(&m->nshards);
+    for (size_t i = 0; i < nshards; i++) {
+        qury_shard_t *s = &m->shards[i];
+        if (s->conn != stmt->conn) {
+            continue;
+        }
+        for (size_t j = 0; j < QURY_SHARD_CACHE_SIZE; j++) {
+            if (s->cache[j].stmt == stmt) {
+                if (s->cache[j].users > 0) {
+                    s->cache[j].users--;
+                }
+                return;
+            }
+        }
+    }
+    /* not cached */
+    qury_free(stmt);
+}
+
+qury_stmt_t *qury_shard_stmt(qury_shard_map_t *m, const char *query,
+                             const qury_param_t *params) {
+    assert(m != NULL);
+    assert(query != NULL);
+
+    const qury_param_t *key = NULL;
+    for (const qury_param_t *p = params; p && p->name; p++) {
+        if (strcmp(p->name, m->key) == 0) {
+            key = p;
+            break;
+        }
+    }
+    if (!key) {
+        fprintf(stderr, "qury_shard_stmt : no :%s parameter\n", m->key);
+        return NULL;
+    }
+    int shard = qury_shard_lookup(m, qury_shard_hash(key));
+    if (shard < 0) {
+        fprintf(stderr, "qury_shard_stmt : no shard\n");
+        return NULL;
+    }
+    qury_stmt_t *stmt = _shard_cached(&m->shards[shard], query);
+    if (!stmt) {
+        return NULL;
+    }
+    for (const qury_param_t *p = params; p && p->name; p++) {
+        if (!qury_stmt_bind(stmt, p->name, p->ptr, p->vlen, p->type)) {
+            qury_shard_release(m, stmt);
+            return NULL;
+        }
+    }
+    return stmt;
+}
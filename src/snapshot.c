@@ -0,0 +1,482 @@
+#include "include/quaerimus_snapshot.h"
+#include "include/array.h"
+#include "include/quaerimus.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define _SNAP_ALIGN 16
+#define _snap_align(x) (((x) + (_SNAP_ALIGN - 1)) & ~(uint64_t)(_SNAP_ALIGN - 1))
+
+struct _snap_buf {
+    uint8_t *ptr;
+    size_t len;
+    size_t cap;
+};
+
+struct _snap_col {
+    qury_snapshot_column_t desc;
+    struct _snap_buf nulls;
+    struct _snap_buf data;
+    struct _snap_buf heap;
+};
+
+static bool _snap_reserve(struct _snap_buf *b, size_t need) {
+    if (b->len + need <= b->cap) {
+        return true;
+    }
+    size_t cap = b->cap > 0 ? b->cap : 4096;
+    while (cap < b->len + need) {
+        cap *= 2;
+    }
+    uint8_t *tmp = realloc(b->ptr, cap);
+    if (!tmp) {
+        return false;
+    }
+    b->ptr = tmp;
+    b->cap = cap;
+    return true;
+}
+
+static bool _snap_append(struct _snap_buf *b, const void *data, size_t len) {
+    if (!_snap_reserve(b, len)) {
+        return false;
+    }
+    if (len > 0) {
+        memcpy(&b->ptr[b->len], data, len);
+    }
+    b->len += len;
+    return true;
+}
+
+static uint32_t _snap_width(qury_bind_value_type_t type) {
+    switch (type) {
+        case QURY_Integer:
+            return sizeof(uint64_t);
+        case QURY_Float:
+            return sizeof(double);
+        case QURY_Bool:
+            return sizeof(bool);
+        case QURY_DateTime:
+            return sizeof(MYSQL_TIME);
+        case QURY_Decimal:
+            return sizeof(qury_decimal_t);
+        case QURY_CString:
+        case QURY_OString:
+            /* heap offsets */
+            return sizeof(uint64_t);
+        default:
+            return 0;
+    }
+}
+
+/* value over the memory budget, read from the row piece by piece */
+static bool _snap_add_chunked(struct _snap_col *col, qury_stmt_t *stmt,
+                              size_t column, qury_bind_t *v) {
+    size_t offset = 0;
+    size_t n = 0;
+    if (!_snap_reserve(&col->heap, v->length)) {
+        return false;
+    }
+    while (offset < v->length
+           && (n = qury_read_column(stmt, column, offset,
+                                    &col->heap.ptr[col->heap.len + offset],
+                                    v->length - offset)) > 0) {
+        offset += n;
+    }
+    if (offset < v->length) {
+        fprintf(stderr, "qury_snapshot_write : cannot read column %zu\n",
+                column);
+        return false;
+    }
+    col->heap.len += offset;
+    return true;
+}
+
+static bool _snap_add_row(struct _snap_col *col, qury_stmt_t *stmt,
+                          size_t column, qury_bind_t *v, uint64_t row) {
+    if ((row & 7) == 0) {
+        uint8_t zero = 0;
+        if (!_snap_append(&col->nulls, &zero, 1)) {
+            return false;
+        }
+    }
+    bool is_null = qury_is_null(v);
+    if (is_null) {
+        col->nulls.ptr[row >> 3] |= (uint8_t)(1 << (row & 7));
+    }
+    switch (col->desc.type) {
+        case QURY_CString:
+        case QURY_OString: {
+            const void *ptr = col->desc.type == QURY_CString
+                                  ? (const void *)v->value.cstr
+                                  : (const void *)v->value.ostr.ptr;
+            size_t len = col->desc.type == QURY_CString ? v->length
+                                                         : v->value.ostr.len;
+            uint8_t nul = 0;
+            if (!is_null && v->chunked) {
+                /* no data in the value, see qury_read_column */
+                if (!_snap_add_chunked(col, stmt, column, v)) {
+                    return false;
+                }
+            } else if (!is_null && ptr && !_snap_append(&col->heap, ptr, len)) {
+                return false;
+            }
+            if (!_snap_append(&col->heap, &nul, 1)) {
+                return false;
+            }
+            uint64_t end = col->heap.len;
+            return _snap_append(&col->data, &end, sizeof(end));
+        }
+        case QURY_Null:
+            return true;
+        default: {
+            uint8_t zero[sizeof(qury_bind_value_t)] = {0};
+            const void *src = is_null ? (const void *)zero : (const void *)&v->value;
+            return _snap_append(&col->data, src, col->desc.width);
+        }
+    }
+}
+
+static bool _snap_write_at(int fd, const void *data, size_t len,
+                           uint64_t offset) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t w = pwrite(fd, p, len, (off_t)offset);
+        if (w < 0) {
+            return false;
+        }
+        p += w;
+        len -= (size_t)w;
+        offset += (uint64_t)w;
+    }
+    return true;
+}
+
+static bool _snap_write_file(const char *path, struct _snap_col *cols,
+                             uint32_t ncols, uint64_t nrows,
+                             struct _snap_buf *names) {
+    qury_snapshot_header_t header = {0};
+    uint64_t offset = 0;
+
+    memcpy(header.magic, QURY_SNAPSHOT_MAGIC, sizeof(QURY_SNAPSHOT_MAGIC));
+    header.version = QURY_SNAPSHOT_VERSION;
+    header.ncols = ncols;
+    header.nrows = nrows;
+
+    /* layout */
+    offset = _snap_align(sizeof(header) + ncols * sizeof(qury_snapshot_column_t));
+    header.names_offset = offset;
+    header.names_size = names->len;
+    offset = _snap_align(offset + names->len);
+    for (uint32_t c = 0; c < ncols; c++) {
+        cols[c].desc.nulls_offset = offset;
+        offset = _snap_align(offset + cols[c].nulls.len);
+        cols[c].desc.data_offset = offset;
+        offset = _snap_align(offset + cols[c].data.len);
+        cols[c].desc.heap_offset = offset;
+        cols[c].desc.heap_size = cols[c].heap.len;
+        offset = _snap_align(offset + cols[c].heap.len);
+    }
+    header.size = offset;
+
+    size_t plen = strlen(path);
+    char *tmp = malloc(plen + 32);
+    if (!tmp) {
+        return false;
+    }
+    snprintf(tmp, plen + 32, "%s.%ld.tmp", path, (long)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "qury_snapshot_write : cannot open %s\n", tmp);
+        free(tmp);
+        return false;
+    }
+
+    bool ok = ftruncate(fd, (off_t)header.size) == 0
+              && _snap_write_at(fd, &header, sizeof(header), 0)
+              && _snap_write_at(fd, names->ptr, names->len, header.names_offset);
+    for (uint32_t c = 0; ok && c < ncols; c++) {
+        ok = _snap_write_at(fd, &cols[c].desc, sizeof(cols[c].desc),
+                            sizeof(header) + c * sizeof(cols[c].desc))
+             && _snap_write_at(fd, cols[c].nulls.ptr, cols[c].nulls.len,
+                               cols[c].desc.nulls_offset)
+             && _snap_write_at(fd, cols[c].data.ptr, cols[c].data.len,
+                               cols[c].desc.data_offset)
+             && _snap_write_at(fd, cols[c].heap.ptr, cols[c].heap.len,
+                               cols[c].desc.heap_offset);
+    }
+    ok = ok && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (ok && rename(tmp, path) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "qury_snapshot_write : cannot write %s\n", path);
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok;
+}
+
+bool qury_snapshot_write(qury_stmt_t *stmt, const char *path) {
+    assert(stmt != NULL);
+    assert(path != NULL);
+
+    uint32_t ncols = (uint32_t)stmt->field_cnt;
+    uint64_t nrows = 0;
+    struct _snap_buf names = {0};
+    struct _snap_col *cols = calloc(ncols > 0 ? ncols : 1, sizeof(*cols));
+    bool ok = cols != NULL;
+
+    for (uint32_t c = 0; ok && c < ncols; c++) {
+        qury_field_name_t *f = (qury_field_name_t *)array_get(&stmt->fields, c);
+        const char *name = f->name ? f->name : "";
+        cols[c].desc.name_offset = (uint32_t)names.len;
+        cols[c].desc.is_unsigned = !!(f->flags & UNSIGNED_FLAG);
+        ok = _snap_append(&names, name, strlen(name) + 1);
+    }
+
+    while (ok && qury_fetch(stmt)) {
+        for (uint32_t c = 0; ok && c < ncols; c++) {
+            qury_bind_t *v = qury_get_column_value(stmt, c);
+            ok = v != NULL;
+            if (!ok) {
+                break;
+            }
+            if (nrows == 0) {
+                /* type of the value, as decoded by qury_fetch */
+                cols[c].desc.type = v->type;
+                cols[c].desc.width = _snap_width(v->type);
+                uint64_t zero = 0;
+                if (v->type == QURY_CString || v->type == QURY_OString) {
+                    ok = _snap_append(&cols[c].data, &zero, sizeof(zero));
+                }
+            }
+            ok = ok && _snap_add_row(&cols[c], stmt, c, v, nrows);
+        }
+        nrows++;
+    }
+    if (ok && qury_fetch_failed(stmt)) {
+        /* nothing written, a truncated snapshot would look complete */
+        fprintf(stderr, "qury_snapshot_write : result ended on an error\n");
+        ok = false;
+    }
+    if (ok && nrows == 0) {
+        /* no row, types from the fields */
+        for (uint32_t c = 0; c < ncols; c++) {
+            qury_bind_t *v = (qury_bind_t *)array_get(&stmt->values, c);
+            cols[c].desc.type = v ? v->type : QURY_Null;
+            cols[c].desc.width = _snap_width(cols[c].desc.type);
+        }
+    }
+
+    ok = ok && _snap_write_file(path, cols, ncols, nrows, &names);
+
+    for (uint32_t c = 0; cols && c < ncols; c++) {
+        free(cols[c].nulls.ptr);
+        free(cols[c].data.ptr);
+        free(cols[c].heap.ptr);
+    }
+    free(cols);
+    free(names.ptr);
+    return ok;
+}
+
+static bool _snap_in(qury_snapshot_t *snap, uint64_t offset, uint64_t len) {
+    return offset <= snap->size && len <= snap->size - offset;
+}
+
+static bool _snap_mul(uint64_t a, uint64_t b, uint64_t *r) {
+    if (b != 0 && a > UINT64_MAX / b) {
+        return false;
+    }
+    *r = a * b;
+    return true;
+}
+
+/* heap offsets start at 0 and grow by at least the nul of each value */
+static bool _snap_validate_offsets(qury_snapshot_t *snap,
+                                   const qury_snapshot_column_t *col) {
+    const uint64_t *offs = (const uint64_t *)(snap->map + col->data_offset);
+    if (offs[0] != 0) {
+        return false;
+    }
+    for (uint64_t row = 0; row < snap->header->nrows; row++) {
+        if (offs[row + 1] <= offs[row] || offs[row + 1] > col->heap_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool _snap_validate(qury_snapshot_t *snap) {
+    const qury_snapshot_header_t *h = snap->header;
+    uint64_t len = 0;
+    if (snap->size < sizeof(*h)
+        || memcmp(h->magic, QURY_SNAPSHOT_MAGIC, sizeof(QURY_SNAPSHOT_MAGIC)) != 0
+        || h->version != QURY_SNAPSHOT_VERSION || h->size != snap->size
+        || !_snap_mul(h->ncols, sizeof(qury_snapshot_column_t), &len)
+        || !_snap_in(snap, sizeof(*h), len)
+        || !_snap_in(snap, h->names_offset, h->names_size)) {
+        return false;
+    }
+    const char *names = (const char *)(snap->map + h->names_offset);
+    /* no overflow of nrows + 7 */
+    uint64_t nulls_len = h->nrows / 8 + ((h->nrows & 7) != 0);
+    for (uint32_t c = 0; c < h->ncols; c++) {
+        const qury_snapshot_column_t *col = &snap->columns[c];
+        bool var = col->type == QURY_CString || col->type == QURY_OString;
+        uint64_t data_len = 0;
+        if (col->width != _snap_width(col->type)
+            || col->name_offset >= h->names_size
+            || !memchr(names + col->name_offset, '\0',
+                       h->names_size - col->name_offset)
+            || !_snap_in(snap, col->nulls_offset, nulls_len)
+            || !_snap_in(snap, col->heap_offset, col->heap_size)) {
+            return false;
+        }
+        if (var && h->nrows > 0) {
+            /* nrows + 1 offsets, read as uint64_t */
+            if (h->nrows == UINT64_MAX
+                || !_snap_mul(h->nrows + 1, sizeof(uint64_t), &data_len)
+                || col->data_offset % sizeof(uint64_t) != 0
+                || !_snap_in(snap, col->data_offset, data_len)
+                || !_snap_validate_offsets(snap, col)) {
+                return false;
+            }
+        } else if (!var && (!_snap_mul(h->nrows, col->width, &data_len)
+                            || !_snap_in(snap, col->data_offset, data_len))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+qury_snapshot_t *qury_snapshot_open(const char *path) {
+    assert(path != NULL);
+
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(qury_snapshot_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    qury_snapshot_t *snap = calloc(1, sizeof(*snap));
+    if (!snap) {
+        munmap(map, (size_t)st.st_size);
+        return NULL;
+    }
+    snap->map = map;
+    snap->size = (size_t)st.st_size;
+    snap->header = map;
+    snap->columns = (const qury_snapshot_column_t *)(snap->map + sizeof(*snap->header));
+    if (!_snap_validate(snap)) {
+        fprintf(stderr, "qury_snapshot_open : %s is not a valid snapshot\n",
+                path);
+        qury_snapshot_close(snap);
+        return NULL;
+    }
+
+    uint32_t ncols = snap->header->ncols;
+    snap->names = calloc(ncols > 0 ? ncols : 1, sizeof(*snap->names));
+    snap->values = calloc(ncols > 0 ? ncols : 1, sizeof(*snap->values));
+    if (!snap->names || !snap->values) {
+        qury_snapshot_close(snap);
+        return NULL;
+    }
+    for (uint32_t c = 0; c < ncols; c++) {
+        snap->names[c] = (const char *)(snap->map + snap->header->names_offset
+                                        + snap->columns[c].name_offset);
+        snap->values[c].name = (char *)snap->names[c];
+        snap->values[c].type = snap->columns[c].type;
+        snap->values[c].is_unsigned = snap->columns[c].is_unsigned;
+        snap->values[c].length = snap->columns[c].width;
+    }
+    /* one page cache copy for every reader, hint the kernel */
+    madvise(map, snap->size, MADV_WILLNEED);
+    return snap;
+}
+
+void qury_snapshot_close(qury_snapshot_t *snap) {
+    if (snap) {
+        if (snap->map) {
+            munmap((void *)snap->map, snap->size);
+        }
+        free(snap->names);
+        free(snap->values);
+        free(snap);
+    }
+}
+
+bool qury_snapshot_fetch(qury_snapshot_t *snap) {
+    assert(snap != NULL);
+    uint64_t row = snap->row;
+    if (row >= snap->header->nrows) {
+        return false;
+    }
+    for (uint32_t c = 0; c < snap->header->ncols; c++) {
+        const qury_snapshot_column_t *col = &snap->columns[c];
+        qury_bind_t *v = &snap->values[c];
+        const uint8_t *data = snap->map + col->data_offset;
+
+        v->is_null = (snap->map[col->nulls_offset + (row >> 3)] >> (row & 7)) & 1;
+        switch (col->type) {
+            case QURY_CString:
+            case QURY_OString: {
+                const uint64_t *offs = (const uint64_t *)data;
+                uint8_t *ptr = (uint8_t *)(snap->map + col->heap_offset + offs[row]);
+                /* strings are followed by a nul in the heap */
+                v->length = offs[row + 1] - offs[row] - 1;
+                if (col->type == QURY_CString) {
+                    v->value.cstr = (char *)ptr;
+                } else {
+                    v->value.ostr.ptr = ptr;
+                    v->value.ostr.len = v->length;
+                }
+            } break;
+            case QURY_Null:
+                break;
+            default:
+                memcpy(&v->value, data + row * col->width, col->width);
+                break;
+        }
+    }
+    snap->row++;
+    return true;
+}
+
+bool qury_snapshot_seek(qury_snapshot_t *snap, uint64_t row) {
+    assert(snap != NULL);
+    if (row >= snap->header->nrows) {
+        return false;
+    }
+    snap->row = row;
+    return true;
+}
+
+qury_bind_t *qury_snapshot_get_field_value(qury_snapshot_t *snap,
+                                           const char *name) {
+    assert(snap != NULL);
+    for (uint32_t c = 0; c < snap->header->ncols; c++) {
+        if (strcmp(name, snap->names[c]) == 0) {
+            return &snap->values[c];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,505 @@
+#include "include/quaerimus_writer.h"
+#include "include/array.h"
+#include "include/quaerimus.h"
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* multiple of 3 so base64 of each piece can be concatenated */
+#define _QURY_CHUNK_SIZE (3 * 4096)
+
+typedef struct {
+    qury_writer_t *writer;
+    size_t len;
+    bool failed;
+    uint8_t buf[QURY_WRITER_BUFFER_SIZE];
+    uint8_t chunk[_QURY_CHUNK_SIZE]; /* pieces of chunked values */
+} _qury_out_t;
+
+static const char _digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536"
+    "37383940414243444546474849505152535455565758596061626364656667686970717273"
+    "7475767778798081828384858687888990919293949596979899";
+
+/* JSON escape for each byte: 0 none, 'u' for \u00XX, else the char after the
+ * backslash */
+static const uint8_t _json_escape[256] = {
+    ['\0'] = 'u', [0x01] = 'u', [0x02] = 'u', [0x03] = 'u', [0x04] = 'u',
+    [0x05] = 'u', [0x06] = 'u', [0x07] = 'u', ['\b'] = 'b', ['\t'] = 't',
+    ['\n'] = 'n', [0x0B] = 'u', ['\f'] = 'f', ['\r'] = 'r', [0x0E] = 'u',
+    [0x0F] = 'u', [0x10] = 'u', [0x11] = 'u', [0x12] = 'u', [0x13] = 'u',
+    [0x14] = 'u', [0x15] = 'u', [0x16] = 'u', [0x17] = 'u', [0x18] = 'u',
+    [0x19] = 'u', [0x1A] = 'u', [0x1B] = 'u', [0x1C] = 'u', [0x1D] = 'u',
+    [0x1E] = 'u', [0x1F] = 'u', ['"'] = '"',  ['\\'] = '\\'};
+
+static bool _out_flush(_qury_out_t *out) {
+    size_t done = 0;
+    if (out->failed) {
+        return false;
+    }
+    if (out->writer->write) {
+        if (out->len > 0
+            && !out->writer->write(out->writer->userptr, out->buf, out->len)) {
+            out->failed = true;
+        }
+        out->len = 0;
+        return !out->failed;
+    }
+    while (done < out->len) {
+        ssize_t w = write(out->writer->fd, &out->buf[done], out->len - done);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            out->failed = true;
+            break;
+        }
+        done += (size_t)w;
+    }
+    out->len = 0;
+    return !out->failed;
+}
+
+/* make room for len bytes, len must be below QURY_WRITER_BUFFER_SIZE */
+static inline uint8_t *_out_reserve(_qury_out_t *out, size_t len) {
+    if (out->len + len > QURY_WRITER_BUFFER_SIZE && !_out_flush(out)) {
+        return NULL;
+    }
+    return &out->buf[out->len];
+}
+
+static inline void _out_raw(_qury_out_t *out, const void *data, size_t len) {
+    while (len > 0) {
+        if (out->len == QURY_WRITER_BUFFER_SIZE && !_out_flush(out)) {
+            return;
+        }
+        size_t n = QURY_WRITER_BUFFER_SIZE - out->len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&out->buf[out->len], data, n);
+        out->len += n;
+        data = (const uint8_t *)data + n;
+        len -= n;
+    }
+}
+
+static inline void _out_char(_qury_out_t *out, char c) {
+    uint8_t *p = _out_reserve(out, 1);
+    if (p) {
+        *p = (uint8_t)c;
+        out->len++;
+    }
+}
+
+/* write v backward ending at end, return the start */
+static inline char *_fmt_u64(char *end, uint64_t v) {
+    while (v >= 100) {
+        unsigned int r = (unsigned int)(v % 100) * 2;
+        v /= 100;
+        *--end = _digit_pairs[r + 1];
+        *--end = _digit_pairs[r];
+    }
+    if (v >= 10) {
+        *--end = _digit_pairs[v * 2 + 1];
+        *--end = _digit_pairs[v * 2];
+    } else {
+        *--end = (char)('0' + v);
+    }
+    return end;
+}
+
+static void _out_int(_qury_out_t *out, uint64_t v, bool is_unsigned) {
+    char tmp[24];
+    char *end = tmp + sizeof(tmp);
+    char *start = NULL;
+    if (!is_unsigned && (int64_t)v < 0) {
+        start = _fmt_u64(end, (uint64_t)0 - v);
+        *--start = '-';
+    } else {
+        start = _fmt_u64(end, v);
+    }
+    _out_raw(out, start, end - start);
+}
+
+static void _out_double(_qury_out_t *out, double d, const char *null) {
+    char tmp[32];
+    if (!isfinite(d)) {
+        _out_raw(out, null, strlen(null));
+        return;
+    }
+    /* integral values are common and don't need printf, range first, the
+     * cast of a double out of int64_t range is undefined */
+    if (fabs(d) < 9007199254740992.0 && d == (double)(int64_t)d) {
+        _out_int(out, (uint64_t)(int64_t)d, false);
+        return;
+    }
+    int len = snprintf(tmp, sizeof(tmp), "%.17g", d);
+    _out_raw(out, tmp, len);
+}
+
+static void _out_decimal(_qury_out_t *out, qury_decimal_t d,
+                         const char *null) {
+    char tmp[QURY_DECIMAL_SIZE];
+    size_t len = qury_decimal_format(d, tmp, sizeof(tmp));
+    if (len == 0) {
+        /* overflowed when parsed */
+        _out_raw(out, null, strlen(null));
+        return;
+    }
+    _out_raw(out, tmp, len);
+}
+
+static void _out_datetime(_qury_out_t *out, const MYSQL_TIME *t) {
+    char tmp[40];
+    char *p = tmp;
+#define _two(v)                                                               \
+    do {                                                                      \
+        memcpy(p, &_digit_pairs[((v) % 100) * 2], 2);                         \
+        p += 2;                                                               \
+    } while (0)
+    if (t->time_type != MYSQL_TIMESTAMP_TIME) {
+        _two(t->year / 100);
+        _two(t->year);
+        *p++ = '-';
+        _two(t->month);
+        *p++ = '-';
+        _two(t->day);
+        if (t->time_type == MYSQL_TIMESTAMP_DATE) {
+            _out_raw(out, tmp, p - tmp);
+            return;
+        }
+        *p++ = ' ';
+        _two(t->hour);
+    } else {
+        if (t->neg) {
+            *p++ = '-';
+        }
+        if (t->hour >= 100) {
+            *p++ = (char)('0' + (t->hour / 100) % 10);
+        }
+        _two(t->hour);
+    }
+    *p++ = ':';
+    _two(t->minute);
+    *p++ = ':';
+    _two(t->second);
+    if (t->second_part > 0) {
+        *p++ = '.';
+        _two(t->second_part / 10000);
+        _two(t->second_part / 100);
+        _two(t->second_part);
+    }
+#undef _two
+    _out_raw(out, tmp, p - tmp);
+}
+
+/* offset of the first byte needing an escape in s[0..len), len if none */
+static inline size_t _json_scan(const uint8_t *s, size_t len) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1F);
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)&s[i]);
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)),
+            /* unsigned x <= 0x1F */
+            _mm_cmpeq_epi8(_mm_min_epu8(x, ctrl), x));
+        int mask = _mm_movemask_epi8(m);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if (_json_escape[s[i]]) {
+            return i;
+        }
+    }
+    return len;
+}
+
+static void _out_json_body(_qury_out_t *out, const uint8_t *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    while (len > 0) {
+        size_t n = _json_scan(s, len);
+        _out_raw(out, s, n);
+        if (n == len) {
+            break;
+        }
+        uint8_t e = _json_escape[s[n]];
+        if (e == 'u') {
+            char u[6] = {'\\', 'u', '0', '0', hex[s[n] >> 4], hex[s[n] & 0x0F]};
+            _out_raw(out, u, sizeof(u));
+        } else {
+            char esc[2] = {'\\', (char)e};
+            _out_raw(out, esc, sizeof(esc));
+        }
+        s += n + 1;
+        len -= n + 1;
+    }
+}
+
+static void _out_json_string(_qury_out_t *out, const uint8_t *s, size_t len) {
+    _out_char(out, '"');
+    _out_json_body(out, s, len);
+    _out_char(out, '"');
+}
+
+static void _out_base64_body(_qury_out_t *out, const uint8_t *s, size_t len) {
+    static const char b64[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char quad[4];
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)s[i] << 16;
+        if (i + 1 < len) {
+            v |= (uint32_t)s[i + 1] << 8;
+        }
+        if (i + 2 < len) {
+            v |= s[i + 2];
+        }
+        quad[0] = b64[(v >> 18) & 0x3F];
+        quad[1] = b64[(v >> 12) & 0x3F];
+        quad[2] = i + 1 < len ? b64[(v >> 6) & 0x3F] : '=';
+        quad[3] = i + 2 < len ? b64[v & 0x3F] : '=';
+        _out_raw(out, quad, sizeof(quad));
+    }
+}
+
+static void _out_base64(_qury_out_t *out, const uint8_t *s, size_t len) {
+    _out_char(out, '"');
+    _out_base64_body(out, s, len);
+    _out_char(out, '"');
+}
+
+/* true if the field has a char that requires quoting in CSV */
+static inline bool _csv_needs_quote(const uint8_t *s, size_t len) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)&s[i]);
+        __m128i m =
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, comma),
+                                      _mm_cmpeq_epi8(x, quote)),
+                         _mm_or_si128(_mm_cmpeq_epi8(x, cr), _mm_cmpeq_epi8(x, lf)));
+        if (_mm_movemask_epi8(m)) {
+            return true;
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if (s[i] == ',' || s[i] == '"' || s[i] == '\r' || s[i] == '\n') {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void _out_csv_body(_qury_out_t *out, const uint8_t *s, size_t len) {
+    const uint8_t *q = NULL;
+    while ((q = memchr(s, '"', len)) != NULL) {
+        /* double the quote */
+        _out_raw(out, s, q - s + 1);
+        _out_char(out, '"');
+        len -= q - s + 1;
+        s = q + 1;
+    }
+    _out_raw(out, s, len);
+}
+
+static void _out_csv_string(_qury_out_t *out, const uint8_t *s, size_t len) {
+    if (!_csv_needs_quote(s, len)) {
+        _out_raw(out, s, len);
+        return;
+    }
+    _out_char(out, '"');
+    _out_csv_body(out, s, len);
+    _out_char(out, '"');
+}
+
+/* value over the memory budget, read from the row piece by piece */
+static void _out_chunked(_qury_out_t *out, qury_format_t format,
+                         qury_stmt_t *stmt, size_t column, qury_bind_t *v) {
+    bool csv = format == QURY_FormatCSV;
+    size_t offset = 0;
+    size_t n = 0;
+    /* quoting can't be decided up front, always quote */
+    _out_char(out, '"');
+    while ((n = qury_read_column(stmt, column, offset, out->chunk,
+                                 sizeof(out->chunk))) > 0) {
+        if (csv) {
+            _out_csv_body(out, out->chunk, n);
+        } else if (v->type == QURY_OString) {
+            _out_base64_body(out, out->chunk, n);
+        } else {
+            /* escaping is per byte, utf-8 sequences can be split */
+            _out_json_body(out, out->chunk, n);
+        }
+        offset += n;
+    }
+    if (offset < v->length) {
+        out->failed = true;
+    }
+    _out_char(out, '"');
+}
+
+static void _out_value(_qury_out_t *out, qury_format_t format,
+                       qury_stmt_t *stmt, size_t column) {
+    bool csv = format == QURY_FormatCSV;
+    qury_bind_t *v = qury_get_column_value(stmt, column);
+    if (!v) {
+        out->failed = true;
+        return;
+    }
+    if (qury_is_null(v) || v->type == QURY_Null) {
+        if (!csv) {
+            _out_raw(out, "null", 4);
+        }
+        return;
+    }
+    if (v->chunked) {
+        _out_chunked(out, format, stmt, column, v);
+        return;
+    }
+    switch (v->type) {
+        case QURY_Integer:
+            _out_int(out, v->value.i, v->is_unsigned);
+            break;
+        case QURY_Float:
+            _out_double(out, v->value.f, csv ? "" : "null");
+            break;
+        case QURY_Decimal:
+            _out_decimal(out, v->value.dec, csv ? "" : "null");
+            break;
+        case QURY_Bool:
+            if (csv) {
+                _out_char(out, v->value.b ? '1' : '0');
+            } else {
+                _out_raw(out, v->value.b ? "true" : "false", v->value.b ? 4 : 5);
+            }
+            break;
+        case QURY_DateTime:
+            if (!csv) {
+                _out_char(out, '"');
+            }
+            _out_datetime(out, &v->value.dt);
+            if (!csv) {
+                _out_char(out, '"');
+            }
+            break;
+        case QURY_CString:
+            if (csv) {
+                _out_csv_string(out, (const uint8_t *)v->value.cstr, v->length);
+            } else {
+                _out_json_string(out, (const uint8_t *)v->value.cstr, v->length);
+            }
+            break;
+        case QURY_OString:
+            if (csv) {
+                _out_csv_string(out, v->value.ostr.ptr, v->value.ostr.len);
+            } else {
+                _out_base64(out, v->value.ostr.ptr, v->value.ostr.len);
+            }
+            break;
+        default:
+            if (!csv) {
+                _out_raw(out, "null", 4);
+            }
+            break;
+    }
+}
+
+int64_t qury_write_results(qury_stmt_t *stmt, qury_format_t format,
+                           qury_writer_t *writer) {
+    assert(stmt != NULL);
+    assert(writer != NULL);
+
+    /* too large for the stack, one allocation per call */
+    _qury_out_t *out = malloc(sizeof(*out));
+    if (!out) {
+        return -1;
+    }
+    out->writer = writer;
+    out->len = 0;
+    out->failed = false;
+
+    int64_t rows = 0;
+    size_t cnt = (size_t)stmt->field_cnt;
+
+    if (format == QURY_FormatCSV) {
+        for (size_t i = 0; i < cnt; i++) {
+            qury_field_name_t *f = (qury_field_name_t *)array_get(&stmt->fields, i);
+            if (i > 0) {
+                _out_char(out, ',');
+            }
+            if (f->name) {
+                _out_csv_string(out, (const uint8_t *)f->name, strlen(f->name));
+            }
+        }
+        _out_raw(out, "\r\n", 2);
+    } else if (format == QURY_FormatJSONArray) {
+        _out_char(out, '[');
+    }
+
+    while (!out->failed && qury_fetch(stmt)) {
+        if (format == QURY_FormatCSV) {
+            for (size_t i = 0; i < cnt; i++) {
+                if (i > 0) {
+                    _out_char(out, ',');
+                }
+                _out_value(out, format, stmt, i);
+            }
+            _out_raw(out, "\r\n", 2);
+        } else {
+            if (format == QURY_FormatJSONArray && rows > 0) {
+                _out_char(out, ',');
+            }
+            _out_char(out, '{');
+            for (size_t i = 0; i < cnt; i++) {
+                qury_field_name_t *f =
+                    (qury_field_name_t *)array_get(&stmt->fields, i);
+                if (i > 0) {
+                    _out_char(out, ',');
+                }
+                _out_json_string(out, (const uint8_t *)f->name,
+                                 f->name ? strlen(f->name) : 0);
+                _out_char(out, ':');
+                _out_value(out, format, stmt, i);
+            }
+            _out_char(out, '}');
+            if (format == QURY_FormatJSONLines) {
+                _out_char(out, '\n');
+            }
+        }
+        rows++;
+    }
+    if (!out->failed && qury_fetch_failed(stmt)) {
+        /* the output is truncated */
+        fprintf(stderr, "qury_write_results : result ended on an error\n");
+        free(out);
+        return -1;
+    }
+
+    if (format == QURY_FormatJSONArray) {
+        _out_raw(out, "]\n", 2);
+    }
+    if (!_out_flush(out)) {
+        rows = -1;
+    }
+    free(out);
+    return rows;
+}
@@ -0,0 +1,1653 @@
+#include "../src/include/quaerimus.h"
+#include "../src/include/quaerimus_deadline.h"
+#include "../src/include/quaerimus_digest.h"
+#include "../src/include/quaerimus_executor.h"
+#include "../src/include/quaerimus_group.h"
+#include "../src/include/quaerimus_paginate.h"
+#include "../src/include/quaerimus_pipeline.h"
+#include "../src/include/quaerimus_registry.h"
+#include "../src/include/quaerimus_router.h"
+#include "../src/include/quaerimus_scatter.h"
+#include "../src/include/quaerimus_shard.h"
+#include "../src/include/quaerimus_snapshot.h"
+#include <check.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Needs a server, connection parameters are read from QURY_TEST_HOST,
+ * QURY_TEST_USER, QURY_TEST_PASSWORD and QURY_TEST_DB. Tests are skipped
+ * when QURY_TEST_HOST is not set.
+ */
+
+#define UNUSED(x) (void)(x)
+#define LOOPS 100
+
+/* arena counting every allocation */
+static size_t Allocations = 0;
+
+struct chunk {
+  struct chunk *next;
+  struct chunk *prev;
+};
+
+struct head {
+  struct chunk list;
+};
+
+static void *_alloc(void *h, size_t len) {
+  struct head *head = h;
+  struct chunk *c = malloc(sizeof(*c) + len);
+  if (!c) {
+    return NULL;
+  }
+  Allocations++;
+  c->prev = &head->list;
+  c->next = head->list.next;
+  if (c->next) {
+    c->next->prev = c;
+  }
+  head->list.next = c;
+  return c + 1;
+}
+
+static void *_realloc(void *h, void *ptr, size_t len) {
+  if (!ptr) {
+    return _alloc(h, len);
+  }
+  struct chunk *c = ((struct chunk *)ptr) - 1;
+  struct chunk *prev = c->prev;
+  struct chunk *next = c->next;
+  struct chunk *n = realloc(c, sizeof(*n) + len);
+  if (!n) {
+    return NULL;
+  }
+  Allocations++;
+  prev->next = n;
+  if (next) {
+    next->prev = n;
+  }
+  return n + 1;
+}
+
+static void _free(void *h, void *ptr) {
+  UNUSED(h);
+  if (ptr) {
+    struct chunk *c = ((struct chunk *)ptr) - 1;
+    c->prev->next = c->next;
+    if (c->next) {
+      c->next->prev = c->prev;
+    }
+    free(c);
+  }
+}
+
+static char *_strndup(void *h, const char *ptr, size_t len) {
+  if (!ptr || len == 0) {
+    return NULL;
+  }
+  char *str = _alloc(h, len + 1);
+  if (str) {
+    memcpy(str, ptr, len);
+    str[len] = '\0';
+  }
+  return str;
+}
+
+static void *_memdup(void *h, const void *ptr, size_t len) {
+  void *tmp = _alloc(h, len);
+  if (tmp) {
+    memcpy(tmp, ptr, len);
+  }
+  return tmp;
+}
+
+static void _reset(void *h) {
+  struct head *head = h;
+  struct chunk *c = head->list.next;
+  while (c) {
+    struct chunk *n = c->next;
+    free(c);
+    c = n;
+  }
+  head->list.next = NULL;
+}
+
+static void *_init(size_t len, void **ptr) {
+  UNUSED(len);
+  UNUSED(ptr);
+  return calloc(1, sizeof(struct head));
+}
+
+static void _destroy(void *h) {
+  _reset(h);
+  free(h);
+}
+
+static qury_allocator_t CountingAllocator = {.init = _init,
+                                             .destroy = _destroy,
+                                             .alloc = _alloc,
+                                             .realloc = _realloc,
+                                             .free = _free,
+                                             .strndup = _strndup,
+                                             .memdup = _memdup,
+                                             .reset = _reset};
+
+static qury_conn_t Conn;
+
+/* port 0 is the default one */
+static bool connect_server_to(qury_conn_t *conn, unsigned int port) {
+  const char *host = getenv("QURY_TEST_HOST");
+  if (!host) {
+    return false;
+  }
+  qury_conn_init(conn);
+  ck_assert_ptr_nonnull(mysql_real_connect(
+      conn->mysql, host, getenv("QURY_TEST_USER"), getenv("QURY_TEST_PASSWORD"),
+      getenv("QURY_TEST_DB"), port, NULL, 0));
+  return true;
+}
+
+static bool connect_server(void) { return connect_server_to(&Conn, 0); }
+
+static void run_loop(bool borrowed) {
+  if (!connect_server()) {
+    fprintf(stderr, "QURY_TEST_HOST not set, skipped\n");
+    return;
+  }
+  qury_init(&CountingAllocator);
+  qury_stmt_t *stmt = qury_new(&Conn, NULL);
+  ck_assert_ptr_nonnull(stmt);
+  ck_assert(qury_prepare(stmt,
+                         "SELECT CAST(:id AS SIGNED) + 1 AS n, "
+                         "CONCAT('name-', :name) AS s",
+                         0));
+
+  size_t baseline = 0;
+  for (int i = 0; i < LOOPS; i++) {
+    char name[16];
+    char expected[32];
+    snprintf(name, sizeof(name), "%08d", i);
+    snprintf(expected, sizeof(expected), "name-%08d", i);
+
+    ck_assert(qury_stmt_bind_int(stmt, "id", i));
+    if (borrowed) {
+      ck_assert(qury_stmt_bind_str_ref(stmt, "name", name));
+    } else {
+      ck_assert(qury_stmt_bind_str(stmt, "name", name));
+    }
+    ck_assert(qury_execute(stmt));
+    int rows = 0;
+    while (qury_fetch(stmt)) {
+      qury_bind_t *v = NULL;
+      ck_assert(qury_get_value(stmt, "n", &v));
+      ck_assert_int_eq((int64_t)qury_get_int(v), i + 1);
+      ck_assert(qury_get_value(stmt, "s", &v));
+      ck_assert_str_eq(qury_get_cstr(v), expected);
+      rows++;
+    }
+    ck_assert_int_eq(rows, 1);
+    if (i == 0) {
+      baseline = Allocations;
+    }
+  }
+  /* nothing allocated after the first iteration */
+  ck_assert_uint_eq(Allocations, baseline);
+
+  qury_free(stmt);
+  mysql_close(Conn.mysql);
+}
+
+START_TEST(test_steady_state_copy) { run_loop(false); }
+END_TEST
+
+START_TEST(test_steady_state_borrowed) { run_loop(true); }
+END_TEST
+
+static void run_budget(bool chunked) {
+  if (!connect_server()) {
+    fprintf(stderr, "QURY_TEST_HOST not set, skipped\n");
+    return;
+  }
+  qury_stmt_t *stmt = qury_new(&Conn, NULL);
+  ck_assert_ptr_nonnull(stmt);
+  ck_assert(qury_prepare(stmt, "SELECT REPEAT('x', :len) AS s", 0));
+  ck_assert(qury_stmt_bind_int(stmt, "len", 200000));
+  qury_set_memory_budget(stmt, 0, stmt->mem.current + 64 * 1024, chunked);
+  ck_assert(qury_execute(stmt));
+
+  if (!chunked) {
+    ck_assert(!qury_fetch(stmt));
+    ck_assert_int_eq(qury_stmt_errno(stmt), QURY_ErrMemoryBudget);
+  } else {
+    ck_assert(qury_fetch(stmt));
+    qury_bind_t *v = qury_get_field_value(stmt, "s");
+    ck_assert_ptr_nonnull(v);
+    ck_assert(v->chunked);
+    ck_assert_uint_eq(v->length, 200000);
+    char buffer[4096];
+    size_t n = 0;
+    size_t total = 0;
+    while ((n = qury_read_column(stmt, qury_field_index(stmt, "s"), total,
+                                 buffer, sizeof(buffer))) > 0) {
+      for (size_t i = 0; i < n; i++) {
+        ck_assert_int_eq(buffer[i], 'x');
+      }
+      total += n;
+    }
+    ck_assert_uint_eq(total, 200000);
+    ck_assert(!qury_fetch(stmt));
+  }
+  ck_assert_uint_le(stmt->mem.peak, stmt->mem.hard_limit);
+  ck_assert_uint_ge(Conn.mem.current, stmt->mem.current);
+
+  qury_free(stmt);
+  mysql_close(Conn.mysql);
+}
+
+START_TEST(test_budget_fail) { run_budget(false); }
+END_TEST
+
+START_TEST(test_budget_chunked) { run_budget(true); }
+END_TEST
+
+START_TEST(test_lazy_columns) {
+  if (!connect_server()) {
+    fprintf(stderr, "QURY_TEST_HOST not set, skipped\n");
+    return;
+  }
+  qury_stmt_t *stmt = qury_new(&Conn, NULL);
+  ck_assert_ptr_nonnull(stmt);
+  ck_assert(qury_prepare(stmt,
+                         "SELECT REPEAT('x', 100000) AS wide, 'a' AS narrow",
+                         0));
+  ck_assert(qury_execute(stmt));
+  ck_assert(qury_fetch(stmt));
+  size_t fetched = stmt->mem.current;
+
+  /* the wide column is only copied when read */
+  qury_bind_t *v = NULL;
+  ck_assert(qury_get_value(stmt, "narrow", &v));
+  ck_assert_str_eq(qury_get_cstr(v), "a");
+  ck_assert_uint_lt(stmt->mem.current, fetched + 1024);
+  ck_assert(qury_get_value(stmt, "wide", &v));
+  ck_assert_uint_eq(v->length, 100000);
+  ck_assert_int_eq(qury_get_cstr(v)[99999], 'x');
+  ck_assert_uint_gt(stmt->mem.current, fetched + 100000);
+  ck_assert(!qury_fetch(stmt));
+
+  qury_free(stmt);
+  mysql_close(Conn.mysql);
+}
+END_TEST
+
+/* text protocol query of one parameter list, built without a server */
+static void check_interpolated(const char *query, const qury_param_t *params,
+                               const char *expected) {
+  qury_conn_t conn;
+  qury_conn_init(&conn);
+  qury_stmt_t *stmt = qury_new(&conn, NULL);
+  ck_assert_ptr_nonnull(stmt);
+  ck_assert(qury_batch_add(stmt, query, 0, params));
+  ck_assert_uint_eq(stmt->batch_length, strlen(expected));
+  ck_assert_mem_eq(stmt->batch, expected, strlen(expected));
+  qury_free(stmt);
+  mysql_close(conn.mysql);
+}
+
+static size_t interpolate_nul(uint8_t *buffer, size_t length) {
+  static const uint8_t value[] = {'a', 0, 'b'};
+  static bool sent = false;
+  sent = !sent;
+  if (!sent || length < sizeof(value)) {
+    return 0;
+  }
+  memcpy(buffer, value, sizeof(value));
+  return sizeof(value);
+}
+
+START_TEST(test_interpolate) {
+  /* strings are escaped for the connection charset */
+  check_interpolated(
+      "SELECT :a",
+      (qury_param_t[]){QURY_PARAM_STR("a", "it's"), QURY_PARAM_END},
+      "SELECT 'it\\'s'");
+  check_interpolated(
+      "SELECT :a",
+      (qury_param_t[]){QURY_PARAM_STR("a", "C:\\tmp \"x\""), QURY_PARAM_END},
+      "SELECT 'C:\\\\tmp \\\"x\\\"'");
+  check_interpolated(
+      "SELECT :a",
+      (qury_param_t[]){{.name = "a",
+                        .ptr = (quryptr_t)(uintptr_t)interpolate_nul,
+                        .type = QURY_CString | QURY_DataCallback},
+                       QURY_PARAM_END},
+      "SELECT 'a\\0b'");
+  check_interpolated(
+      "SELECT :a",
+      (qury_param_t[]){QURY_PARAM_BYTES("a", "a\0'", 3), QURY_PARAM_END},
+      "SELECT X'610027'");
+
+  /* NULL whatever the type */
+  check_interpolated("SELECT :a, :b, :c",
+                     (qury_param_t[]){QURY_PARAM_STR("a", NULL),
+                                      QURY_PARAM_BYTES("b", NULL, 0),
+                                      QURY_PARAM_NULL("c"), QURY_PARAM_END},
+                     "SELECT NULL, NULL, NULL");
+
+  /* integers, signed unless bound as unsigned */
+  check_interpolated(
+      "SELECT :a, :b, :c, :d",
+      (qury_param_t[]){QURY_PARAM_INT("a", -42), QURY_PARAM_INT("b", INT64_MIN),
+                       QURY_PARAM_UINT("c", UINT64_MAX),
+                       QURY_PARAM_UINT("d", 42), QURY_PARAM_END},
+      "SELECT -42, -9223372036854775808, 18446744073709551615, 42");
+
+  /* a name used twice and one left out */
+  check_interpolated(
+      "SELECT :a + :a, :b",
+      (qury_param_t[]){QURY_PARAM_INT("a", 1), QURY_PARAM_END},
+      "SELECT 1 + 1, NULL");
+}
+END_TEST
+
+/* reference value of the digits of s, dot skipped */
+static qury_decimal_int_t decimal_digits(const char *s, size_t n) {
+  qury_decimal_int_t m = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (s[i] >= '0' && s[i] <= '9') {
+      m = m * 10 + (s[i] - '0');
+    }
+  }
+  return m;
+}
+
+static void check_decimal(const char *s, qury_decimal_int_t mantissa,
+                          uint8_t scale) {
+  qury_decimal_t d;
+  ck_assert_msg(qury_decimal_parse(s, strlen(s), &d), "%s", s);
+  ck_assert_msg(d.mantissa == mantissa, "%s", s);
+  ck_assert_uint_eq(d.scale, scale);
+  ck_assert(!d.overflow);
+}
+
+START_TEST(test_decimal_parse) {
+  /* no server */
+  qury_decimal_t d;
+  char s[2 * QURY_DECIMAL_DIGITS + 4];
+
+  check_decimal("-123.4500", -1234500, 4);
+  check_decimal("+7", 7, 0);
+  check_decimal("42", 42, 0);
+  check_decimal("000123", 123, 0);
+  check_decimal(".5", 5, 1);
+  check_decimal("-0.5", -5, 1);
+  check_decimal("0.00000000000000000001", 1, 20);
+  /* 8 digits at once, then the rest one by one */
+  check_decimal("1234567890123", decimal_digits("1234567890123", 13), 0);
+  check_decimal("12345678901234567.123",
+                decimal_digits("12345678901234567.123", 21), 3);
+  check_decimal("-98765432.1234567890",
+                -decimal_digits("98765432.1234567890", 19), 10);
+  ck_assert(!qury_decimal_parse("12a", 3, &d));
+  ck_assert(!qury_decimal_parse("1.2.3", 5, &d));
+  ck_assert(!qury_decimal_parse("12345678x", 9, &d));
+
+  /* exactly QURY_DECIMAL_DIGITS digits fit */
+  for (size_t i = 0; i < QURY_DECIMAL_DIGITS; i++) {
+    s[i] = (char)('1' + i % 9);
+  }
+  s[QURY_DECIMAL_DIGITS] = '\0';
+  check_decimal(s, decimal_digits(s, QURY_DECIMAL_DIGITS), 0);
+
+  /* leading zeros are not significant digits */
+  memset(s, '0', 9);
+  for (size_t i = 0; i < QURY_DECIMAL_DIGITS; i++) {
+    s[9 + i] = (char)('9' - i % 9);
+  }
+  s[9 + QURY_DECIMAL_DIGITS] = '\0';
+  check_decimal(s, decimal_digits(s, strlen(s)), 0);
+
+  /* with a fraction, the digits after the zeros */
+  memmove(s, s + 9, QURY_DECIMAL_DIGITS / 2);
+  s[QURY_DECIMAL_DIGITS / 2] = '.';
+  for (size_t i = QURY_DECIMAL_DIGITS / 2; i < QURY_DECIMAL_DIGITS; i++) {
+    s[i + 1] = (char)('0' + i % 10);
+  }
+  s[QURY_DECIMAL_DIGITS + 1] = '\0';
+  check_decimal(s, decimal_digits(s, strlen(s)),
+                QURY_DECIMAL_DIGITS - QURY_DECIMAL_DIGITS / 2);
+
+  /* one more digit overflows, the leading digits are kept */
+  for (size_t i = 0; i <= QURY_DECIMAL_DIGITS; i++) {
+    s[i] = (char)('1' + i % 9);
+  }
+  s[QURY_DECIMAL_DIGITS + 1] = '\0';
+  ck_assert(qury_decimal_parse(s, strlen(s), &d));
+  ck_assert(d.overflow);
+  ck_assert(d.mantissa == decimal_digits(s, QURY_DECIMAL_DIGITS));
+}
+END_TEST
+
+static void check_decimal_format(const char *s, const char *expected) {
+  qury_decimal_t d;
+  char buf[QURY_DECIMAL_SIZE];
+  ck_assert(qury_decimal_parse(s, strlen(s), &d));
+  ck_assert_uint_eq(qury_decimal_format(d, buf, sizeof(buf)), strlen(expected));
+  ck_assert_str_eq(buf, expected);
+}
+
+START_TEST(test_decimal_format) {
+  /* no server */
+  qury_decimal_t d;
+  char buf[QURY_DECIMAL_SIZE];
+
+  check_decimal_format("-123.4500", "-123.4500");
+  check_decimal_format("+7", "7");
+  check_decimal_format("000123", "123");
+  check_decimal_format(".5", "0.5");
+  check_decimal_format("-0.5", "-0.5");
+  check_decimal_format("0", "0");
+  check_decimal_format("0.00000000000000000001", "0.00000000000000000001");
+  check_decimal_format("-98765432.1234567890", "-98765432.1234567890");
+
+  /* the nul must fit */
+  ck_assert(qury_decimal_parse("-1.25", 5, &d));
+  ck_assert_uint_eq(qury_decimal_format(d, buf, 5), 0);
+  ck_assert_uint_eq(qury_decimal_format(d, buf, 6), 5);
+
+  /* leading digits only, can't be sent */
+  memset(buf, '9', QURY_DECIMAL_DIGITS + 1);
+  ck_assert(qury_decimal_parse(buf, QURY_DECIMAL_DIGITS + 1, &d));
+  ck_assert(d.overflow);
+  ck_assert_uint_eq(qury_decimal_format(d, buf, sizeof(buf)), 0);
+}
+END_TEST
+
+START_TEST(test_decimal_bind) {
+  /* no server, sent as text */
+  qury_decimal_t d;
+  char buf[QURY_DECIMAL_DIGITS + 1];
+  ck_assert(qury_decimal_parse("-123.4500", 9, &d));
+  check_interpolated("SELECT :d, :n",
+                     (qury_param_t[]){QURY_PARAM_DECIMAL("d", &d),
+                                      QURY_PARAM_DECIMAL("n", NULL),
+                                      QURY_PARAM_END},
+                     "SELECT -123.4500, NULL");
+
+  qury_conn_t conn;
+  qury_conn_init(&conn);
+  qury_stmt_t *stmt = qury_new(&conn, NULL);
+  ck_assert_ptr_nonnull(stmt);
+  ck_assert(qury_batch_add(stmt, "SELECT :d", 0, NULL));
+  memset(buf, '9', sizeof(buf));
+  ck_assert(qury_decimal_parse(buf, sizeof(buf), &d));
+  ck_assert(!qury_stmt_bind_decimal(stmt, "d", &d));
+  qury_free(stmt);
+  mysql_close(conn.mysql);
+}
+END_TEST
+
+#define EPOCH_TIMES 1003 /* not a multiple of the batch width */
+
+static int64_t epoch_timegm(const MYSQL_TIME *t) {
+  int64_t us = ((int64_t)t->hour * 3600 + t->minute * 60 + t->second) * 1000000
+               + (int64_t)t->second_part;
+  if (t->time_type == MYSQL_TIMESTAMP_TIME) {
+    return t->neg ? -us : us;
+  }
+  struct tm tm = {.tm_year = (int)t->year - 1900,
+                  .tm_mon = (int)t->month - 1,
+                  .tm_mday = (int)t->day};
+  return (int64_t)timegm(&tm) * 1000000 + us;
+}
+
+START_TEST(test_epoch_us) {
+  /* no server, checked against timegm */
+  static const MYSQL_TIME fixed[] = {
+      {.year = 1970, .month = 1, .day = 1,
+       .time_type = MYSQL_TIMESTAMP_DATETIME},
+      {.year = 1, .month = 1, .day = 1, .time_type = MYSQL_TIMESTAMP_DATETIME},
+      {.year = 9999, .month = 12, .day = 31, .hour = 23, .minute = 59,
+       .second = 59, .second_part = 999999,
+       .time_type = MYSQL_TIMESTAMP_DATETIME},
+      {.year = 2024, .month = 2, .day = 29, .hour = 12,
+       .time_type = MYSQL_TIMESTAMP_DATETIME},
+      {.year = 2000, .month = 2, .day = 29, .time_type = MYSQL_TIMESTAMP_DATE},
+      {.year = 1900, .month = 3, .day = 1, .time_type = MYSQL_TIMESTAMP_DATE},
+      {.hour = 838, .minute = 59, .second = 59, .neg = 1,
+       .time_type = MYSQL_TIMESTAMP_TIME},
+      {.minute = 1, .second_part = 5, .neg = 1,
+       .time_type = MYSQL_TIMESTAMP_TIME},
+      {.hour = 25, .time_type = MYSQL_TIMESTAMP_TIME},
+  };
+  static const int days[13] = {0, 31, 29, 31, 30, 31, 30,
+                               31, 31, 30, 31, 30, 31};
+  static MYSQL_TIME t[EPOCH_TIMES];
+  static int64_t out[EPOCH_TIMES];
+  size_t n = sizeof(fixed) / sizeof(*fixed);
+  uint64_t seed = 88172645463325252ULL;
+
+  memcpy(t, fixed, sizeof(fixed));
+  for (size_t i = n; i < EPOCH_TIMES; i++) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    MYSQL_TIME *v = &t[i];
+    memset(v, 0, sizeof(*v));
+    v->time_type = i % 10 == 0 ? MYSQL_TIMESTAMP_TIME
+                               : MYSQL_TIMESTAMP_DATETIME;
+    v->year = 1 + seed % 9999;
+    v->month = 1 + (seed >> 16) % 12;
+    v->day = 1 + (seed >> 24) % days[v->month];
+    if (v->month == 2 && v->day == 29
+        && !(v->year % 4 == 0 && (v->year % 100 != 0 || v->year % 400 == 0))) {
+      v->day = 28;
+    }
+    v->hour = (seed >> 32) % (v->time_type == MYSQL_TIMESTAMP_TIME ? 839 : 24);
+    v->minute = (seed >> 42) % 60;
+    v->second = (seed >> 48) % 60;
+    v->second_part = (seed >> 8) % 1000000;
+    v->neg = v->time_type == MYSQL_TIMESTAMP_TIME && (seed & 1);
+  }
+
+  qury_time_to_epoch_us_batch(t, EPOCH_TIMES, out);
+  for (size_t i = 0; i < EPOCH_TIMES; i++) {
+    int64_t expected = epoch_timegm(&t[i]);
+    ck_assert_int_eq(qury_time_to_epoch_us(&t[i]), expected);
+    ck_assert_int_eq(out[i], expected);
+  }
+  /* short batches, only the scalar tail */
+  for (size_t k = 0; k < 8; k++) {
+    qury_time_to_epoch_us_batch(&t[k], 3, out);
+    for (size_t i = 0; i < 3; i++) {
+      ck_assert_int_eq(out[i], epoch_timegm(&t[k + i]));
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_digest) {
+  /* no server, only the normalization and the table */
+  char text[QURY_DIGEST_TEXT_SIZE];
+  uint64_t a = qury_digest_fingerprint(
+      "SELECT * FROM t WHERE id IN (1, 2, 3) AND name = 'it''s' -- note\n"
+      "LIMIT 10",
+      0, text, sizeof(text));
+  ck_assert_str_eq(text, "select * from t where id in(?) and name = ? limit ?");
+  uint64_t b = qury_digest_fingerprint(
+      "select *  from t where id in (4,5) and name=\"x\" /* c */ limit :n", 0,
+      NULL, 0);
+  ck_assert_uint_eq(a, b);
+  ck_assert_uint_ne(a, qury_digest_fingerprint("SELECT * FROM t2", 0, NULL, 0));
+  qury_digest_fingerprint("SELECT a.b, `Odd Name` FROM t1 WHERE x > -1.5e3", 0,
+                          text, sizeof(text));
+  ck_assert_str_eq(text, "select a.b, `Odd Name` from t1 where x > - ?");
+
+  qury_digest_reset();
+  qury_digest_t *d = qury_digest_lookup("SELECT 1", 0);
+  ck_assert_ptr_nonnull(d);
+  ck_assert_ptr_eq(d, qury_digest_lookup("select 2", 0));
+  qury_digest_record(d, 1000, true);
+  qury_digest_record(d, 5000, false);
+  qury_digest_add_rows(d, 2, 16);
+
+  qury_digest_stat_t top[4];
+  ck_assert_uint_ge(qury_digest_top(top, 4, QURY_DigestByTime), 1);
+  ck_assert_uint_eq(top[0].fingerprint, d->fingerprint);
+  ck_assert_uint_eq(top[0].calls, 2);
+  ck_assert_uint_eq(top[0].errors, 1);
+  ck_assert_uint_eq(top[0].total_ns, 6000);
+  ck_assert_uint_eq(top[0].max_ns, 5000);
+  ck_assert_uint_eq(top[0].rows, 2);
+  ck_assert_str_eq(top[0].text, "select ?");
+}
+END_TEST
+
+START_TEST(test_digest_direct) {
+  if (!connect_server()) {
+    fprintf(stderr, "QURY_TEST_HOST not set, skipped\n");
+    return;
+  }
+  qury_digest_enable(true);
+  qury_digest_reset();
+  qury_stmt_t *stmt = qury_new(&Conn, NULL);
+  ck_assert_ptr_nonnull(stmt);
+  /* direct execution, no separate prepare */
+  ck_assert(qury_prepare_execute(
+      stmt, "SELECT :a AS x UNION ALL SELECT 2", 0,
+      (qury_param_t[]){QURY_PARAM_INT("a", 1), QURY_PARAM_END}));
+  while (qury_fetch(stmt)) {
+  }
+  qury_digest_stat_t top[4];
+  /* digests of other tests are kept, with no time */
+  ck_assert_uint_ge(qury_digest_top(top, 4, QURY_DigestByTime), 1);
+  ck_assert_str_eq(top[0].text, "select ? as x union all select ?");
+  ck_assert_uint_eq(top[0].calls, 1);
+  ck_assert_uint_eq(top[0].errors, 0);
+  ck_assert_uint_gt(top[0].total_ns, 0);
+  ck_assert_uint_eq(top[0].rows, 2);
+  qury_free(stmt);
+  qury_digest_enable(false);
+  mysql_close(Conn.mysql);
+}
+END_TEST
+
+START_TEST(test_batch) {
+  if (!connect_server()) {
+    fprintf(stderr, "QURY_TEST_HOST not set, skipped\n");
+    return;
+  }
+  qury_stmt_t *stmt = qury_new(&Conn, NULL);
+  ck_assert_ptr_nonnull(stmt);
+  ck_assert(qury_batch_add(stmt, "SELECT :a AS x", 0,
+                           (qury_param_t[]){QURY_PARAM_INT("a", 1),
+                                            QURY_PARAM_END}));
+  ck_assert(qury_batch_add(stmt, "DO :a", 0,
+                           (qury_param_t[]){QURY_PARAM_INT("a", 2),
+                                            QURY_PARAM_END}));
+  ck_assert(qury_batch_add(stmt, "SELECT :b AS y, :c AS z", 0,
+                           (qury_param_t[]){QURY_PARAM_STR("b", "it's"),
+                                            QURY_PARAM_INT("c", 3),
+                                            QURY_PARAM_END}));
+  ck_assert(qury_batch_execute(stmt));
+
+  qury_bind_t *v = NULL;
+  ck_assert(qury_fetch(stmt));
+  ck_assert(qury_get_value(stmt, "x", &v));
+  ck_assert_int_eq(qury_get_int(v), 1);
+  ck_assert(!qury_fetch(stmt));
+
+  ck_assert(qury_next_result(stmt));
+  ck_assert(!qury_fetch(stmt));
+
+  ck_assert(qury_next_result(stmt));
+  ck_assert(qury_fetch(stmt));
+  ck_assert(qury_get_value(stmt, "y", &v));
+  ck_assert_str_eq(qury_get_cstr(v), "it's");
+  ck_assert(qury_get_value(stmt, "z", &v));
+  ck_assert_int_eq(qury_get_int(v), 3);
+  ck_assert(!qury_fetch(stmt));
+
+  ck_assert(!qury_next_result(stmt));
+  ck_assert(!stmt->batch_pending);
+
+  qury_free(stmt);
+  mysql_close(Conn.mysql);
+}
+END_TEST
+
+/* two rows "ab" and "c" in a string column, laid out as the writer does */
+struct snapshot_file {
+  qury_snapshot_header_t header;
+  qury_snapshot_column_t column;
+  char names[16];
+  uint8_t nulls[16];
+  uint64_t offs[4];
+  char heap[16];
+};
+
+static struct snapshot_file snapshot_file(void) {
+  struct snapshot_file f;
+  memset(&f, 0, sizeof(f));
+  memcpy(f.header.magic, QURY_SNAPSHOT_MAGIC, sizeof(QURY_SNAPSHOT_MAGIC));
+  f.header.version = QURY_SNAPSHOT_VERSION;
+  f.header.ncols = 1;
+  f.header.nrows = 2;
+  f.header.size = sizeof(f);
+  f.header.names_offset = offsetof(struct snapshot_file, names);
+  f.header.names_size = 5;
+  memcpy(f.names, "name", 5);
+  f.column.type = QURY_CString;
+  f.column.width = sizeof(uint64_t);
+  f.column.nulls_offset = offsetof(struct snapshot_file, nulls);
+  f.column.data_offset = offsetof(struct snapshot_file, offs);
+  f.column.heap_offset = offsetof(struct snapshot_file, heap);
+  f.column.heap_size = 5;
+  f.offs[1] = 3;
+  f.offs[2] = 5;
+  memcpy(f.heap, "ab\0c", 5);
+  return f;
+}
+
+static bool snapshot_opens(const struct snapshot_file *f) {
+  char path[] = "/tmp/quaerimus-snapshot-XXXXXX";
+  int fd = mkstemp(path);
+  ck_assert_int_ge(fd, 0);
+  ck_assert_int_eq(write(fd, f, sizeof(*f)), (ssize_t)sizeof(*f));
+  close(fd);
+  qury_snapshot_t *snap = qury_snapshot_open(path);
+  unlink(path);
+  if (!snap) {
+    return false;
+  }
+  qury_snapshot_close(snap);
+  return true;
+}
+
+START_TEST(test_snapshot_validate) {
+  /* no server, files are written by hand */
+  struct snapshot_file f = snapshot_file();
+  ck_assert(snapshot_opens(&f));
+
+  /* offsets not starting at 0, decreasing, with no room for the nul or
+   * past the heap */
+  f = snapshot_file();
+  f.offs[0] = 1;
+  ck_assert(!snapshot_opens(&f));
+  f = snapshot_file();
+  f.offs[1] = 6;
+  ck_assert(!snapshot_opens(&f));
+  f = snapshot_file();
+  f.offs[1] = 0;
+  ck_assert(!snapshot_opens(&f));
+  f = snapshot_file();
+  f.offs[2] = 3;
+  ck_assert(!snapshot_opens(&f));
+  f = snapshot_file();
+  f.offs[2] = 6;
+  ck_assert(!snapshot_opens(&f));
+
+  /* sizes overflowing 64 bits */
+  f = snapshot_file();
+  f.header.nrows = UINT64_MAX;
+  ck_assert(!snapshot_opens(&f));
+  f = snapshot_file();
+  f.header.nrows = UINT64_MAX / 8;
+  ck_assert(!snapshot_opens(&f));
+  f = snapshot_file();
+  f.column.type = QURY_Integer;
+  f.header.nrows = UINT64_MAX / 4;
+  ck_assert(!snapshot_opens(&f));
+
+  /* misaligned offsets */
+  f = snapshot_file();
+  f.column.data_offset += 4;
+  ck_assert(!snapshot_opens(&f));
+
+  /* name without a nul in the names */
+  f = snapshot_file();
+  f.header.names_size = 4;
+  ck_assert(!snapshot_opens(&f));
+  f = snapshot_file();
+  f.column.name_offset = 5;
+  ck_assert(!snapshot_opens(&f));
+}
+END_TEST
+
+START_TEST(test_router_read_only) {
+  /* no server, only the classification */
+  ck_assert(qury_query_is_read_only("SELECT 1", 0));
+  ck_assert(qury_query_is_read_only("(SELECT a FROM t) UNION (SELECT b FROM u)",
+                                    0));
+  ck_assert(qury_query_is_read_only("show tables", 0));
+  ck_assert(qury_query_is_read_only("WITH x AS (SELECT 1) SELECT * FROM x", 0));
+  ck_assert(!qury_query_is_read_only("UPDATE t SET a = 1", 0));
+  ck_assert(!qury_query_is_read_only("", 0));
+  ck_assert(!qury_query_is_read_only("  -- nothing\n", 0));
+
+  /* locking and writing reads */
+  ck_assert(!qury_query_is_read_only("SELECT a FROM t WHERE id = 1 FOR UPDATE",
+                                     0));
+  ck_assert(!qury_query_is_read_only(
+      "SELECT a FROM t WHERE id = 1 LOCK IN SHARE MODE", 0));
+  ck_assert(!qury_query_is_read_only("SELECT a INTO @a FROM t", 0));
+  ck_assert(!qury_query_is_read_only("SELECT a FROM t INTO OUTFILE '/tmp/a'",
+                                     0));
+  ck_assert(!qury_query_is_read_only("SELECT GET_LOCK('a', 1)", 0));
+  ck_assert(!qury_query_is_read_only("SELECT NEXT VALUE FOR s", 0));
+  ck_assert(!qury_query_is_read_only("SELECT nextval(s)", 0));
+
+  /* write words in strings and quoted identifiers */
+  ck_assert(qury_query_is_read_only("SELECT 'delete' AS a", 0));
+  ck_assert(qury_query_is_read_only("SELECT \"for update\"", 0));
+  ck_assert(qury_query_is_read_only("SELECT `update`, `into` FROM `delete`", 0));
+  ck_assert(qury_query_is_read_only("SELECT 'it''s; DELETE FROM t'", 0));
+  ck_assert(qury_query_is_read_only("SELECT 'it\\'s; DELETE FROM t'", 0));
+  ck_assert(qury_query_is_read_only("SELECT `a``; DELETE` FROM t", 0));
+  ck_assert(!qury_query_is_read_only("SELECT 'a' FROM t FOR UPDATE", 0));
+
+  /* comments before the first statement and after */
+  ck_assert(qury_query_is_read_only("/* DELETE */ SELECT 1", 0));
+  ck_assert(qury_query_is_read_only("-- UPDATE t\nSELECT 1", 0));
+  ck_assert(qury_query_is_read_only("# INSERT\n  SELECT 1 -- FOR UPDATE", 0));
+  ck_assert(!qury_query_is_read_only("/* SELECT */ DELETE FROM t", 0));
+  ck_assert(!qury_query_is_read_only("-- SELECT\nINSERT INTO t VALUES (1)", 0));
+  /* the server runs executable comments */
+  ck_assert(!qury_query_is_read_only("/*!DELETE FROM t*/", 0));
+  ck_assert(!qury_query_is_read_only("SELECT a FROM t /*!50000 FOR UPDATE */",
+                                     0));
+  ck_assert(!qury_query_is_read_only("SELECT a FROM t /*M!100000 FOR UPDATE */",
+                                     0));
+
+  /* every statement counts */
+  ck_assert(qury_query_is_read_only("SELECT 1; SELECT 2;", 0));
+  ck_assert(!qury_query_is_read_only("SELECT 1; DELETE FROM t", 0));
+  ck_assert(!qury_query_is_read_only("SELECT 1;\n/* next */ DELETE FROM t", 0));
+
+  /* named parameters are not words */
+  ck_assert(qury_query_is_read_only(
+      "SELECT a FROM t WHERE b = :update AND c = :delete", 0));
+  ck_assert(!qury_query_is_read_only("UPDATE t SET a = :select", 0));
+
+  /* the length is honored */
+  ck_assert(qury_query_is_read_only("SELECT 1; DELETE FROM t", 8));
+}
+END_TEST
+
+/* QURY_TEST_REPLICA_PORTS lists the ports of replicas of the server on
+ * QURY_TEST_HOST, like "3307,3308" */
+START_TEST(test_router_servers) {
+  const char *ports = getenv("QURY_TEST_REPLICA_PORTS");
+  if (!ports || !connect_server()) {
+    fprintf(stderr, "QURY_TEST_REPLICA_PORTS not set, skipped\n");
+    return;
+  }
+  static qury_router_t r;
+  static qury_conn_t replicas[QURY_ROUTER_MAX_REPLICAS];
+  ck_assert(qury_router_init(&r, &Conn));
+  int n = 0;
+  for (const char *p = ports; *p && n < QURY_ROUTER_MAX_REPLICAS; n++) {
+    char *end = NULL;
+    unsigned int port = (unsigned int)strtoul(p, &end, 10);
+    ck_assert(connect_server_to(&replicas[n], port));
+    ck_assert(qury_router_add_replica(&r, &replicas[n]));
+    p = *end == ',' ? end + 1 : end;
+  }
+  qury_router_set_wait(&r, 5000);
+
+  ck_assert_int_eq(
+      mysql_query(Conn.mysql, "CREATE OR REPLACE TABLE qury_router_test "
+                              "(id INT PRIMARY KEY, v INT NOT NULL)"),
+      0);
+  ck_assert_int_eq(mysql_query(Conn.mysql,
+                               "INSERT INTO qury_router_test VALUES (1, -1)"),
+                   0);
+  ck_assert(qury_router_track(&r));
+
+  qury_stmt_t *upd = qury_router_prepare(
+      &r, "UPDATE qury_router_test SET v = :v WHERE id = 1", 0, QURY_RouteAuto,
+      NULL);
+  qury_stmt_t *sel = qury_router_prepare(
+      &r, "SELECT v FROM qury_router_test WHERE id = 1", 0, QURY_RouteAuto,
+      NULL);
+  ck_assert_ptr_nonnull(upd);
+  ck_assert_ptr_nonnull(sel);
+  ck_assert_int_eq(upd->route, QURY_RoutePrimary);
+  ck_assert_int_eq(sel->route, QURY_RouteReplica);
+
+  /* every read sees the write just before it, wherever it runs */
+  for (int i = 0; i < 100; i++) {
+    ck_assert(qury_stmt_bind_int(upd, "v", i));
+    ck_assert(qury_router_execute(&r, upd));
+    ck_assert(r.has_gtid);
+    ck_assert(qury_router_execute(&r, sel));
+    ck_assert(qury_fetch(sel));
+    qury_bind_t *v = NULL;
+    ck_assert(qury_get_value(sel, "v", &v));
+    ck_assert_int_eq((int64_t)qury_get_int(v), i);
+    ck_assert(!qury_fetch(sel));
+  }
+  ck_assert_uint_eq(r.replica_reads + r.primary_reads, 100);
+  ck_assert_uint_gt(r.replica_reads, 0);
+
+  qury_free(upd);
+  qury_free(sel);
+  ck_assert_int_eq(mysql_query(Conn.mysql, "DROP TABLE qury_router_test"), 0);
+  for (int i = 0; i < n; i++) {
+    mysql_close(replicas[i].mysql);
+  }
+  mysql_close(Conn.mysql);
+}
+END_TEST
+
+#define SHARD_KEYS 10000
+
+START_TEST(test_shard_ring) {
+  /* no server, lookups don't use the connections */
+  static qury_shard_map_t m;
+  qury_conn_t conns[4];
+  int before[SHARD_KEYS];
+  size_t count[4] = {0};
+  ck_assert(qury_shard_map_init(&m, "tenant_id"));
+  ck_assert_int_eq(qury_shard_add(&m, "s0", &conns[0], 1), 0);
+  ck_assert_int_eq(qury_shard_add(&m, "s1", &conns[1], 1), 1);
+  ck_assert_int_eq(qury_shard_add(&m, "s2", &conns[2], 1), 2);
+  ck_assert_int_eq(qury_shard_add(&m, "s2", &conns[3], 1), -1);
+
+  for (int k = 0; k < SHARD_KEYS; k++) {
+    qury_param_t p = QURY_PARAM_INT("tenant_id", k);
+    before[k] = qury_shard_lookup(&m, qury_shard_hash(&p));
+    ck_assert_int_ge(before[k], 0);
+    count[before[k]]++;
+  }
+  for (int i = 0; i < 3; i++) {
+    ck_assert_uint_gt(count[i], SHARD_KEYS / 5);
+  }
+
+  /* only keys going to the new shard move */
+  ck_assert_int_eq(qury_shard_add(&m, "s3", &conns[3], 1), 3);
+  int moved = 0;
+  for (int k = 0; k < SHARD_KEYS; k++) {
+    qury_param_t p = QURY_PARAM_INT("tenant_id", k);
+    int s = qury_shard_lookup(&m, qury_shard_hash(&p));
+    if (s != before[k]) {
+      ck_assert_int_eq(s, 3);
+      moved++;
+    }
+  }
+  ck_assert_int_gt(moved, SHARD_KEYS / 8);
+  ck_assert_int_lt(moved, SHARD_KEYS / 2);
+
+  /* and come back when it leaves */
+  ck_assert(qury_shard_set_weight(&m, 3, 0));
+  for (int k = 0; k < SHARD_KEYS; k++) {
+    qury_param_t p = QURY_PARAM_INT("tenant_id", k);
+    ck_assert_int_eq(qury_shard_lookup(&m, qury_shard_hash(&p)), before[k]);
+  }
+  qury_shard_map_free(&m);
+}
+END_TEST
+
+/* QURY_TEST_SHARD_PORTS lists the ports of local servers on QURY_TEST_HOST,
+ * like "3307,3308,3309" */
+START_TEST(test_shard_servers) {
+  const char *ports = getenv("QURY_TEST_SHARD_PORTS");
+  if (!ports) {
+    fprintf(stderr, "QURY_TEST_SHARD_PORTS not set, skipped\n");
+    return;
+  }
+  static qury_shard_map_t m;
+  static qury_conn_t conns[QURY_SHARD_MAX];
+  ck_assert(qury_shard_map_init(&m, "tenant_id"));
+  int n = 0;
+  for (const char *p = ports; *p && n < QURY_SHARD_MAX; n++) {
+    char *end = NULL;
+    unsigned int port = (unsigned int)strtoul(p, &end, 10);
+    char name[16];
+    snprintf(name, sizeof(name), "port-%u", port);
+    if (!connect_server_to(&conns[n], port)) {
+      fprintf(stderr, "QURY_TEST_HOST not set, skipped\n");
+      qury_shard_map_free(&m);
+      return;
+    }
+    ck_assert_int_eq(qury_shard_add(&m, name, &conns[n], 1), n);
+    p = *end == ',' ? end + 1 : end;
+  }
+
+  /* a tenant always lands on the same server */
+  const char *query = "SELECT @@port AS port, :tenant_id AS t";
+  for (int loop = 0; loop < 2; loop++) {
+    for (int k = 0; k < 100; k++) {
+      qury_stmt_t *stmt = qury_shard_stmt(
+          &m, query,
+          (qury_param_t[]){QURY_PARAM_INT("tenant_id", k), QURY_PARAM_END});
+      ck_assert_ptr_nonnull(stmt);
+      ck_assert(qury_execute(stmt));
+      ck_assert(qury_fetch(stmt));
+      qury_bind_t *v = NULL;
+      ck_assert(qury_get_value(stmt, "port", &v));
+      qury_param_t key = QURY_PARAM_INT("tenant_id", k);
+      int shard = qury_shard_lookup(&m, qury_shard_hash(&key));
+      char name[16];
+      snprintf(name, sizeof(name), "port-%u", (unsigned int)qury_get_int(v));
+      ck_assert_str_eq(m.shards[shard].name, name);
+      ck_assert(!qury_fetch(stmt));
+      qury_shard_release(&m, stmt);
+    }
+  }
+
+  /* a statement in use survives a full cache */
+  qury_param_t key[] = {QURY_PARAM_INT("tenant_id", 1), QURY_PARAM_END};
+  qury_stmt_t *held = qury_shard_stmt(&m, query, key);
+  ck_assert_ptr_nonnull(held);
+  for (int k = 0; k < 2 * QURY_SHARD_CACHE_SIZE; k++) {
+    char other[64];
+    snprintf(other, sizeof(other), "SELECT %d AS n, :tenant_id AS t", k);
+    qury_stmt_t *stmt = qury_shard_stmt(&m, other, key);
+    ck_assert_ptr_nonnull(stmt);
+    ck_assert(qury_execute(stmt));
+    while (qury_fetch(stmt))
+      ;
+    qury_shard_release(&m, stmt);
+  }
+  ck_assert(qury_execute(held));
+  ck_assert(qury_fetch(held));
+  ck_assert(!qury_fetch(held));
+  qury_shard_release(&m, held);
+  qury_shard_map_free(&m);
+  for (int i = 0; i < n; i++) {
+    mysql_close(conns[i].mysql);
+  }
+}
+END_TEST
+
+#define SCATTER_PARTS 4
+
+/* needs the Sequence engine for seq_0_to_999 */
+START_TEST(test_scatter) {
+  static qury_scatter_t sg;
+  qury_conn_t conns[SCATTER_PARTS];
+  qury_conn_t *pconns[SCATTER_PARTS];
+  for (int i = 0; i < SCATTER_PARTS; i++) {
+    if (!connect_server_to(&conns[i], 0)) {
+      fprintf(stderr, "QURY_TEST_HOST not set, skipped\n");
+      return;
+    }
+    pconns[i] = &conns[i];
+  }
+  ck_assert(qury_scatter_init(&sg, pconns, SCATTER_PARTS,
+                              "SELECT seq, (seq * 7919) % 1000 AS k "
+                              "FROM seq_0_to_999 "
+                              "WHERE seq >= :lo AND seq < :hi ORDER BY k",
+                              0));
+
+  /* merged on k */
+  ck_assert(qury_scatter_execute(&sg, 0, 1000, "k", false));
+  int rows = 0;
+  int64_t prev = -1;
+  qury_bind_t *v = NULL;
+  while (qury_scatter_fetch(&sg)) {
+    ck_assert(qury_scatter_get_value(&sg, "k", &v));
+    ck_assert_int_ge((int64_t)qury_get_int(v), prev);
+    prev = (int64_t)qury_get_int(v);
+    rows++;
+  }
+  ck_assert(!sg.failed);
+  ck_assert_int_eq(rows, 1000);
+
+  /* unordered, every row once */
+  ck_assert(qury_scatter_execute(&sg, 0, 1000, NULL, false));
+  rows = 0;
+  uint64_t sum = 0;
+  while (qury_scatter_fetch(&sg)) {
+    ck_assert(qury_scatter_get_value(&sg, "seq", &v));
+    sum += qury_get_int(v);
+    rows++;
+  }
+  ck_assert_int_eq(rows, 1000);
+  ck_assert_uint_eq(sum, 999 * 1000 / 2);
+  qury_scatter_free(&sg);
+
+  /* strings, both cases and trailing spaces, merged in the order of the
+   * _bin collation : byte order, padded with spaces */
+  for (int i = 0; i < SCATTER_PARTS; i++) {
+    ck_assert_int_eq(mysql_set_character_set(conns[i].mysql, "utf8mb4"), 0);
+  }
+  ck_assert(qury_scatter_init(
+      &sg, pconns, SCATTER_PARTS,
+      "SELECT seq, CONCAT(CHAR(IF(seq % 2, 65, 97) + (seq * 7919) % 26 "
+      "USING utf8mb4), ELT(seq % 3 + 1, '', ' ', '\\t')) COLLATE utf8mb4_bin "
+      "AS s FROM seq_0_to_999 WHERE seq >= :lo AND seq < :hi ORDER BY s",
+      0));
+  ck_assert(qury_scatter_execute(&sg, 0, 1000, "s", false));
+  rows = 0;
+  char last[4] = "";
+  while (qury_scatter_fetch(&sg)) {
+    ck_assert(qury_scatter_get_value(&sg, "s", &v));
+    const char *cur = qury_get_cstr(v);
+    /* "a\t" < "a" == "a " */
+    ck_assert(cur[0] > last[0]
+              || (cur[0] == last[0] && (cur[1] == '\t') <= (last[1] == '\t')));
+    strncpy(last, cur, sizeof(last) - 1);
+    rows++;
+  }
+  ck_assert(!sg.failed);
+  ck_assert_int_eq(rows, 1000);
+  qury_scatter_free(&sg);
+
+  /* a case insensitive order can't be merged byte by byte */
+  ck_assert(qury_scatter_init(
+      &sg, pconns, SCATTER_PARTS,
+      "SELECT seq, CHAR(65 + seq % 26 USING utf8mb4) "
+      "COLLATE utf8mb4_general_ci AS s "
+      "FROM seq_0_to_999 WHERE seq >= :lo AND seq < :hi ORDER BY s",
+      0));
+  ck_assert(qury_scatter_execute(&sg, 0, 1000, "s", false));
+  ck_assert(!qury_scatter_fetch(&sg));
+  ck_assert(sg.failed);
+  qury_scatter_free(&sg);
+
+  /* a part whose result ends on an error, merged or not */
+  ck_assert(qury_scatter_init(
+      &sg, pconns, SCATTER_PARTS,
+      "SELECT t.seq AS k, (SELECT 1 FROM seq_1_to_2 WHERE t.seq = 999) AS x "
+      "FROM seq_0_to_999 AS t WHERE t.seq >= :lo AND t.seq < :hi ORDER BY k",
+      0));
+  for (int ordered = 0; ordered < 2; ordered++) {
+    ck_assert(qury_scatter_execute(&sg, 0, 1000, ordered ? "k" : NULL, false));
+    rows = 0;
+    while (qury_scatter_fetch(&sg)) {
+      rows++;
+    }
+    ck_assert(sg.failed);
+    ck_assert_int_lt(rows, 1000);
+  }
+
+  qury_scatter_free(&sg);
+  for (int i = 0; i < SCATTER_PARTS; i++) {
+    mysql_close(conns[i].mysql);
+  }
+}
+END_TEST
+
+#define REGISTRY_STMTS 64
+
+/* the statement id adds id to its parameter */
+static void check_registry_stmt(qury_registry_conn_t *rc, int id) {
+  qury_stmt_t *stmt = qury_registry_stmt(rc, id);
+  qury_bind_t *v = NULL;
+  ck_assert_ptr_nonnull(stmt);
+  ck_assert(qury_stmt_bind_int(stmt, "v", 1000));
+  ck_assert(qury_execute(stmt));
+  ck_assert(qury_fetch(stmt));
+  ck_assert(qury_get_value(stmt, "n", &v));
+  ck_assert_int_eq((int64_t)qury_get_int(v), 1000 + id);
+  ck_assert(!qury_fetch(stmt));
+  qury_registry_release(rc);
+}
+
+START_TEST(test_registry) {
+  if (!connect_server()) {
+    fprintf(stderr, "QURY_TEST_HOST not set, skipped\n");
+    return;
+  }
+  const qury_registry_mode_t modes[] = {
+      QURY_RegistryEager, QURY_RegistryBackground, QURY_RegistryLazy};
+  qury_registry_t reg;
+  qury_registry_conn_t rc;
+  char name[32];
+  char query[64];
+
+  qury_registry_init(&reg);
+  for (int i = 0; i < REGISTRY_STMTS; i++) {
+    snprintf(name, sizeof(name), "plus_%d", i);
+    snprintf(query, sizeof(query), "SELECT CAST(:v AS SIGNED) + %d AS n", i);
+    ck_assert_int_eq(qury_registry_add(&reg, name, query), i);
+  }
+  ck_assert_int_eq(qury_registry_add(&reg, "plus_0", "SELECT 1"), -1);
+  int bad = qury_registry_add(&reg, "bad", "SELECT n FROM qury_no_such_table");
+  ck_assert_int_eq(bad, REGISTRY_STMTS);
+  ck_assert_int_eq(qury_registry_find(&reg, "plus_7"), 7);
+  ck_assert_int_eq(qury_registry_find(&reg, "unknown"), -1);
+
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    ck_assert(qury_registry_attach(&reg, &Conn, &rc, modes[m]));
+    ck_assert_uint_eq(rc.count, REGISTRY_STMTS + 1);
+    if (modes[m] == QURY_RegistryEager) {
+      ck_assert_uint_eq(rc.prepared, REGISTRY_STMTS);
+      ck_assert_uint_eq(rc.failed, 1);
+    } else if (modes[m] == QURY_RegistryLazy) {
+      ck_assert(!rc.running);
+      ck_assert_uint_eq(rc.prepared, 0);
+      ck_assert_ptr_null(rc.stmts[0]);
+    }
+
+    /* a request pauses the worker and prepares the statement it needs if
+     * the worker didn't reach it yet */
+    check_registry_stmt(&rc, REGISTRY_STMTS - 1);
+    for (int i = 0; i < REGISTRY_STMTS; i++) {
+      check_registry_stmt(&rc, i);
+    }
+    /* the worker is joined by the first request after it is done */
+    while (rc.running) {
+      usleep(1000);
+      check_registry_stmt(&rc, 0);
+    }
+    ck_assert_uint_eq(rc.prepared, REGISTRY_STMTS);
+    ck_assert_ptr_null(qury_registry_stmt(&rc, bad));
+    ck_assert_uint_ge(rc.failed, 1);
+    ck_assert_ptr_null(qury_registry_stmt(&rc, -1));
+    ck_assert_ptr_null(qury_registry_stmt(&rc, REGISTRY_STMTS + 1));
+
+    /* prepared again with the same mode */
+    ck_assert(qury_registry_reconnect(&rc));
+    ck_assert_uint_eq(rc.mode, modes[m]);
+    if (modes[m] == QURY_RegistryEager) {
+      ck_assert_uint_eq(rc.prepared, REGISTRY_STMTS);
+    } else if (modes[m] == QURY_RegistryLazy) {
+      ck_assert_uint_eq(rc.prepared, 0);
+      ck_assert_uint_eq(rc.failed, 0);
+      ck_assert_ptr_null(rc.stmts[0]);
+    }
+    check_registry_stmt(&rc, 0);
+    check_registry_stmt(&rc, REGISTRY_STMTS - 1);
+
+    qury_registry_detach(&rc);
+    ck_assert_ptr_null(rc.stmts);
+    ck_assert_uint_eq(rc.count, 0);
+  }
+
+  /* detached while the worker runs */
+  ck_assert(qury_registry_attach(&reg, &Conn, &rc, QURY_RegistryBackground));
+  qury_registry_detach(&rc);
+  ck_assert(!rc.running);
+
+  qury_registry_free(&reg);
+  mysql_close(Conn.mysql);
+}
+END_TEST
+
+#define EXECUTOR_WORKERS 4
+#define EXECUTOR_REQUESTS 1000
+
+static bool executor_rows(qury_request_t *req, qury_stmt_t *stmt) {
+  qury_bind_t *v = NULL;
+  if (!qury_fetch(stmt) || !qury_get_value(stmt, "v", &v)) {
+    return false;
+  }
+  *(int64_t *)req->userptr = (int64_t)qury_get_int(v);
+  return true;
+}
+
+static bool executor_null_rows(qury_request_t *req, qury_stmt_t *stmt) {
+  qury_bind_t *v = NULL;
+  if (!qury_fetch(stmt) || !qury_get_value(stmt, "v", &v)) {
+    return false;
+  }
+  *(bool *)req->userptr = qury_is_null(v);
+  return true;
+}
+
+START_TEST(test_executor) {
+  static qury_executor_t ex;
+  static qury_request_t reqs[EXECUTOR_REQUESTS];
+  static qury_param_t params[EXECUTOR_REQUESTS][2];
+  static int64_t results[EXECUTOR_REQUESTS];
+  qury_registry_t registry;
+  qury_conn_t conns[EXECUTOR_WORKERS];
+  qury_conn_t *pconns[EXECUTOR_WORKERS];
+
+  for (int i = 0; i < EXECUTOR_WORKERS; i++) {
+    if (!connect_server_to(&conns[i], 0)) {
+      fprintf(stderr, "QURY_TEST_HOST not set, skipped\n");
+      return;
+    }
+    pconns[i] = &conns[i];
+  }
+  qury_registry_init(&registry);
+  int id = qury_registry_add(&registry, "double", "SELECT :a * 2 AS v");
+  ck_assert_int_ge(id, 0);
+  ck_assert(qury_executor_init(&ex, &registry, pconns, EXECUTOR_WORKERS));
+
+  for (int i = 0; i < EXECUTOR_REQUESTS; i++) {
+    params[i][0] = QURY_PARAM_INT("a", i);
+    params[i][1] = QURY_PARAM_END;
+    reqs[i] = (qury_request_t){.stmt_id = id,
+                               .params = params[i],
+                               .on_rows = executor_rows,
+                               .userptr = &results[i]};
+    /* all on one worker, the others have to steal */
+    ck_assert(qury_executor_submit_to(&ex, 0, &reqs[i]));
+  }
+  for (int i = 0; i < EXECUTOR_REQUESTS; i++) {
+    qury_request_t *req = qury_executor_wait(&ex, 10000);
+    ck_assert_ptr_nonnull(req);
+    ck_assert(req->ok);
+  }
+  for (int i = 0; i < EXECUTOR_REQUESTS; i++) {
+    ck_assert_int_eq(results[i], 2 * i);
+  }
+
+  /* a parameter left out is NULL, not the value of the previous request */
+  bool is_null[EXECUTOR_WORKERS];
+  for (int i = 0; i < EXECUTOR_WORKERS; i++) {
+    is_null[i] = false;
+    reqs[i] = (qury_request_t){.stmt_id = id,
+                               .on_rows = executor_null_rows,
+                               .userptr = &is_null[i]};
+    ck_assert(qury_executor_submit_to(&ex, (size_t)i, &reqs[i]));
+  }
+  for (int i = 0; i < EXECUTOR_WORKERS; i++) {
+    qury_request_t *req = qury_executor_wait(&ex, 10000);
+    ck_assert_ptr_nonnull(req);
+    ck_assert(req->ok);
+  }
+  for (int i = 0; i < EXECUTOR_WORKERS; i++) {
+    ck_assert(is_null[i]);
+  }
+
+  qury_executor_shutdown(&ex);
+  qury_registry_free(&registry);
+  for (int i = 0; i < EXECUTOR_WORKERS; i++) {
+    mysql_close(conns[i].mysql);
+  }
+}
+END_TEST
+
+#define GROUP_THREADS 8
+#define GROUP_WRITES 200
+
+static qury_group_t Group;
+static int GroupInsert = -1;
+
+static void *group_writer(void *arg) {
+  intptr_t t = (intptr_t)arg;
+  qury_param_t params[2];
+  qury_request_t req;
+  intptr_t failed = 0;
+
+  for (int i = 0; i < GROUP_WRITES; i++) {
+    /* thread 0 writes one id twice, only that write fails */
+    int64_t id = t == 0 && i == GROUP_WRITES - 1 ? 0 : t * GROUP_WRITES + i;
+    params[0] = QURY_PARAM_INT("id", id);
+    params[1] = QURY_PARAM_END;
+    req = (qury_request_t){.stmt_id = GroupInsert, .params = params};
+    if (!qury_group_submit(&Group, &req) || !qury_group_wait(&Group, &req)
+        || req.affected_rows != 1) {
+      failed++;
+    }
+  }
+  return (void *)failed;
+}
+
+START_TEST(test_group) {
+  qury_registry_t registry;
+  qury_conn_t conn;
+  pthread_t threads[GROUP_THREADS];
+  intptr_t failed = 0;
+
+  if (!connect_server_to(&conn, 0)) {
+    fprintf(stderr, "QURY_TEST_HOST not set, skipped\n");
+    return;
+  }
+  /* temporary, the flusher writes on this connection */
+  ck_assert_int_eq(mysql_query(conn.mysql, "CREATE TEMPORARY TABLE qury_group "
+                                           "(id INT PRIMARY KEY) ENGINE=InnoDB"),
+                   0);
+  qury_registry_init(&registry);
+  GroupInsert = qury_registry_add(&registry, "insert",
+                                  "INSERT INTO qury_group VALUES (:id)");
+  ck_assert_int_ge(GroupInsert, 0);
+  ck_assert(qury_group_init(&Group, &conn, &registry, 64, 1000));
+
+  for (intptr_t t = 0; t < GROUP_THREADS; t++) {
+    ck_assert_int_eq(
+        pthread_create(&threads[t], NULL, group_writer, (void *)t), 0);
+  }
+  for (int t = 0; t < GROUP_THREADS; t++) {
+    void *ret = NULL;
+    pthread_join(threads[t], &ret);
+    failed += (intptr_t)ret;
+  }
+  qury_group_shutdown(&Group);
+  ck_assert_int_eq(failed, 1);
+  ck_assert_uint_eq(Group.writes, GROUP_THREADS * GROUP_WRITES);
+  ck_assert_uint_lt(Group.round_trips, Group.writes);
+
+  ck_assert_int_eq(mysql_query(conn.mysql, "SELECT COUNT(*) FROM qury_group"),
+                   0);
+  MYSQL_RES *res = mysql_store_result(conn.mysql);
+  ck_assert_ptr_nonnull(res);
+  MYSQL_ROW row = mysql_fetch_row(res);
+  ck_assert_int_eq(atoi(row[0]), GROUP_THREADS * GROUP_WRITES - 1);
+  mysql_free_result(res);
+
+  qury_registry_free(&registry);
+  mysql_close(conn.mysql);
+}
+END_TEST
+
+static void run_paginate(bool prefetch) {
+  qury_conn_t conns[2];
+  qury_paginate_t p;
+
+  for (int i = 0; i < 2; i++) {
+    if (!connect_server_to(&conns[i], 0)) {
+      fprintf(stderr, "QURY_TEST_HOST not set, skipped\n");
+      return;
+    }
+  }
+  /* 999 rows, the last page is short */
+  ck_assert(qury_paginate_init(&p, &conns[0], prefetch ? &conns[1] : NULL,
+                               "SELECT seq AS id FROM seq_1_to_999 "
+                               "WHERE seq > :after_key ORDER BY seq "
+                               "LIMIT :limit",
+                               0, "id", 100));
+  ck_assert(qury_paginate_start(&p, 0, 0, QURY_Integer));
+  int64_t expected = 1;
+  while (qury_paginate_fetch(&p)) {
+    qury_bind_t *v = NULL;
+    ck_assert(qury_paginate_get_value(&p, "id", &v));
+    ck_assert_int_eq((int64_t)qury_get_int(v), expected);
+    expected++;
+  }
+  ck_assert(!p.failed);
+  ck_assert_int_eq(expected, 1000);
+  ck_assert_uint_eq(p.page_count, 10);
+  ck_assert_uint_eq(p.prefetched, prefetch ? 9 : 0);
+
+  qury_paginate_free(&p);
+  for (int i = 0; i < 2; i++) {
+    mysql_close(conns[i].mysql);
+  }
+}
+
+START_TEST(test_paginate) { run_paginate(false); }
+END_TEST
+
+START_TEST(test_paginate_prefetch) { run_paginate(true); }
+END_TEST
+
+START_TEST(test_pipeline) {
+  if (!connect_server()) {
+    fprintf(stderr, "QURY_TEST_HOST not set, skipped\n");
+    return;
+  }
+  const char *query = "SELECT seq AS n, CONCAT('r', seq) AS s, "
+                      "IF(seq % 10 = 0, NULL, seq) AS maybe "
+                      "FROM seq_1_to_10000";
+  qury_stmt_t *stmt = qury_new(&Conn, NULL);
+  qury_pipeline_t p;
+  char expected[32];
+  ck_assert_ptr_nonnull(stmt);
+  qury_set_result_mode(stmt, QURY_ResultStreaming);
+
+  /* a small ring, the reader waits for the consumer */
+  ck_assert(qury_query_once(stmt, query, 0, NULL));
+  ck_assert(qury_pipeline_start(&p, stmt, 4));
+  int64_t n = 0;
+  while (qury_fetch(stmt)) {
+    qury_bind_t *v = NULL;
+    n++;
+    ck_assert(qury_get_value(stmt, "n", &v));
+    ck_assert_int_eq((int64_t)qury_get_int(v), n);
+    ck_assert(qury_get_value(stmt, "s", &v));
+    snprintf(expected, sizeof(expected), "r%ld", (long)n);
+    ck_assert_str_eq(qury_get_cstr(v), expected);
+    ck_assert(qury_get_value(stmt, "maybe", &v));
+    ck_assert(qury_is_null(v) == (n % 10 == 0));
+  }
+  ck_assert_int_eq(n, 10000);
+  ck_assert(!p.failed);
+  ck_assert_uint_eq(p.rows, 10000);
+  ck_assert_ptr_null(stmt->pipeline);
+  ck_assert_uint_eq(qury_num_rows(stmt), 10000);
+
+  /* stopped early, the connection is usable again */
+  ck_assert(qury_query_once(stmt, query, 0, NULL));
+  ck_assert(qury_pipeline_start(&p, stmt, 0));
+  for (int i = 0; i < 100; i++) {
+    ck_assert(qury_fetch(stmt));
+  }
+  ck_assert(qury_query_once(stmt, "SELECT 42 AS answer", 0, NULL));
+  ck_assert_ptr_null(stmt->pipeline);
+  ck_assert(qury_fetch(stmt));
+  qury_bind_t *v = NULL;
+  ck_assert(qury_get_value(stmt, "answer", &v));
+  ck_assert_int_eq((int64_t)qury_get_int(v), 42);
+
+  /* buffered results are not pipelined */
+  qury_set_result_mode(stmt, QURY_ResultBuffered);
+  ck_assert(qury_query_once(stmt, query, 0, NULL));
+  ck_assert(!qury_pipeline_start(&p, stmt, 0));
+  ck_assert(qury_fetch(stmt));
+
+  qury_free(stmt);
+  mysql_close(Conn.mysql);
+}
+END_TEST
+
+static void run_deadline(bool watchdog) {
+  if (!connect_server()) {
+    fprintf(stderr, "QURY_TEST_HOST not set, skipped\n");
+    return;
+  }
+  qury_conn_t side;
+  qury_watchdog_t w;
+  struct timespec t0, t1;
+
+  ck_assert(connect_server_to(&side, 0));
+  ck_assert(qury_watchdog_init(&w, &side));
+
+  qury_stmt_t *stmt = qury_new(&Conn, NULL);
+  ck_assert_ptr_nonnull(stmt);
+  ck_assert(qury_prepare(stmt, "SELECT COUNT(*) AS n FROM seq_1_to_10000000000",
+                         0));
+  ck_assert(qury_set_deadline(stmt, 200, watchdog ? &w : NULL));
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (qury_execute(stmt)) {
+    /* streaming, the error comes with the row */
+    ck_assert(!qury_fetch(stmt));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  ck_assert_int_eq(qury_stmt_errno(stmt), QURY_ErrTimeout);
+  ck_assert_int_lt(t1.tv_sec - t0.tv_sec, 5);
+
+  /* the connection is usable, a fast query is in time */
+  ck_assert(qury_prepare(stmt, "SELECT 42 AS answer", 0));
+  ck_assert(qury_execute(stmt));
+  ck_assert_int_eq(qury_stmt_errno(stmt), QURY_ErrNone);
+  ck_assert(qury_fetch(stmt));
+  qury_bind_t *v = NULL;
+  ck_assert(qury_get_value(stmt, "answer", &v));
+  ck_assert_int_eq((int64_t)qury_get_int(v), 42);
+  ck_assert(!qury_fetch(stmt));
+
+  /* text protocol */
+  if (qury_query_once(stmt, "SELECT COUNT(*) AS n FROM seq_1_to_10000000000",
+                      0, NULL)) {
+    ck_assert(!qury_fetch(stmt));
+  }
+  ck_assert_int_eq(qury_stmt_errno(stmt), QURY_ErrTimeout);
+
+  qury_free(stmt);
+  qury_watchdog_shutdown(&w);
+  mysql_close(side.mysql);
+  mysql_close(Conn.mysql);
+}
+
+START_TEST(test_deadline) { run_deadline(false); }
+END_TEST
+
+START_TEST(test_deadline_watchdog) { run_deadline(true); }
+END_TEST
+
+Suite *test_suite_quaerimus(void) {
+  Suite *s;
+  s = suite_create("quaerimus.c test");
+
+  TCase *tc_steady = tcase_create("Steady state");
+  tcase_add_test(tc_steady, test_steady_state_copy);
+  tcase_add_test(tc_steady, test_steady_state_borrowed);
+  tcase_add_test(tc_steady, test_lazy_columns);
+  suite_add_tcase(s, tc_steady);
+
+  TCase *tc_interpolate = tcase_create("Interpolation");
+  tcase_add_test(tc_interpolate, test_interpolate);
+  suite_add_tcase(s, tc_interpolate);
+
+  TCase *tc_budget = tcase_create("Memory budget");
+  tcase_add_test(tc_budget, test_budget_fail);
+  tcase_add_test(tc_budget, test_budget_chunked);
+  suite_add_tcase(s, tc_budget);
+
+  TCase *tc_results = tcase_create("Multiple results");
+  tcase_add_test(tc_results, test_batch);
+  suite_add_tcase(s, tc_results);
+
+  TCase *tc_digest = tcase_create("Query digests");
+  tcase_add_test(tc_digest, test_digest);
+  tcase_add_test(tc_digest, test_digest_direct);
+  suite_add_tcase(s, tc_digest);
+
+  TCase *tc_decimal = tcase_create("Decimal");
+  tcase_add_test(tc_decimal, test_decimal_parse);
+  tcase_add_test(tc_decimal, test_decimal_format);
+  tcase_add_test(tc_decimal, test_decimal_bind);
+  suite_add_tcase(s, tc_decimal);
+
+  TCase *tc_epoch = tcase_create("Epoch conversion");
+  tcase_add_test(tc_epoch, test_epoch_us);
+  suite_add_tcase(s, tc_epoch);
+
+  TCase *tc_snapshot = tcase_create("Snapshot files");
+  tcase_add_test(tc_snapshot, test_snapshot_validate);
+  suite_add_tcase(s, tc_snapshot);
+
+  TCase *tc_router = tcase_create("Read/write splitting");
+  tcase_add_test(tc_router, test_router_read_only);
+  tcase_add_test(tc_router, test_router_servers);
+  suite_add_tcase(s, tc_router);
+
+  TCase *tc_shard = tcase_create("Shard map");
+  tcase_add_test(tc_shard, test_shard_ring);
+  tcase_add_test(tc_shard, test_shard_servers);
+  suite_add_tcase(s, tc_shard);
+
+  TCase *tc_scatter = tcase_create("Scatter-gather");
+  tcase_add_test(tc_scatter, test_scatter);
+  suite_add_tcase(s, tc_scatter);
+
+  TCase *tc_registry = tcase_create("Statement registry");
+  tcase_add_test(tc_registry, test_registry);
+  suite_add_tcase(s, tc_registry);
+
+  TCase *tc_executor = tcase_create("Executor");
+  tcase_add_test(tc_executor, test_executor);
+  tcase_set_timeout(tc_executor, 30);
+  suite_add_tcase(s, tc_executor);
+
+  TCase *tc_group = tcase_create("Group commit");
+  tcase_add_test(tc_group, test_group);
+  tcase_set_timeout(tc_group, 30);
+  suite_add_tcase(s, tc_group);
+
+  TCase *tc_paginate = tcase_create("Keyset pagination");
+  tcase_add_test(tc_paginate, test_paginate);
+  tcase_add_test(tc_paginate, test_paginate_prefetch);
+  suite_add_tcase(s, tc_paginate);
+
+  TCase *tc_pipeline = tcase_create("Pipelined fetch");
+  tcase_add_test(tc_pipeline, test_pipeline);
+  suite_add_tcase(s, tc_pipeline);
+
+  TCase *tc_deadline = tcase_create("Deadlines");
+  tcase_add_test(tc_deadline, test_deadline);
+  tcase_add_test(tc_deadline, test_deadline_watchdog);
+  tcase_set_timeout(tc_deadline, 30);
+  suite_add_tcase(s, tc_deadline);
+
+  return s;
+}
+
+int main(void) {
+  int failed = 0;
+  Suite *s;
+  SRunner *sr;
+
+  mysql_library_init(0, NULL, NULL);
+  s = test_suite_quaerimus();
+  sr = srunner_create(s);
+  srunner_set_fork_status(sr, CK_NOFORK);
+  srunner_run_all(sr, CK_VERBOSE);
+  failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+  mysql_library_end();
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
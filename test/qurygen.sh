@@ -0,0 +1,46 @@
+#!/bin/sh
+# qurygen test, needs no server : generate the functions of qurygen.sql,
+# check the binds and compile the result.
+set -e
+QURYGEN=${QURYGEN:-../qurygen}
+CC=${CC:-gcc}
+OUT=${TMPDIR:-/tmp}/qurygen-test.$$
+trap 'rm -f "$OUT.h" "$OUT.c" "$OUT.o" "$OUT.sql"' EXIT
+
+expect() {
+    if ! grep -qF -- "$2" "$OUT.$1"; then
+        echo "qurygen.sh : $OUT.$1 has no $2"
+        exit 1
+    fi
+}
+
+"$QURYGEN" -o "$OUT" qurygen.sql
+
+# decimal parameters are sent as text, formatted on each execution
+expect h 'char pd_min_total[QURY_DECIMAL_SIZE];'
+expect h 'unsigned long pd_max_total_length;'
+expect h 'bool invoice_total_execute(invoice_total_t *q, uint64_t prj_id, qury_decimal_t min_total, const qury_decimal_t *max_total, const char *nr, size_t nr_length);'
+expect c 'q->params[1].buffer_type = MYSQL_TYPE_STRING;'
+expect c 'q->params[1].buffer = q->pd_min_total;'
+expect c 'q->pd_min_total_length = qury_decimal_format(min_total, q->pd_min_total, sizeof(q->pd_min_total));'
+expect c 'q->pd_max_total_length = qury_decimal_format(*max_total, q->pd_max_total, sizeof(q->pd_max_total));'
+expect c 'q->lengths[1] = q->pd_min_total_length;'
+# a parameter used twice has a bind per placeholder
+expect c 'q->params[3].buffer = q->pd_max_total;'
+expect c 'q->lengths[3] = q->pd_max_total_length;'
+expect c 'q->nulls[2] = max_total == NULL;'
+# decimal columns are fetched as text and parsed
+expect c 'q->results[1].buffer = q->d_total;'
+expect c 'qury_decimal_parse(q->d_total, q->d_total_length, &q->row.total);'
+expect c 'q->params[0].is_unsigned = 1;'
+expect c 'WHERE id = ?'
+
+"$CC" $CFLAGS -I../src/include -Wall -Wextra -Werror -c "$OUT.c" -o "$OUT.o"
+
+# undeclared parameter
+printf -- '-- name: broken\nSELECT :missing\n' > "$OUT.sql"
+if "$QURYGEN" -o "$OUT" "$OUT.sql" 2>/dev/null; then
+    echo "qurygen.sh : undeclared parameter accepted"
+    exit 1
+fi
+echo "qurygen.sh : ok"
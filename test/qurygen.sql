@@ -0,0 +1,18 @@
+-- Generator test fixture, see qurygen.sh
+
+-- name: invoice_total
+-- param: prj_id uint
+-- param: min_total decimal
+-- param: max_total decimal?
+-- param: nr str
+-- column: id uint
+-- column: total decimal
+-- column: nr str 64
+SELECT id, total, nr FROM invoice
+WHERE project_id = :prj_id AND total >= :min_total
+  AND (:max_total IS NULL OR total <= :max_total) AND nr LIKE :nr;
+
+-- name: invoice_paid
+-- param: id uint
+-- param: paid datetime?
+UPDATE invoice SET paid = :paid WHERE id = :id;